@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <assert.h>
+#include "arena.h"
+
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+struct arena_slab {
+    arena_slab_t *next;
+    max_align_t data[];
+};
+
+// Rounds the object size up so that every object in a slab stays aligned and
+// can hold a free list link
+static size_t slot_size(const arena_t *arena) {
+    size_t size = arena->object_size < sizeof(void *) ? sizeof(void *) : arena->object_size;
+    return (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+void *arena_alloc(arena_t *arena) {
+    void *object;
+    if (arena->free_list != NULL) {
+        object = arena->free_list;
+        arena->free_list = *(void **) object;
+    } else {
+        if (arena->bump == arena->bump_end) {
+            size_t size = slot_size(arena) * arena->objects_per_slab;
+            arena_slab_t *slab = malloc(sizeof(arena_slab_t) + size);
+            assert(slab != NULL);
+            slab->next = arena->slabs;
+            arena->slabs = slab;
+            arena->bump = (char *) slab->data;
+            arena->bump_end = arena->bump + size;
+            arena->num_slabs++;
+        }
+        object = arena->bump;
+        arena->bump += slot_size(arena);
+    }
+    arena->allocations++;
+    if (++arena->live > arena->peak) arena->peak = arena->live;
+    return object;
+}
+
+void arena_free(arena_t *arena, void *object) {
+    if (object == NULL) return;
+    *(void **) object = arena->free_list;
+    arena->free_list = object;
+    arena->frees++;
+    arena->live--;
+}
+
+void arena_release(arena_t *arena) {
+    while (arena->slabs != NULL) {
+        arena_slab_t *slab = arena->slabs;
+        arena->slabs = slab->next;
+        free(slab);
+    }
+    arena->free_list = NULL;
+    arena->bump = NULL;
+    arena->bump_end = NULL;
+    arena->num_slabs = 0;
+    arena->live = 0;
+    arena->peak = 0;
+    arena->allocations = 0;
+    arena->frees = 0;
+}
+
+void arena_print_stats(FILE *file, const arena_t *arena) {
+    if (arena == NULL) {
+        fprintf(file, "%-10s %8s %10s %8s %12s %12s %12s %12s %14s\n",
+                "Arena", "Object", "Per slab", "Slabs", "Live", "Peak", "Allocs", "Frees", "Slab bytes");
+        return;
+    }
+    size_t slab_bytes = arena->num_slabs * (sizeof(arena_slab_t) + slot_size(arena) * arena->objects_per_slab);
+    fprintf(file, "%-10s %8zu %10zu %8zu %12zu %12zu %12zu %12zu %14zu\n",
+            arena->name, slot_size(arena), arena->objects_per_slab, arena->num_slabs,
+            arena->live, arena->peak, arena->allocations, arena->frees, slab_bytes);
+}
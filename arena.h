@@ -0,0 +1,77 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+typedef struct arena_slab arena_slab_t;
+
+// A slab allocator for objects of one size. Objects are carved out of large
+// slabs and freed objects are kept on a free list for reuse. Slabs are only
+// returned to the system when the whole arena is released.
+typedef struct arena {
+    const char *name;
+    size_t object_size;
+    size_t objects_per_slab;
+    arena_slab_t *slabs;
+    void *free_list;
+    char *bump;
+    char *bump_end;
+    size_t num_slabs;
+    size_t live;
+    size_t peak;
+    size_t allocations;
+    size_t frees;
+} arena_t;
+
+// Initializes an arena for objects of a type
+#define ARENA_INIT(name, type, objects_per_slab) {name, sizeof(type), objects_per_slab, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0}
+
+/**
+ * Allocates an object, reusing a freed one if there is any.
+ *
+ * Parameters:
+ * arena: The arena.
+ *
+ * Returns:
+ * The uninitialized object.
+ */
+void *arena_alloc(arena_t *arena);
+
+/**
+ * Puts an object back on the arena's free list.
+ *
+ * Parameters:
+ * arena: The arena the object was allocated from.
+ * object: The object.
+ *
+ * Returns:
+ * None
+ */
+void arena_free(arena_t *arena, void *object);
+
+/**
+ * Frees every slab at once. All objects allocated from the arena become
+ * invalid, and the statistics are reset.
+ *
+ * Parameters:
+ * arena: The arena.
+ *
+ * Returns:
+ * None
+ */
+void arena_release(arena_t *arena);
+
+/**
+ * Prints an arena's allocation statistics as one row of a table.
+ *
+ * Parameters:
+ * file: The file to print to.
+ * arena: The arena, or NULL to print the table's header.
+ *
+ * Returns:
+ * None
+ */
+void arena_print_stats(FILE *file, const arena_t *arena);
+
+#endif
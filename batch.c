@@ -0,0 +1,448 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include "nodes.h"
+#include "functions.h"
+#include "feed.h"
+#include "fanout.h"
+#include "shard.h"
+#include "epoch.h"
+#include "search.h"
+#include "prefix.h"
+#include "suggest.h"
+#include "edgeset.h"
+#include "password.h"
+#include "metrics.h"
+#include "postlist.h"
+#include "batch.h"
+
+// Splits the next space-separated word off the cursor
+static char *next_word(char **cursor) {
+    char *word = *cursor + strspn(*cursor, " \t");
+    if (*word == '\0') return NULL;
+    char *end = word + strcspn(word, " \t");
+    *cursor = *end == '\0' ? end : end + 1;
+    *end = '\0';
+    return word;
+}
+
+// Gets the logged in user, or NULL if there is none or it was deleted
+static user_t *session_user(const batch_session_t *session) {
+    return session->logged_in ? shard_resolve(session->user) : NULL;
+}
+
+// Checks if a password was verified against a user's current hash. A hash
+// that was replaced since is no match, even if the password was right.
+static _Bool verified(const batch_prepared_t *prepared, const user_t *user) {
+    return prepared->verified != NULL && prepared->verified == epoch_load(user->password);
+}
+
+static void execute_register(const batch_prepared_t *prepared, char *arguments, FILE *out) {
+    char *username = next_word(&arguments);
+    char *password = next_word(&arguments);
+    if (username == NULL || password == NULL) {
+        fputs("err usage\n", out);
+    } else if (find_user(username) != NULL) {
+        fputs("err exists\n", out);
+    } else if (strlen(password) < 8 || !prepared->hashed) {
+        fputs("err password\n", out);
+    } else {
+        add_user(str_to_lower(username), &prepared->hash);
+        fputs("ok\n", out);
+    }
+}
+
+static void execute_login(batch_session_t *session, const batch_prepared_t *prepared, char *arguments, FILE *out) {
+    char *username = next_word(&arguments);
+    user_t *user = username == NULL ? NULL : find_user(username);
+    if (user == NULL || !verified(prepared, user)) {
+        fputs("err auth\n", out);
+        return;
+    }
+    if (prepared->hashed) set_password(user, &prepared->hash);
+    session->user = shard_handle(user);
+    session->logged_in = true;
+    fputs("ok\n", out);
+}
+
+// Gets the shard of the logged in user without resolving it, since the
+// shard's lock has to be taken before it can be
+static shard_t *session_shard(const batch_session_t *session) {
+    return session->logged_in ? &shards[session->user.id & (NUM_SHARDS - 1)] : NULL;
+}
+
+// Parses an optional count of posts to list
+static long parse_count(char **arguments) {
+    char *word = next_word(arguments);
+    long count = word == NULL ? BATCH_DEFAULT_COUNT : strtol(word, NULL, 10);
+    if (count < 0) return 0;
+    return count > BATCH_MAX_COUNT ? BATCH_MAX_COUNT : count;
+}
+
+static void execute_password(const batch_prepared_t *prepared, user_t *user, FILE *out) {
+    if (!verified(prepared, user) || !prepared->hashed) {
+        fputs("err auth\n", out);
+        return;
+    }
+    set_password(user, &prepared->hash);
+    fputs("ok\n", out);
+}
+
+static void execute_delete(batch_session_t *session, const batch_prepared_t *prepared, user_t *user, FILE *out) {
+    if (!verified(prepared, user)) {
+        fputs("err auth\n", out);
+        return;
+    }
+    delete_user(user);
+    session->logged_in = false;
+    fputs("ok\n", out);
+}
+
+// Finds the author whose posts a command lists, replying with an error if
+// there is none or the user may not read them
+static const user_t *posts_author(const user_t *user, char **arguments, FILE *out) {
+    char *username = next_word(arguments);
+    const user_t *author = username == NULL ? NULL : find_user(username);
+    if (author == NULL) {
+        fputs("err notfound\n", out);
+        return NULL;
+    }
+    // The edge set is checked rather than the friend graph, which is only
+    // safe to read under the shared lock
+    if (author != user && !edgeset_contains(&friend_edges, user->id, author->id)) {
+        fputs("err notfriend\n", out);
+        return NULL;
+    }
+    return author;
+}
+
+static void print_posts(const post_t **posts, size_t n, FILE *out) {
+    for (size_t i = 0; i < n; i++) fprintf(out, "%lld %s\n", posts[i]->timestamp, post_content(posts[i]));
+}
+
+static void execute_posts(user_t *user, char *arguments, FILE *out) {
+    const user_t *author = posts_author(user, &arguments, out);
+    if (author == NULL) return;
+    long count = parse_count(&arguments);
+    const post_t *posts[BATCH_MAX_COUNT];
+    post_cursor_t cursor = post_cursor_open(author);
+    size_t n = post_cursor_next(&cursor, posts, count);
+    fprintf(out, "ok %zu\n", n);
+    print_posts(posts, n, out);
+}
+
+// Parses a cursor written by execute_page, which has to be on the author's
+// current account
+static _Bool parse_cursor(const char *word, const user_t *author, post_cursor_t *cursor) {
+    int length = 0;
+    if (sscanf(word, "%u.%u.%u.%lld%n", &cursor->author.id, &cursor->author.generation, &cursor->position,
+               &cursor->timestamp, &length) != 4 || word[length] != '\0') {
+        return false;
+    }
+    return cursor->author.id == author->id && cursor->author.generation == author->generation;
+}
+
+static void execute_page(user_t *user, char *arguments, FILE *out) {
+    const user_t *author = posts_author(user, &arguments, out);
+    if (author == NULL) return;
+    long count = parse_count(&arguments);
+    char *word = next_word(&arguments);
+    post_cursor_t cursor = post_cursor_open(author);
+    if (word != NULL && strcmp(word, "end") == 0) {
+        cursor.position = 0;
+    } else if (word != NULL && !parse_cursor(word, author, &cursor)) {
+        fputs("err cursor\n", out);
+        return;
+    }
+    const post_t *posts[BATCH_MAX_COUNT];
+    size_t n = post_cursor_next(&cursor, posts, count);
+    // Posts added later are newer than the cursor, so once it reaches the
+    // oldest post it stays at the end
+    if (cursor.position == 0) {
+        fprintf(out, "ok %zu end\n", n);
+    } else {
+        fprintf(out, "ok %zu %u.%u.%u.%lld\n", n, cursor.author.id, cursor.author.generation, cursor.position,
+                cursor.timestamp);
+    }
+    print_posts(posts, n, out);
+}
+
+static void execute_post(user_t *user, char *arguments, FILE *out) {
+    if (arguments[strspn(arguments, " \t")] == '\0') {
+        fputs("err usage\n", out);
+        return;
+    }
+    add_post(user, arguments);
+    const post_t *post = postlist_newest(user);
+    fprintf(out, "ok %lld %u.%u\n", post->timestamp, post->id, post->generation);
+}
+
+static void execute_unpost(user_t *user, char *arguments, FILE *out) {
+    char *word = next_word(&arguments);
+    if (word == NULL) {
+        fputs(delete_post(user) ? "ok\n" : "err empty\n", out);
+        return;
+    }
+    // Only the user's own posts can be deleted, and their author is the one
+    // user whose shard is locked
+    post_handle_t handle;
+    int length = 0;
+    _Bool parsed = sscanf(word, "%u.%u%n", &handle.id, &handle.generation, &length) == 2 && word[length] == '\0';
+    post_t *post = parsed ? find_post(user, handle) : NULL;
+    if (post == NULL) {
+        fputs("err notfound\n", out);
+        return;
+    }
+    remove_post(user, post);
+    fputs("ok\n", out);
+}
+
+static _Bool contains_text(const post_t *post, void *text) {
+    return strstr(post_content(post), text) != NULL;
+}
+
+static void execute_purge(user_t *user, char *arguments, FILE *out) {
+    arguments += strspn(arguments, " \t");
+    if (*arguments == '\0') {
+        fputs("err usage\n", out);
+        return;
+    }
+    fprintf(out, "ok %zu\n", delete_posts_where(user, contains_text, arguments));
+}
+
+static void execute_feed(user_t *user, char *arguments, FILE *out) {
+    long count = parse_count(&arguments);
+    const post_t *posts[BATCH_MAX_COUNT];
+    const user_t *authors[BATCH_MAX_COUNT];
+    long n = 0;
+    feed_t feed;
+    feed_open(&feed, user);
+    while (n < count && (posts[n] = feed_next(&feed, &authors[n])) != NULL) n++;
+    feed_close(&feed);
+    fprintf(out, "ok %ld\n", n);
+    for (long i = 0; i < n; i++) {
+        fprintf(out, "%lld %s %s\n", posts[i]->timestamp, authors[i]->username, post_content(posts[i]));
+    }
+}
+
+static void execute_search(char *arguments, FILE *out) {
+    search_result_t results[BATCH_DEFAULT_COUNT];
+    size_t n = search_query(arguments, results, BATCH_DEFAULT_COUNT);
+    if (n == 0 && errno != 0) {
+        fputs("err query\n", out);
+        return;
+    }
+    fprintf(out, "ok %zu\n", n);
+    for (size_t i = 0; i < n; i++) {
+        fprintf(out, "%lld %s %s\n", results[i].post->timestamp, results[i].author->username, post_content(results[i].post));
+    }
+}
+
+static void execute_users(char *arguments, FILE *out) {
+    char *prefix = next_word(&arguments);
+    user_t *matches[BATCH_DEFAULT_COUNT];
+    size_t n = prefix_find(prefix != NULL ? prefix : "", matches, BATCH_DEFAULT_COUNT);
+    fprintf(out, "ok %zu\n", n);
+    for (size_t i = 0; i < n; i++) fprintf(out, "%s\n", matches[i]->username);
+}
+
+static void execute_suggest(user_t *user, char *arguments, FILE *out) {
+    long count = parse_count(&arguments);
+    suggestion_t suggestions[SUGGEST_MAX_RESULTS];
+    size_t n = suggest_friends(user, suggestions, count < SUGGEST_MAX_RESULTS ? (size_t) count : SUGGEST_MAX_RESULTS);
+    fprintf(out, "ok %zu\n", n);
+    for (size_t i = 0; i < n; i++) fprintf(out, "%s %u\n", suggestions[i].user->username, suggestions[i].mutual);
+}
+
+// Copies the next space-separated word of a line into a buffer, truncating
+// it if it does not fit, without modifying the line
+static const char *peek_word(const char *line, char *buffer, size_t size) {
+    line += strspn(line, " \t");
+    size_t length = strcspn(line, " \t");
+    if (length >= size) length = size - 1;
+    memcpy(buffer, line, length);
+    buffer[length] = '\0';
+    return line + strcspn(line, " \t");
+}
+
+batch_locks_t batch_command_locks(const batch_session_t *session, const char *line) {
+    batch_locks_t locks = {NULL, false};
+    char command[16];
+    line = peek_word(line, command, sizeof(command));
+    if (strcmp(command, "register") == 0) {
+        // The username is truncated the same way add_user truncates it, so
+        // it routes to the shard the user is added to
+        char username[MAX_USERNAME_SIZE];
+        peek_word(line, username, sizeof(username));
+        if (username[0] != '\0') locks.shard = shard_for(username);
+        return locks;
+    }
+    if (strcmp(command, "login") == 0) {
+        // Logging in may replace a hash made by a bulk import
+        char username[MAX_USERNAME_SIZE];
+        peek_word(line, username, sizeof(username));
+        if (username[0] != '\0') locks.shard = shard_for(username);
+        return locks;
+    }
+    shard_t *shard = session_shard(session);
+    if (shard == NULL) return locks;
+    if (strcmp(command, "post") == 0) {
+        // With fan-out enabled, the post is pushed to the followers'
+        // timelines, while deleted posts are left for their readers to skip
+        locks.shard = shard;
+        locks.shared = fanout_settings.enabled;
+    } else if (strcmp(command, "unpost") == 0 || strcmp(command, "purge") == 0 || strcmp(command, "password") == 0) {
+        locks.shard = shard;
+    } else if (strcmp(command, "delete") == 0) {
+        // Deleting a user removes its edges from the friend graphs
+        locks.shard = shard;
+        locks.shared = true;
+    } else if (strcmp(command, "friend") == 0 || strcmp(command, "unfriend") == 0) {
+        // Both directions of a mutual friendship are in the friend graphs
+        locks.shard = shard;
+        locks.shared = true;
+    } else if (strcmp(command, "suggest") == 0) {
+        // Suggestions are computed from the friend graphs
+        locks.shared = true;
+    } else if (strcmp(command, "feed") == 0) {
+        // The friends are read from the friend graph, and with fan-out
+        // enabled, reading a feed may rebuild its timeline
+        locks.shared = true;
+    }
+    return locks;
+}
+
+_Bool batch_command_hashes(const char *line) {
+    char command[16];
+    peek_word(line, command, sizeof(command));
+    return strcmp(command, "register") == 0 || strcmp(command, "login") == 0 || strcmp(command, "password") == 0
+           || strcmp(command, "delete") == 0;
+}
+
+void batch_prepare(batch_session_t *session, const char *line) {
+    batch_prepared_t *prepared = &session->prepared;
+    prepared->verified = NULL;
+    prepared->hashed = false;
+    if (!batch_command_hashes(line)) return;
+    char *copy = strdup(line);
+    assert(copy != NULL);
+    char *arguments = copy;
+    char *command = next_word(&arguments);
+    char *first = next_word(&arguments);
+    char *second = next_word(&arguments);
+    if (strcmp(command, "register") == 0) {
+        // Registering a taken name fails anyway, so it is not worth hashing
+        if (first != NULL && second != NULL && strlen(second) >= 8 && find_user(first) == NULL) {
+            password_hash(&prepared->hash, second);
+            prepared->hashed = true;
+        }
+    } else if (strcmp(command, "login") == 0) {
+        user_t *user = first == NULL || second == NULL ? NULL : find_user(first);
+        const password_hash_t *hash = user == NULL ? NULL : epoch_load(user->password);
+        if (hash != NULL && password_verify(hash, second)) prepared->verified = hash;
+        // A hash made by a bulk import is replaced at the full cost
+        if (prepared->verified != NULL && password_outdated(hash)) {
+            password_hash(&prepared->hash, second);
+            prepared->hashed = true;
+        }
+    } else {
+        user_t *user = session_user(session);
+        const password_hash_t *hash = user == NULL || first == NULL ? NULL : epoch_load(user->password);
+        if (hash != NULL && password_verify(hash, first)) prepared->verified = hash;
+        if (prepared->verified != NULL && strcmp(command, "password") == 0 && second != NULL) {
+            password_hash(&prepared->hash, second);
+            prepared->hashed = true;
+        }
+    }
+    free(copy);
+}
+
+void batch_execute(batch_session_t *session, char *line, FILE *out) {
+    // The preparation only ever applies to the command right after it
+    batch_prepared_t prepared = session->prepared;
+    session->prepared.verified = NULL;
+    session->prepared.hashed = false;
+    char *arguments = line;
+    char *command = next_word(&arguments);
+    if (command == NULL || command[0] == '#') return;
+    if (strcmp(command, "register") == 0) {
+        execute_register(&prepared, arguments, out);
+        return;
+    }
+    if (strcmp(command, "login") == 0) {
+        execute_login(session, &prepared, arguments, out);
+        return;
+    }
+    if (strcmp(command, "stats") == 0) {
+        fprintf(out, "ok %d\n", METRIC_COUNT);
+        metrics_print(out);
+        return;
+    }
+    user_t *user = session_user(session);
+    if (strcmp(command, "logout") == 0) {
+        session->logged_in = false;
+        fputs("ok\n", out);
+    } else if (strcmp(command, "post") != 0 && strcmp(command, "unpost") != 0 && strcmp(command, "purge") != 0
+               && strcmp(command, "friend") != 0
+               && strcmp(command, "unfriend") != 0 && strcmp(command, "feed") != 0 && strcmp(command, "password") != 0
+               && strcmp(command, "posts") != 0 && strcmp(command, "page") != 0 && strcmp(command, "search") != 0
+               && strcmp(command, "users") != 0 && strcmp(command, "suggest") != 0 && strcmp(command, "delete") != 0) {
+        fputs("err command\n", out);
+    } else if (user == NULL) {
+        fputs("err login\n", out);
+    } else if (strcmp(command, "post") == 0) {
+        execute_post(user, arguments, out);
+    } else if (strcmp(command, "unpost") == 0) {
+        execute_unpost(user, arguments, out);
+    } else if (strcmp(command, "purge") == 0) {
+        execute_purge(user, arguments, out);
+    } else if (strcmp(command, "friend") == 0) {
+        char *friend = next_word(&arguments);
+        if (friend == NULL || find_user(friend) == NULL) {
+            fputs("err notfound\n", out);
+        } else {
+            add_friend(user, friend);
+            fputs("ok\n", out);
+        }
+    } else if (strcmp(command, "unfriend") == 0) {
+        char *friend = next_word(&arguments);
+        fputs(friend != NULL && delete_friend(user, friend) ? "ok\n" : "err notfound\n", out);
+    } else if (strcmp(command, "password") == 0) {
+        execute_password(&prepared, user, out);
+    } else if (strcmp(command, "delete") == 0) {
+        execute_delete(session, &prepared, user, out);
+    } else if (strcmp(command, "posts") == 0) {
+        execute_posts(user, arguments, out);
+    } else if (strcmp(command, "page") == 0) {
+        execute_page(user, arguments, out);
+    } else if (strcmp(command, "search") == 0) {
+        execute_search(arguments, out);
+    } else if (strcmp(command, "users") == 0) {
+        execute_users(arguments, out);
+    } else if (strcmp(command, "suggest") == 0) {
+        execute_suggest(user, arguments, out);
+    } else {
+        execute_feed(user, arguments, out);
+    }
+}
+
+size_t batch_run(FILE *in, FILE *out) {
+    setvbuf(out, NULL, _IOFBF, 1 << 16);
+    batch_session_t session = BATCH_SESSION_INIT;
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    size_t executed = 0;
+    while ((length = getline(&line, &capacity, in)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) line[--length] = '\0';
+        batch_prepare(&session, line);
+        batch_execute(&session, line, out);
+        executed++;
+    }
+    free(line);
+    fflush(out);
+    return executed;
+}
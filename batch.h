@@ -0,0 +1,159 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "nodes.h"
+#include "shard.h"
+#include "password.h"
+
+#define BATCH_DEFAULT_COUNT 10
+#define BATCH_MAX_COUNT 1000
+
+// A non-interactive command stream. Each line is one command and gets one
+// reply line, "ok" or "err <reason>", optionally followed by values:
+//
+// register <username> <password>  ok | err exists | err password
+// login <username> <password>     ok | err auth
+// logout                          ok
+// password <old> <new>            ok | err auth
+// delete <password>               ok | err auth
+// post <text>                     ok <timestamp> <id> | err usage
+// unpost [id]                     ok | err empty | err notfound
+// purge <text>                    ok <n> | err usage
+// friend <username>               ok | err notfound
+// unfriend <username>             ok | err notfound
+// posts <username> [count]        ok <n>, then n lines "<timestamp> <text>" |
+//                                 err notfound | err notfriend
+// page <username> [count] [cursor] ok <n> <cursor>, then n lines "<timestamp> <text>" |
+//                                 err notfound | err notfriend | err cursor
+// feed [count]                    ok <n>, then n lines "<timestamp> <author> <text>"
+// search <query>                  ok <n>, then n lines "<timestamp> <author> <text>" |
+//                                 err query
+// users [prefix]                  ok <n>, then n lines "<username>"
+// suggest [count]                 ok <n>, then n lines "<username> <mutual friends>"
+// stats                           ok <n>, then n lines "<operation> <count> <mean> <p50>
+//                                 <p99> <p99.9> <max>", latencies in nanoseconds
+//
+// Every command but register, login and stats acts as the logged in user and
+// replies "err login" if there is none. Blank lines and lines starting with
+// '#' are skipped, and unknown commands reply "err command". search lists
+// the newest BATCH_DEFAULT_COUNT posts of any user that match the query, in
+// the syntax of search_query, and replies "err query" to a query that
+// search_query refuses. users lists the first BATCH_DEFAULT_COUNT
+// usernames starting with the prefix, alphabetically. suggest lists at most
+// SUGGEST_MAX_RESULTS people the user may know. delete deletes the logged in
+// user's account and logs out. login replaces a password hash made at a
+// lower cost, such as by a bulk import, with one at the current cost.
+//
+// page lists an author's posts like posts, and also replies with a cursor to
+// pass to the next page command, which lists the posts after the last one
+// listed, even in a later session or after posts were added or deleted in
+// between. Reading a page takes time in proportion to the page, however deep
+// it is. The cursor is "end" once the oldest post has been listed, and is
+// refused with "err cursor" once the author's account has been deleted.
+// Cursors do not outlive the process, since loading the users gives them new
+// IDs.
+//
+// unpost deletes the post with the ID that post replied with, or the newest
+// post without one, and purge deletes every post that contains the text.
+// Both only delete the logged in user's own posts. A post ID is "n.g": a
+// deleted post's n goes to a later post with a new g, so an old ID never
+// deletes a later post. Post IDs do not outlive the process either.
+
+// The password work of the next command, done by batch_prepare before the
+// command takes its locks, since hashing a password takes far longer than
+// any command
+typedef struct batch_prepared {
+    const password_hash_t *verified; // The hash the given password matched, or NULL
+    password_hash_t hash; // The hash of a new password
+    _Bool hashed;
+} batch_prepared_t;
+
+// The state a command stream carries from one command to the next. The
+// logged in user is kept as a handle, since another session may delete the
+// account, and the session is logged out from then on.
+typedef struct batch_session {
+    user_handle_t user;
+    _Bool logged_in;
+    batch_prepared_t prepared;
+} batch_session_t;
+
+#define BATCH_SESSION_INIT {{0, 0}, false, {NULL, {0}, false}}
+
+// The locks a command has to hold when several sessions share the database.
+// A command writes at most one shard, and the shared lock is taken after the
+// shard's lock. Commands that take no lock only read, inside an epoch.
+typedef struct batch_locks {
+    shard_t *shard;
+    _Bool shared;
+} batch_locks_t;
+
+/**
+ * Works out the locks a command needs from the session it runs in and its
+ * arguments.
+ *
+ * Parameters:
+ * session: The session the command runs in.
+ * line: The command. It is not modified.
+ *
+ * Returns:
+ * The shards to lock, if any, and whether to take the shared lock.
+ */
+batch_locks_t batch_command_locks(const batch_session_t *session, const char *line);
+
+/**
+ * Checks if a command hashes or verifies a password, which is register,
+ * login, password and delete.
+ *
+ * Parameters:
+ * line: The command. It is not modified.
+ *
+ * Returns:
+ * True if the command hashes a password and false otherwise.
+ */
+_Bool batch_command_hashes(const char *line);
+
+/**
+ * Hashes and verifies the passwords a command needs, without taking any
+ * lock. It must run in the same epoch as the batch_execute of the command
+ * that follows, with no other command of the session in between.
+ *
+ * Parameters:
+ * session: The session the command runs in.
+ * line: The command. It is not modified.
+ *
+ * Returns:
+ * None
+ */
+void batch_prepare(batch_session_t *session, const char *line);
+
+/**
+ * Executes one command against the database and writes its reply. Commands
+ * that hash a password have to be prepared with batch_prepare first, or
+ * they reply as if the password were wrong.
+ *
+ * Parameters:
+ * session: The session the command runs in.
+ * line: The command, without its newline. It is modified while parsing.
+ * out: The file to write the reply to.
+ *
+ * Returns:
+ * None
+ */
+void batch_execute(batch_session_t *session, char *line, FILE *out);
+
+/**
+ * Executes every command of a stream in a single session. Replies are fully
+ * buffered rather than written line by line.
+ *
+ * Parameters:
+ * in: The file to read commands from.
+ * out: The file to write replies to.
+ *
+ * Returns:
+ * The number of commands executed.
+ */
+size_t batch_run(FILE *in, FILE *out);
+
+#endif
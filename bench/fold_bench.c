@@ -0,0 +1,152 @@
+// Times the case-folding kernels against the byte-at-a-time loops they
+// replaced, on random usernames of every length up to MAX_USERNAME_SIZE.
+// fold_lower is the same byte loop in every version, and is timed with each
+// one only for comparison with the baseline.
+//
+// gcc -O2 -I. bench/fold_bench.c fold.c -o fold_bench
+// ./fold_bench [count] [rounds]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "fold.h"
+
+#define MAX_USERNAME_SIZE 30
+#define DEFAULT_COUNT 100000
+#define DEFAULT_ROUNDS 20
+
+static char char_to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? 'a' + (c - 'A') : c;
+}
+
+static int scalar_strcmp(const char *str1, const char *str2) {
+    int i = 0;
+    for (; str1[i] != '\0' && str2[i] != '\0'; i++) {
+        int diff = char_to_lower(str1[i]) - char_to_lower(str2[i]);
+        if (diff != 0) return diff;
+    }
+    return char_to_lower(str1[i]) - char_to_lower(str2[i]);
+}
+
+static size_t scalar_hash(const char *str) {
+    size_t hash = 14695981039346656037ULL;
+    for (int i = 0; str[i] != '\0'; i++) {
+        hash ^= (unsigned char) char_to_lower(str[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void scalar_lower(char *str) {
+    for (int i = 0; str[i] != '\0'; i++) str[i] = char_to_lower(str[i]);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keeps results alive so the loops are not optimized away
+static volatile size_t sink;
+
+// Times each operation over every username and prints the nanoseconds per
+// call. isa is negative for the scalar baseline.
+static void run(int isa, char (*names)[MAX_USERNAME_SIZE], char (*upper)[MAX_USERNAME_SIZE], size_t count, int rounds) {
+    char scratch[MAX_USERNAME_SIZE];
+    double calls = (double) count * rounds;
+    size_t total = 0;
+
+    double start = now();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            if (isa < 0) total += scalar_hash(names[i]);
+            else total += fold_hash(names[i], strlen(names[i]));
+        }
+    }
+    double hash_time = now() - start;
+
+    start = now();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            // Equal apart from case, the lookup hit that scans the most bytes
+            if (isa < 0) total += scalar_strcmp(names[i], upper[i]);
+            else {
+                size_t length = strlen(names[i]);
+                total += fold_compare(names[i], upper[i], length + 1);
+            }
+        }
+    }
+    double compare_time = now() - start;
+
+    start = now();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            memcpy(scratch, upper[i], MAX_USERNAME_SIZE);
+            if (isa < 0) scalar_lower(scratch);
+            else fold_lower(scratch, strlen(scratch));
+            total += scratch[0];
+        }
+    }
+    double lower_time = now() - start;
+
+    sink = total;
+    printf("%-8s hash %6.2f ns  compare %6.2f ns  lower %6.2f ns\n", isa < 0 ? "baseline" : fold_isa_name(isa),
+           hash_time * 1e9 / calls, compare_time * 1e9 / calls, lower_time * 1e9 / calls);
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_COUNT;
+    int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    char (*names)[MAX_USERNAME_SIZE] = malloc(count * sizeof(*names));
+    char (*upper)[MAX_USERNAME_SIZE] = malloc(count * sizeof(*upper));
+    if (names == NULL || upper == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    srand(1);
+    const char *alphabet = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    for (size_t i = 0; i < count; i++) {
+        int length = 1 + rand() % (MAX_USERNAME_SIZE - 1);
+        for (int j = 0; j < length; j++) names[i][j] = alphabet[rand() % 63];
+        names[i][length] = '\0';
+        for (int j = 0; j <= length; j++) upper[i][j] = names[i][j] >= 'a' && names[i][j] <= 'z' ? names[i][j] - 32 : names[i][j];
+    }
+
+    // Every version must agree before any of them is timed
+    size_t *hashes = malloc(count * sizeof(size_t));
+    if (hashes == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int isa = FOLD_SCALAR; isa <= FOLD_AVX2; isa++) {
+        if (!fold_select(isa)) continue;
+        for (size_t i = 0; i < count; i++) {
+            size_t length = strlen(names[i]);
+            size_t hash = fold_hash(upper[i], length);
+            if (isa == FOLD_SCALAR) hashes[i] = hash;
+            size_t j = (i + 1) % count;
+            int expected = scalar_strcmp(names[i], names[j]);
+            int actual = fold_compare(names[i], upper[j], (length < strlen(names[j]) ? length : strlen(names[j])) + 1);
+            if (fold_compare(names[i], upper[i], length + 1) != 0 || (expected > 0) != (actual > 0) ||
+                (expected < 0) != (actual < 0) || hash != hashes[i] || hash != fold_hash(names[i], length)) {
+                fprintf(stderr, "%s disagrees on %s\n", fold_isa_name(isa), names[i]);
+                return 1;
+            }
+        }
+    }
+
+    printf("%zu usernames, %d rounds, %s detected\n", count, rounds, fold_isa_name(fold_detect()));
+    run(-1, names, upper, count, rounds);
+    for (int isa = FOLD_SCALAR; isa <= FOLD_AVX2; isa++) {
+        if (fold_select(isa)) run(isa, names, upper, count, rounds);
+    }
+
+    free(hashes);
+    free(names);
+    free(upper);
+    return 0;
+}
@@ -0,0 +1,237 @@
+// Times the core operations on synthetic social graphs written by social_gen
+// and prints their throughput and p50/p99 latencies as JSON, one object per
+// input file, so runs can be compared across sizes and across commits.
+// Passwords are hashed at the lowest scrypt cost, with 128-byte blocks, and
+// -k only raises the number of blocks, since at the default cost hashing the
+// imported rows would dwarf the rest of the load.
+//
+// gcc -O2 -I. bench/social_bench.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o social_bench -pthread -lm
+// for n in 1000 10000 100000 1000000 10000000; do ./social_gen $n > users_$n.csv; done
+// ./social_bench [-n operations] [-k cost] users_1000.csv ... users_10000000.csv > results.json
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "nodes.h"
+#include "functions.h"
+#include "feed.h"
+#include "password.h"
+
+#define DEFAULT_OPERATIONS 100000
+#define FEED_PAGE_SIZE 10
+#define FEED_PAGES 3
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// splitmix64, so every run does the same operations
+static uint64_t state = 1;
+
+static uint64_t next_random(void) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double next_uniform(void) {
+    return ((next_random() >> 11) + 0.5) / 9007199254740992.0;
+}
+
+// Keeps results alive so the loops are not optimized away
+static volatile size_t sink;
+
+static int compare_latencies(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// Prints one timed operation. The latencies are sorted in place.
+static void print_operation(const char *name, uint64_t *latencies, size_t count, uint64_t elapsed, _Bool last) {
+    qsort(latencies, count, sizeof(uint64_t), compare_latencies);
+    uint64_t p50 = count == 0 ? 0 : latencies[count / 2];
+    uint64_t p99 = count == 0 ? 0 : latencies[count * 99 / 100];
+    printf("    \"%s\": {\"operations\": %zu, \"seconds\": %.6f, \"throughput\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu}%s\n",
+           name, count, elapsed / 1e9, elapsed == 0 ? 0 : count / (elapsed / 1e9), (unsigned long long) p50,
+           (unsigned long long) p99, last ? "" : ",");
+}
+
+// Prints an operation that is timed once over every user, like a load
+static void print_total(const char *name, size_t users, uint64_t elapsed) {
+    printf("    \"%s\": {\"users\": %zu, \"seconds\": %.6f, \"throughput\": %.1f},\n", name, users, elapsed / 1e9,
+           elapsed == 0 ? 0 : users / (elapsed / 1e9));
+}
+
+// Picks the usernames the operations run on, uniformly from the rows of the
+// file, without keeping every username of a large file in memory. Returns
+// the number of rows.
+static size_t sample_usernames(FILE *file, char (*sample)[MAX_USERNAME_SIZE], size_t count) {
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t rows = 0;
+    if (getline(&line, &capacity, file) == -1) return 0;
+    while (getline(&line, &capacity, file) != -1) {
+        size_t slot = rows < count ? rows : next_random() % (rows + 1);
+        rows++;
+        if (slot >= count) continue;
+        size_t length = strcspn(line, ",\r\n");
+        if (length >= MAX_USERNAME_SIZE) length = MAX_USERNAME_SIZE - 1;
+        memcpy(sample[slot], line, length);
+        sample[slot][length] = '\0';
+    }
+    free(line);
+    return rows;
+}
+
+// Writes a post of log-normal length, like those social_gen writes
+static void make_post(char *text) {
+    static const char filler[] = "just finished quidditch practice and the snitch got away again #quidditch ";
+    double length = exp(log(70.0) + 0.6 * sqrt(-2 * log(next_uniform())) * cos(2 * M_PI * next_uniform()));
+    size_t size = length < 5 ? 5 : length > MAX_CONTENT_SIZE - 1 ? MAX_CONTENT_SIZE - 1 : (size_t) length;
+    for (size_t i = 0; i < size; i++) text[i] = filler[i % (sizeof(filler) - 1)];
+    text[size] = '\0';
+}
+
+static _Bool run(const char *path, size_t operations, _Bool last) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    char (*sample)[MAX_USERNAME_SIZE] = malloc(operations * sizeof(*sample));
+    char (*texts)[MAX_CONTENT_SIZE] = malloc(operations * sizeof(*texts));
+    user_t **users = malloc(operations * sizeof(user_t *));
+    uint64_t *latencies = malloc(operations * FEED_PAGES * sizeof(uint64_t));
+    if (sample == NULL || texts == NULL || users == NULL || latencies == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+    size_t rows = sample_usernames(file, sample, operations);
+    size_t count = rows < operations ? rows : operations;
+    rewind(file);
+
+    printf("  {\n    \"file\": \"%s\",\n", path);
+    uint64_t start = now_ns();
+    size_t loaded = read_CSV_and_create_users(file, INT_MAX);
+    print_total("read_CSV_and_create_users", loaded, now_ns() - start);
+    fclose(file);
+
+    // The users the writes go to are looked up before they are timed, and
+    // rows the loader skipped are dropped from the sample
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        users[kept] = find_user(sample[i]);
+        if (users[kept] != NULL) memmove(sample[kept++], sample[i], MAX_USERNAME_SIZE);
+    }
+    count = kept;
+    for (size_t i = 0; i < operations; i++) make_post(texts[i]);
+
+    size_t found = 0;
+    start = now_ns();
+    for (size_t i = 0; i < operations && count > 0; i++) {
+        const char *username = sample[next_random() % count];
+        uint64_t before = now_ns();
+        found += find_user(username) != NULL;
+        latencies[i] = now_ns() - before;
+    }
+    sink = found;
+    print_operation("find_user", latencies, count > 0 ? operations : 0, now_ns() - start, false);
+
+    size_t linked = 0;
+    start = now_ns();
+    for (size_t i = 0; i < operations && count > 0; i++) {
+        user_t *user = users[next_random() % count];
+        const char *friend = sample[next_random() % count];
+        if (strcmp(friend, user->username) == 0) continue;
+        uint64_t before = now_ns();
+        add_friend(user, friend);
+        latencies[linked++] = now_ns() - before;
+    }
+    print_operation("add_friend", latencies, linked, now_ns() - start, false);
+
+    start = now_ns();
+    for (size_t i = 0; i < operations && count > 0; i++) {
+        user_t *user = users[next_random() % count];
+        uint64_t before = now_ns();
+        add_post(user, texts[i]);
+        latencies[i] = now_ns() - before;
+    }
+    print_operation("add_post", latencies, count > 0 ? operations : 0, now_ns() - start, false);
+
+    // Every page of a feed is timed on its own, the first including opening
+    // the feed, the way a client scrolls through it
+    size_t pages = 0;
+    size_t read = 0;
+    start = now_ns();
+    for (size_t i = 0; i < operations && count > 0; i++) {
+        feed_t feed;
+        uint64_t before = now_ns();
+        feed_open(&feed, users[next_random() % count]);
+        for (int page = 0; page < FEED_PAGES; page++) {
+            size_t n = 0;
+            while (n < FEED_PAGE_SIZE && feed_next(&feed, NULL) != NULL) n++;
+            uint64_t after = now_ns();
+            latencies[pages++] = after - before;
+            before = after;
+            read += n;
+            if (n < FEED_PAGE_SIZE) break;
+        }
+        feed_close(&feed);
+    }
+    sink = read;
+    print_operation("feed_page", latencies, pages, now_ns() - start, false);
+
+    start = now_ns();
+    teardown();
+    uint64_t elapsed = now_ns() - start;
+    printf("    \"teardown\": {\"users\": %zu, \"seconds\": %.6f, \"throughput\": %.1f}\n  }%s\n", loaded, elapsed / 1e9,
+           elapsed == 0 ? 0 : loaded / (elapsed / 1e9), last ? "" : ",");
+    fflush(stdout);
+
+    free(sample);
+    free(texts);
+    free(users);
+    free(latencies);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    size_t operations = DEFAULT_OPERATIONS;
+    password_settings.log_n = 1;
+    password_settings.r = 1;
+    int option;
+    while ((option = getopt(argc, argv, "n:k:")) != -1) {
+        switch (option) {
+            case 'n':
+                operations = strtoul(optarg, NULL, 10);
+                break;
+            case 'k':
+                password_settings.log_n = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n operations] [-k cost] users.csv...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind == argc || operations == 0 || password_settings.log_n < 1 || password_settings.log_n > 20) {
+        fprintf(stderr, "Usage: %s [-n operations] [-k cost] users.csv...\n", argv[0]);
+        return 1;
+    }
+
+    printf("[\n");
+    for (int i = optind; i < argc; i++) {
+        if (!run(argv[i], operations, i == argc - 1)) return 1;
+    }
+    printf("]\n");
+    return 0;
+}
@@ -0,0 +1,165 @@
+// Writes a synthetic social graph in the users.csv layout, to benchmark the
+// loader and the feeds at sizes far beyond the bundled data set. Popularity
+// follows a power law: each friend field names a user drawn from a Zipf
+// distribution over a shuffled ranking, so a few users are everyone's friend
+// and most are almost nobody's. Each row has at most the CSV_FRIEND_FIELDS
+// friends the layout allows. Post counts follow a power law as well, and
+// post lengths are log-normal like those of real short posts, with hashtags
+// and mentions mixed into the words. The same seed always writes the same
+// file.
+//
+// gcc -O2 bench/social_gen.c -o social_gen -lm
+// ./social_gen users [seed] > users.csv
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+// The limits of nodes.h and loader.c
+#define MAX_USERNAME_SIZE 30
+#define MAX_CONTENT_SIZE 250
+#define CSV_FRIEND_FIELDS 3
+
+#define MAX_POSTS 64
+// Post lengths are log-normal around a median of this many characters
+#define POST_LENGTH_MEDIAN 70.0
+#define POST_LENGTH_SIGMA 0.6
+
+static const char *first_names[] = {
+    "harry", "ron", "hermione", "ginny", "fred", "george", "luna", "neville", "draco", "cho", "cedric", "dean",
+    "seamus", "lavender", "padma", "parvati", "oliver", "katie", "angelina", "lee", "percy", "bill", "charlie",
+    "molly", "arthur", "sirius", "remus", "nymphadora", "minerva", "albus", "severus", "rubeus", "filius"};
+static const char *last_names[] = {
+    "potter", "weasley", "granger", "lovegood", "longbottom", "malfoy", "chang", "diggory", "thomas", "finnigan",
+    "brown", "patil", "wood", "bell", "johnson", "jordan", "black", "lupin", "tonks", "mcgonagall", "snape",
+    "hagrid", "flitwick", "sprout", "slughorn", "krum", "delacour", "lockhart", "skeeter", "filch"};
+static const char *words[] = {
+    "the", "a", "to", "and", "of", "in", "is", "my", "for", "at", "with", "on", "this", "just", "today", "new",
+    "quidditch", "match", "potion", "wand", "spell", "castle", "owl", "broom", "snitch", "library", "feast",
+    "hogsmeade", "butterbeer", "detention", "exam", "charms", "dragon", "forest", "lake", "tower", "common",
+    "room", "homework", "practice", "great", "terrible", "finally", "again", "never", "always", "who", "knew",
+    "anyone", "else", "seen", "lost", "found", "brewing", "flying", "reading", "dueling", "studying"};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+// splitmix64, which is fast and good enough for synthetic data
+static uint64_t state;
+
+static uint64_t next_random(void) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// A uniform double in (0, 1)
+static double next_uniform(void) {
+    return ((next_random() >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static size_t next_below(size_t n) {
+    return next_random() % n;
+}
+
+// A rank from 0 to n - 1 with probability roughly proportional to
+// 1 / (rank + 1), by inverting the continuous CDF
+static size_t next_zipf(size_t n) {
+    size_t rank = (size_t) exp(next_uniform() * log((double) n + 1)) - 1;
+    return rank < n ? rank : n - 1;
+}
+
+// Popularity ranks are spread over the rows by a stride coprime to the
+// number of users, so the most popular users are not all written first
+static size_t num_users;
+static size_t stride;
+
+static size_t next_popular(void) {
+    return next_zipf(num_users) * stride % num_users;
+}
+
+static size_t gcd(size_t a, size_t b) {
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Every user's name is made from the same row index, so friend fields can
+// name users that are written later
+static void username(char *buffer, size_t index) {
+    size_t first = index % COUNT(first_names);
+    size_t last = index / COUNT(first_names) % COUNT(last_names);
+    snprintf(buffer, MAX_USERNAME_SIZE, "%s%s%zu", first_names[first], last_names[last], index);
+}
+
+static void write_post(void) {
+    double length = exp(log(POST_LENGTH_MEDIAN) + POST_LENGTH_SIGMA * sqrt(-2 * log(next_uniform())) * cos(2 * M_PI * next_uniform()));
+    size_t target = length < 5 ? 5 : length > MAX_CONTENT_SIZE - 1 ? MAX_CONTENT_SIZE - 1 : (size_t) length;
+    char text[MAX_CONTENT_SIZE + MAX_USERNAME_SIZE + 2];
+    size_t size = 0;
+    while (size < target) {
+        char word[MAX_USERNAME_SIZE + 2];
+        uint64_t kind = next_below(20);
+        if (kind == 0) {
+            // Mentions favour popular users, like friendships do
+            word[0] = '@';
+            username(word + 1, next_popular());
+        } else if (kind == 1) {
+            snprintf(word, sizeof(word), "#%s", words[16 + next_below(COUNT(words) - 16)]);
+        } else {
+            snprintf(word, sizeof(word), "%s", words[next_below(COUNT(words))]);
+        }
+        size_t word_length = strlen(word);
+        if (size + (size > 0) + word_length > MAX_CONTENT_SIZE - 1) break;
+        if (size > 0) text[size++] = ' ';
+        memcpy(text + size, word, word_length);
+        size += word_length;
+    }
+    text[size] = '\0';
+    fputs(text, stdout);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s users [seed]\n", argv[0]);
+        return 1;
+    }
+    num_users = strtoull(argv[1], NULL, 10);
+    state = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    if (num_users == 0) return 0;
+
+    stride = 2654435761ULL % num_users;
+    while (num_users > 1 && (stride == 0 || gcd(stride, num_users) != 1)) stride = (stride + 1) % num_users;
+    if (num_users == 1) stride = 1;
+
+    setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+    fputs("username,password,friends,,,posts,,\n", stdout);
+    char name[MAX_USERNAME_SIZE];
+    for (size_t i = 0; i < num_users; i++) {
+        username(name, i);
+        printf("%s,%08llu", name, (unsigned long long) (next_random() % 100000000));
+        // Most users list a few friends, and some list none
+        size_t num_friends = next_below(CSV_FRIEND_FIELDS + 2);
+        if (num_friends > CSV_FRIEND_FIELDS) num_friends = CSV_FRIEND_FIELDS;
+        for (size_t j = 0; j < CSV_FRIEND_FIELDS; j++) {
+            size_t friend = next_popular();
+            if (j < num_friends && friend != i) {
+                username(name, friend);
+                printf(",%s", name);
+            } else {
+                fputs(", ", stdout);
+            }
+        }
+        size_t num_posts = next_zipf(MAX_POSTS + 1);
+        for (size_t j = 0; j < num_posts; j++) {
+            putchar(',');
+            write_post();
+        }
+        putchar('\n');
+    }
+    return ferror(stdout) || fflush(stdout) != 0;
+}
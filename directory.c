@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "nodes.h"
+#include "functions.h"
+#include "directory.h"
+#include "epoch.h"
+#include "fold.h"
+
+#define DIRECTORY_INITIAL_CAPACITY 64
+
+size_t directory_hash(const char *username) {
+    return fold_hash(username, strlen(username));
+}
+
+// Marks the slot of a removed user, so probe sequences continue past it
+static user_t removed_user;
+
+static void directory_place(directory_table_t *table, user_t *user) {
+    size_t i = directory_hash(user->username) & (table->capacity - 1);
+    while (table->slots[i] != NULL) i = (i + 1) & (table->capacity - 1);
+    epoch_publish(table->slots[i], user);
+}
+
+// Replaces the table with one sized for the users in the index, which also
+// drops every tombstone
+static void directory_rebuild(directory_t *directory) {
+    directory_table_t *old_table = directory->table;
+    size_t capacity = DIRECTORY_INITIAL_CAPACITY;
+    // Leave the new table at most 0.35 full, as doubling a full one would
+    while ((directory->live + 1) * 20 > capacity * 7) capacity *= 2;
+    directory_table_t *table = calloc(1, sizeof(directory_table_t) + capacity * sizeof(user_t *));
+    assert(table != NULL);
+    table->capacity = capacity;
+    for (size_t i = 0; old_table != NULL && i < old_table->capacity; i++) {
+        user_t *user = old_table->slots[i];
+        if (user != NULL && user != &removed_user) directory_place(table, user);
+    }
+    epoch_publish(directory->table, table);
+    directory->used = directory->live;
+    if (old_table != NULL) epoch_retire(&directory->retired, epoch_free, NULL, old_table);
+}
+
+void directory_insert(directory_t *directory, user_t *user) {
+    // Keep the load factor under 0.7 so probe sequences stay short.
+    // Tombstones count toward it, since probes have to walk them too.
+    if (directory->table == NULL || (directory->used + 1) * 10 > directory->table->capacity * 7) directory_rebuild(directory);
+    // Released indexes are reused first, which keeps the IDs dense
+    unsigned int index = (unsigned int) directory->count;
+    user->generation = 0;
+    if (directory->num_released > 0) {
+        directory_released_t released = directory->released[--directory->num_released];
+        index = released.index;
+        user->generation = released.generation;
+    }
+    user->id = index << directory->id_shift | directory->id_tag;
+    directory_place(directory->table, user);
+    directory->used++;
+    epoch_publish(directory->live, directory->live + 1);
+    if (index < directory->count) {
+        epoch_publish(directory->by_id[index], user);
+        return;
+    }
+    if (directory->count == directory->id_capacity) {
+        size_t id_capacity = directory->id_capacity == 0 ? DIRECTORY_INITIAL_CAPACITY : directory->id_capacity * 2;
+        user_t **by_id = malloc(id_capacity * sizeof(user_t *));
+        assert(by_id != NULL);
+        for (size_t i = 0; i < directory->count; i++) by_id[i] = directory->by_id[i];
+        user_t **old_by_id = directory->by_id;
+        epoch_publish(directory->by_id, by_id);
+        if (old_by_id != NULL) epoch_retire(&directory->retired, epoch_free, NULL, old_by_id);
+        directory->id_capacity = id_capacity;
+    }
+    directory->by_id[directory->count] = user;
+    // The count is published last, so a reader that sees the ID also sees
+    // the array holding it
+    epoch_publish(directory->count, directory->count + 1);
+}
+
+void directory_remove(directory_t *directory, user_t *user) {
+    directory_table_t *table = directory->table;
+    size_t i = directory_hash(user->username) & (table->capacity - 1);
+    while (table->slots[i] != user) i = (i + 1) & (table->capacity - 1);
+    epoch_publish(table->slots[i], &removed_user);
+    unsigned int index = user->id >> directory->id_shift;
+    epoch_publish(directory->by_id[index], NULL);
+    if (directory->num_released == directory->released_capacity) {
+        directory->released_capacity = directory->released_capacity == 0 ? 16 : directory->released_capacity * 2;
+        directory->released = realloc(directory->released, directory->released_capacity * sizeof(directory_released_t));
+        assert(directory->released != NULL);
+    }
+    directory->released[directory->num_released++] = (directory_released_t) {index, user->generation + 1};
+    epoch_publish(directory->live, directory->live - 1);
+}
+
+user_t *directory_find(const directory_t *directory, const char *username) {
+    const directory_table_t *table = epoch_load(directory->table);
+    if (table == NULL) return NULL;
+    size_t i = directory_hash(username) & (table->capacity - 1);
+    user_t *user;
+    while ((user = epoch_load(table->slots[i])) != NULL) {
+        if (user != &removed_user && !case_insensitive_strcmp(user->username, username)) return user;
+        i = (i + 1) & (table->capacity - 1);
+    }
+    return NULL;
+}
+
+user_t *directory_user(const directory_t *directory, unsigned int id) {
+    id >>= directory->id_shift;
+    if (id >= epoch_load(directory->count)) return NULL;
+    return epoch_load(epoch_load(directory->by_id)[id]);
+}
+
+void directory_clear(directory_t *directory) {
+    epoch_drain(&directory->retired);
+    free(directory->table);
+    free(directory->by_id);
+    free(directory->released);
+    directory->table = NULL;
+    directory->by_id = NULL;
+    directory->released = NULL;
+    directory->id_capacity = 0;
+    directory->released_capacity = 0;
+    directory->num_released = 0;
+    directory->count = 0;
+    directory->live = 0;
+    directory->used = 0;
+}
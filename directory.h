@@ -0,0 +1,126 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <stddef.h>
+#include "nodes.h"
+#include "epoch.h"
+
+// The slots of the hash index, allocated together with their number so a
+// reader always sees a matching pair
+typedef struct directory_table {
+    size_t capacity;
+    user_t *slots[];
+} directory_table_t;
+
+// A dense index freed by a removed user, and the generation its next user
+// gets
+typedef struct directory_released {
+    unsigned int index;
+    unsigned int generation;
+} directory_released_t;
+
+// An open-addressing (linear probing) hash index of users keyed on the
+// case-folded username. Users are also interned into dense indexes in
+// insertion order, so they can be looked up by ID in constant time. A user's
+// ID is its index shifted left by id_shift and tagged with id_tag, so several
+// indexes can hand out IDs that never collide. Lookups take no lock: tables
+// are replaced rather than resized in place, and the old ones are retired
+// through the epoch scheme.
+//
+// Removed users leave a tombstone in the hash index, and their dense index is
+// handed to the next user added with its generation bumped, so the IDs stay
+// dense and a stale handle to the removed user never resolves to the new one.
+typedef struct directory {
+    directory_table_t *table;
+    size_t count; // Dense indexes handed out, including released ones
+    size_t live; // Users in the index
+    size_t used; // Hash slots holding a user or a tombstone
+    user_t **by_id;
+    size_t id_capacity;
+    unsigned int id_shift;
+    unsigned int id_tag;
+    directory_released_t *released;
+    size_t num_released;
+    size_t released_capacity;
+    epoch_domain_t retired;
+} directory_t;
+
+// Initializes an empty index
+#define DIRECTORY_INIT(id_shift, id_tag) {NULL, 0, 0, 0, NULL, 0, id_shift, id_tag, NULL, 0, 0, EPOCH_DOMAIN_INIT}
+
+/**
+ * Hashes a username, ignoring case.
+ *
+ * Parameters:
+ * username: The username.
+ *
+ * Returns:
+ * The hash of the case-folded username.
+ */
+size_t directory_hash(const char *username);
+
+/**
+ * Adds a user to the index, growing it when it becomes too full. The user is
+ * given the ID and generation of the last released dense index, or of the
+ * next dense index if none are released.
+ *
+ * Parameters:
+ * directory: The index.
+ * user: The user to add.
+ *
+ * Returns:
+ * None
+ */
+void directory_insert(directory_t *directory, user_t *user);
+
+/**
+ * Removes a user from the index and releases its dense index for reuse. The
+ * user itself is not freed, and lock-free readers may still see it until the
+ * current epoch ends.
+ *
+ * Parameters:
+ * directory: The index.
+ * user: The user to remove, which must be in the index.
+ *
+ * Returns:
+ * None
+ */
+void directory_remove(directory_t *directory, user_t *user);
+
+/**
+ * Searches the index for a user, ignoring case.
+ *
+ * Parameters:
+ * directory: The index.
+ * username: The username to search for.
+ *
+ * Returns:
+ * A pointer to the user if found and NULL if not found.
+ */
+user_t *directory_find(const directory_t *directory, const char *username);
+
+/**
+ * Looks up a user by ID.
+ *
+ * Parameters:
+ * directory: The index.
+ * id: The user's ID.
+ *
+ * Returns:
+ * A pointer to the user if the ID is in use and NULL if not. A reused ID
+ * finds its newest user.
+ */
+user_t *directory_user(const directory_t *directory, unsigned int id);
+
+/**
+ * Frees the index's slots. The users themselves are not freed.
+ *
+ * Parameters:
+ * directory: The index.
+ *
+ * Returns:
+ * None
+ */
+void directory_clear(directory_t *directory);
+
+#endif
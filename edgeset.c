@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include "epoch.h"
+#include "edgeset.h"
+
+#define EDGESET_INITIAL_CAPACITY 1024
+// IDs are 32 bits, so no pair packs into the two highest keys
+#define EDGESET_EMPTY UINT64_MAX
+#define EDGESET_TOMBSTONE (UINT64_MAX - 1)
+
+edgeset_settings_t edgeset_settings = {false};
+
+edgeset_t friend_edges = EDGESET_INIT;
+
+static uint64_t edge_key(unsigned int user, unsigned int friend) {
+    return (uint64_t) user << 32 | friend;
+}
+
+static size_t edge_slot(const edgeset_table_t *table, uint64_t key) {
+    // Fibonacci hashing, since consecutive IDs would cluster in the low bits
+    return (size_t) ((key * 11400714819323198485ULL) >> 32) & (table->capacity - 1);
+}
+
+static void edgeset_place(edgeset_table_t *table, uint64_t key) {
+    size_t i = edge_slot(table, key);
+    while (table->slots[i] != EDGESET_EMPTY) i = (i + 1) & (table->capacity - 1);
+    epoch_publish(table->slots[i], key);
+}
+
+// Replaces the table with one of at least a number of slots, which also
+// drops every tombstone
+static void edgeset_rebuild(edgeset_t *set, size_t min_capacity) {
+    size_t capacity = EDGESET_INITIAL_CAPACITY;
+    while (capacity < min_capacity) capacity *= 2;
+    edgeset_table_t *old_table = set->table;
+    edgeset_table_t *table = malloc(sizeof(edgeset_table_t) + capacity * sizeof(uint64_t));
+    assert(table != NULL);
+    table->capacity = capacity;
+    memset(table->slots, 0xFF, capacity * sizeof(uint64_t));
+    for (size_t i = 0; old_table != NULL && i < old_table->capacity; i++) {
+        uint64_t key = old_table->slots[i];
+        if (key != EDGESET_EMPTY && key != EDGESET_TOMBSTONE) edgeset_place(table, key);
+    }
+    epoch_publish(set->table, table);
+    set->used = set->count;
+    if (old_table != NULL) epoch_retire(&set->retired, epoch_free, NULL, old_table);
+}
+
+void edgeset_reserve(edgeset_t *set, size_t count) {
+    if (set->table == NULL || count * 2 > set->table->capacity) edgeset_rebuild(set, count * 2);
+}
+
+_Bool edgeset_insert(edgeset_t *set, unsigned int user, unsigned int friend) {
+    if (edgeset_contains(set, user, friend)) return false;
+    // Keep the load factor under 0.5 so probe sequences stay short.
+    // Tombstones count toward it, since probes have to walk them too, and a
+    // rebuild leaves the table at most a quarter full so it is not rebuilt
+    // again soon.
+    if (set->table == NULL || (set->used + 1) * 2 > set->table->capacity) edgeset_rebuild(set, (set->count + 1) * 4);
+    edgeset_table_t *table = set->table;
+    uint64_t key = edge_key(user, friend);
+    size_t i = edge_slot(table, key);
+    while (table->slots[i] != EDGESET_EMPTY && table->slots[i] != EDGESET_TOMBSTONE) i = (i + 1) & (table->capacity - 1);
+    if (table->slots[i] == EDGESET_EMPTY) set->used++;
+    epoch_publish(table->slots[i], key);
+    set->count++;
+    return true;
+}
+
+_Bool edgeset_remove(edgeset_t *set, unsigned int user, unsigned int friend) {
+    edgeset_table_t *table = set->table;
+    if (table == NULL) return false;
+    uint64_t key = edge_key(user, friend);
+    for (size_t i = edge_slot(table, key); table->slots[i] != EDGESET_EMPTY; i = (i + 1) & (table->capacity - 1)) {
+        if (table->slots[i] == key) {
+            epoch_publish(table->slots[i], EDGESET_TOMBSTONE);
+            set->count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+_Bool edgeset_contains(const edgeset_t *set, unsigned int user, unsigned int friend) {
+    const edgeset_table_t *table = epoch_load(set->table);
+    if (table == NULL) return false;
+    uint64_t key = edge_key(user, friend);
+    uint64_t slot;
+    for (size_t i = edge_slot(table, key); (slot = epoch_load(table->slots[i])) != EDGESET_EMPTY; i = (i + 1) & (table->capacity - 1)) {
+        if (slot == key) return true;
+    }
+    return false;
+}
+
+void edgeset_clear(edgeset_t *set) {
+    epoch_drain(&set->retired);
+    free(set->table);
+    set->table = NULL;
+    set->count = 0;
+    set->used = 0;
+}
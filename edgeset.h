@@ -0,0 +1,106 @@
+#ifndef EDGESET_H
+#define EDGESET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "epoch.h"
+
+// How friend edges behave. When symmetric, adding or removing a friend does
+// the same to the edge back from the friend in the same operation, so
+// friendships are always mutual.
+typedef struct edgeset_settings {
+    _Bool symmetric;
+} edgeset_settings_t;
+
+// The slots of the hash set, allocated together with their number so a
+// reader always sees a matching pair
+typedef struct edgeset_table {
+    size_t capacity;
+    uint64_t slots[];
+} edgeset_table_t;
+
+// An open-addressing (linear probing) hash set of directed (user, friend) ID
+// pairs, packed into one 64-bit key each, for checking if two users are
+// friends in constant time. Removed edges leave tombstones so lookups can
+// keep probing past them, and the table is rebuilt without them once they
+// and the live edges fill it. Like the directory, lookups take no lock:
+// tables are replaced rather than resized in place, and the old ones are
+// retired through the epoch scheme. Writes happen under the shared lock.
+typedef struct edgeset {
+    edgeset_table_t *table;
+    size_t count;
+    size_t used;
+    epoch_domain_t retired;
+} edgeset_t;
+
+#define EDGESET_INIT {NULL, 0, 0, EPOCH_DOMAIN_INIT}
+
+extern edgeset_settings_t edgeset_settings;
+
+// Every friend edge in the database
+extern edgeset_t friend_edges;
+
+/**
+ * Makes room for a number of edges at once, such as before a bulk load.
+ *
+ * Parameters:
+ * set: The set.
+ * count: The total number of edges to make room for.
+ *
+ * Returns:
+ * None
+ */
+void edgeset_reserve(edgeset_t *set, size_t count);
+
+/**
+ * Adds an edge to the set.
+ *
+ * Parameters:
+ * set: The set.
+ * user: The ID of the user.
+ * friend: The ID of the friend.
+ *
+ * Returns:
+ * True if the edge was added and false if it was already in the set.
+ */
+_Bool edgeset_insert(edgeset_t *set, unsigned int user, unsigned int friend);
+
+/**
+ * Removes an edge from the set.
+ *
+ * Parameters:
+ * set: The set.
+ * user: The ID of the user.
+ * friend: The ID of the friend.
+ *
+ * Returns:
+ * True if the edge was removed and false if it was not in the set.
+ */
+_Bool edgeset_remove(edgeset_t *set, unsigned int user, unsigned int friend);
+
+/**
+ * Checks if an edge is in the set. Safe to call without locks inside an
+ * epoch.
+ *
+ * Parameters:
+ * set: The set.
+ * user: The ID of the user.
+ * friend: The ID of the friend.
+ *
+ * Returns:
+ * True if the friend is one of the user's friends and false otherwise.
+ */
+_Bool edgeset_contains(const edgeset_t *set, unsigned int user, unsigned int friend);
+
+/**
+ * Frees the set.
+ *
+ * Parameters:
+ * set: The set.
+ *
+ * Returns:
+ * None
+ */
+void edgeset_clear(edgeset_t *set);
+
+#endif
@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include "epoch.h"
+
+#define EPOCH_RECLAIM_BATCH 64
+#define EPOCH_CACHE_LINE 64
+
+// A thread's announced epoch, or 0 while it is outside any read-side
+// section. Each record sits on its own cache line so readers never write to
+// a line another reader touches.
+typedef struct epoch_thread {
+    _Alignas(EPOCH_CACHE_LINE) unsigned long long epoch;
+    struct epoch_thread *next;
+} epoch_thread_t;
+
+static unsigned long long global_epoch = 1;
+
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static epoch_thread_t *threads = NULL;
+static __thread epoch_thread_t *self = NULL;
+
+// Threads are registered on their first read-side section. Records are never
+// unlinked, so the list can be walked without the lock.
+static epoch_thread_t *register_thread(void) {
+    epoch_thread_t *thread = aligned_alloc(EPOCH_CACHE_LINE, sizeof(epoch_thread_t));
+    assert(thread != NULL);
+    thread->epoch = 0;
+    pthread_mutex_lock(&threads_lock);
+    thread->next = threads;
+    epoch_publish(threads, thread);
+    pthread_mutex_unlock(&threads_lock);
+    return thread;
+}
+
+void epoch_enter(void) {
+    if (self == NULL) self = register_thread();
+    // The announcement must be visible before any link is loaded
+    __atomic_store_n(&self->epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void) {
+    __atomic_store_n(&self->epoch, 0, __ATOMIC_RELEASE);
+}
+
+// The epoch can only move on once every reader inside a section has seen it
+static void try_advance(void) {
+    unsigned long long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    for (epoch_thread_t *thread = epoch_load(threads); thread != NULL; thread = thread->next) {
+        unsigned long long announced = __atomic_load_n(&thread->epoch, __ATOMIC_SEQ_CST);
+        if (announced != 0 && announced != epoch) return;
+    }
+    __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+void epoch_retire(epoch_domain_t *domain, void (*reclaim)(void *context, void *object), void *context, void *object) {
+    if (domain->count == domain->capacity) {
+        domain->capacity = domain->capacity == 0 ? EPOCH_RECLAIM_BATCH * 2 : domain->capacity * 2;
+        domain->retired = realloc(domain->retired, domain->capacity * sizeof(epoch_retired_t));
+        assert(domain->retired != NULL);
+    }
+    epoch_retired_t *retired = &domain->retired[domain->count++];
+    retired->reclaim = reclaim;
+    retired->context = context;
+    retired->object = object;
+    retired->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    if (++domain->since_reclaim >= EPOCH_RECLAIM_BATCH) epoch_reclaim(domain);
+}
+
+void epoch_free(void *context, void *object) {
+    (void) context;
+    free(object);
+}
+
+void epoch_reclaim(epoch_domain_t *domain) {
+    domain->since_reclaim = 0;
+    try_advance();
+    // An object retired in epoch e may still be seen by readers in epochs e
+    // and e - 1, and both are gone once the epoch reaches e + 2
+    unsigned long long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    size_t kept = 0;
+    for (size_t i = 0; i < domain->count; i++) {
+        epoch_retired_t *retired = &domain->retired[i];
+        if (retired->epoch + 2 <= epoch) {
+            retired->reclaim(retired->context, retired->object);
+        } else {
+            domain->retired[kept++] = *retired;
+        }
+    }
+    domain->count = kept;
+}
+
+void epoch_drain(epoch_domain_t *domain) {
+    for (size_t i = 0; i < domain->count; i++) domain->retired[i].reclaim(domain->retired[i].context, domain->retired[i].object);
+    free(domain->retired);
+    domain->retired = NULL;
+    domain->count = 0;
+    domain->capacity = 0;
+    domain->since_reclaim = 0;
+}
@@ -0,0 +1,121 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+
+// Epoch-based reclamation, so readers can walk the user, friend and post
+// lists without taking any lock while a single writer at a time changes them.
+//
+// Readers bracket every traversal with epoch_enter and epoch_exit, and load
+// shared links with epoch_load. Writers fully initialize a node before
+// linking it in with epoch_publish, and hand unlinked nodes to epoch_retire
+// instead of freeing them. A retired node is only reclaimed once the global
+// epoch has advanced twice, which cannot happen while a reader that might
+// still see it is inside its epoch.
+//
+// Retired nodes are kept in domains. Each domain belongs to a structure that
+// is written under its own lock, such as a shard, and is only touched by
+// whoever holds that lock, so nodes are reclaimed under the same lock they
+// were allocated under.
+
+// An object waiting for its grace period, tagged with the epoch it was
+// retired in
+typedef struct epoch_retired {
+    void (*reclaim)(void *context, void *object);
+    void *context;
+    void *object;
+    unsigned long long epoch;
+} epoch_retired_t;
+
+// The objects retired by one writer
+typedef struct epoch_domain {
+    epoch_retired_t *retired;
+    size_t count;
+    size_t capacity;
+    size_t since_reclaim;
+} epoch_domain_t;
+
+#define EPOCH_DOMAIN_INIT {NULL, 0, 0, 0}
+
+// Loads a link that a writer may publish concurrently
+#define epoch_load(link) __atomic_load_n(&(link), __ATOMIC_ACQUIRE)
+
+// Links in a fully initialized node, or unlinks one
+#define epoch_publish(link, value) __atomic_store_n(&(link), (value), __ATOMIC_RELEASE)
+
+/**
+ * Enters a read-side critical section. Nodes reachable from here are not
+ * reclaimed until the matching epoch_exit. Sections do not nest.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void epoch_enter(void);
+
+/**
+ * Leaves a read-side critical section.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void epoch_exit(void);
+
+/**
+ * Defers reclaiming an object that has been unlinked until no reader can see
+ * it anymore.
+ *
+ * Parameters:
+ * domain: The domain of the writer retiring the object.
+ * reclaim: The function that reclaims the object. It runs on a later call
+ * into the same domain.
+ * context: Passed to reclaim, such as the arena the object came from.
+ * object: The object.
+ *
+ * Returns:
+ * None
+ */
+void epoch_retire(epoch_domain_t *domain, void (*reclaim)(void *context, void *object), void *context, void *object);
+
+/**
+ * Reclaims an object allocated with malloc. It can be passed to epoch_retire.
+ *
+ * Parameters:
+ * context: Unused.
+ * object: The object.
+ *
+ * Returns:
+ * None
+ */
+void epoch_free(void *context, void *object);
+
+/**
+ * Advances the global epoch if every reader has caught up with it, and
+ * reclaims the domain's objects whose grace period has passed.
+ *
+ * Parameters:
+ * domain: The domain.
+ *
+ * Returns:
+ * None
+ */
+void epoch_reclaim(epoch_domain_t *domain);
+
+/**
+ * Reclaims every object of a domain straight away. There must be no readers
+ * left, such as when tearing down the database.
+ *
+ * Parameters:
+ * domain: The domain.
+ *
+ * Returns:
+ * None
+ */
+void epoch_drain(epoch_domain_t *domain);
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include "nodes.h"
+#include "graph.h"
+#include "shard.h"
+#include "feed.h"
+#include "fanout.h"
+
+fanout_settings_t fanout_settings = {false, 256, 1000};
+
+static timeline_t **timelines = NULL;
+static size_t timelines_capacity = 0;
+
+static timeline_t *find_timeline(unsigned int user) {
+    return user < timelines_capacity ? timelines[user] : NULL;
+}
+
+_Bool fanout_is_celebrity(unsigned int user) {
+    return graph_degree(&follower_graph, user) > fanout_settings.celebrity_threshold;
+}
+
+static void push_entry(timeline_t *timeline, const post_t *post, const user_t *author) {
+    size_t end = (timeline->start + timeline->count) % fanout_settings.capacity;
+    timeline->entries[end].post = shard_post_handle(post);
+    timeline->entries[end].author = shard_handle(author);
+    if (timeline->count == fanout_settings.capacity) {
+        timeline->start = (timeline->start + 1) % fanout_settings.capacity;
+    } else {
+        timeline->count++;
+    }
+}
+
+void fanout_post(const user_t *author, const post_t *post) {
+    if (!fanout_settings.enabled || fanout_is_celebrity(author->id)) return;
+    graph_iterator_t iterator = graph_friends(&follower_graph, author->id);
+    unsigned int follower;
+    while (graph_next(&iterator, &follower)) {
+        timeline_t *timeline = find_timeline(follower);
+        if (timeline != NULL && timeline->warm) push_entry(timeline, post, author);
+    }
+}
+
+void fanout_follow(const user_t *user, const user_t *author, _Bool followed) {
+    if (timelines == NULL) return;
+    timeline_t *timeline = find_timeline(user->id);
+    if (timeline != NULL) timeline->warm = false;
+    size_t followers = graph_degree(&follower_graph, author->id);
+    size_t threshold = fanout_settings.celebrity_threshold;
+    if ((followed && followers == threshold + 1) || (!followed && followers == threshold)) {
+        graph_iterator_t iterator = graph_friends(&follower_graph, author->id);
+        unsigned int follower;
+        while (graph_next(&iterator, &follower)) {
+            timeline = find_timeline(follower);
+            if (timeline != NULL) timeline->warm = false;
+        }
+    }
+}
+
+const timeline_t *fanout_timeline(const user_t *user) {
+    if (user->id >= timelines_capacity) {
+        size_t capacity = timelines_capacity == 0 ? 1024 : timelines_capacity;
+        while (capacity <= user->id) capacity *= 2;
+        timelines = realloc(timelines, capacity * sizeof(timeline_t *));
+        assert(timelines != NULL);
+        for (size_t i = timelines_capacity; i < capacity; i++) timelines[i] = NULL;
+        timelines_capacity = capacity;
+    }
+    timeline_t *timeline = timelines[user->id];
+    if (timeline == NULL) {
+        timeline = calloc(1, sizeof(timeline_t));
+        assert(timeline != NULL);
+        timeline->entries = malloc(fanout_settings.capacity * sizeof(timeline_entry_t));
+        assert(timeline->entries != NULL);
+        timelines[user->id] = timeline;
+    }
+    if (!timeline->warm) {
+        // Pull the newest posts from the non-celebrity friends, newest first,
+        // and lay them out oldest first
+        feed_t feed;
+        feed_open_pull(&feed, user, FEED_NON_CELEBRITIES);
+        timeline->start = 0;
+        timeline->count = 0;
+        const user_t *author;
+        const post_t *post;
+        while (timeline->count < fanout_settings.capacity && (post = feed_next(&feed, &author)) != NULL) {
+            timeline->entries[timeline->count].post = shard_post_handle(post);
+            timeline->entries[timeline->count].author = shard_handle(author);
+            timeline->count++;
+        }
+        feed_close(&feed);
+        for (size_t i = 0; i < timeline->count / 2; i++) {
+            timeline_entry_t entry = timeline->entries[i];
+            timeline->entries[i] = timeline->entries[timeline->count - 1 - i];
+            timeline->entries[timeline->count - 1 - i] = entry;
+        }
+        timeline->warm = true;
+    }
+    return timeline;
+}
+
+void fanout_clear(void) {
+    for (size_t i = 0; i < timelines_capacity; i++) {
+        if (timelines[i] == NULL) continue;
+        free(timelines[i]->entries);
+        free(timelines[i]);
+    }
+    free(timelines);
+    timelines = NULL;
+    timelines_capacity = 0;
+}
@@ -0,0 +1,98 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stddef.h>
+#include "nodes.h"
+
+// How news feeds are precomputed. When fan-out is enabled, every post is
+// pushed to the timelines of the author's followers as it is written, unless
+// the author has more than celebrity_threshold followers. Celebrities' posts
+// are still merged in when a feed is read.
+typedef struct fanout_settings {
+    _Bool enabled;
+    size_t capacity;
+    size_t celebrity_threshold;
+} fanout_settings_t;
+
+// A post pushed to a follower's timeline. Deleting the post leaves the entry
+// in place, and its handle no longer resolves.
+typedef struct timeline_entry {
+    post_handle_t post;
+    user_handle_t author;
+} timeline_entry_t;
+
+// A bounded ring buffer of the newest posts of a user's non-celebrity
+// friends, oldest first, including the ones deleted since they were pushed,
+// which readers skip. A cold timeline is rebuilt the next time it is read.
+typedef struct timeline {
+    timeline_entry_t *entries;
+    size_t start;
+    size_t count;
+    _Bool warm;
+} timeline_t;
+
+extern fanout_settings_t fanout_settings;
+
+/**
+ * Checks if a user has too many followers for their posts to be fanned out.
+ *
+ * Parameters:
+ * user: The user's ID.
+ *
+ * Returns:
+ * True if the user is a celebrity and false otherwise.
+ */
+_Bool fanout_is_celebrity(unsigned int user);
+
+/**
+ * Pushes a new post to the warm timelines of the author's followers, unless
+ * the author is a celebrity.
+ *
+ * Parameters:
+ * author: The post's author.
+ * post: The post.
+ *
+ * Returns:
+ * None
+ */
+void fanout_post(const user_t *author, const post_t *post);
+
+/**
+ * Updates the timelines after a user followed or unfollowed an author. The
+ * user's timeline goes cold, and so do the timelines of all of the author's
+ * followers if the author crossed the celebrity threshold.
+ *
+ * Parameters:
+ * user: The user who added or removed the friend.
+ * author: The friend.
+ * followed: True if the friend was added and false if removed.
+ *
+ * Returns:
+ * None
+ */
+void fanout_follow(const user_t *user, const user_t *author, _Bool followed);
+
+/**
+ * Gets a user's timeline, rebuilding it from the user's non-celebrity
+ * friends' posts if it is cold.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * The warm timeline.
+ */
+const timeline_t *fanout_timeline(const user_t *user);
+
+/**
+ * Frees every timeline.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void fanout_clear(void);
+
+#endif
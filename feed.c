@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <assert.h>
+#include "nodes.h"
+#include "functions.h"
+#include "shard.h"
+#include "fanout.h"
+#include "feed.h"
+#include "graph.h"
+#include "postlist.h"
+
+static _Bool is_newer(const feed_entry_t *entry1, const feed_entry_t *entry2) {
+    return entry1->post->timestamp > entry2->post->timestamp;
+}
+
+static void sift_down(feed_t *feed, size_t i) {
+    while (true) {
+        size_t newest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < feed->size && is_newer(&feed->heap[left], &feed->heap[newest])) newest = left;
+        if (right < feed->size && is_newer(&feed->heap[right], &feed->heap[newest])) newest = right;
+        if (newest == i) return;
+        feed_entry_t entry = feed->heap[i];
+        feed->heap[i] = feed->heap[newest];
+        feed->heap[newest] = entry;
+        i = newest;
+    }
+}
+
+void feed_open_pull(feed_t *feed, const user_t *user, feed_friends_t friends) {
+    size_t num_friends = graph_degree(&friend_graph, user->id);
+    feed->heap = malloc((num_friends + 1) * sizeof(feed_entry_t));
+    assert(feed->heap != NULL);
+    feed->size = 0;
+    feed->timeline = NULL;
+    feed->timeline_remaining = 0;
+    graph_iterator_t iterator = graph_friends(&friend_graph, user->id);
+    unsigned int friend;
+    while (feed->size < num_friends && graph_next(&iterator, &friend)) {
+        const user_t *author = shard_user(friend);
+        if (friends != FEED_ALL_FRIENDS && fanout_is_celebrity(author->id) != (friends == FEED_CELEBRITIES)) continue;
+        size_t position = postlist_length(author);
+        const post_t *newest = postlist_older(author, &position, LLONG_MAX);
+        if (newest == NULL) continue;
+        feed->heap[feed->size].post = newest;
+        feed->heap[feed->size].author = author;
+        feed->heap[feed->size].position = position;
+        feed->size++;
+    }
+    // Heapify bottom up in linear time
+    for (size_t i = feed->size / 2; i > 0; i--) sift_down(feed, i - 1);
+}
+
+void feed_open(feed_t *feed, const user_t *user) {
+    if (!fanout_settings.enabled) {
+        feed_open_pull(feed, user, FEED_ALL_FRIENDS);
+        return;
+    }
+    const timeline_t *timeline = fanout_timeline(user);
+    feed_open_pull(feed, user, FEED_CELEBRITIES);
+    feed->timeline = timeline;
+    feed->timeline_remaining = timeline->count;
+}
+
+// Finds the post of the newest timeline entry that has not been read,
+// skipping the entries of posts deleted since they were pushed
+static const post_t *next_timeline_post(feed_t *feed, const user_t **author) {
+    while (feed->timeline_remaining > 0) {
+        const timeline_entry_t *entry = &feed->timeline->entries[(feed->timeline->start + feed->timeline_remaining - 1) % fanout_settings.capacity];
+        const post_t *post = shard_resolve_post(entry->post);
+        *author = post != NULL ? shard_resolve(entry->author) : NULL;
+        if (*author != NULL) return post;
+        feed->timeline_remaining--;
+    }
+    return NULL;
+}
+
+const post_t *feed_next(feed_t *feed, const user_t **author) {
+    const user_t *timeline_author;
+    const post_t *post = next_timeline_post(feed, &timeline_author);
+    if (post != NULL && (feed->size == 0 || post->timestamp > feed->heap[0].post->timestamp)) {
+        feed->timeline_remaining--;
+        if (author != NULL) *author = timeline_author;
+        return post;
+    }
+    if (feed->size == 0) return NULL;
+    feed_entry_t newest = feed->heap[0];
+    // The post may have been deleted or moved since it was read, so the next
+    // one is found by its timestamp
+    size_t position = newest.position;
+    const post_t *next = postlist_older(newest.author, &position, newest.post->timestamp);
+    if (next != NULL) {
+        feed->heap[0].post = next;
+        feed->heap[0].position = position;
+    } else {
+        feed->heap[0] = feed->heap[--feed->size];
+    }
+    sift_down(feed, 0);
+    if (author != NULL) *author = newest.author;
+    return newest.post;
+}
+
+void feed_close(feed_t *feed) {
+    free(feed->heap);
+    feed->heap = NULL;
+    feed->size = 0;
+    feed->timeline = NULL;
+    feed->timeline_remaining = 0;
+}
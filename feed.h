@@ -0,0 +1,86 @@
+#ifndef FEED_H
+#define FEED_H
+
+#include <stddef.h>
+#include "nodes.h"
+#include "fanout.h"
+
+// The next unread post of one of a user's friends
+typedef struct feed_entry {
+    const post_t *post;
+    const user_t *author;
+    size_t position; // The post's position in the author's posts
+} feed_entry_t;
+
+// Which of a user's friends a pull-based feed merges
+typedef enum feed_friends {
+    FEED_ALL_FRIENDS,
+    FEED_CELEBRITIES,
+    FEED_NON_CELEBRITIES
+} feed_friends_t;
+
+// A user's news feed: the posts of the user's friends, newest first. It is a
+// k-way merge of the friends' post lists through a binary heap that holds one
+// entry per friend, so posts are only visited as they are read. With fan-out
+// enabled, the heap only holds celebrities and is merged with the user's
+// precomputed timeline, which is scanned from its newest entry.
+typedef struct feed {
+    feed_entry_t *heap;
+    size_t size;
+    const timeline_t *timeline;
+    size_t timeline_remaining;
+} feed_t;
+
+/**
+ * Opens a user's news feed. Only the newest post of each friend is looked at.
+ * The friends are read from the friend graph, so the caller must hold the
+ * shared lock while other threads are running.
+ *
+ * Parameters:
+ * feed: The feed to open.
+ * user: The user.
+ *
+ * Returns:
+ * None
+ */
+void feed_open(feed_t *feed, const user_t *user);
+
+/**
+ * Opens a news feed that only merges the posts of some of a user's friends,
+ * ignoring any precomputed timeline.
+ *
+ * Parameters:
+ * feed: The feed to open.
+ * user: The user.
+ * friends: Which friends to merge.
+ *
+ * Returns:
+ * None
+ */
+void feed_open_pull(feed_t *feed, const user_t *user, feed_friends_t friends);
+
+/**
+ * Reads the next newest post from a news feed in O(log f) time, where f is
+ * the number of friends merged.
+ *
+ * Parameters:
+ * feed: The feed.
+ * author: Set to the post's author. May be NULL.
+ *
+ * Returns:
+ * The post, or NULL if every post has been read.
+ */
+const post_t *feed_next(feed_t *feed, const user_t **author);
+
+/**
+ * Closes a news feed.
+ *
+ * Parameters:
+ * feed: The feed.
+ *
+ * Returns:
+ * None
+ */
+void feed_close(feed_t *feed);
+
+#endif
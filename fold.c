@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "fold.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FOLD_X86
+#include <immintrin.h>
+#endif
+
+#define FOLD_BLOCK_SIZE 32
+#define FOLD_PAGE_SIZE 4096
+
+// One version of every kernel. fold_block folds up to FOLD_BLOCK_SIZE bytes
+// for the hash and zeroes the rest of the block.
+typedef struct fold_kernels {
+    fold_isa_t isa;
+    int (*compare)(const char *str1, const char *str2, size_t length);
+    void (*fold_block)(const char *src, size_t size, char *dst);
+} fold_kernels_t;
+
+static char lower_byte(char c) {
+    return (c >= 'A' && c <= 'Z') ? 'a' + (c - 'A') : c;
+}
+
+static int compare_scalar(const char *str1, const char *str2, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        int diff = lower_byte(str1[i]) - lower_byte(str2[i]);
+        if (diff != 0) return diff;
+    }
+    return 0;
+}
+
+static void fold_block_scalar(const char *src, size_t size, char *dst) {
+    size_t i = 0;
+    for (; i < size; i++) dst[i] = lower_byte(src[i]);
+    for (; i < FOLD_BLOCK_SIZE; i++) dst[i] = 0;
+}
+
+static const fold_kernels_t scalar_kernels = {FOLD_SCALAR, compare_scalar, fold_block_scalar};
+
+#ifdef FOLD_X86
+
+// The first FOLD_BLOCK_SIZE bytes are set and the rest are clear, so loading
+// at FOLD_BLOCK_SIZE - n gives a mask of the first n bytes
+static const char tail_mask[2 * FOLD_BLOCK_SIZE] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+// Checks if a whole vector can be loaded from a string whose end is nearer.
+// The load may then read past the end, but never into the next page, so it
+// cannot fault, and the bytes past the end are masked off. Those bytes may
+// belong to another object or be written concurrently, so the kernels that
+// load them are excluded from the address and thread sanitizers.
+#define FOLD_OVERREADS no_sanitize_address, no_sanitize_thread
+
+static inline _Bool within_page(const char *str, size_t size) {
+    return ((uintptr_t) str & (FOLD_PAGE_SIZE - 1)) <= FOLD_PAGE_SIZE - size;
+}
+
+// Adds 0x20 to every byte between 'A' and 'Z'. The comparisons are signed,
+// so bytes of 0x80 and above are never in range.
+__attribute__((target("sse2")))
+static inline __m128i lower_sse2_vector(__m128i bytes) {
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(bytes, _mm_set1_epi8('Z' + 1)));
+    return _mm_add_epi8(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+// Loads and folds the first size bytes of a string, zeroing the rest. An
+// empty string may end right before an unmapped page, so nothing is loaded.
+__attribute__((target("sse2"), FOLD_OVERREADS))
+static inline __m128i load_sse2_tail(const char *str, size_t size) {
+    if (size == 0) return _mm_setzero_si128();
+    __m128i mask = _mm_loadu_si128((const __m128i *) (tail_mask + FOLD_BLOCK_SIZE - size));
+    if (within_page(str, 16)) return _mm_and_si128(lower_sse2_vector(_mm_loadu_si128((const __m128i *) str)), mask);
+    char tail[16] = {0};
+    memcpy(tail, str, size);
+    return lower_sse2_vector(_mm_loadu_si128((const __m128i *) tail));
+}
+
+// Returns a bit per byte, set where the folded bytes are equal
+__attribute__((target("sse2")))
+static inline unsigned int equal_sse2(__m128i bytes1, __m128i bytes2) {
+    return (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes1, bytes2));
+}
+
+__attribute__((target("sse2"), FOLD_OVERREADS))
+static int compare_sse2(const char *str1, const char *str2, size_t length) {
+    size_t i = 0;
+    unsigned int equal = 0xFFFF;
+    for (; i + 16 <= length; i += 16) {
+        equal = equal_sse2(lower_sse2_vector(_mm_loadu_si128((const __m128i *) (str1 + i))),
+                           lower_sse2_vector(_mm_loadu_si128((const __m128i *) (str2 + i))));
+        if (equal != 0xFFFF) break;
+    }
+    if (equal == 0xFFFF) {
+        if (i == length) return 0;
+        equal = equal_sse2(load_sse2_tail(str1 + i, length - i), load_sse2_tail(str2 + i, length - i));
+        if (equal == 0xFFFF) return 0;
+    }
+    i += __builtin_ctz(~equal);
+    return lower_byte(str1[i]) - lower_byte(str2[i]);
+}
+
+__attribute__((target("sse2"), FOLD_OVERREADS))
+static void fold_block_sse2(const char *src, size_t size, char *dst) {
+    if (size == FOLD_BLOCK_SIZE) {
+        _mm_storeu_si128((__m128i *) dst, lower_sse2_vector(_mm_loadu_si128((const __m128i *) src)));
+        _mm_storeu_si128((__m128i *) (dst + 16), lower_sse2_vector(_mm_loadu_si128((const __m128i *) (src + 16))));
+    } else if (size > 16) {
+        _mm_storeu_si128((__m128i *) dst, lower_sse2_vector(_mm_loadu_si128((const __m128i *) src)));
+        _mm_storeu_si128((__m128i *) (dst + 16), load_sse2_tail(src + 16, size - 16));
+    } else {
+        _mm_storeu_si128((__m128i *) dst, load_sse2_tail(src, size));
+        _mm_storeu_si128((__m128i *) (dst + 16), _mm_setzero_si128());
+    }
+}
+
+static const fold_kernels_t sse2_kernels = {FOLD_SSE2, compare_sse2, fold_block_sse2};
+
+__attribute__((target("avx2")))
+static inline __m256i lower_avx2_vector(__m256i bytes) {
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), bytes));
+    return _mm256_add_epi8(bytes, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"), FOLD_OVERREADS))
+static inline __m256i load_avx2_tail(const char *str, size_t size) {
+    if (size == 0) return _mm256_setzero_si256();
+    __m256i mask = _mm256_loadu_si256((const __m256i *) (tail_mask + FOLD_BLOCK_SIZE - size));
+    if (within_page(str, 32)) return _mm256_and_si256(lower_avx2_vector(_mm256_loadu_si256((const __m256i *) str)), mask);
+    char tail[32] = {0};
+    memcpy(tail, str, size);
+    return lower_avx2_vector(_mm256_loadu_si256((const __m256i *) tail));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned int equal_avx2(__m256i bytes1, __m256i bytes2) {
+    return (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes1, bytes2));
+}
+
+__attribute__((target("avx2"), FOLD_OVERREADS))
+static int compare_avx2(const char *str1, const char *str2, size_t length) {
+    size_t i = 0;
+    unsigned int equal = 0xFFFFFFFF;
+    for (; i + 32 <= length; i += 32) {
+        equal = equal_avx2(lower_avx2_vector(_mm256_loadu_si256((const __m256i *) (str1 + i))),
+                           lower_avx2_vector(_mm256_loadu_si256((const __m256i *) (str2 + i))));
+        if (equal != 0xFFFFFFFF) break;
+    }
+    if (equal == 0xFFFFFFFF) {
+        if (i == length) return 0;
+        equal = equal_avx2(load_avx2_tail(str1 + i, length - i), load_avx2_tail(str2 + i, length - i));
+        if (equal == 0xFFFFFFFF) return 0;
+    }
+    i += __builtin_ctz(~equal);
+    return lower_byte(str1[i]) - lower_byte(str2[i]);
+}
+
+__attribute__((target("avx2"), FOLD_OVERREADS))
+static void fold_block_avx2(const char *src, size_t size, char *dst) {
+    if (size == FOLD_BLOCK_SIZE) {
+        _mm256_storeu_si256((__m256i *) dst, lower_avx2_vector(_mm256_loadu_si256((const __m256i *) src)));
+    } else {
+        _mm256_storeu_si256((__m256i *) dst, load_avx2_tail(src, size));
+    }
+}
+
+static const fold_kernels_t avx2_kernels = {FOLD_AVX2, compare_avx2, fold_block_avx2};
+
+#endif
+
+static const fold_kernels_t *kernels = NULL;
+
+fold_isa_t fold_detect(void) {
+#ifdef FOLD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return FOLD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return FOLD_SSE2;
+#endif
+    return FOLD_SCALAR;
+}
+
+_Bool fold_select(fold_isa_t isa) {
+    if (isa > fold_detect()) return false;
+    const fold_kernels_t *selected = &scalar_kernels;
+#ifdef FOLD_X86
+    if (isa == FOLD_AVX2) selected = &avx2_kernels;
+    if (isa == FOLD_SSE2) selected = &sse2_kernels;
+#endif
+    __atomic_store_n(&kernels, selected, __ATOMIC_RELEASE);
+    return true;
+}
+
+const char *fold_isa_name(fold_isa_t isa) {
+    static const char *names[] = {"scalar", "SSE2", "AVX2"};
+    return names[isa];
+}
+
+// Picks the kernels on first use. Threads racing here all pick the same ones.
+static const fold_kernels_t *current_kernels(void) {
+    const fold_kernels_t *current = __atomic_load_n(&kernels, __ATOMIC_ACQUIRE);
+    if (current != NULL) return current;
+    fold_select(fold_detect());
+    return __atomic_load_n(&kernels, __ATOMIC_ACQUIRE);
+}
+
+void fold_lower(char *str, size_t length) {
+    for (size_t i = 0; i < length; i++) str[i] = lower_byte(str[i]);
+}
+
+int fold_compare(const char *str1, const char *str2, size_t length) {
+    return current_kernels()->compare(str1, str2, length);
+}
+
+// Multiplies two words into 128 bits and folds the halves together
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    unsigned __int128 product = (unsigned __int128) a * b;
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+size_t fold_hash(const char *str, size_t length) {
+    const fold_kernels_t *current = current_kernels();
+    _Alignas(FOLD_BLOCK_SIZE) char block[FOLD_BLOCK_SIZE];
+    uint64_t hash = length ^ 0xA0761D6478BD642FULL;
+    size_t i = 0;
+    do {
+        size_t size = length - i < FOLD_BLOCK_SIZE ? length - i : FOLD_BLOCK_SIZE;
+        current->fold_block(str + i, size, block);
+        uint64_t words[FOLD_BLOCK_SIZE / 8];
+        memcpy(words, block, sizeof(words));
+        // The two halves are multiplied independently so they overlap
+        hash = mix(words[0] ^ 0xE7037ED1A0B428DBULL, words[1] ^ hash) ^ mix(words[2] ^ 0x8EBC6AF09C88C6E3ULL, words[3] ^ 0x589965CC75374CC3ULL);
+        i += size;
+    } while (i < length);
+    return (size_t) mix(hash ^ 0xE7037ED1A0B428DBULL, length ^ 0xA0761D6478BD642FULL);
+}
@@ -0,0 +1,94 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stddef.h>
+
+// Case-folding kernels for usernames and other short ASCII strings. Only
+// 'A' to 'Z' are folded, so UTF-8 bytes pass through unchanged. The compare
+// and hash kernels have a scalar, an SSE2 and an AVX2 version, which work on
+// 1, 16 and 32 bytes at a time. The fastest one the CPU supports is picked on
+// first use, and every version gives the same results. fold_lower is a byte
+// loop everywhere, since on usernames the vector versions were no faster.
+typedef enum fold_isa {
+    FOLD_SCALAR,
+    FOLD_SSE2,
+    FOLD_AVX2
+} fold_isa_t;
+
+/**
+ * Detects the fastest kernels the CPU supports.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * The instruction set.
+ */
+fold_isa_t fold_detect(void);
+
+/**
+ * Switches the compare and hash kernels to an instruction set, such as to benchmark the
+ * versions against each other.
+ *
+ * Parameters:
+ * isa: The instruction set.
+ *
+ * Returns:
+ * True if the CPU supports it and false otherwise, with the kernels left
+ * unchanged.
+ */
+_Bool fold_select(fold_isa_t isa);
+
+/**
+ * Gets the name of an instruction set.
+ *
+ * Parameters:
+ * isa: The instruction set.
+ *
+ * Returns:
+ * The name.
+ */
+const char *fold_isa_name(fold_isa_t isa);
+
+/**
+ * Converts a string to lowercase in place.
+ *
+ * Parameters:
+ * str: The string.
+ * length: The number of bytes to convert.
+ *
+ * Returns:
+ * None
+ */
+void fold_lower(char *str, size_t length);
+
+/**
+ * Compares two strings, ignoring case.
+ *
+ * Parameters:
+ * str1: The first string.
+ * str2: The second string.
+ * length: The number of bytes to compare. Both strings must have at least
+ * this many bytes, including a terminating NUL that is part of the range.
+ *
+ * Returns:
+ * The difference between the first pair of case-folded bytes that differ,
+ * or 0 if there is none.
+ */
+int fold_compare(const char *str1, const char *str2, size_t length);
+
+/**
+ * Hashes a string, ignoring case. The bytes are folded 32 at a time into
+ * 64-bit words which are mixed with multiplies, so both the low and the high
+ * bits of the hash are usable.
+ *
+ * Parameters:
+ * str: The string.
+ * length: The number of bytes to hash.
+ *
+ * Returns:
+ * The hash of the case-folded string.
+ */
+size_t fold_hash(const char *str, size_t length);
+
+#endif
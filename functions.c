@@ -3,150 +3,349 @@
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
 #include <time.h>
 #include "nodes.h"
 #include "functions.h"
+#include "shard.h"
+#include "graph.h"
+#include "arena.h"
+#include "strheap.h"
+#include "feed.h"
+#include "fanout.h"
+#include "snapshot.h"
+#include "loader.h"
+#include "wal.h"
+#include "epoch.h"
+#include "search.h"
+#include "fold.h"
+#include "prefix.h"
+#include "suggest.h"
+#include "edgeset.h"
+#include "password.h"
+#include "metrics.h"
+#include "postlist.h"
 
 #define MAX_USERNAME_SIZE 30
 #define MAX_PASSWORD_SIZE 15
 #define MAX_POST_SIZE 250
+#define SEARCH_MENU_RESULTS 30
+#define PREFIX_MENU_MATCHES 10
+#define SUGGEST_MENU_MUTUALS 3
+
+// Copies a password hash into the arena of a user's shard
+static password_hash_t *copy_password(shard_t *shard, const password_hash_t *password) {
+    password_hash_t *copy = arena_alloc(&shard->password_arena);
+    assert(copy != NULL);
+    *copy = *password;
+    return copy;
+}
 
-user_t *add_user(user_t *users, const char *username, const char *password) {
-    user_t *new_user = malloc(sizeof(user_t));
+user_t *create_user(const char *username, const password_hash_t *password) {
+    // The shard is picked by the truncated username, which is the one stored
+    char name[MAX_USERNAME_SIZE];
+    strncpy(name, username, MAX_USERNAME_SIZE - 1);
+    name[MAX_USERNAME_SIZE - 1] = '\0';
+    shard_t *shard = shard_for(name);
+    user_t *new_user = arena_alloc(&shard->user_arena);
     assert(new_user != NULL);
-    strcpy(new_user->username, username);
-    strcpy(new_user->password, password);
-    new_user->friends = NULL;
+    strcpy(new_user->username, name);
+    new_user->password = copy_password(shard, password);
     new_user->posts = NULL;
+    new_user->num_posts = 0;
+    new_user->num_deleted = 0;
     new_user->next = NULL;
-    if (users == NULL) {
-        users = new_user;
-    } else {
-        user_t *current = users;
-        while (current->next != NULL && strcmp(current->next->username, username) < 0) current = current->next;
-        new_user->next = current->next;
-        current->next = new_user;
-    }
-    return users;
+    return new_user;
 }
 
-user_t *find_user(user_t *users, const char *username) {
-    user_t *current = users;
-    while (current != NULL) {
-        if (!case_insensitive_strcmp(current->username, username)) return current;
-        current = current->next;
-    }
-    return NULL;
+user_t *add_user(const char *username, const password_hash_t *password) {
+    uint64_t start = metrics_begin();
+    user_t *new_user = create_user(username, password);
+    shard_insert(shard_for(new_user->username), new_user);
+    prefix_add_user(new_user);
+    wal_append(WAL_REGISTER, new_user->username, password, sizeof(password_hash_t));
+    metrics_end(METRIC_ADD_USER, start);
+    return new_user;
 }
 
-friend_t *create_friend(user_t *users, const char *username) {
-    friend_t *new_friend = malloc(sizeof(friend_t));
-    assert (new_friend != NULL);
-    strcpy(new_friend->username, username);
-    user_t *user = find_user(users, username);
-    if (user == NULL) {
-        free(new_friend);
-        return NULL;
-    }
-    new_friend->posts = &user->posts;
-    new_friend->next = NULL;
-    return new_friend;
+static void reclaim_node(void *arena, void *node) {
+    arena_free(arena, node);
 }
 
-void add_friend(user_t *users, user_t *user, const char *friend) {
-    friend_t *new_friend = create_friend(users, friend);
-    if (new_friend == NULL) return;
-    if (user->friends == NULL || strcmp(user->friends->username, friend) > 0) {
-        new_friend->next = user->friends;
-        user->friends = new_friend;
-        return;
-    }
-    friend_t *current = user->friends;
-    while (current->next != NULL && strcmp(current->next->username, friend) < 0) current = current->next;
-    new_friend->next = current->next;
-    current->next = new_friend;
+void set_password(user_t *user, const password_hash_t *password) {
+    shard_t *shard = shard_of(user);
+    const password_hash_t *old_password = user->password;
+    epoch_publish(user->password, copy_password(shard, password));
+    epoch_retire(&shard->retired, reclaim_node, &shard->password_arena, (void *) old_password);
+    wal_append(WAL_PASSWORD, user->username, password, sizeof(password_hash_t));
 }
 
-_Bool delete_friend(user_t *user, char *friend_name) {
-    if (user->friends == NULL) return false;
-    if (strcmp(user->friends->username, friend_name) == 0) {
-        friend_t *to_delete = user->friends;
-        user->friends = user->friends->next;
-        free(to_delete);
-        return true;
+user_t *find_user(const char *username) {
+    uint64_t start = metrics_begin();
+    user_t *user = directory_find(&shard_for(username)->directory, username);
+    metrics_end(METRIC_FIND_USER, start);
+    return user;
+}
+
+// Adds one direction of a friendship, unless it is already there
+static void link_friend(user_t *user, user_t *friend_user) {
+    if (!edgeset_insert(&friend_edges, user->id, friend_user->id)) return;
+    graph_add_edge(&friend_graph, user->id, friend_user->id);
+    graph_add_edge(&follower_graph, friend_user->id, user->id);
+    suggest_invalidate(user->id, friend_user->id);
+    fanout_follow(user, friend_user, true);
+    wal_append(WAL_FRIEND, user->username, friend_user->username, strlen(friend_user->username) + 1);
+}
+
+void add_friend(user_t *user, const char *friend) {
+    uint64_t start = metrics_begin();
+    user_t *friend_user = find_user(friend);
+    if (friend_user != NULL) {
+        link_friend(user, friend_user);
+        if (edgeset_settings.symmetric && friend_user != user) link_friend(friend_user, user);
     }
-    friend_t *current = user->friends;
-    while (current->next != NULL && strcmp(current->next->username, friend_name) != 0) current = current->next;
-    if (current->next == NULL) return false;
-    friend_t *to_delete = current->next;
-    current->next = to_delete->next;
-    free(to_delete);
+    metrics_end(METRIC_ADD_FRIEND, start);
+}
+
+// Removes one direction of a friendship from the edge set, the graphs and
+// the indexes built from them, returning false if it was not there
+static _Bool drop_friend(user_t *user, user_t *friend_user) {
+    if (!edgeset_remove(&friend_edges, user->id, friend_user->id)) return false;
+    graph_remove_edge(&friend_graph, user->id, friend_user->id);
+    graph_remove_edge(&follower_graph, friend_user->id, user->id);
+    suggest_invalidate(user->id, friend_user->id);
+    fanout_follow(user, friend_user, false);
+    return true;
+}
+
+// Removes one direction of a friendship and logs it
+static _Bool unlink_friend(user_t *user, user_t *friend_user) {
+    if (!drop_friend(user, friend_user)) return false;
+    wal_append(WAL_UNFRIEND, user->username, friend_user->username, strlen(friend_user->username) + 1);
     return true;
 }
 
-post_t *create_post(const char *text) {
-    post_t *new_post = malloc(sizeof(post_t));
+_Bool delete_friend(user_t *user, char *friend_name) {
+    uint64_t start = metrics_begin();
+    // Names are found in any case, and the edge set rules out the users
+    // that are not friends
+    user_t *friend_user = find_user(friend_name);
+    _Bool deleted = friend_user != NULL && unlink_friend(user, friend_user);
+    if (deleted && edgeset_settings.symmetric && friend_user != user) unlink_friend(friend_user, user);
+    metrics_end(METRIC_DELETE_FRIEND, start);
+    return deleted;
+}
+
+static long long last_post_timestamp = 0;
+
+// Returns the current time in microseconds, bumped past the last timestamp
+// handed out so that posts are totally ordered by creation. Shards post
+// concurrently, so the last timestamp is claimed with a compare-and-swap.
+static long long next_post_timestamp(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    long long timestamp = (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    long long last = __atomic_load_n(&last_post_timestamp, __ATOMIC_RELAXED);
+    long long next;
+    do {
+        next = timestamp > last ? timestamp : last + 1;
+    } while (!__atomic_compare_exchange_n(&last_post_timestamp, &last, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return next;
+}
+
+post_t *create_post(const user_t *author, const char *text) {
+    size_t length = strnlen(text, MAX_CONTENT_SIZE - 1);
+    // Don't cut a multi-byte UTF-8 character in half when truncating
+    if (text[length] != '\0') {
+        while (length > 0 && (text[length] & 0xC0) == 0x80) length--;
+    }
+    post_t *new_post = arena_alloc(&shard_of(author)->post_arena);
     assert(new_post != NULL);
-    strcpy(new_post->content, text);
-    new_post->next = NULL;
+    new_post->timestamp = next_post_timestamp();
+    new_post->content = strheap_append(&post_heap, text, length);
+    new_post->length = length;
     return new_post;
 }
 
+post_t *restore_post(const user_t *author, long long timestamp, unsigned long long content, unsigned short length) {
+    post_t *post = arena_alloc(&shard_of(author)->post_arena);
+    assert(post != NULL);
+    long long last = __atomic_load_n(&last_post_timestamp, __ATOMIC_RELAXED);
+    while (timestamp > last && !__atomic_compare_exchange_n(&last_post_timestamp, &last, timestamp, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    post->timestamp = timestamp;
+    post->content = content;
+    post->length = length;
+    return post;
+}
+
+const char *post_content(const post_t *post) {
+    return strheap_get(&post_heap, post->content);
+}
+
+void push_post(user_t *user, post_t *post) {
+    shard_add_post(shard_of(user), post);
+    postlist_push(user, post);
+    fanout_post(user, post);
+    search_add_post(user, post);
+}
+
 void add_post(user_t *user, const char *text) {
-    post_t *new_post = create_post(text);
-    if (user->posts == NULL) {
-        user->posts = new_post;
-    } else {
-        new_post->next = user->posts;
-        user->posts = new_post;
-    }
+    uint64_t start = metrics_begin();
+    post_t *new_post = create_post(user, text);
+    push_post(user, new_post);
+    // The record carries the timestamp so replay recreates the same post
+    const char *content = post_content(new_post);
+    char record[sizeof(int64_t) + MAX_CONTENT_SIZE];
+    int64_t timestamp = new_post->timestamp;
+    memcpy(record, &timestamp, sizeof(timestamp));
+    memcpy(record + sizeof(timestamp), content, new_post->length);
+    wal_append(WAL_POST, user->username, record, sizeof(timestamp) + new_post->length);
+    metrics_end(METRIC_ADD_POST, start);
+}
+
+// Removes a post of a user from everywhere it is indexed
+static void unlink_post(user_t *user, post_t *to_delete) {
+    // Timelines are not touched: their entries of the post stop resolving
+    // once its ID is released
+    postlist_delete(user, to_delete);
+    search_remove_post(to_delete);
+    shard_t *shard = shard_of(user);
+    shard_remove_post(shard, to_delete);
+    epoch_retire(&shard->retired, reclaim_node, &shard->post_arena, to_delete);
 }
 
 _Bool delete_post(user_t *user) {
-    if (user->posts == NULL) return false;
-    post_t *to_delete = user->posts;
-    user->posts = to_delete->next;
-    free(to_delete);
+    post_t *newest = postlist_newest(user);
+    if (newest == NULL) return false;
+    remove_post(user, newest);
     return true;
 }
 
+post_t *find_post(const user_t *author, post_handle_t handle) {
+    // The ID is handed out by the author's shard, and the post must still be
+    // in the author's list
+    if ((handle.id & (NUM_SHARDS - 1)) != (author->id & (NUM_SHARDS - 1))) return NULL;
+    post_t *post = shard_resolve_post(handle);
+    return post != NULL && postlist_get(author, post->position) == post ? post : NULL;
+}
+
+void remove_post(user_t *user, post_t *post) {
+    uint64_t start = metrics_begin();
+    // The log finds the post by timestamp, which the snapshot under the log
+    // keeps, while IDs are handed out afresh on every start
+    int64_t timestamp = post->timestamp;
+    wal_append(WAL_UNPOST, user->username, &timestamp, sizeof(timestamp));
+    unlink_post(user, post);
+    metrics_end(METRIC_DELETE_POST, start);
+}
+
+size_t delete_posts_where(user_t *user, _Bool (*matches)(const post_t *post, void *context), void *context) {
+    // The walk carries on by timestamp, since a compaction may move the
+    // posts it has not reached yet
+    size_t position = postlist_length(user);
+    long long timestamp = LLONG_MAX;
+    size_t deleted = 0;
+    post_t *post;
+    while ((post = postlist_older(user, &position, timestamp)) != NULL) {
+        timestamp = post->timestamp;
+        if (!matches(post, context)) continue;
+        remove_post(user, post);
+        deleted++;
+    }
+    return deleted;
+}
+
+void delete_user(user_t *user) {
+    wal_append(WAL_DELETE_USER, user->username, "", 1);
+    post_t *post;
+    while ((post = postlist_newest(user)) != NULL) unlink_post(user, post);
+    postlist_retire(user);
+    // The friendships both ways go with the user, so its ID holds no edges
+    // when it is reused
+    size_t n;
+    unsigned int *friends = graph_copy_friends(&friend_graph, user->id, &n);
+    for (size_t i = 0; i < n; i++) drop_friend(user, shard_user(friends[i]));
+    free(friends);
+    unsigned int *followers = graph_copy_friends(&follower_graph, user->id, &n);
+    for (size_t i = 0; i < n; i++) drop_friend(shard_user(followers[i]), user);
+    free(followers);
+    // The prefix index may be built from the shards concurrently, so the
+    // user leaves the shard first and the index second
+    shard_t *shard = shard_of(user);
+    shard_remove(shard, user);
+    prefix_remove_user(user);
+    epoch_retire(&shard->retired, reclaim_node, &shard->password_arena, (void *) user->password);
+    epoch_retire(&shard->retired, reclaim_node, &shard->user_arena, user);
+}
+
 void display_all_user_posts(user_t *user) {
     hr();
     printf("%s's Posts:\n", user->username);
     hr();
-    if (user->posts == NULL) printf("No posts available for %s.\n", user->username);
-    post_t *current = user->posts;
-    while (current != NULL) {
-        printf("%s\n", current->content);
-        current = current->next;
+    if (postlist_count(user) == 0) printf("No posts available for %s.\n", user->username);
+    for (size_t i = postlist_length(user); i > 0; i--) {
+        const post_t *post = postlist_get(user, i - 1);
+        if (post != NULL) printf("%s\n", post_content(post));
     }
 }
 
+static int compare_usernames(const void *user1, const void *user2) {
+    return strcmp((*(const user_t *const *) user1)->username, (*(const user_t *const *) user2)->username);
+}
+
 void display_user_friends(user_t *user) {
     hr();
     printf("%s's Friends:\n", user->username);
     hr();
-    if (user->friends == NULL) printf("No friends available for %s.\n", user->username);
-    friend_t *current = user->friends;
-    for (int i = 1; current != NULL; i++) {
-        printf("%d. %s\n", i, current->username);
-        current = current->next;
-    }
+    // The graph lists friends by ID, so they are sorted by name here
+    size_t n;
+    unsigned int *ids = graph_copy_friends(&friend_graph, user->id, &n);
+    const user_t **friends = malloc((n + 1) * sizeof(user_t *));
+    assert(friends != NULL);
+    for (size_t i = 0; i < n; i++) friends[i] = shard_user(ids[i]);
+    free(ids);
+    qsort(friends, n, sizeof(user_t *), compare_usernames);
+    if (n == 0) printf("No friends available for %s.\n", user->username);
+    for (size_t i = 0; i < n; i++) printf("%zu. %s\n", i + 1, friends[i]->username);
+    free(friends);
     printf("\n");
 }
 
-void display_posts_by_n(user_t *user, int number) {
+void display_friend_suggestions(user_t *user) {
     hr();
-    printf("%s's Posts:\n", user->username);
+    printf("People %s May Know:\n", user->username);
     hr();
+    suggestion_t suggestions[SUGGEST_MAX_RESULTS];
+    size_t n = suggest_friends(user, suggestions, SUGGEST_MAX_RESULTS);
+    if (n == 0) printf("No suggestions available for %s.\n", user->username);
+    for (size_t i = 0; i < n; i++) {
+        user_t *mutual[SUGGEST_MENU_MUTUALS];
+        size_t shown = suggest_mutual_friends(user, suggestions[i].user, mutual, SUGGEST_MENU_MUTUALS);
+        printf("%zu. %s (%u mutual friend%s:", i + 1, suggestions[i].user->username, suggestions[i].mutual,
+               suggestions[i].mutual == 1 ? "" : "s");
+        for (size_t j = 0; j < shown; j++) printf("%s %s", j == 0 ? "" : ",", mutual[j]->username);
+        printf("%s)\n", shown < suggestions[i].mutual ? ", ..." : "");
+    }
+    printf("\n");
+}
+
+// Prints an author's posts a page at a time, newest first, asking before
+// each page after the first
+static void display_post_pages(const user_t *author, int number) {
+    post_cursor_t cursor = post_cursor_open(author);
     _Bool exit = false;
-    post_t *current = user->posts;
     while (!exit) {
-        for (int i = 0; i < number && current != NULL; i++) {
-            printf("%s\n", current->content);
-            current = current->next;
+        const post_t *page[POSTLIST_CHUNK_SIZE];
+        for (int i = 0; i < number; i += POSTLIST_CHUNK_SIZE) {
+            size_t wanted = number - i < POSTLIST_CHUNK_SIZE ? number - i : POSTLIST_CHUNK_SIZE;
+            size_t n = post_cursor_next(&cursor, page, wanted);
+            for (size_t j = 0; j < n; j++) printf("%s\n", post_content(page[j]));
+            if (n < wanted) break;
         }
-        if (current == NULL) {
+        if (cursor.position == 0) {
             printf("All posts have been displayed.\n");
             return;
         }
@@ -154,20 +353,24 @@ void display_posts_by_n(user_t *user, int number) {
     }
 }
 
-void teardown(user_t *users) {
-    while (users != NULL) {
-        user_t *user_to_delete = users;
-        while (user_to_delete->friends != NULL) {
-            friend_t *friend_to_delete = user_to_delete->friends;
-            user_to_delete->friends = user_to_delete->friends->next;
-            free(friend_to_delete);
-        }
-        while (user_to_delete->posts != NULL) {
-            delete_post(user_to_delete);
-        }
-        users = users->next;
-        free(user_to_delete);
-    }
+void display_posts_by_n(user_t *user, int number) {
+    hr();
+    printf("%s's Posts:\n", user->username);
+    hr();
+    display_post_pages(user, number);
+}
+
+void teardown(void) {
+    suggest_clear();
+    edgeset_clear(&friend_edges);
+    prefix_clear();
+    search_clear();
+    shard_clear();
+    strheap_clear(&post_heap);
+    snapshot_unmap();
+    graph_clear(&friend_graph);
+    graph_clear(&follower_graph);
+    fanout_clear();
 }
 
 void print_menu() {
@@ -176,51 +379,32 @@ void print_menu() {
     hr();
     printf("1. Register a new user\n"
            "2. Login with existing user's information\n"
-           "3. Exit\n\n");
-}
-
-user_t *read_CSV_and_create_users(FILE *file, int num_users)
-{
-    srand(time(NULL));
-    user_t *users = NULL;
-    char buffer[500];
-    fgets(buffer, sizeof(buffer), file); // Read and discard the header line
-    int count = 0;
-    for (int i = 0; i < num_users; i++)
-    {
-        fgets(buffer, sizeof(buffer), file);
-        buffer[strcspn(buffer, "\r\n")] = 0; // Remove newline characters
-
-        char *token = strtok(buffer, ",");
-        char *token2 = strtok(NULL, ",");
-        users = add_user(users, token, token2);
-        char *username = token;
-
-        token = strtok(NULL, ",");
-
-        user_t *current_user = users;
-        for (; current_user != NULL && strcmp(current_user->username, username) != 0; current_user = current_user->next)
-            ;
-
-        while (token != NULL && strcmp(token, ",") != 0 && count < 3)
-        {
-            if (strcmp(token, " ") != 0)
-            {
-                add_friend(users, current_user, token);
-            }
-            token = strtok(NULL, ",");
-            count++;
-        }
-        count = 0;
+           "3. Save a snapshot\n"
+           "4. Exit\n\n");
+}
 
-        // token = strtok(NULL, ",");
-        while (token != NULL && strcmp(token, ",") != 0)
-        {
-            add_post(current_user, token);
-            token = strtok(NULL, ",");
+size_t read_CSV_and_create_users(FILE *file, int num_users) {
+    // Read the header line and up to num_users rows, then import them in two
+    // passes so friends that appear later in the file are linked as well
+    char *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    for (int i = 0; i <= num_users && (length = getline(&line, &line_capacity, file)) != -1; i++) {
+        if (size + length > capacity) {
+            capacity = (size + length) * 2;
+            data = realloc(data, capacity);
+            assert(data != NULL);
         }
+        memcpy(data + size, line, length);
+        size += length;
     }
-    return users;
+    free(line);
+    size_t count = size == 0 ? 0 : load_users_from_buffer(data, size, 1);
+    free(data);
+    return count;
 }
 
 _Bool input_bool(const char *prompt) {
@@ -238,47 +422,43 @@ _Bool input_bool(const char *prompt) {
 	return input == 'Y' || input == 'y';
 }
 
-friend_t *input_friend(const char *prompt, user_t *user) {
+user_t *input_friend(const char *prompt, user_t *user) {
     char username[MAX_USERNAME_SIZE];
     printf("%s", prompt);
     scanf("%s", username);
-    friend_t *current = user->friends;
-    while (current != NULL) {
-        if (!strcmp(current->username, username)) return current;
-        current = current->next;
-    }
+    user_t *friend_user = find_user(username);
+    if (friend_user != NULL && edgeset_contains(&friend_edges, user->id, friend_user->id)) return friend_user;
     printf("This user is not on your friends list.\n");
     return NULL;
 }
 
-user_t *input_username(const char *prompt, user_t *users) {
+// Lists the users whose names start with a name that was not found
+static void print_username_matches(const char *prefix) {
+    user_t *matches[PREFIX_MENU_MATCHES];
+    size_t n = prefix_find(prefix, matches, PREFIX_MENU_MATCHES);
+    if (n == 0) return;
+    printf("Users starting with \"%s\":\n", prefix);
+    for (size_t i = 0; i < n; i++) printf("%s\n", matches[i]->username);
+}
+
+user_t *input_username(const char *prompt) {
     char username[MAX_USERNAME_SIZE];
     printf("%s", prompt);
     scanf("%s", username);
-    user_t *user = find_user(users, username);
-    if (user == NULL) printf("User not found.\n");
+    user_t *user = find_user(username);
+    if (user == NULL) {
+        printf("User not found.\n");
+        print_username_matches(username);
+    }
     return user;
 }
 
-void register_user(user_t *users) {
-    hr();
-    printf("Registering a new user:\n");
-    hr();
-    char username[MAX_USERNAME_SIZE];
-    printf("Enter a username: ");
-    scanf("%s", username);
-    user_t *current = users;
-    while (current != NULL) {
-        if (case_insensitive_strcmp(current->username, username) == 0) {
-            printf("That username is already in use.\n");
-            return;
-        }
-        current = current->next;
-    }
+// Prompts for a password until it is long enough, and hashes it
+static void input_new_password(const char *prompt, password_hash_t *hash) {
     char password[MAX_PASSWORD_SIZE];
     _Bool valid = false;
     while (!valid) {
-        printf("Enter an up to 15 characters password: ");
+        printf("%s", prompt);
         scanf("%s", password);
         if (strlen(password) < 8) {
             printf("The length must be at least eight characters.\n");
@@ -286,7 +466,23 @@ void register_user(user_t *users) {
             valid = true;
         }
     }
-    add_user(users, str_to_lower(username), password);
+    password_hash(hash, password);
+}
+
+void register_user(void) {
+    hr();
+    printf("Registering a new user:\n");
+    hr();
+    char username[MAX_USERNAME_SIZE];
+    printf("Enter a username: ");
+    scanf("%s", username);
+    if (find_user(username) != NULL) {
+        printf("That username is already in use.\n");
+        return;
+    }
+    password_hash_t hash;
+    input_new_password("Enter an up to 15 characters password: ", &hash);
+    add_user(str_to_lower(username), &hash);
     printf("User added.\n");
 }
 
@@ -295,30 +491,28 @@ char char_to_lower(char c) {
 }
 
 char *str_to_lower(char *str) {
-    for (int i = 0; str[i] != '\0'; i++) {
-        str[i] = char_to_lower(str[i]);
-    }
+    fold_lower(str, strlen(str));
     return str;
 }
 
 int case_insensitive_strcmp(const char *str1, const char *str2) {
-    int i = 0;
-    for (; str1[i] != '\0' && str2[i] != '\0'; i++) {
-        int diff = char_to_lower(str1[i]) - char_to_lower(str2[i]);
-        if (diff != 0) return diff;
-    }
-    return char_to_lower(str1[i]) - char_to_lower(str2[i]);
+    size_t length1 = strlen(str1);
+    size_t length2 = strlen(str2);
+    // The shorter string's NUL is included, so a prefix compares as smaller
+    return fold_compare(str1, str2, (length1 < length2 ? length1 : length2) + 1);
 }
 
 void print_logged_in_menu(const char *username) {
     hr();
     printf("Welcome %s:\n", username);
     hr();
-    printf("1. Manage profile (change password)\n"
+    printf("1. Manage profile (change password/delete account)\n"
            "2. Manage posts (add/remove)\n"
            "3. Manage friends (add/remove)\n"
            "4. Display a friend's posts\n"
-           "5. Exit\n\n");
+           "5. Display news feed\n"
+           "6. Search posts\n"
+           "7. Exit\n\n");
 }
 
 unsigned short input_unsigned_short_between(const char *prompt, const unsigned short min, const unsigned short max) {
@@ -336,45 +530,63 @@ unsigned short input_unsigned_short_between(const char *prompt, const unsigned s
 	return input;
 }
 
-_Bool input_password(const char *prompt, const char *password) {
+_Bool input_password(const char *prompt, user_t *user) {
     char guess[MAX_PASSWORD_SIZE];
     printf("%s", prompt);
     scanf("%s", guess);
-    if (strcmp(password, guess) != 0) printf("Incorrect password.\n");
-    return strcmp(password, guess) == 0;
+    _Bool correct = password_verify(user->password, guess);
+    if (!correct) printf("Incorrect password.\n");
+    // A hash made by a bulk import is replaced at the full cost
+    if (correct && password_outdated(user->password)) {
+        password_hash_t hash;
+        password_hash(&hash, guess);
+        set_password(user, &hash);
+    }
+    return correct;
 }
 
-void manage_user(user_t *users, const char *username) {
-    user_t *user = find_user(users, username);
+_Bool manage_user(const char *username) {
+    user_t *user = find_user(username);
     hr();
     printf("Managing %s's Profile:\n", user->username);
     hr();
-    if (input_password("Enter your password: ", user->password)) {
-        char new_password[MAX_PASSWORD_SIZE];
-        printf("Enter a new password up to 15 characters: ");
-        scanf("%s", new_password);
-        strcpy(user->password, new_password);
-        printf("Password changed.\n");
+    if (!input_password("Enter your password: ", user)) return false;
+    printf("1. Change password\n"
+           "2. Delete account\n"
+           "3. Return to main menu\n\n");
+    switch (input_unsigned_short_between("Enter your choice: ", 1, 3)) {
+        case 1:
+            password_hash_t hash;
+            input_new_password("Enter a new password up to 15 characters: ", &hash);
+            set_password(user, &hash);
+            printf("Password changed.\n");
+            break;
+        case 2:
+            if (!input_bool("Delete your account, posts and friends for good? (Y/N)\n\nEnter your choice: ")) break;
+            delete_user(user);
+            printf("Account deleted.\n");
+            return true;
     }
+    return false;
 }
 
-void manage_posts(user_t *users, const char *username) {
-    user_t *user = find_user(users, username);
+void manage_posts(const char *username) {
+    user_t *user = find_user(username);
     _Bool exit = false;
     while (!exit) {
         hr();
         printf("Managing %s's Posts:\n", user->username);
         hr();
-        if (user->posts == NULL) printf("No posts available for %s.\n", user->username);
+        if (postlist_count(user) == 0) printf("No posts available for %s.\n", user->username);
         printf("1. Add a new post\n"
                "2. Remove a post\n"
                "3. Return to main menu\n\n");
         switch (input_unsigned_short_between("Enter your choice: ", 1, 3)) {
             case 1:
-                char post_content[MAX_POST_SIZE];
+                char content[MAX_POST_SIZE];
                 printf("Enter your post content: ");
-                scanf(" %[^\n]s", post_content);
-                add_post(user, post_content);
+                scanf(" %249[^\n]%*[^\n]", content);
+                add_post(user, content);
                 display_all_user_posts(user);
                 break;
             case 2:
@@ -390,33 +602,35 @@ void manage_posts(user_t *users, const char *username) {
     }
 }
 
-void manage_friends(user_t *users, const char *username) {
-    user_t *user = find_user(users, username);
+void manage_friends(const char *username) {
+    user_t *user = find_user(username);
     _Bool exit = false;
     while (!exit) {
         hr();
         printf("Managing %s's Friends:\n", user->username);
         hr();
-        if (user->friends == NULL) printf("No friends available for %s.\n", user->username);
+        if (graph_degree(&friend_graph, user->id) == 0) printf("No friends available for %s.\n", user->username);
         printf("1. Add a new friend\n"
                "2. Remove a friend\n"
-               "3. Return to main menu\n\n");
-        switch (input_unsigned_short_between("Enter your choice: ", 1, 3)) {
+               "3. Show people you may know\n"
+               "4. Return to main menu\n\n");
+        switch (input_unsigned_short_between("Enter your choice: ", 1, 4)) {
             case 1:
                 char new_friend_name[MAX_USERNAME_SIZE];
                 printf("Enter a new friend's name: ");
                 scanf("%s", new_friend_name);
-                user_t *new_friend = find_user(users, new_friend_name);
+                user_t *new_friend = find_user(new_friend_name);
                 if (new_friend == NULL) {
                     printf("User not found.\n");
+                    print_username_matches(new_friend_name);
                     break;
                 }
-                add_friend(users, user, new_friend_name);
+                add_friend(user, new_friend_name);
                 printf("Friend added to the list.\n");
                 break;
             case 2:
                 display_user_friends(user);
-                if (user->friends == NULL) return;
+                if (graph_degree(&friend_graph, user->id) == 0) return;
                 char friend_to_delete_name[MAX_USERNAME_SIZE];
                 printf("Enter a friend's name to delete: ");
                 scanf("%s", friend_to_delete_name);
@@ -427,75 +641,141 @@ void manage_friends(user_t *users, const char *username) {
                 }
                 break;
             case 3:
+                display_friend_suggestions(user);
+                break;
+            case 4:
                 exit = true;
         }
     }
 }
 
-void logged_in_menu(user_t *users, const char *username) {
+void logged_in_menu(const char *username) {
     _Bool exit = false;
     while (!exit) {
         print_logged_in_menu(username);
-        switch (input_unsigned_short_between("Enter your choice: ", 1, 5)) {
+        switch (input_unsigned_short_between("Enter your choice: ", 1, 7)) {
             case 1:
-                manage_user(users, username);
+                // The username belongs to the user, so it is gone with them
+                if (manage_user(username)) return;
                 break;
             case 2:
-                manage_posts(users, username);
+                manage_posts(username);
                 break;
             case 3:
-                manage_friends(users, username);
+                manage_friends(username);
                 break;
             case 4:
-                display_friends_posts(users, username);
+                display_friends_posts(username);
                 break;
             case 5:
+                display_news_feed(username);
+                break;
+            case 6:
+                display_search_results();
+                break;
+            case 7:
                 exit = true; 
         }
     }
 }
 
-void main_menu(user_t *users) {
+void main_menu(void) {
     _Bool exit = false;
     while (!exit) {
         print_menu();
-        switch (input_unsigned_short_between("Enter your choice: ", 1, 3)) {
+        switch (input_unsigned_short_between("Enter your choice: ", 1, 4)) {
             case 1:
-                register_user(users);
+                register_user();
                 break;
             case 2:
-                user_t *user = input_username("Enter your username: ", users);
+                user_t *user = input_username("Enter your username: ");
                 if (user == NULL) break;
-                if (input_password("Enter your password: ", user->password)) logged_in_menu(users, user->username);
+                if (input_password("Enter your password: ", user)) logged_in_menu(user->username);
                 break;
             case 3:
+                if (wal_checkpoint()) {
+                    printf("Snapshot saved to %s.\n", snapshot_path);
+                } else {
+                    perror("Error saving the snapshot");
+                }
+                break;
+            case 4:
                 printf("Goodbye.\n");
                 exit = true;
         }
     }
 }
 
-void display_friends_posts(user_t *users, const char *username) {
-    user_t *user = find_user(users, username);
+void display_friends_posts(const char *username) {
+    user_t *user = find_user(username);
+    if (user == NULL) return;
+    user_t *friend_user = input_friend("Enter your friend's username: ", user);
+    if (friend_user == NULL) return;
+    hr();
+    printf("%s's Posts:\n", friend_user->username);
+    hr();
+    display_post_pages(friend_user, 3);
+}
+
+void display_news_feed(const char *username) {
+    user_t *user = find_user(username);
     if (user == NULL) return;
-    friend_t *friend = input_friend("Enter your friend's username: ", user);
-    if (friend == NULL) return;
     hr();
-    printf("%s's Posts:\n", friend->username);
+    printf("%s's News Feed:\n", user->username);
     hr();
+    feed_t feed;
+    feed_open(&feed, user);
+    const user_t *author;
+    const post_t *current = feed_next(&feed, &author);
+    if (current == NULL) printf("No posts available from %s's friends.\n", user->username);
     _Bool exit = false;
-    post_t *current = *friend->posts;
-    while (!exit) {
+    while (!exit && current != NULL) {
         for (int i = 0; i < 3 && current != NULL; i++) {
-            printf("%s\n", current->content);
-            current = current->next;
+            char date[32];
+            time_t seconds = current->timestamp / 1000000;
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&seconds));
+            printf("[%s] %s: %s\n", date, author->username, post_content(current));
+            current = feed_next(&feed, &author);
         }
         if (current == NULL) {
             printf("All posts have been displayed.\n");
-            return;
+        } else {
+            exit = !input_bool("Do you want to display more posts? (Y/N)\n\n"
+                               "Enter your choice: ");
+        }
+    }
+    feed_close(&feed);
+}
+
+void display_search_results(void) {
+    char query[MAX_POST_SIZE];
+    printf("Enter words, #hashtags or @mentions to search for (OR between alternatives): ");
+    scanf(" %249[^\n]%*[^\n]", query);
+    search_result_t results[SEARCH_MENU_RESULTS];
+    size_t count = search_query(query, results, SEARCH_MENU_RESULTS);
+    hr();
+    printf("Search Results:\n");
+    hr();
+    if (count == 0 && errno == E2BIG) {
+        printf("Your search has too many words: at most %d between each OR.\n", SEARCH_MAX_QUERY_TERMS);
+    } else if (count == 0) {
+        printf("No posts match your search.\n");
+    }
+    size_t i = 0;
+    _Bool exit = false;
+    while (!exit && i < count) {
+        for (int shown = 0; shown < 3 && i < count; shown++, i++) {
+            char date[32];
+            time_t seconds = results[i].post->timestamp / 1000000;
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&seconds));
+            printf("[%s] %s: %s\n", date, results[i].author->username, post_content(results[i].post));
+        }
+        if (i == count) {
+            printf("All results have been displayed.\n");
+        } else {
+            exit = !input_bool("Do you want to display more results? (Y/N)\n\n"
+                               "Enter your choice: ");
         }
-        exit = !input_bool("Do you want to display more posts? (Y/N)\n\n"
-                           "Enter your choice: ");
     }
 }
 
@@ -4,59 +4,79 @@
 #include "nodes.h"
 
 /**
- * Creates a new user and adds it to a sorted (in non-decreasing order) linked
- * list at the proper location.
+ * Creates a new user's node in the arena of the shard its username routes
+ * to. Usernames that are too long are truncated.
  *
  * Parameters:
- * users: The list of users.
  * username: The new user's username.
- * password: The new user's password.
+ * password: The new user's password hash, which is copied.
  *
  * Returns:
- * The head of the linked list.
+ * The newly created node.
  */
-user_t *add_user(user_t *users, const char *username, const char *password);
+user_t *create_user(const char *username, const password_hash_t *password);
 
 /**
- * Searches if the user is available in the database.
- * 
+ * Creates a new user and adds it to its shard's sorted (in non-decreasing
+ * order) linked list at the proper location. The caller must hold the shard's
+ * lock while other threads are running.
+ *
  * Parameters:
- * users: The list of users.
- * username: The username to search for.
- * 
+ * username: The new user's username.
+ * password: The new user's password hash, which is copied.
+ *
  * Returns:
- * A pointer to the user if found and NULL if not found.
+ * The new user.
+ */
+user_t *add_user(const char *username, const password_hash_t *password);
+
+/**
+ * Changes a user's password. The old hash is retired rather than
+ * overwritten, so a login verifying against it concurrently is unaffected.
+ *
+ * Parameters:
+ * user: The user.
+ * password: The new password hash, which is copied.
+ *
+ * Returns:
+ * None
  */
-user_t *find_user(user_t *users, const char *username);
+void set_password(user_t *user, const password_hash_t *password);
 
 /**
- * Creates a new friend's node.
+ * Searches if the user is available in the database. The lookup goes through
+ * the hash index of the shard the username routes to, so it takes constant
+ * time on average.
  * 
  * Parameters:
- * users: The list of users.
- * username: The new friend's username.
+ * username: The username to search for.
  * 
  * Returns:
- * The newly created node.
+ * A pointer to the user if found and NULL if not found.
  */
-friend_t *create_friend(user_t *users, const char *username);
+user_t *find_user(const char *username);
 
 /**
- * Links a friend to a user. The friend's name is added into a sorted (in
- * non-decreasing order) linked list.
+ * Links a friend to a user by adding the edge to the friend graph, which is
+ * the only place a user's friends are kept, and to the follower graph.
+ * Nothing happens if the friend does not exist or is already linked, which
+ * the friend edge set checks in constant time. With symmetric friendships
+ * the edge back from the friend is added as well. The caller must hold the
+ * user's shard lock and the shared lock while other threads are running.
  * 
  * Parameters:
- * users: The list of users.
  * user: The user to add the friend to.
  * friend: The friend's name.
  * 
  * Returns:
  * None
  */
-void add_friend(user_t *users, user_t *user, const char *friend);
+void add_friend(user_t *user, const char *friend);
 
 /**
- * Removes a friend from a user's friend list.
+ * Removes a friend from the user's edges in the friend graph, matching the
+ * name in any case. With symmetric friendships the edge back from the friend
+ * is removed as well, under the same locks as add_friend.
  * 
  * Parameters:
  * user: The user to delete a friend from.
@@ -68,18 +88,61 @@ void add_friend(user_t *users, user_t *user, const char *friend);
 _Bool delete_friend(user_t *user, char *friend_name);
 
 /**
- * Creates a new user's post.
+ * Creates a new user's post in the arena of the author's shard. The content
+ * is copied into the post heap and truncated to MAX_CONTENT_SIZE - 1
+ * characters.
  * 
  * Parameters:
+ * author: The post's author.
  * text: The posts's content.
  * 
  * Returns:
  * The newly created post.
  */
-post_t *create_post(const char *text);
+post_t *create_post(const user_t *author, const char *text);
+
+/**
+ * Recreates a saved post whose content is already in the post heap. Posts
+ * created afterwards are given later timestamps.
+ * 
+ * Parameters:
+ * author: The post's author.
+ * timestamp: The post's timestamp.
+ * content: The content's offset in the post heap.
+ * length: The content's length.
+ * 
+ * Returns:
+ * The recreated post.
+ */
+post_t *restore_post(const user_t *author, long long timestamp, unsigned long long content, unsigned short length);
+
+/**
+ * Gets a post's content.
+ * 
+ * Parameters:
+ * post: The post.
+ * 
+ * Returns:
+ * The NUL-terminated content.
+ */
+const char *post_content(const post_t *post);
+
+/**
+ * Pushes an existing post onto a user's timeline without logging it, such as
+ * a post recreated while replaying the write-ahead log.
+ * 
+ * Parameters:
+ * user: The user to add the post to.
+ * post: The post.
+ * 
+ * Returns:
+ * None
+ */
+void push_post(user_t *user, post_t *post);
 
 /**
- * Adds a post to a user's timeline (following a stack).
+ * Adds a post to a user's timeline (following a stack). With fan-out enabled,
+ * the post is also pushed to the precomputed feeds of the user's followers.
  * 
  * Parameters:
  * user: The user to add the post to.
@@ -101,6 +164,62 @@ void add_post(user_t *user, const char *text);
  */
 _Bool delete_post(user_t *user);
 
+/**
+ * Looks up one of a user's posts by the handle of its ID, which the post is
+ * given when it is added, in constant time.
+ * 
+ * Parameters:
+ * author: The user.
+ * handle: The post's handle.
+ * 
+ * Returns:
+ * The post, or NULL if the user has no post with that ID.
+ */
+post_t *find_post(const user_t *author, post_handle_t handle);
+
+/**
+ * Deletes any of a user's posts in constant time, however many posts and
+ * followers the user has: the user's list of posts keeps a tombstone in its
+ * place until it is next compacted, and the timelines the post was pushed to
+ * skip it when they are read. Removing it from the search index takes time in
+ * proportion to its terms.
+ * 
+ * Parameters:
+ * user: The post's author.
+ * post: The post, which must not be used afterwards.
+ * 
+ * Returns:
+ * None
+ */
+void remove_post(user_t *user, post_t *post);
+
+/**
+ * Deletes every one of a user's posts that matches a predicate. Each post is
+ * tested once and each match is deleted in constant time.
+ * 
+ * Parameters:
+ * user: The user to delete the posts of.
+ * matches: The predicate, called with each post and the context.
+ * context: Passed to the predicate.
+ * 
+ * Returns:
+ * The number of posts deleted.
+ */
+size_t delete_posts_where(user_t *user, _Bool (*matches)(const post_t *post, void *context), void *context);
+
+/**
+ * Deletes a user's account along with their posts and friendships, and frees
+ * their ID for reuse. Takes the user's shard lock and the shared lock when
+ * called concurrently.
+ * 
+ * Parameters:
+ * user: The user to delete, which must not be used afterwards.
+ * 
+ * Returns:
+ * None
+ */
+void delete_user(user_t *user);
+
 /**
  * Displays all of a specific user's posts.
  * 
@@ -113,7 +232,7 @@ _Bool delete_post(user_t *user);
 void display_all_user_posts(user_t *user);
 
 /**
- * Displays all of a specific user's friends.
+ * Displays all of a specific user's friends, sorted by name.
  * 
  * Parameters:
  * user: The user to display the friends of.
@@ -123,6 +242,18 @@ void display_all_user_posts(user_t *user);
  */
 void display_user_friends(user_t *user);
 
+/**
+ * Displays the people a user may know, with some of the friends they have in
+ * common.
+ *
+ * Parameters:
+ * user: The user to display the suggestions of.
+ *
+ * Returns:
+ * None
+ */
+void display_friend_suggestions(user_t *user);
+
 /**
  * Displays a given number of posts for a given user. After displaying the
  * given number of posts, it prompts if you want to display more posts.
@@ -138,15 +269,17 @@ void display_user_friends(user_t *user);
 void display_posts_by_n(user_t *users, int number);
 
 /**
- * Frees all users from the database before quitting the application.
+ * Frees all users from the database before quitting the application. The
+ * node arenas of every shard are released slab by slab rather than node by
+ * node.
  * 
  * Parameters:
- * users: The list of users.
+ * None
  * 
  * Returns:
  * None
  */
-void teardown(user_t *users);
+void teardown(void);
 
 /**
  * Prints the main menu with a lith of option for the user to choose from.
@@ -160,16 +293,18 @@ void teardown(user_t *users);
 void print_menu();
 
 /**
- * Reads users from the text file.
+ * Reads users from the text file. All usernames are read before any
+ * friendships are linked, so friends may appear later in the file.
  * 
  * Parameters:
  * file: The file to read users from.
- * num_users: The number of users.
+ * num_users: The maximum number of users. Reading stops early at the end of
+ * the file.
  * 
  * Returns:
- * The list of users.
+ * The number of users read.
  */
-user_t *read_CSV_and_create_users(FILE *file, int num_users);
+size_t read_CSV_and_create_users(FILE *file, int num_users);
 
 /*
  * Prompts the user to enter 'Y'or 'N'.
@@ -194,33 +329,33 @@ _Bool input_bool(const char *prompt);
  * The friend with the username if the friend is found.
  * NULL if the friend is not found.
  */
-friend_t *input_friend(const char *prompt, user_t *user);
+user_t *input_friend(const char *prompt, user_t *user);
 
 /*
  * Prompts the user to enter a username.
  *
  * Parameters:
  * prompt: The prompt.
- * users: The users.
  *
  * Returns:
  * The user with the username if the user is found.
- * NULL if the user is not found.
+ * NULL if the user is not found, after listing the users whose names start
+ * with what was entered.
  */
-user_t *input_username(const char *prompt, user_t *users);
+user_t *input_username(const char *prompt);
 
 /*
  * Registers a new user.
  * Creates a new user.
- * Adds the new user to users.
+ * Adds the new user to its shard.
  *
  * Parameters:
- * users: The users.
+ * None
  *
  * Returns:
  * None
  */
-void register_user(user_t *users);
+void register_user(void);
 
 /*
  * Converts a character to lowercase.
@@ -280,88 +415,110 @@ void print_logged_in_menu(const char *username);
 unsigned short input_unsigned_short_between(const char *prompt, const unsigned short min, const unsigned short max);
 
 /**
- * Prompts the user to enter their password.
+ * Prompts the user to enter their password and checks it against their hash,
+ * replacing the hash if it was made at a lower cost than the current one.
  *
  * Parameters:
  * prompt: The prompt.
- * password: The password.
+ * user: The user.
  *
  * Returns:
  * True if the passwords match.
  * False if the passwords do not match.
  */
-_Bool input_password(const char *prompt, const char *password);
+_Bool input_password(const char *prompt, user_t *user);
 
 /**
  * User's profile menu.
  * 
  * Parameters:
- * user: The users.
  * username: The logged in user's username.
  * 
  * Returns:
- * None
+ * True if the user deleted their account and false otherwise.
  */
-void manage_user(user_t *users, const char *username);
+_Bool manage_user(const char *username);
 
 /**
  * User's posts menu.
  * 
  * Parameters
- * user: The users
  * username: The logged in user's username.
  * 
  * Returns:
  * None
  */
-void manage_posts(user_t *users, const char *username);
+void manage_posts(const char *username);
 
 /**
  * User's friends menu.
  * 
  * Parameters
- * user: The users
  * username: The logged in user's username.
  * 
  * Returns:
  * None
  */
-void manage_friends(user_t *users, const char *username);
+void manage_friends(const char *username);
 
 /**
  * Logged in menu.
  * 
  * Parameters
- * users: The users
  * user: The logged in user's username.
  * 
  * Returns
  * None
  */
-void logged_in_menu(user_t *users, const char *username);
+void logged_in_menu(const char *username);
 
 /**
  * Main menu.
  * 
  * Parameters
- * users: The users.
+ * None
  * 
  * Returns:
  * None
 */
-void main_menu(user_t *users);
+void main_menu(void);
 
 /**
  * Displays a user's friend's posts.
  * 
  * Parameters:
- * users: The users
  * username: The user's username.
  * 
  * Returns:
  * None
 */
-void display_friends_posts(user_t *users, const char *username);
+void display_friends_posts(const char *username);
+
+/**
+ * Displays a user's news feed: the posts of all of the user's friends, newest
+ * first, three at a time. Posts are merged lazily, so each page only costs
+ * O(log f) per post for f friends. With fan-out enabled, the feed is read from
+ * the user's precomputed timeline and only celebrities are merged.
+ * 
+ * Parameters:
+ * username: The user's username.
+ * 
+ * Returns:
+ * None
+*/
+void display_news_feed(const char *username);
+
+/**
+ * Prompts for a search query and displays the newest matching posts of any
+ * user, three at a time.
+ * 
+ * Parameters:
+ * None
+ * 
+ * Returns:
+ * None
+*/
+void display_search_results(void);
 
 /**
  * Prints a horizontal rule.
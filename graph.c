@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include "graph.h"
+
+#define GRAPH_DELTA_MIN_COMPACTION 1024
+
+friend_graph_t friend_graph = {NULL, NULL, 0, 0, NULL, 0, 0};
+friend_graph_t follower_graph = {NULL, NULL, 0, 0, NULL, 0, 0};
+
+static int compare_changes(const void *a, const void *b) {
+    const graph_delta_t *change1 = a;
+    const graph_delta_t *change2 = b;
+    if (change1->friend != change2->friend) return change1->friend < change2->friend ? -1 : 1;
+    return 0;
+}
+
+// Finds a user's delta row, or NULL if the user has no pending changes
+static const graph_delta_row_t *delta_row(const friend_graph_t *graph, unsigned int user) {
+    if (user >= graph->delta_rows || graph->delta[user].count == 0) return NULL;
+    return &graph->delta[user];
+}
+
+// Finds the first change in a row that is not before a friend
+static size_t delta_lower_bound(const graph_delta_row_t *row, unsigned int friend) {
+    size_t low = 0;
+    size_t high = row->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (row->changes[middle].friend < friend) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/*
+ * Rebuilds the CSR arrays with a row of changes per user merged in, each
+ * sorted by friend. When a change repeats an edge, the last one wins.
+ */
+static void merge_changes(friend_graph_t *graph, const graph_delta_row_t *rows, size_t num_rows) {
+    size_t num_users = graph->num_users;
+    size_t count = 0;
+    for (size_t user = 0; user < num_rows; user++) {
+        count += rows[user].count;
+        if (rows[user].count > 0 && user + 1 > num_users) num_users = user + 1;
+    }
+    unsigned int *offsets = malloc((num_users + 1) * sizeof(unsigned int));
+    unsigned int *targets = malloc((graph->num_edges + count + 1) * sizeof(unsigned int));
+    assert(offsets != NULL && targets != NULL);
+    size_t n = 0;
+    for (size_t user = 0; user < num_users; user++) {
+        offsets[user] = n;
+        size_t i = user < graph->num_users ? graph->offsets[user] : 0;
+        size_t end = user < graph->num_users ? graph->offsets[user + 1] : 0;
+        const graph_delta_t *changes = user < num_rows ? rows[user].changes : NULL;
+        size_t num_changes = user < num_rows ? rows[user].count : 0;
+        size_t c = 0;
+        while (i < end || c < num_changes) {
+            if (c < num_changes && (i == end || changes[c].friend <= graph->targets[i])) {
+                unsigned int friend = changes[c].friend;
+                while (c + 1 < num_changes && changes[c + 1].friend == friend) c++;
+                _Bool removed = changes[c++].removed;
+                if (i < end && graph->targets[i] == friend) i++;
+                if (!removed) targets[n++] = friend;
+            } else {
+                targets[n++] = graph->targets[i++];
+            }
+        }
+    }
+    offsets[num_users] = n;
+    free(graph->offsets);
+    free(graph->targets);
+    graph->offsets = offsets;
+    graph->targets = realloc(targets, (n + 1) * sizeof(unsigned int));
+    assert(graph->targets != NULL);
+    graph->num_users = num_users;
+    graph->num_edges = n;
+}
+
+void graph_add_edges(friend_graph_t *graph, const unsigned int *users, const unsigned int *friends, size_t count) {
+    graph_compact(graph);
+    if (count == 0) return;
+
+    // Counting sort by user, then sort each user's short run by friend
+    unsigned int num_users = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (users[i] + 1 > num_users) num_users = users[i] + 1;
+    }
+    size_t *starts = calloc(num_users + 1, sizeof(size_t));
+    graph_delta_t *changes = malloc(count * sizeof(graph_delta_t));
+    graph_delta_row_t *rows = malloc(num_users * sizeof(graph_delta_row_t));
+    assert(starts != NULL && changes != NULL && rows != NULL);
+    for (size_t i = 0; i < count; i++) starts[users[i] + 1]++;
+    for (unsigned int user = 0; user < num_users; user++) starts[user + 1] += starts[user];
+    for (size_t i = 0; i < count; i++) {
+        graph_delta_t change = {friends[i], false};
+        changes[starts[users[i]]++] = change;
+    }
+    size_t begin = 0;
+    for (unsigned int user = 0; user < num_users; user++) {
+        qsort(changes + begin, starts[user] - begin, sizeof(graph_delta_t), compare_changes);
+        graph_delta_row_t row = {changes + begin, starts[user] - begin, 0};
+        rows[user] = row;
+        begin = starts[user];
+    }
+    merge_changes(graph, rows, num_users);
+    free(rows);
+    free(changes);
+    free(starts);
+}
+
+static void graph_change_edge(friend_graph_t *graph, unsigned int user, unsigned int friend, _Bool removed) {
+    if (user >= graph->delta_rows) {
+        size_t rows = graph->delta_rows == 0 ? 64 : graph->delta_rows;
+        while (rows <= user) rows *= 2;
+        graph->delta = realloc(graph->delta, rows * sizeof(graph_delta_row_t));
+        assert(graph->delta != NULL);
+        memset(graph->delta + graph->delta_rows, 0, (rows - graph->delta_rows) * sizeof(graph_delta_row_t));
+        graph->delta_rows = rows;
+    }
+    graph_delta_row_t *row = &graph->delta[user];
+    size_t i = delta_lower_bound(row, friend);
+    if (i < row->count && row->changes[i].friend == friend) {
+        row->changes[i].removed = removed;
+        return;
+    }
+    if (row->count == row->capacity) {
+        row->capacity = row->capacity == 0 ? 4 : row->capacity * 2;
+        row->changes = realloc(row->changes, row->capacity * sizeof(graph_delta_t));
+        assert(row->changes != NULL);
+    }
+    // Only the user's own changes move, however many the graph has pending
+    memmove(&row->changes[i + 1], &row->changes[i], (row->count - i) * sizeof(graph_delta_t));
+    graph_delta_t change = {friend, removed};
+    row->changes[i] = change;
+    row->count++;
+    graph->delta_count++;
+    // Keep the delta rows small relative to the graph, so each compaction is
+    // paid for by a number of changes in proportion to the graph
+    if (graph->delta_count > GRAPH_DELTA_MIN_COMPACTION + graph->num_edges / 16) graph_compact(graph);
+}
+
+void graph_add_edge(friend_graph_t *graph, unsigned int user, unsigned int friend) {
+    graph_change_edge(graph, user, friend, false);
+}
+
+void graph_remove_edge(friend_graph_t *graph, unsigned int user, unsigned int friend) {
+    graph_change_edge(graph, user, friend, true);
+}
+
+// Checks if an edge is in the CSR arrays, ignoring the delta rows
+static _Bool row_contains(const friend_graph_t *graph, unsigned int user, unsigned int friend) {
+    if (user >= graph->num_users) return false;
+    size_t low = graph->offsets[user];
+    size_t high = graph->offsets[user + 1];
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (graph->targets[middle] == friend) return true;
+        if (graph->targets[middle] < friend) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+_Bool graph_has_edge(const friend_graph_t *graph, unsigned int user, unsigned int friend) {
+    const graph_delta_row_t *row = delta_row(graph, user);
+    if (row != NULL) {
+        size_t i = delta_lower_bound(row, friend);
+        if (i < row->count && row->changes[i].friend == friend) return !row->changes[i].removed;
+    }
+    return row_contains(graph, user, friend);
+}
+
+void graph_compact(friend_graph_t *graph) {
+    if (graph->delta_count == 0) return;
+    merge_changes(graph, graph->delta, graph->delta_rows);
+    // The rows keep their buffers for the next changes
+    for (size_t user = 0; user < graph->delta_rows; user++) graph->delta[user].count = 0;
+    graph->delta_count = 0;
+}
+
+graph_iterator_t graph_friends(const friend_graph_t *graph, unsigned int user) {
+    graph_iterator_t iterator = {graph, user, 0, 0, 0};
+    if (user < graph->num_users) {
+        iterator.position = graph->offsets[user];
+        iterator.end = graph->offsets[user + 1];
+    }
+    return iterator;
+}
+
+_Bool graph_next(graph_iterator_t *iterator, unsigned int *friend) {
+    const friend_graph_t *graph = iterator->graph;
+    const graph_delta_row_t *delta = delta_row(graph, iterator->user);
+    while (true) {
+        _Bool has_delta = delta != NULL && iterator->delta_position < delta->count;
+        _Bool has_row = iterator->position < iterator->end;
+        if (!has_delta && !has_row) return false;
+        if (has_delta && (!has_row || delta->changes[iterator->delta_position].friend <= graph->targets[iterator->position])) {
+            const graph_delta_t *change = &delta->changes[iterator->delta_position++];
+            if (has_row && graph->targets[iterator->position] == change->friend) iterator->position++;
+            if (change->removed) continue;
+            *friend = change->friend;
+            return true;
+        }
+        *friend = graph->targets[iterator->position++];
+        return true;
+    }
+}
+
+size_t graph_degree(const friend_graph_t *graph, unsigned int user) {
+    // Start from the length of the CSR row and adjust for the user's pending
+    // changes, so the cost does not depend on the number of friends
+    size_t degree = user < graph->num_users ? graph->offsets[user + 1] - graph->offsets[user] : 0;
+    const graph_delta_row_t *row = delta_row(graph, user);
+    for (size_t i = 0; row != NULL && i < row->count; i++) {
+        _Bool in_row = row_contains(graph, user, row->changes[i].friend);
+        if (row->changes[i].removed && in_row) degree--;
+        if (!row->changes[i].removed && !in_row) degree++;
+    }
+    return degree;
+}
+
+unsigned int *graph_copy_friends(const friend_graph_t *graph, unsigned int user, size_t *count) {
+    size_t degree = graph_degree(graph, user);
+    unsigned int *friends = malloc((degree + 1) * sizeof(unsigned int));
+    assert(friends != NULL);
+    graph_iterator_t iterator = graph_friends(graph, user);
+    *count = 0;
+    while (*count < degree && graph_next(&iterator, &friends[*count])) (*count)++;
+    return friends;
+}
+
+void graph_clear(friend_graph_t *graph) {
+    free(graph->offsets);
+    free(graph->targets);
+    for (size_t user = 0; user < graph->delta_rows; user++) free(graph->delta[user].changes);
+    free(graph->delta);
+    memset(graph, 0, sizeof(friend_graph_t));
+}
@@ -0,0 +1,180 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stddef.h>
+
+// A pending change to one of a user's friends that has not been compacted yet
+typedef struct graph_delta {
+    unsigned int friend;
+    _Bool removed;
+} graph_delta_t;
+
+// A user's pending changes, sorted by friend
+typedef struct graph_delta_row {
+    graph_delta_t *changes;
+    unsigned int count;
+    unsigned int capacity;
+} graph_delta_row_t;
+
+// A compressed sparse row (CSR) friend graph. The friends of user u are the
+// user IDs targets[offsets[u]] to targets[offsets[u + 1] - 1], sorted by ID.
+// Edges added or removed since the last compaction are kept in a small delta
+// row per user, delta[u], which takes precedence over the CSR arrays.
+typedef struct friend_graph {
+    unsigned int *offsets;
+    unsigned int *targets;
+    size_t num_users;
+    size_t num_edges;
+    graph_delta_row_t *delta;
+    size_t delta_rows;
+    size_t delta_count;
+} friend_graph_t;
+
+// An iterator over a user's friends
+typedef struct graph_iterator {
+    const friend_graph_t *graph;
+    unsigned int user;
+    size_t position;
+    size_t end;
+    size_t delta_position;
+} graph_iterator_t;
+
+// The friend graph of every user in the database
+extern friend_graph_t friend_graph;
+
+// The transpose of the friend graph: the followers of user u are the users
+// who have u as a friend
+extern friend_graph_t follower_graph;
+
+/**
+ * Adds many edges at once and compacts the graph, which takes time linear in
+ * the size of the graph.
+ *
+ * Parameters:
+ * graph: The graph.
+ * users: The IDs of the users the edges start from.
+ * friends: The IDs of the friends the edges lead to.
+ * count: The number of edges.
+ *
+ * Returns:
+ * None
+ */
+void graph_add_edges(friend_graph_t *graph, const unsigned int *users, const unsigned int *friends, size_t count);
+
+/**
+ * Adds an edge to the user's delta row, compacting the graph when the rows
+ * grow too large. Takes time in proportion to the user's pending changes, plus
+ * the compactions, which take time linear in the size of the graph once every
+ * num_edges / 16 changes.
+ *
+ * Parameters:
+ * graph: The graph.
+ * user: The ID of the user.
+ * friend: The ID of the friend.
+ *
+ * Returns:
+ * None
+ */
+void graph_add_edge(friend_graph_t *graph, unsigned int user, unsigned int friend);
+
+/**
+ * Removes an edge through the user's delta row, compacting the graph when the
+ * rows grow too large, like graph_add_edge.
+ *
+ * Parameters:
+ * graph: The graph.
+ * user: The ID of the user.
+ * friend: The ID of the friend.
+ *
+ * Returns:
+ * None
+ */
+void graph_remove_edge(friend_graph_t *graph, unsigned int user, unsigned int friend);
+
+/**
+ * Checks if an edge is in the graph with binary searches over the user's
+ * delta row and CSR row.
+ *
+ * Parameters:
+ * graph: The graph.
+ * user: The ID of the user.
+ * friend: The ID of the friend.
+ *
+ * Returns:
+ * True if the friend is one of the user's friends and false otherwise.
+ */
+_Bool graph_has_edge(const friend_graph_t *graph, unsigned int user, unsigned int friend);
+
+/**
+ * Merges the delta rows into the CSR arrays.
+ *
+ * Parameters:
+ * graph: The graph.
+ *
+ * Returns:
+ * None
+ */
+void graph_compact(friend_graph_t *graph);
+
+/**
+ * Starts iterating over a user's friends in order of ID.
+ *
+ * Parameters:
+ * graph: The graph.
+ * user: The ID of the user.
+ *
+ * Returns:
+ * The iterator.
+ */
+graph_iterator_t graph_friends(const friend_graph_t *graph, unsigned int user);
+
+/**
+ * Moves an iterator to the next friend.
+ *
+ * Parameters:
+ * iterator: The iterator.
+ * friend: Set to the ID of the next friend.
+ *
+ * Returns:
+ * True if there was another friend and false otherwise.
+ */
+_Bool graph_next(graph_iterator_t *iterator, unsigned int *friend);
+
+/**
+ * Counts a user's friends in time proportional to the user's pending changes.
+ *
+ * Parameters:
+ * graph: The graph.
+ * user: The ID of the user.
+ *
+ * Returns:
+ * The number of friends.
+ */
+size_t graph_degree(const friend_graph_t *graph, unsigned int user);
+
+/**
+ * Copies a user's friends into an array in order of ID, so the graph can be
+ * changed while they are visited.
+ *
+ * Parameters:
+ * graph: The graph.
+ * user: The ID of the user.
+ * count: Set to the number of friends.
+ *
+ * Returns:
+ * The array, which the caller frees.
+ */
+unsigned int *graph_copy_friends(const friend_graph_t *graph, unsigned int user, size_t *count);
+
+/**
+ * Frees the graph.
+ *
+ * Parameters:
+ * graph: The graph.
+ *
+ * Returns:
+ * None
+ */
+void graph_clear(friend_graph_t *graph);
+
+#endif
@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nodes.h"
+#include "functions.h"
+#include "shard.h"
+#include "graph.h"
+#include "edgeset.h"
+#include "password.h"
+#include "metrics.h"
+#include "loader.h"
+
+#define MIN_CHUNK_SIZE (64 * 1024)
+#define CSV_FRIEND_FIELDS 3
+
+// A row of the CSV file, pointing into the mapped file
+typedef struct csv_row {
+    const char *line;
+    unsigned int length;
+    unsigned int username_length;
+} csv_row_t;
+
+// A newline-aligned chunk of the mapped file and the rows parsed from it
+typedef struct csv_chunk {
+    const char *begin;
+    const char *end;
+    csv_row_t *rows;
+    size_t count;
+    size_t capacity;
+    pthread_t thread;
+    _Bool threaded;
+} csv_chunk_t;
+
+static int compare_rows(const void *a, const void *b) {
+    const csv_row_t *row1 = a;
+    const csv_row_t *row2 = b;
+    unsigned int length = row1->username_length < row2->username_length ? row1->username_length : row2->username_length;
+    int diff = memcmp(row1->line, row2->line, length);
+    if (diff != 0) return diff;
+    return (int) row1->username_length - (int) row2->username_length;
+}
+
+static void *parse_chunk(void *arg) {
+    csv_chunk_t *chunk = arg;
+    const char *line = chunk->begin;
+    while (line < chunk->end) {
+        const char *newline = memchr(line, '\n', chunk->end - line);
+        const char *line_end = newline != NULL ? newline : chunk->end;
+        const char *next = newline != NULL ? newline + 1 : chunk->end;
+        if (line_end > line && line_end[-1] == '\r') line_end--;
+        const char *comma = memchr(line, ',', line_end - line);
+        if (comma != NULL && comma > line) {
+            if (chunk->count == chunk->capacity) {
+                chunk->capacity = chunk->capacity == 0 ? 1024 : chunk->capacity * 2;
+                chunk->rows = realloc(chunk->rows, chunk->capacity * sizeof(csv_row_t));
+                assert(chunk->rows != NULL);
+            }
+            chunk->rows[chunk->count].line = line;
+            chunk->rows[chunk->count].length = line_end - line;
+            chunk->rows[chunk->count].username_length = comma - line;
+            chunk->count++;
+        }
+        line = next;
+    }
+    qsort(chunk->rows, chunk->count, sizeof(csv_row_t), compare_rows);
+    return NULL;
+}
+
+/*
+ * Copies the field at the cursor into a buffer, truncating it if it does not
+ * fit, and moves the cursor past the following comma.
+ *
+ * Returns:
+ * True if a field was copied.
+ * False if there are no fields left.
+ */
+static _Bool next_field(const char **cursor, const char *end, char *buffer, size_t size) {
+    if (*cursor > end) return false;
+    const char *comma = memchr(*cursor, ',', end - *cursor);
+    const char *field_end = comma != NULL ? comma : end;
+    size_t length = field_end - *cursor;
+    if (length >= size) length = size - 1;
+    memcpy(buffer, *cursor, length);
+    buffer[length] = '\0';
+    *cursor = field_end + 1;
+    return true;
+}
+
+static _Bool is_blank(const char *str) {
+    for (int i = 0; str[i] != '\0'; i++) {
+        if (str[i] != ' ') return false;
+    }
+    return true;
+}
+
+// Copies a row's plaintext password into a buffer
+static void read_row_password(const csv_row_t *row, char password[MAX_PASSWORD_SIZE]) {
+    const char *cursor = row->line;
+    const char *end = row->line + row->length;
+    char username[MAX_USERNAME_SIZE];
+    password[0] = '\0';
+    next_field(&cursor, end, username, sizeof(username));
+    next_field(&cursor, end, password, MAX_PASSWORD_SIZE);
+}
+
+static user_t *create_user_from_row(const csv_row_t *row, const password_hash_t *password) {
+    const char *cursor = row->line;
+    const char *end = row->line + row->length;
+    char username[MAX_USERNAME_SIZE];
+    char field[MAX_CONTENT_SIZE];
+    next_field(&cursor, end, username, sizeof(username));
+    next_field(&cursor, end, field, sizeof(field));
+    user_t *user = create_user(username, password);
+    shard_insert(shard_for(user->username), user);
+    for (int i = 0; i < CSV_FRIEND_FIELDS && next_field(&cursor, end, field, sizeof(field)); i++)
+        ;
+    while (next_field(&cursor, end, field, sizeof(field))) {
+        if (!is_blank(field)) add_post(user, field);
+    }
+    return user;
+}
+
+/*
+ * Resolves a row's friend fields to the IDs of existing users, sorted by
+ * username with duplicates removed.
+ *
+ * Returns:
+ * The number of IDs.
+ */
+static int resolve_friend_ids(const csv_row_t *row, unsigned int *ids) {
+    const char *cursor = row->line;
+    const char *end = row->line + row->length;
+    char field[MAX_USERNAME_SIZE];
+    next_field(&cursor, end, field, sizeof(field));
+    next_field(&cursor, end, field, sizeof(field));
+    int count = 0;
+    for (int i = 0; i < CSV_FRIEND_FIELDS && next_field(&cursor, end, field, sizeof(field)); i++) {
+        if (is_blank(field)) continue;
+        user_t *friend = find_user(field);
+        if (friend == NULL) continue;
+        int j = 0;
+        while (j < count && ids[j] != friend->id) j++;
+        if (j < count) continue;
+        while (j > 0 && strcmp(shard_user(ids[j - 1])->username, friend->username) > 0) {
+            ids[j] = ids[j - 1];
+            j--;
+        }
+        ids[j] = friend->id;
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Builds the users from the sorted chunks in three phases. The first phase
+ * merges the chunks in a single pass. The second hashes every row's
+ * plaintext password on all CPUs, since hashing is slow on purpose and takes
+ * far longer than the rest of the import. The third creates each user and
+ * appends it to its shard, which interns its username into an ID, and then
+ * resolves every friend field against those IDs and appends the friend nodes
+ * in order, so a friend later in the file is linked like any other.
+ */
+static size_t build_users(csv_chunk_t *chunks, int num_chunks) {
+    size_t num_rows = 0;
+    for (int i = 0; i < num_chunks; i++) num_rows += chunks[i].count;
+    const csv_row_t **rows = malloc((num_rows + 1) * sizeof(csv_row_t *));
+    user_t **users = malloc((num_rows + 1) * sizeof(user_t *));
+    size_t *positions = calloc(num_chunks, sizeof(size_t));
+    assert(rows != NULL && users != NULL && positions != NULL);
+    for (size_t n = 0; n < num_rows; n++) {
+        int min = -1;
+        for (int i = 0; i < num_chunks; i++) {
+            if (positions[i] == chunks[i].count) continue;
+            if (min == -1 || compare_rows(&chunks[i].rows[positions[i]], &chunks[min].rows[positions[min]]) < 0) min = i;
+        }
+        rows[n] = &chunks[min].rows[positions[min]++];
+    }
+
+    char (*plaintexts)[MAX_PASSWORD_SIZE] = malloc((num_rows + 1) * MAX_PASSWORD_SIZE);
+    const char **passwords = malloc((num_rows + 1) * sizeof(char *));
+    password_hash_t *hashes = malloc((num_rows + 1) * sizeof(password_hash_t));
+    assert(plaintexts != NULL && passwords != NULL && hashes != NULL);
+    for (size_t n = 0; n < num_rows; n++) {
+        read_row_password(rows[n], plaintexts[n]);
+        passwords[n] = plaintexts[n];
+    }
+    password_hash_all(hashes, passwords, num_rows, 0);
+    free(plaintexts);
+    free(passwords);
+    for (size_t n = 0; n < num_rows; n++) users[n] = create_user_from_row(rows[n], &hashes[n]);
+    free(hashes);
+
+    unsigned int ids[CSV_FRIEND_FIELDS];
+    unsigned int *edge_users = malloc((num_rows * CSV_FRIEND_FIELDS + 1) * sizeof(unsigned int));
+    unsigned int *edge_friends = malloc((num_rows * CSV_FRIEND_FIELDS + 1) * sizeof(unsigned int));
+    assert(edge_users != NULL && edge_friends != NULL);
+    size_t num_edges = 0;
+    edgeset_reserve(&friend_edges, friend_edges.count + num_rows * CSV_FRIEND_FIELDS);
+    for (size_t n = 0; n < num_rows; n++) {
+        user_t *user = users[n];
+        int count = resolve_friend_ids(rows[n], ids);
+        for (int i = 0; i < count; i++) {
+            // A friend listed twice is only linked once
+            if (!edgeset_insert(&friend_edges, user->id, ids[i])) continue;
+            edge_users[num_edges] = user->id;
+            edge_friends[num_edges++] = ids[i];
+        }
+    }
+    graph_add_edges(&friend_graph, edge_users, edge_friends, num_edges);
+    graph_add_edges(&follower_graph, edge_friends, edge_users, num_edges);
+
+    free(edge_friends);
+    free(edge_users);
+    free(positions);
+    free(users);
+    free(rows);
+    return num_rows;
+}
+
+size_t load_users_from_buffer(const char *data, size_t size, int num_threads) {
+    uint64_t start = metrics_begin();
+    // Skip the header line
+    const char *begin = memchr(data, '\n', size);
+    const char *end = data + size;
+    begin = begin != NULL ? begin + 1 : end;
+
+    if (num_threads <= 0) num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads <= 0) num_threads = 1;
+    size = end - begin;
+    if ((size_t) num_threads > size / MIN_CHUNK_SIZE) num_threads = size / MIN_CHUNK_SIZE;
+    if (num_threads == 0) num_threads = 1;
+
+    // Split the data into chunks that start and end on line boundaries
+    csv_chunk_t *chunks = calloc(num_threads, sizeof(csv_chunk_t));
+    assert(chunks != NULL);
+    const char *chunk_begin = begin;
+    for (int i = 0; i < num_threads; i++) {
+        const char *chunk_end = i == num_threads - 1 ? end : begin + size / num_threads * (i + 1);
+        if (chunk_end < chunk_begin) chunk_end = chunk_begin;
+        const char *newline = memchr(chunk_end, '\n', end - chunk_end);
+        if (i != num_threads - 1) chunk_end = newline != NULL ? newline + 1 : end;
+        chunks[i].begin = chunk_begin;
+        chunks[i].end = chunk_end;
+        chunk_begin = chunk_end;
+    }
+
+    for (int i = 1; i < num_threads; i++) {
+        chunks[i].threaded = pthread_create(&chunks[i].thread, NULL, parse_chunk, &chunks[i]) == 0;
+        if (!chunks[i].threaded) parse_chunk(&chunks[i]);
+    }
+    parse_chunk(&chunks[0]);
+    for (int i = 1; i < num_threads; i++) {
+        if (chunks[i].threaded) pthread_join(chunks[i].thread, NULL);
+    }
+
+    size_t count = build_users(chunks, num_threads);
+
+    for (int i = 0; i < num_threads; i++) free(chunks[i].rows);
+    free(chunks);
+    metrics_end(METRIC_LOAD_CSV, start);
+    return count;
+}
+
+size_t load_users_mapped(const char *path, int num_threads) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return 0;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        errno = 0;
+        return 0;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    size_t count = load_users_from_buffer(map, st.st_size, num_threads);
+    munmap(map, st.st_size);
+    errno = 0;
+    return count;
+}
@@ -0,0 +1,42 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stddef.h>
+#include "nodes.h"
+
+/**
+ * Loads users from CSV data in the users.csv layout. The data is split at
+ * newline boundaries into chunks which are parsed and sorted on worker
+ * threads. Users are then built in two phases: the sorted chunks are merged
+ * in a single pass, appending every user to its shard and interning its
+ * username into an ID, and then every friend field is resolved against those
+ * IDs. Friends that
+ * appear later in the data are linked like any other.
+ *
+ * Parameters:
+ * data: The CSV data, including the header line.
+ * size: The size of the data in bytes.
+ * num_threads: The number of worker threads, or 0 to use one per online CPU.
+ *
+ * Returns:
+ * The number of users loaded.
+ */
+size_t load_users_from_buffer(const char *data, size_t size, int num_threads);
+
+/**
+ * Loads users from a CSV file in the users.csv layout. The file is memory
+ * mapped and loaded with load_users_from_buffer, so loading takes O(n log n)
+ * instead of the O(n^2) of repeated sorted inserts. The number of rows comes
+ * from the file itself.
+ *
+ * Parameters:
+ * path: The path of the CSV file.
+ * num_threads: The number of worker threads, or 0 to use one per online CPU.
+ *
+ * Returns:
+ * The number of users loaded. 0 with errno set if the file could not be
+ * read, or 0 with errno cleared if the file has no users.
+ */
+size_t load_users_mapped(const char *path, int num_threads);
+
+#endif
@@ -2,27 +2,213 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
 #include "nodes.h"
 #include "functions.h"
+#include "loader.h"
+#include "shard.h"
+#include "strheap.h"
+#include "search.h"
+#include "suggest.h"
+#include "edgeset.h"
+#include "password.h"
+#include "metrics.h"
+#include "fanout.h"
+#include "snapshot.h"
+#include "prefix.h"
+#include "wal.h"
+#include "batch.h"
+#include "server.h"
 
-int main() {
-    FILE *csv_file = fopen("users.csv", "r");
+static void print_allocation_stats(void) {
+    shard_print_stats(stderr);
+    strheap_print_stats(stderr, &post_heap);
+    search_print_stats(stderr);
+    prefix_print_stats(stderr);
+    suggest_print_stats(stderr);
+    wal_print_stats(stderr);
+}
 
-    if (csv_file == NULL) {
-        perror("Error opening the CSV file");
+int main(int argc, char *argv[]) {
+    _Bool show_allocation_stats = false;
+    _Bool convert = false;
+    _Bool precompute_suggestions = false;
+    const char *input = NULL;
+    const char *commands = NULL;
+    const char *socket_path = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "sf:i:o:cl:SC:b:u:gmk:K:Md:")) != -1) {
+        switch (option) {
+            case 's':
+                show_allocation_stats = true;
+                break;
+            case 'f':
+                fanout_settings.enabled = true;
+                fanout_settings.celebrity_threshold = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                input = optarg;
+                break;
+            case 'o':
+                snapshot_path = optarg;
+                break;
+            case 'c':
+                convert = true;
+                break;
+            case 'l':
+                wal_settings.path = optarg;
+                break;
+            case 'S':
+                wal_settings.synchronous = true;
+                break;
+            case 'C':
+                wal_settings.checkpoint_bytes = (size_t) strtoul(optarg, NULL, 10) << 20;
+                break;
+            case 'b':
+                commands = optarg;
+                break;
+            case 'u':
+                socket_path = optarg;
+                break;
+            case 'g':
+                precompute_suggestions = true;
+                break;
+            case 'm':
+                edgeset_settings.symmetric = true;
+                break;
+            case 'k':
+                // Each step doubles the time and memory a hash takes, which is
+                // 1 GiB at the highest cost
+                password_settings.log_n = strtoul(optarg, NULL, 10);
+                if (password_settings.log_n < 1 || password_settings.log_n > 20) {
+                    fprintf(stderr, "The password cost must be from 1 to 20\n");
+                    return 1;
+                }
+                break;
+            case 'K':
+                password_settings.import_log_n = strtoul(optarg, NULL, 10);
+                if (password_settings.import_log_n < 1 || password_settings.import_log_n > 20) {
+                    fprintf(stderr, "The import password cost must be from 1 to 20\n");
+                    return 1;
+                }
+                break;
+            case 'M':
+                metrics_settings.enabled = true;
+                break;
+            case 'd':
+                metrics_settings.enabled = true;
+                metrics_settings.dump_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s] [-f threshold] [-i input] [-o snapshot] [-c] [-l log] [-S] [-C size] [-b commands] [-u socket] [-g] [-m] [-k cost] [-K cost] [-M] [-d metrics]\n"
+                                "  -s            Print allocation statistics on exit\n"
+                                "  -f threshold  Fan posts out to the feeds of followers, except for\n"
+                                "                authors with more than threshold followers\n"
+                                "  -i input      Load users from a CSV file or a snapshot (default: the\n"
+                                "                snapshot if it exists, users.csv otherwise)\n"
+                                "  -o snapshot   Where to save the snapshot (default: users.snap)\n"
+                                "  -c            Convert the input to a snapshot and exit, ignoring the\n"
+                                "                write-ahead log\n"
+                                "  -l log        Where to write the write-ahead log (default: users.wal)\n"
+                                "  -S            Wait for every change to be synced to the log\n"
+                                "  -C size       Save a snapshot and truncate the log whenever the server\n"
+                                "                has logged this many MiB since the last time, or 0 for\n"
+                                "                only on exit (default: 64)\n"
+                                "  -b commands   Run the commands of a file (- for stdin) instead of the\n"
+                                "                menus\n"
+                                "  -u socket     Serve the command protocol to clients of a Unix domain\n"
+                                "                socket until interrupted\n"
+                                "  -g            Precompute every user's friend suggestions on all CPUs\n"
+                                "                before starting\n"
+                                "  -m            Make friendships mutual: adding or removing a friend\n"
+                                "                does the same to the edge back from the friend\n"
+                                "  -k cost       Hash new passwords with 2^cost blocks of memory, from 1\n"
+                                "                to 20 (default: 14)\n"
+                                "  -K cost       Hash the passwords of a CSV file or an old snapshot with\n"
+                                "                2^cost blocks, if lower than -k, and rehash each at the\n"
+                                "                -k cost on its first login (default: 4)\n"
+                                "  -M            Time the core operations, for the stats command\n"
+                                "  -d metrics    Time the core operations and dump their latencies to a\n"
+                                "                file every 10 seconds\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (input == NULL) input = access(snapshot_path, R_OK) == 0 ? snapshot_path : "users.csv";
+
+    _Bool from_snapshot = snapshot_detect(input);
+    size_t loaded = from_snapshot ? snapshot_load(input) : load_users_mapped(input, 0);
+
+    if (loaded == 0 && errno != 0) {
+        fprintf(stderr, "Error loading %s: %s\n", input, strerror(errno));
+
+        return 1;
+    }
+
+    if (convert) {
+        _Bool saved = snapshot_save(snapshot_path);
+        if (!saved) perror("Error saving the snapshot");
+        teardown();
+        return saved ? EXIT_SUCCESS : 1;
+    }
 
+    // A CSV file gives its posts new timestamps every time it is loaded, while
+    // the log finds posts by timestamp, so the log is only ever written on
+    // top of a snapshot: one is saved before the first segment is opened
+    if (!from_snapshot) {
+        if (!wal_is_empty()) {
+            fprintf(stderr, "%s was logged on top of %s, not %s: load the snapshot or remove the log\n",
+                    wal_settings.path, snapshot_path, input);
+            teardown();
+            return 1;
+        }
+        if (!snapshot_save(snapshot_path)) {
+            perror("Error saving the snapshot");
+            teardown();
+            return 1;
+        }
+    }
+
+    // A snapshot loaded from elsewhere still has to be saved to the snapshot
+    // path on exit
+    wal_set_snapshot_current(!from_snapshot || strcmp(input, snapshot_path) == 0);
+    wal_replay();
+    if (!wal_open()) {
+        perror("Error opening the write-ahead log");
+        teardown();
         return 1;
     }
-    
-    user_t *users = read_CSV_and_create_users(csv_file, 50);
 
-    fclose(csv_file);
+    if (precompute_suggestions) suggest_precompute(0);
+
+    if (metrics_settings.dump_path != NULL && !metrics_start_dumps()) perror("Error starting the metrics dumps");
+
+    if (socket_path != NULL) {
+        if (!server_run(socket_path, 0)) fprintf(stderr, "Error serving on %s: %s\n", socket_path, strerror(errno));
+    } else if (commands != NULL) {
+        FILE *file = strcmp(commands, "-") == 0 ? stdin : fopen(commands, "r");
+        if (file == NULL) {
+            fprintf(stderr, "Error opening %s: %s\n", commands, strerror(errno));
+        } else {
+            batch_run(file, stdout);
+            if (file != stdin) fclose(file);
+        }
+    } else {
+        printf("Welcome to Text-Based Facebook\n");
+
+        main_menu();
+    }
+
+    if (!wal_checkpoint()) perror("Error saving the snapshot");
+
+    wal_close();
+
+    metrics_stop_dumps();
 
-    printf("Welcome to Text-Based Facebook\n");
- 
-    main_menu(users);
+    if (show_allocation_stats) print_allocation_stats();
 
-    teardown(users);
+    teardown();
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <pthread.h>
+#include "metrics.h"
+
+#define METRICS_SUB_BUCKET_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+// Values under METRICS_SUB_BUCKETS get a bucket each, and every power of two
+// above that gets METRICS_SUB_BUCKETS
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS)
+#define METRICS_CACHE_LINE 64
+
+metrics_settings_t metrics_settings = {false, NULL, 10};
+
+static const char *metric_names[METRIC_COUNT] = {
+    "find_user", "add_user", "add_friend", "delete_friend", "add_post", "delete_post", "load_csv"};
+
+typedef struct metrics_counter {
+    uint64_t total;
+    uint64_t max;
+    uint64_t buckets[METRICS_BUCKETS];
+} metrics_counter_t;
+
+// A thread's counters. Only the thread writes them, so updates are plain
+// loads and stores, and readers may see a total a moment before its bucket.
+typedef struct metrics_thread {
+    _Alignas(METRICS_CACHE_LINE) metrics_counter_t counters[METRIC_COUNT];
+    struct metrics_thread *next;
+} metrics_thread_t;
+
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_thread_t *threads = NULL;
+static __thread metrics_thread_t *self = NULL;
+
+// Threads are registered on their first record. Records are never unlinked,
+// so the counts of threads that have exited are kept, and the list can be
+// walked without the lock.
+static metrics_thread_t *register_thread(void) {
+    metrics_thread_t *thread = aligned_alloc(METRICS_CACHE_LINE, sizeof(metrics_thread_t));
+    assert(thread != NULL);
+    memset(thread, 0, sizeof(metrics_thread_t));
+    pthread_mutex_lock(&threads_lock);
+    thread->next = threads;
+    __atomic_store_n(&threads, thread, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&threads_lock);
+    return thread;
+}
+
+static size_t bucket_for(uint64_t value) {
+    if (value < METRICS_SUB_BUCKETS) return value;
+    int exponent = 63 - __builtin_clzll(value);
+    size_t sub_bucket = (value >> (exponent - METRICS_SUB_BUCKET_BITS)) & (METRICS_SUB_BUCKETS - 1);
+    return (size_t) (exponent - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS + sub_bucket;
+}
+
+// The highest value that falls into a bucket
+static uint64_t bucket_limit(size_t bucket) {
+    if (bucket < METRICS_SUB_BUCKETS) return bucket;
+    int exponent = bucket / METRICS_SUB_BUCKETS + METRICS_SUB_BUCKET_BITS - 1;
+    uint64_t base = (uint64_t) (METRICS_SUB_BUCKETS + bucket % METRICS_SUB_BUCKETS) << (exponent - METRICS_SUB_BUCKET_BITS);
+    return base + ((uint64_t) 1 << (exponent - METRICS_SUB_BUCKET_BITS)) - 1;
+}
+
+#define metrics_add(field, amount) __atomic_store_n(&(field), (field) + (amount), __ATOMIC_RELAXED)
+
+void metrics_record(metric_t metric, uint64_t nanoseconds) {
+    if (self == NULL) self = register_thread();
+    metrics_counter_t *counter = &self->counters[metric];
+    metrics_add(counter->total, nanoseconds);
+    if (nanoseconds > counter->max) __atomic_store_n(&counter->max, nanoseconds, __ATOMIC_RELAXED);
+    metrics_add(counter->buckets[bucket_for(nanoseconds)], 1);
+}
+
+// Finds the latency under which a fraction of the recorded operations fall,
+// which is never more than the highest latency recorded
+static uint64_t percentile(const uint64_t *buckets, uint64_t count, uint64_t max, double fraction) {
+    uint64_t rank = (uint64_t) (count * fraction);
+    if (rank >= count) rank = count - 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < METRICS_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > rank) return bucket_limit(i) < max ? bucket_limit(i) : max;
+    }
+    return max;
+}
+
+void metrics_print(FILE *file) {
+    for (int metric = 0; metric < METRIC_COUNT; metric++) {
+        uint64_t buckets[METRICS_BUCKETS] = {0};
+        uint64_t count = 0;
+        uint64_t total = 0;
+        uint64_t max = 0;
+        for (metrics_thread_t *thread = __atomic_load_n(&threads, __ATOMIC_ACQUIRE); thread != NULL; thread = thread->next) {
+            const metrics_counter_t *counter = &thread->counters[metric];
+            total += __atomic_load_n(&counter->total, __ATOMIC_RELAXED);
+            uint64_t thread_max = __atomic_load_n(&counter->max, __ATOMIC_RELAXED);
+            if (thread_max > max) max = thread_max;
+            // The count is summed from the buckets, so the percentiles always
+            // agree with it
+            for (size_t i = 0; i < METRICS_BUCKETS; i++) {
+                uint64_t n = __atomic_load_n(&counter->buckets[i], __ATOMIC_RELAXED);
+                buckets[i] += n;
+                count += n;
+            }
+        }
+        if (count == 0) {
+            fprintf(file, "%s 0 0 0 0 0 0\n", metric_names[metric]);
+            continue;
+        }
+        fprintf(file, "%s %llu %llu %llu %llu %llu %llu\n", metric_names[metric], (unsigned long long) count,
+                (unsigned long long) (total / count), (unsigned long long) percentile(buckets, count, max, 0.5),
+                (unsigned long long) percentile(buckets, count, max, 0.99),
+                (unsigned long long) percentile(buckets, count, max, 0.999),
+                (unsigned long long) max);
+    }
+}
+
+static pthread_t dump_thread;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dump_cond;
+static _Bool dumping = false;
+static _Bool dump_stopping = false;
+
+// Writes a dump next to the dump file and renames it over the file
+static void dump(void) {
+    size_t length = strlen(metrics_settings.dump_path);
+    char *path = malloc(length + 5);
+    assert(path != NULL);
+    memcpy(path, metrics_settings.dump_path, length);
+    memcpy(path + length, ".tmp", 5);
+    FILE *file = fopen(path, "w");
+    if (file != NULL) {
+        fprintf(file, "# operation count mean_ns p50_ns p99_ns p999_ns max_ns\n");
+        metrics_print(file);
+        if (fclose(file) == 0) rename(path, metrics_settings.dump_path);
+    }
+    free(path);
+}
+
+static void *dump_loop(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&dump_lock);
+    while (!dump_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += metrics_settings.dump_interval;
+        while (!dump_stopping && pthread_cond_timedwait(&dump_cond, &dump_lock, &deadline) != ETIMEDOUT) {}
+        pthread_mutex_unlock(&dump_lock);
+        dump();
+        pthread_mutex_lock(&dump_lock);
+    }
+    pthread_mutex_unlock(&dump_lock);
+    return NULL;
+}
+
+_Bool metrics_start_dumps(void) {
+    if (metrics_settings.dump_path == NULL || dumping) return false;
+    // The deadlines are on the monotonic clock, so setting the time of day
+    // does not skip or repeat dumps
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&dump_cond, &attributes);
+    pthread_condattr_destroy(&attributes);
+    dump_stopping = false;
+    // Signals are left to the other threads, such as the server's signalfd
+    sigset_t signals;
+    sigset_t old_signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+    int error = pthread_create(&dump_thread, NULL, dump_loop, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    if (error != 0) {
+        pthread_cond_destroy(&dump_cond);
+        errno = error;
+        return false;
+    }
+    dumping = true;
+    return true;
+}
+
+void metrics_stop_dumps(void) {
+    if (!dumping) return;
+    pthread_mutex_lock(&dump_lock);
+    dump_stopping = true;
+    pthread_cond_signal(&dump_cond);
+    pthread_mutex_unlock(&dump_lock);
+    pthread_join(dump_thread, NULL);
+    pthread_cond_destroy(&dump_cond);
+    dumping = false;
+}
@@ -0,0 +1,125 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// How many times each core operation ran and how long it took. Every thread
+// counts into its own counters and histograms, which are only summed when
+// they are read, so recording never contends. Each histogram is log-linear,
+// like an HDR histogram: 16 buckets for every power of two, so a percentile
+// is within about 6% of the true latency anywhere from nanoseconds to
+// seconds. Recording is off unless enabled at run time, and building with
+// -DMETRICS_DISABLED compiles it out altogether.
+typedef struct metrics_settings {
+    _Bool enabled;
+    const char *dump_path; // Where to dump the metrics periodically, or NULL
+    unsigned int dump_interval; // Seconds between dumps
+} metrics_settings_t;
+
+typedef enum metric {
+    METRIC_FIND_USER,
+    METRIC_ADD_USER,
+    METRIC_ADD_FRIEND,
+    METRIC_DELETE_FRIEND,
+    METRIC_ADD_POST,
+    METRIC_DELETE_POST,
+    METRIC_LOAD_CSV,
+    METRIC_COUNT
+} metric_t;
+
+extern metrics_settings_t metrics_settings;
+
+/**
+ * Records that an operation ran, on the calling thread's counters.
+ *
+ * Parameters:
+ * metric: The operation.
+ * nanoseconds: How long it took.
+ *
+ * Returns:
+ * None
+ */
+void metrics_record(metric_t metric, uint64_t nanoseconds);
+
+/**
+ * Starts timing an operation. Disabled, it only checks a flag.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * The current time in nanoseconds, or 0 if metrics are disabled.
+ */
+static inline uint64_t metrics_begin(void) {
+#ifdef METRICS_DISABLED
+    return 0;
+#else
+    if (!__builtin_expect(metrics_settings.enabled, 0)) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/**
+ * Finishes timing an operation started with metrics_begin and records it.
+ *
+ * Parameters:
+ * metric: The operation.
+ * start: What metrics_begin returned.
+ *
+ * Returns:
+ * None
+ */
+static inline void metrics_end(metric_t metric, uint64_t start) {
+#ifdef METRICS_DISABLED
+    (void) metric;
+    (void) start;
+#else
+    if (__builtin_expect(start == 0, 1)) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    metrics_record(metric, (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec - start);
+#endif
+}
+
+/**
+ * Prints one line per operation: its name, how many times it ran, and its
+ * mean, p50, p99, p99.9 and maximum latencies in nanoseconds.
+ *
+ * Parameters:
+ * file: The file to print to.
+ *
+ * Returns:
+ * None
+ */
+void metrics_print(FILE *file);
+
+/**
+ * Starts a thread that dumps the metrics to metrics_settings.dump_path
+ * every metrics_settings.dump_interval seconds. Each dump replaces the last
+ * one whole, so readers never see a partial dump.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * True if the thread started, or false with errno set if it could not be
+ * started.
+ */
+_Bool metrics_start_dumps(void);
+
+/**
+ * Stops the dump thread, if any, after a final dump.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void metrics_stop_dumps(void);
+
+#endif
@@ -6,29 +6,48 @@
 #define MAX_CONTENT_SIZE 250
 
 typedef struct user user_t;
-typedef struct friend friend_t;
 typedef struct post post_t;
+typedef struct password_hash password_hash_t;
+typedef struct post_chunk post_chunk_t;
+typedef struct post_table post_table_t;
+
+// A stable reference to a user: the user's ID, and the generation of that ID,
+// which changes every time the ID is reused after its user is deleted. A
+// handle outlives its user and is resolved to NULL from then on.
+typedef struct user_handle {
+    unsigned int id;
+    unsigned int generation;
+} user_handle_t;
+
+// A stable reference to a post, like a user handle: the post's ID and the
+// generation of that ID
+typedef struct post_handle {
+    unsigned int id;
+    unsigned int generation;
+} post_handle_t;
 
 // A linked list of users
 struct user {
+    unsigned int id; // Dense index assigned when the user is added to the directory
+    unsigned int generation; // How many users held the ID before this one
     char username[MAX_USERNAME_SIZE];
-    char password[MAX_PASSWORD_SIZE];
-    friend_t* friends;
-    post_t* posts;
+    const password_hash_t* password; // Replaced rather than changed in place, so logins can read it without a lock
+    post_table_t* posts; // Oldest first, in chunks, read through postlist.h
+    unsigned int num_posts; // Including the deleted posts not yet compacted away
+    unsigned int num_deleted;
     user_t* next;
 };
 
-// A linked list of a user's friends
-struct friend {
-    char username[MAX_USERNAME_SIZE];
-    post_t** posts;
-    friend_t* next;
-};
-
-// A linked list of a user's posts
+// A user's post. The content lives in the post heap, and is at most
+// MAX_CONTENT_SIZE - 1 characters long.
 struct post {
-    char content[MAX_CONTENT_SIZE];
-    post_t* next;
+    long long timestamp; // Microseconds since the epoch, unique and increasing
+    unsigned long long content;
+    unsigned short length;
+    unsigned int id; // Dense index within the author's shard, tagged like user IDs
+    unsigned int generation; // How many posts held the ID before this one
+    unsigned int position; // Where the post is in its author's list
+    unsigned int search_id; // Where the post is in the search index
 };
 
 #endif
\ No newline at end of file
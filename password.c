@@ -0,0 +1,382 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include "password.h"
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_SIZE 32
+#define SALSA_WORDS 16
+
+password_settings_t password_settings = {14, 4, 8, 1, 0};
+
+typedef struct sha256 {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[SHA256_BLOCK_SIZE];
+    size_t used;
+} sha256_t;
+
+// HMAC-SHA256 keyed with a password, with the inner and outer pads already
+// hashed so every PBKDF2 block only hashes its own message
+typedef struct hmac {
+    sha256_t inner;
+    sha256_t outer;
+} hmac_t;
+
+// A bulk hashing thread and the scrypt memory it reuses for every password
+typedef struct hash_worker {
+    pthread_t thread;
+    _Bool threaded;
+    password_hash_t *hashes;
+    const char *const *passwords;
+    size_t count;
+    size_t *next;
+    unsigned int log_n;
+} hash_worker_t;
+
+static const uint32_t sha256_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t rotate_right(uint32_t x, unsigned int n) {
+    return x >> n | x << (32 - n);
+}
+
+static uint32_t rotate_left(uint32_t x, unsigned int n) {
+    return x << n | x >> (32 - n);
+}
+
+static uint32_t load_be32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void store_be32(uint8_t *p, uint32_t x) {
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+static uint32_t load_le32(const uint8_t *p) {
+    return (uint32_t) p[3] << 24 | (uint32_t) p[2] << 16 | (uint32_t) p[1] << 8 | p[0];
+}
+
+static void store_le32(uint8_t *p, uint32_t x) {
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+    p[3] = x >> 24;
+}
+
+static void sha256_compress(uint32_t state[8], const uint8_t block[SHA256_BLOCK_SIZE]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) w[i] = load_be32(block + i * 4);
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^ w[i - 15] >> 3;
+        uint32_t s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^ w[i - 2] >> 10;
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25)) + ((e & f) ^ (~e & g))
+                      + sha256_constants[i] + w[i];
+        uint32_t t2 = (rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void sha256_init(sha256_t *sha) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+static void sha256_update(sha256_t *sha, const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    sha->length += length;
+    if (sha->used > 0) {
+        size_t take = SHA256_BLOCK_SIZE - sha->used < length ? SHA256_BLOCK_SIZE - sha->used : length;
+        memcpy(sha->block + sha->used, bytes, take);
+        sha->used += take;
+        bytes += take;
+        length -= take;
+        if (sha->used < SHA256_BLOCK_SIZE) return;
+        sha256_compress(sha->state, sha->block);
+        sha->used = 0;
+    }
+    for (; length >= SHA256_BLOCK_SIZE; bytes += SHA256_BLOCK_SIZE, length -= SHA256_BLOCK_SIZE) sha256_compress(sha->state, bytes);
+    memcpy(sha->block, bytes, length);
+    sha->used = length;
+}
+
+static void sha256_final(sha256_t *sha, uint8_t digest[SHA256_SIZE]) {
+    uint64_t bits = sha->length * 8;
+    uint8_t padding[SHA256_BLOCK_SIZE * 2] = {0x80};
+    // Pad to 56 bytes past a block boundary, leaving room for the length
+    size_t padding_length = (sha->used < 56 ? 56 : 120) - sha->used;
+    for (int i = 0; i < 8; i++) padding[padding_length + i] = bits >> (56 - i * 8);
+    sha256_update(sha, padding, padding_length + 8);
+    for (int i = 0; i < 8; i++) store_be32(digest + i * 4, sha->state[i]);
+}
+
+static void hmac_init(hmac_t *hmac, const void *key, size_t key_length) {
+    uint8_t block[SHA256_BLOCK_SIZE] = {0};
+    if (key_length > SHA256_BLOCK_SIZE) {
+        sha256_t sha;
+        sha256_init(&sha);
+        sha256_update(&sha, key, key_length);
+        sha256_final(&sha, block);
+    } else {
+        memcpy(block, key, key_length);
+    }
+    uint8_t pad[SHA256_BLOCK_SIZE];
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++) pad[i] = block[i] ^ 0x36;
+    sha256_init(&hmac->inner);
+    sha256_update(&hmac->inner, pad, sizeof(pad));
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++) pad[i] = block[i] ^ 0x5c;
+    sha256_init(&hmac->outer);
+    sha256_update(&hmac->outer, pad, sizeof(pad));
+}
+
+// PBKDF2-HMAC-SHA256 with a single iteration, which is all scrypt uses it
+// for: the salt is spread into as many blocks as the key needs
+static void pbkdf2(const hmac_t *hmac, const void *salt, size_t salt_length, uint8_t *key, size_t key_length) {
+    for (uint32_t i = 1; key_length > 0; i++) {
+        uint8_t counter[4];
+        store_be32(counter, i);
+        uint8_t digest[SHA256_SIZE];
+        sha256_t inner = hmac->inner;
+        sha256_update(&inner, salt, salt_length);
+        sha256_update(&inner, counter, sizeof(counter));
+        sha256_final(&inner, digest);
+        sha256_t outer = hmac->outer;
+        sha256_update(&outer, digest, sizeof(digest));
+        sha256_final(&outer, digest);
+        size_t take = key_length < SHA256_SIZE ? key_length : SHA256_SIZE;
+        memcpy(key, digest, take);
+        key += take;
+        key_length -= take;
+    }
+}
+
+static void salsa20_8(uint32_t b[SALSA_WORDS]) {
+    uint32_t x[SALSA_WORDS];
+    memcpy(x, b, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+        x[4] ^= rotate_left(x[0] + x[12], 7);
+        x[8] ^= rotate_left(x[4] + x[0], 9);
+        x[12] ^= rotate_left(x[8] + x[4], 13);
+        x[0] ^= rotate_left(x[12] + x[8], 18);
+        x[9] ^= rotate_left(x[5] + x[1], 7);
+        x[13] ^= rotate_left(x[9] + x[5], 9);
+        x[1] ^= rotate_left(x[13] + x[9], 13);
+        x[5] ^= rotate_left(x[1] + x[13], 18);
+        x[14] ^= rotate_left(x[10] + x[6], 7);
+        x[2] ^= rotate_left(x[14] + x[10], 9);
+        x[6] ^= rotate_left(x[2] + x[14], 13);
+        x[10] ^= rotate_left(x[6] + x[2], 18);
+        x[3] ^= rotate_left(x[15] + x[11], 7);
+        x[7] ^= rotate_left(x[3] + x[15], 9);
+        x[11] ^= rotate_left(x[7] + x[3], 13);
+        x[15] ^= rotate_left(x[11] + x[7], 18);
+        x[1] ^= rotate_left(x[0] + x[3], 7);
+        x[2] ^= rotate_left(x[1] + x[0], 9);
+        x[3] ^= rotate_left(x[2] + x[1], 13);
+        x[0] ^= rotate_left(x[3] + x[2], 18);
+        x[6] ^= rotate_left(x[5] + x[4], 7);
+        x[7] ^= rotate_left(x[6] + x[5], 9);
+        x[4] ^= rotate_left(x[7] + x[6], 13);
+        x[5] ^= rotate_left(x[4] + x[7], 18);
+        x[11] ^= rotate_left(x[10] + x[9], 7);
+        x[8] ^= rotate_left(x[11] + x[10], 9);
+        x[9] ^= rotate_left(x[8] + x[11], 13);
+        x[10] ^= rotate_left(x[9] + x[8], 18);
+        x[12] ^= rotate_left(x[15] + x[14], 7);
+        x[13] ^= rotate_left(x[12] + x[15], 9);
+        x[14] ^= rotate_left(x[13] + x[12], 13);
+        x[15] ^= rotate_left(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < SALSA_WORDS; i++) b[i] += x[i];
+}
+
+// Mixes the 2r 64-byte blocks of b through Salsa20/8 into y, writing the
+// even blocks to the first half and the odd ones to the second
+static void block_mix(const uint32_t *b, uint32_t *y, unsigned int r) {
+    uint32_t x[SALSA_WORDS];
+    memcpy(x, b + (2 * r - 1) * SALSA_WORDS, sizeof(x));
+    for (unsigned int i = 0; i < 2 * r; i++) {
+        for (int k = 0; k < SALSA_WORDS; k++) x[k] ^= b[i * SALSA_WORDS + k];
+        salsa20_8(x);
+        memcpy(y + ((i & 1) * r + i / 2) * SALSA_WORDS, x, sizeof(x));
+    }
+}
+
+// The memory-hard part of scrypt: fills v with 2^log_n successive mixes of
+// the block, then mixes the block with entries of v picked by its own
+// contents. scratch holds v followed by two blocks of working space.
+static void ro_mix(uint8_t *block, unsigned int log_n, unsigned int r, uint32_t *scratch) {
+    size_t words = 32 * (size_t) r;
+    size_t n = (size_t) 1 << log_n;
+    uint32_t *v = scratch;
+    uint32_t *x = v + n * words;
+    uint32_t *y = x + words;
+    for (size_t k = 0; k < words; k++) x[k] = load_le32(block + k * 4);
+    // Two steps per iteration, so the block mixes back and forth between x
+    // and y instead of being copied back after every step
+    for (size_t i = 0; i < n; i += 2) {
+        memcpy(v + i * words, x, words * sizeof(uint32_t));
+        block_mix(x, y, r);
+        memcpy(v + (i + 1) * words, y, words * sizeof(uint32_t));
+        block_mix(y, x, r);
+    }
+    for (size_t i = 0; i < n; i += 2) {
+        size_t j = x[(2 * r - 1) * SALSA_WORDS] & (n - 1);
+        for (size_t k = 0; k < words; k++) x[k] ^= v[j * words + k];
+        block_mix(x, y, r);
+        j = y[(2 * r - 1) * SALSA_WORDS] & (n - 1);
+        for (size_t k = 0; k < words; k++) y[k] ^= v[j * words + k];
+        block_mix(y, x, r);
+    }
+    for (size_t k = 0; k < words; k++) store_le32(block + k * 4, x[k]);
+}
+
+static size_t scratch_size(unsigned int log_n, unsigned int r) {
+    return (((size_t) 1 << log_n) + 2) * 128 * r;
+}
+
+static void scrypt(const void *password, size_t password_length, const void *salt, size_t salt_length,
+                   unsigned int log_n, unsigned int r, unsigned int p, uint8_t *key, size_t key_length, uint32_t *scratch) {
+    hmac_t hmac;
+    hmac_init(&hmac, password, password_length);
+    size_t block_size = 128 * (size_t) r;
+    uint8_t *blocks = malloc(block_size * p);
+    assert(blocks != NULL);
+    pbkdf2(&hmac, salt, salt_length, blocks, block_size * p);
+    for (unsigned int i = 0; i < p; i++) ro_mix(blocks + i * block_size, log_n, r, scratch);
+    pbkdf2(&hmac, blocks, block_size * p, key, key_length);
+    free(blocks);
+}
+
+void password_scrypt(const void *password, size_t password_length, const void *salt, size_t salt_length,
+                     unsigned int log_n, unsigned int r, unsigned int p, uint8_t *key, size_t key_length) {
+    assert(log_n > 0 && log_n < 32 && r > 0 && p > 0);
+    uint32_t *scratch = malloc(scratch_size(log_n, r));
+    assert(scratch != NULL);
+    scrypt(password, password_length, salt, salt_length, log_n, r, p, key, key_length, scratch);
+    free(scratch);
+}
+
+static void random_salt(uint8_t salt[PASSWORD_SALT_SIZE]) {
+    size_t filled = 0;
+    while (filled < PASSWORD_SALT_SIZE) {
+        ssize_t got = getrandom(salt + filled, PASSWORD_SALT_SIZE - filled, 0);
+        assert(got > 0);
+        filled += got;
+    }
+}
+
+// Hashes a password into a hash whose cost and salt are already set
+static void derive_key(password_hash_t *hash, const char *password, uint32_t *scratch) {
+    scrypt(password, strlen(password), hash->salt, PASSWORD_SALT_SIZE, hash->log_n, hash->r, hash->p,
+           hash->key, PASSWORD_KEY_SIZE, scratch);
+}
+
+static void start_hash(password_hash_t *hash, unsigned int log_n) {
+    hash->log_n = log_n;
+    hash->r = password_settings.r;
+    hash->p = password_settings.p;
+    hash->reserved = 0;
+    random_salt(hash->salt);
+}
+
+void password_hash(password_hash_t *hash, const char *password) {
+    start_hash(hash, password_settings.log_n);
+    uint32_t *scratch = malloc(scratch_size(hash->log_n, hash->r));
+    assert(scratch != NULL);
+    derive_key(hash, password, scratch);
+    free(scratch);
+}
+
+static void *hash_passwords(void *arg) {
+    hash_worker_t *worker = arg;
+    // Every hash is made at the same cost, so one allocation serves them all
+    // and its pages are only faulted in once
+    uint32_t *scratch = malloc(scratch_size(worker->log_n, password_settings.r));
+    assert(scratch != NULL);
+    size_t i;
+    while ((i = __atomic_fetch_add(worker->next, 1, __ATOMIC_RELAXED)) < worker->count) {
+        start_hash(&worker->hashes[i], worker->log_n);
+        derive_key(&worker->hashes[i], worker->passwords[i], scratch);
+    }
+    free(scratch);
+    return NULL;
+}
+
+void password_hash_all(password_hash_t *hashes, const char *const *passwords, size_t count, int num_threads) {
+    if (num_threads <= 0) num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads <= 0) num_threads = 1;
+    if ((size_t) num_threads > count) num_threads = count > 0 ? (int) count : 1;
+    size_t next = 0;
+    unsigned int log_n = password_settings.import_log_n < password_settings.log_n ? password_settings.import_log_n : password_settings.log_n;
+    hash_worker_t *workers = calloc(num_threads, sizeof(hash_worker_t));
+    assert(workers != NULL);
+    for (int i = 0; i < num_threads; i++) workers[i] = (hash_worker_t) {0, false, hashes, passwords, count, &next, log_n};
+    for (int i = 1; i < num_threads; i++) {
+        workers[i].threaded = pthread_create(&workers[i].thread, NULL, hash_passwords, &workers[i]) == 0;
+    }
+    hash_passwords(&workers[0]);
+    for (int i = 1; i < num_threads; i++) {
+        if (workers[i].threaded) pthread_join(workers[i].thread, NULL);
+    }
+    free(workers);
+}
+
+_Bool password_verify(const password_hash_t *hash, const char *password) {
+    // A corrupt hash may ask for more memory than there is
+    if (hash->log_n == 0 || hash->log_n >= 32 || hash->r == 0 || hash->p == 0) return false;
+    uint32_t *scratch = malloc(scratch_size(hash->log_n, hash->r));
+    if (scratch == NULL) return false;
+    password_hash_t guess = *hash;
+    derive_key(&guess, password, scratch);
+    free(scratch);
+    const uint8_t *key = guess.key;
+    // Every byte is compared whatever the earlier ones were
+    uint8_t difference = 0;
+    for (int i = 0; i < PASSWORD_KEY_SIZE; i++) difference |= key[i] ^ hash->key[i];
+    return difference == 0;
+}
+
+_Bool password_outdated(const password_hash_t *hash) {
+    return hash->log_n < password_settings.log_n || hash->r < password_settings.r || hash->p < password_settings.p;
+}
@@ -0,0 +1,110 @@
+#ifndef PASSWORD_H
+#define PASSWORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PASSWORD_SALT_SIZE 16
+#define PASSWORD_KEY_SIZE 32
+
+// Passwords are stored as scrypt hashes (RFC 7914), which are salted and
+// memory-hard: each hash fills and then reads back 128 * r * 2^log_n bytes in
+// an order that depends on the password, so guessing passwords costs memory
+// as well as time and does not get much cheaper on GPUs or custom hardware.
+// The cost is set per deployment and stored in every hash, so hashes made
+// with an older cost still verify after it changes. Bulk imports hash at a
+// lower cost, since at the full one a million users take hours, and each of
+// those hashes is replaced at the full cost on the user's first login.
+typedef struct password_settings {
+    unsigned int log_n; // 2^log_n blocks of memory per hash
+    unsigned int import_log_n; // The same for bulk imports, if lower
+    unsigned int r; // The size of each block, in units of 128 bytes
+    unsigned int p; // How many times the memory-hard mixing runs
+    int threads; // Threads the server verifies passwords on, or 0 for half the CPUs
+} password_settings_t;
+
+// A salted password hash and the cost it was made with
+typedef struct password_hash {
+    uint8_t log_n;
+    uint8_t r;
+    uint8_t p;
+    uint8_t reserved;
+    uint8_t salt[PASSWORD_SALT_SIZE];
+    uint8_t key[PASSWORD_KEY_SIZE];
+} password_hash_t;
+
+extern password_settings_t password_settings;
+
+/**
+ * Derives a key with scrypt.
+ *
+ * Parameters:
+ * password: The password.
+ * password_length: The length of the password.
+ * salt: The salt.
+ * salt_length: The length of the salt.
+ * log_n: The base 2 logarithm of the number of blocks, at most 31.
+ * r: The size of each block, in units of 128 bytes.
+ * p: The number of times the mixing runs.
+ * key: Where to store the key.
+ * key_length: The length of the key.
+ *
+ * Returns:
+ * None
+ */
+void password_scrypt(const void *password, size_t password_length, const void *salt, size_t salt_length,
+                     unsigned int log_n, unsigned int r, unsigned int p, uint8_t *key, size_t key_length);
+
+/**
+ * Hashes a password with a fresh random salt at the current cost.
+ *
+ * Parameters:
+ * hash: Where to store the hash.
+ * password: The password.
+ *
+ * Returns:
+ * None
+ */
+void password_hash(password_hash_t *hash, const char *password);
+
+/**
+ * Hashes many passwords at once, such as the plaintext rows of a bulk
+ * import, split across threads, at the import cost.
+ *
+ * Parameters:
+ * hashes: Where to store the hashes, one per password.
+ * passwords: The passwords.
+ * count: The number of passwords.
+ * num_threads: The number of threads, or 0 for one per CPU.
+ *
+ * Returns:
+ * None
+ */
+void password_hash_all(password_hash_t *hashes, const char *const *passwords, size_t count, int num_threads);
+
+/**
+ * Checks a password against a hash. The keys are compared in constant time,
+ * so the time taken does not tell how much of a guess was right.
+ *
+ * Parameters:
+ * hash: The hash.
+ * password: The password to check.
+ *
+ * Returns:
+ * True if the password matches and false otherwise.
+ */
+_Bool password_verify(const password_hash_t *hash, const char *password);
+
+/**
+ * Checks if a hash was made at a lower cost than the current one, such as by
+ * a bulk import, so it should be replaced once the password is known.
+ *
+ * Parameters:
+ * hash: The hash.
+ *
+ * Returns:
+ * True if the hash is cheaper to guess than a new one and false otherwise.
+ */
+_Bool password_outdated(const password_hash_t *hash);
+
+#endif
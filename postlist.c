@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <pthread.h>
+#include "nodes.h"
+#include "shard.h"
+#include "arena.h"
+#include "epoch.h"
+#include "postlist.h"
+
+#define POSTLIST_INITIAL_CHUNKS 4
+
+// Stands in for the chunks a compacted list no longer needs, so readers that
+// loaded the length from before the compaction only find deleted slots there
+static const post_chunk_t empty_chunk;
+
+static void reclaim_chunk(void *arena, void *chunk) {
+    arena_free(arena, chunk);
+}
+
+// Reads the slot at a position, which must be below a length loaded earlier
+// in the same epoch
+static post_t *slot(const post_table_t *table, size_t position) {
+    const post_chunk_t *chunk = epoch_load(table->chunks[position / POSTLIST_CHUNK_SIZE]);
+    return epoch_load(chunk->posts[position % POSTLIST_CHUNK_SIZE]);
+}
+
+// Finds the newest post below a position that is older than a timestamp,
+// moving the position to it
+static post_t *older_in(const post_table_t *table, size_t *position, long long timestamp) {
+    while (*position > 0) {
+        post_t *post = slot(table, --*position);
+        if (post != NULL && post->timestamp < timestamp) return post;
+    }
+    return NULL;
+}
+
+static post_chunk_t *new_chunk(shard_t *shard) {
+    post_chunk_t *chunk = arena_alloc(&shard->chunk_arena);
+    assert(chunk != NULL);
+    // Readers may look past the length, so unused slots read as deleted
+    memset(chunk, 0, sizeof(post_chunk_t));
+    return chunk;
+}
+
+size_t postlist_length(const user_t *user) {
+    return epoch_load(user->num_posts);
+}
+
+size_t postlist_count(const user_t *user) {
+    return user->num_posts - user->num_deleted;
+}
+
+post_t *postlist_get(const user_t *user, size_t position) {
+    // The length is loaded before the table, so the table holds every
+    // position below it
+    if (position >= postlist_length(user)) return NULL;
+    return slot(epoch_load(user->posts), position);
+}
+
+post_t *postlist_newest(const user_t *user) {
+    size_t position = postlist_length(user);
+    return postlist_older(user, &position, LLONG_MAX);
+}
+
+post_t *postlist_older(const user_t *user, size_t *position, long long timestamp) {
+    size_t length = postlist_length(user);
+    if (*position > length) *position = length;
+    if (*position == 0) return NULL;
+    // Only posts pushed after the post at the position was deleted are
+    // newer than it, and they all sit above the older ones
+    return older_in(epoch_load(user->posts), position, timestamp);
+}
+
+post_t *postlist_find(const user_t *user, long long timestamp) {
+    // The posts are in order of timestamp, with deleted ones in between
+    const post_table_t *table = epoch_load(user->posts);
+    size_t low = 0;
+    size_t high = postlist_length(user);
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        size_t probe = middle;
+        post_t *post;
+        while ((post = slot(table, probe)) == NULL && probe > low) probe--;
+        if (post == NULL || post->timestamp < timestamp) {
+            low = middle + 1;
+        } else if (post->timestamp > timestamp) {
+            high = probe;
+        } else {
+            return post;
+        }
+    }
+    return NULL;
+}
+
+void postlist_push(user_t *user, post_t *post) {
+    size_t position = user->num_posts;
+    size_t chunk = position / POSTLIST_CHUNK_SIZE;
+    post_table_t *table = user->posts;
+    if (table == NULL || chunk >= table->capacity) {
+        size_t capacity = table == NULL ? POSTLIST_INITIAL_CHUNKS : table->capacity * 2;
+        post_table_t *grown = calloc(1, sizeof(post_table_t) + capacity * sizeof(post_chunk_t *));
+        assert(grown != NULL);
+        grown->capacity = capacity;
+        if (table != NULL) memcpy(grown->chunks, table->chunks, table->capacity * sizeof(post_chunk_t *));
+        epoch_publish(user->posts, grown);
+        if (table != NULL) epoch_retire(&shard_of(user)->retired, epoch_free, NULL, table);
+        table = grown;
+    }
+    // Chunks are kept when their posts are popped, and refilled later
+    if (table->chunks[chunk] == NULL || table->chunks[chunk] == &empty_chunk) {
+        epoch_publish(table->chunks[chunk], new_chunk(shard_of(user)));
+    }
+    post->position = position;
+    epoch_publish(table->chunks[chunk]->posts[position % POSTLIST_CHUNK_SIZE], post);
+    epoch_publish(user->num_posts, position + 1);
+}
+
+post_t *postlist_pop(user_t *user) {
+    size_t length = user->num_posts;
+    if (length == 0) return NULL;
+    post_t *post = slot(user->posts, --length);
+    // The deleted posts under it go with it, so the newest slot always holds
+    // a post
+    while (length > 0 && slot(user->posts, length - 1) == NULL) {
+        length--;
+        user->num_deleted--;
+    }
+    epoch_publish(user->num_posts, length);
+    return post;
+}
+
+// Rewrites a user's list without its deleted posts. Readers that already
+// loaded the old table carry on with it, and readers that load the new one
+// with the old length only find deleted slots past the posts.
+static void compact(user_t *user) {
+    shard_t *shard = shard_of(user);
+    post_table_t *table = user->posts;
+    size_t length = user->num_posts;
+    post_table_t *compacted = calloc(1, sizeof(post_table_t) + table->capacity * sizeof(post_chunk_t *));
+    assert(compacted != NULL);
+    compacted->capacity = table->capacity;
+    size_t live = 0;
+    for (size_t i = 0; i < length; i++) {
+        post_t *post = slot(table, i);
+        if (post == NULL) continue;
+        if (live % POSTLIST_CHUNK_SIZE == 0) compacted->chunks[live / POSTLIST_CHUNK_SIZE] = new_chunk(shard);
+        compacted->chunks[live / POSTLIST_CHUNK_SIZE]->posts[live % POSTLIST_CHUNK_SIZE] = post;
+        post->position = live++;
+    }
+    size_t used = (live + POSTLIST_CHUNK_SIZE - 1) / POSTLIST_CHUNK_SIZE;
+    for (size_t i = used; i < (length + POSTLIST_CHUNK_SIZE - 1) / POSTLIST_CHUNK_SIZE; i++) {
+        compacted->chunks[i] = (post_chunk_t *) &empty_chunk;
+    }
+    epoch_publish(user->posts, compacted);
+    epoch_publish(user->num_posts, live);
+    user->num_deleted = 0;
+    for (size_t i = 0; i < table->capacity && table->chunks[i] != NULL; i++) {
+        if (table->chunks[i] != &empty_chunk) epoch_retire(&shard->retired, reclaim_chunk, &shard->chunk_arena, table->chunks[i]);
+    }
+    epoch_retire(&shard->retired, epoch_free, NULL, table);
+}
+
+// A list is due for compaction once at least half of it, and at least a
+// chunk's worth, is deleted
+static _Bool compaction_due(size_t deleted, size_t length) {
+    return deleted >= POSTLIST_CHUNK_SIZE && deleted * 2 >= length;
+}
+
+static pthread_t compactor;
+static pthread_mutex_t compactor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compactor_cond = PTHREAD_COND_INITIALIZER;
+static _Bool compacting = false;
+static _Bool compactor_stopping = false;
+
+// The users whose lists are due for compaction, which may repeat a user and
+// include deleted ones
+static user_handle_t *pending = NULL;
+static size_t num_pending = 0;
+static size_t pending_capacity = 0;
+
+static void *compact_loop(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&compactor_lock);
+    // The users still pending when it is stopped are compacted first
+    while (!compactor_stopping || num_pending > 0) {
+        if (num_pending == 0) {
+            pthread_cond_wait(&compactor_cond, &compactor_lock);
+            continue;
+        }
+        user_handle_t handle = pending[--num_pending];
+        pthread_mutex_unlock(&compactor_lock);
+        shard_t *shard = &shards[handle.id & (NUM_SHARDS - 1)];
+        pthread_mutex_lock(&shard->lock);
+        user_t *user = shard_resolve(handle);
+        if (user != NULL && compaction_due(user->num_deleted, user->num_posts)) compact(user);
+        pthread_mutex_unlock(&shard->lock);
+        pthread_mutex_lock(&compactor_lock);
+    }
+    pthread_mutex_unlock(&compactor_lock);
+    return NULL;
+}
+
+void postlist_delete(user_t *user, post_t *post) {
+    if (post->position + 1 == user->num_posts) {
+        postlist_pop(user);
+        return;
+    }
+    epoch_publish(user->posts->chunks[post->position / POSTLIST_CHUNK_SIZE]->posts[post->position % POSTLIST_CHUNK_SIZE], NULL);
+    user->num_deleted++;
+    // Each compaction is scheduled by the delete that makes it due
+    if (!compaction_due(user->num_deleted, user->num_posts) || compaction_due(user->num_deleted - 1, user->num_posts)) return;
+    pthread_mutex_lock(&compactor_lock);
+    if (compacting) {
+        if (num_pending == pending_capacity) {
+            pending_capacity = pending_capacity == 0 ? 64 : pending_capacity * 2;
+            pending = realloc(pending, pending_capacity * sizeof(user_handle_t));
+            assert(pending != NULL);
+        }
+        pending[num_pending++] = shard_handle(user);
+        pthread_cond_signal(&compactor_cond);
+        pthread_mutex_unlock(&compactor_lock);
+        return;
+    }
+    pthread_mutex_unlock(&compactor_lock);
+    compact(user);
+}
+
+_Bool postlist_start_compactor(void) {
+    if (compacting) return false;
+    compactor_stopping = false;
+    // Signals are left to the other threads, such as the server's signalfd
+    sigset_t signals;
+    sigset_t old_signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+    int error = pthread_create(&compactor, NULL, compact_loop, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    if (error != 0) {
+        errno = error;
+        return false;
+    }
+    compacting = true;
+    return true;
+}
+
+void postlist_stop_compactor(void) {
+    if (!compacting) return;
+    pthread_mutex_lock(&compactor_lock);
+    compactor_stopping = true;
+    pthread_cond_signal(&compactor_cond);
+    pthread_mutex_unlock(&compactor_lock);
+    pthread_join(compactor, NULL);
+    pthread_mutex_lock(&compactor_lock);
+    compacting = false;
+    free(pending);
+    pending = NULL;
+    pending_capacity = 0;
+    pthread_mutex_unlock(&compactor_lock);
+}
+
+void postlist_retire(user_t *user) {
+    post_table_t *table = user->posts;
+    if (table == NULL) return;
+    epoch_publish(user->posts, NULL);
+    shard_t *shard = shard_of(user);
+    // Chunks are only ever added after the last one
+    for (size_t i = 0; i < table->capacity && table->chunks[i] != NULL; i++) {
+        if (table->chunks[i] != &empty_chunk) epoch_retire(&shard->retired, reclaim_chunk, &shard->chunk_arena, table->chunks[i]);
+    }
+    epoch_retire(&shard->retired, epoch_free, NULL, table);
+}
+
+void postlist_clear(user_t *user) {
+    free(user->posts);
+    user->posts = NULL;
+    user->num_posts = 0;
+    user->num_deleted = 0;
+}
+
+post_cursor_t post_cursor_open(const user_t *author) {
+    post_cursor_t cursor = {shard_handle(author), postlist_length(author), LLONG_MAX};
+    return cursor;
+}
+
+size_t post_cursor_next(post_cursor_t *cursor, const post_t **posts, size_t count) {
+    const user_t *author = shard_resolve(cursor->author);
+    if (author == NULL) return 0;
+    size_t length = postlist_length(author);
+    size_t position = cursor->position < length ? cursor->position : length;
+    const post_table_t *table = epoch_load(author->posts);
+    size_t n = 0;
+    const post_t *post;
+    while (n < count && (post = older_in(table, &position, cursor->timestamp)) != NULL) {
+        posts[n++] = post;
+        cursor->timestamp = post->timestamp;
+    }
+    cursor->position = position;
+    return n;
+}
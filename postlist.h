@@ -0,0 +1,236 @@
+#ifndef POSTLIST_H
+#define POSTLIST_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "nodes.h"
+
+#define POSTLIST_CHUNK_SIZE 32
+
+// A user's posts are kept oldest first in chunks of POSTLIST_CHUNK_SIZE
+// pointers, so a page of posts is a run of adjacent slots, and any post is
+// found from its position in constant time. Posts are pushed and popped at
+// the newest end, and deleting any other post only clears its slot, leaving a
+// tombstone, so it takes constant time however many posts the user has.
+// Chunks never move: when a user outgrows the table of chunk pointers, only
+// the table is copied and the old one is retired through the epoch.
+//
+// Once at least half of a list is tombstones, it is compacted: copied into
+// new chunks without them, which renumbers the positions of its posts. The
+// copy is made by a background thread while one is running, and right away
+// otherwise.
+//
+// Writers hold the user's shard lock. Readers inside an epoch load the
+// length first and only read positions below it, which hold either a post
+// that was live at some point during the epoch or a tombstone. The posts
+// are in order of timestamp, so readers carry on from a post they read by
+// its timestamp, whatever was deleted, pushed or compacted in between.
+struct post_chunk {
+    post_t *posts[POSTLIST_CHUNK_SIZE];
+};
+
+struct post_table {
+    size_t capacity; // The number of chunk pointers
+    post_chunk_t *chunks[];
+};
+
+// Where to carry on reading an author's posts, newest first, across
+// requests. It records the last post read by its position and timestamp. If
+// that post is deleted and a newer post takes its position, or the list is
+// compacted under it, the timestamps give it away, and the cursor still
+// carries on with the posts that are older than the one it read last. A cursor on a deleted
+// author reads nothing, even if another user reuses the author's ID.
+typedef struct post_cursor {
+    user_handle_t author;
+    unsigned int position; // The position of the last post read, or the list's length before any is read
+    long long timestamp; // The timestamp of the last post read
+} post_cursor_t;
+
+/**
+ * Gets the number of positions in a user's list, tombstones included.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * The number of positions.
+ */
+size_t postlist_length(const user_t *user);
+
+/**
+ * Gets the number of posts a user has. Only the user's writers may call it.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * The number of posts.
+ */
+size_t postlist_count(const user_t *user);
+
+/**
+ * Gets a user's post by its position, counted from the oldest.
+ *
+ * Parameters:
+ * user: The user.
+ * position: The position.
+ *
+ * Returns:
+ * The post, or NULL if the user has no post at that position or it was
+ * deleted.
+ */
+post_t *postlist_get(const user_t *user, size_t position);
+
+/**
+ * Gets a user's newest post.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * The post, or NULL if the user has no posts.
+ */
+post_t *postlist_newest(const user_t *user);
+
+/**
+ * Finds the next post to read in a user's posts, newest first, after a post
+ * that may have been deleted or moved since it was read. It takes constant
+ * time, plus one step for every tombstone it skips and every post pushed
+ * since the post was deleted.
+ *
+ * Parameters:
+ * user: The user.
+ * position: The position the post had, which is moved to the next post's.
+ * timestamp: The post's timestamp, or LLONG_MAX to start at the newest.
+ *
+ * Returns:
+ * The newest post older than the timestamp, or NULL if there is none.
+ */
+post_t *postlist_older(const user_t *user, size_t *position, long long timestamp);
+
+/**
+ * Finds a user's post by its timestamp, in O(log n) time.
+ *
+ * Parameters:
+ * user: The user.
+ * timestamp: The timestamp.
+ *
+ * Returns:
+ * The post, or NULL if the user has no post with that timestamp.
+ */
+post_t *postlist_find(const user_t *user, long long timestamp);
+
+/**
+ * Makes a post a user's newest post.
+ *
+ * Parameters:
+ * user: The user.
+ * post: The post.
+ *
+ * Returns:
+ * None
+ */
+void postlist_push(user_t *user, post_t *post);
+
+/**
+ * Removes a user's newest post, along with the tombstones under it. The post
+ * itself is left to the caller.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * The post, or NULL if the user has no posts.
+ */
+post_t *postlist_pop(user_t *user);
+
+/**
+ * Removes any of a user's posts in constant time, leaving a tombstone unless
+ * it is the newest. The post itself is left to the caller.
+ *
+ * Parameters:
+ * user: The user.
+ * post: The post.
+ *
+ * Returns:
+ * None
+ */
+void postlist_delete(user_t *user, post_t *post);
+
+/**
+ * Starts a thread that compacts the lists that are due, so that deletes
+ * never copy a list themselves. The thread takes the users' shard locks.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * True if the thread started, or false with errno set if it could not be
+ * started.
+ */
+_Bool postlist_start_compactor(void);
+
+/**
+ * Stops the compaction thread, if any, once it has compacted every list that
+ * is due. Lists are compacted right away from then on.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void postlist_stop_compactor(void);
+
+/**
+ * Retires the chunks of a user that is being deleted, once every post has
+ * been popped.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * None
+ */
+void postlist_retire(user_t *user);
+
+/**
+ * Frees a user's table of chunks at once, when nothing can read it any more.
+ * The chunks themselves are released with their shard's arena.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * None
+ */
+void postlist_clear(user_t *user);
+
+/**
+ * Opens a cursor on an author's posts, which starts at the newest post.
+ *
+ * Parameters:
+ * author: The author.
+ *
+ * Returns:
+ * The cursor.
+ */
+post_cursor_t post_cursor_open(const user_t *author);
+
+/**
+ * Reads the next page of posts from a cursor, newest first, and moves the
+ * cursor past them. It takes time in proportion to the page and the
+ * tombstones in it, however far into the posts the cursor is. It must be
+ * called inside an epoch.
+ *
+ * Parameters:
+ * cursor: The cursor.
+ * posts: Where to store the posts.
+ * count: The most posts to read.
+ *
+ * Returns:
+ * The number of posts read, which is 0 once every post has been read.
+ */
+size_t post_cursor_next(post_cursor_t *cursor, const post_t **posts, size_t count);
+
+#endif
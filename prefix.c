@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include "nodes.h"
+#include "shard.h"
+#include "fold.h"
+#include "prefix.h"
+
+#define PREFIX_NAME_SIZE 32
+#define PREFIX_RECENT_SIZE 1024
+#define PREFIX_LINE_SIZE 64
+
+_Static_assert(MAX_USERNAME_SIZE <= PREFIX_NAME_SIZE, "usernames must fit in a slot");
+
+typedef char prefix_name_t[PREFIX_NAME_SIZE];
+
+// Users sorted by their folded names, which are kept apart from the user
+// pointers so binary searches only touch the names. A NULL user marks a
+// removed name, and count includes them.
+typedef struct prefix_run {
+    prefix_name_t *names;
+    user_t **users;
+    size_t count;
+    size_t capacity;
+    size_t removed;
+} prefix_run_t;
+
+// A name and its user, for sorting them together when the index is built
+typedef struct prefix_entry {
+    prefix_name_t name;
+    user_t *user;
+} prefix_entry_t;
+
+static pthread_rwlock_t prefix_lock = PTHREAD_RWLOCK_INITIALIZER;
+static _Bool built = false;
+static prefix_run_t sorted = {NULL, NULL, 0, 0, 0};
+static prefix_run_t recent = {NULL, NULL, 0, 0, 0};
+
+// Folds a name into a NUL-padded slot, so slots compare with memcmp in the
+// same order as the names compare with strcmp
+static size_t make_name(prefix_name_t name, const char *username) {
+    size_t length = strlen(username);
+    if (length > MAX_USERNAME_SIZE - 1) length = MAX_USERNAME_SIZE - 1;
+    memset(name, 0, PREFIX_NAME_SIZE);
+    memcpy(name, username, length);
+    fold_lower(name, length);
+    return length;
+}
+
+static void run_reserve(prefix_run_t *run, size_t capacity) {
+    if (capacity <= run->capacity) return;
+    // A power of two of at least 2 slots keeps the size a multiple of a line
+    size_t new_capacity = run->capacity == 0 ? 2 : run->capacity;
+    while (new_capacity < capacity) new_capacity *= 2;
+    prefix_name_t *names = aligned_alloc(PREFIX_LINE_SIZE, new_capacity * sizeof(prefix_name_t));
+    assert(names != NULL);
+    if (run->count > 0) memcpy(names, run->names, run->count * sizeof(prefix_name_t));
+    free(run->names);
+    run->names = names;
+    run->users = realloc(run->users, new_capacity * sizeof(user_t *));
+    assert(run->users != NULL);
+    run->capacity = new_capacity;
+}
+
+static void run_free(prefix_run_t *run) {
+    free(run->names);
+    free(run->users);
+    *run = (prefix_run_t) {NULL, NULL, 0, 0, 0};
+}
+
+// Finds the first slot not less than a name
+static size_t lower_bound(const prefix_run_t *run, const prefix_name_t name) {
+    size_t low = 0;
+    size_t high = run->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (memcmp(run->names[middle], name, PREFIX_NAME_SIZE) < 0) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+static _Bool run_contains(const prefix_run_t *run, const prefix_name_t name) {
+    size_t i = lower_bound(run, name);
+    return i < run->count && run->users[i] != NULL && memcmp(run->names[i], name, PREFIX_NAME_SIZE) == 0;
+}
+
+// Merges the recent run into the sorted one and empties it
+static void merge_recent(void) {
+    prefix_run_t merged = {NULL, NULL, 0, 0, 0};
+    run_reserve(&merged, sorted.count + recent.count);
+    size_t i = 0;
+    size_t j = 0;
+    while (i < sorted.count || j < recent.count) {
+        prefix_run_t *from;
+        size_t index;
+        if (j == recent.count || (i < sorted.count && memcmp(sorted.names[i], recent.names[j], PREFIX_NAME_SIZE) < 0)) {
+            from = &sorted;
+            index = i++;
+        } else {
+            from = &recent;
+            index = j++;
+        }
+        if (from->users[index] == NULL) continue;
+        memcpy(merged.names[merged.count], from->names[index], PREFIX_NAME_SIZE);
+        merged.users[merged.count++] = from->users[index];
+    }
+    run_free(&sorted);
+    sorted = merged;
+    recent.count = 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return memcmp(((const prefix_entry_t *) a)->name, ((const prefix_entry_t *) b)->name, PREFIX_NAME_SIZE);
+}
+
+// Builds the sorted run from the shards. The caller holds the write lock.
+static void build_index(void) {
+    size_t capacity = shard_count() + 1;
+    prefix_entry_t *entries = malloc(capacity * sizeof(prefix_entry_t));
+    assert(entries != NULL);
+    size_t count = 0;
+    for (user_t *user = shard_first_user(); user != NULL; user = shard_next_user(user)) {
+        // Users added while this runs are added again by prefix_add_user
+        if (count == capacity) {
+            capacity *= 2;
+            entries = realloc(entries, capacity * sizeof(prefix_entry_t));
+            assert(entries != NULL);
+        }
+        make_name(entries[count].name, user->username);
+        entries[count++].user = user;
+    }
+    qsort(entries, count, sizeof(prefix_entry_t), compare_entries);
+    run_reserve(&sorted, count);
+    for (size_t i = 0; i < count; i++) {
+        memcpy(sorted.names[i], entries[i].name, PREFIX_NAME_SIZE);
+        sorted.users[i] = entries[i].user;
+    }
+    sorted.count = count;
+    free(entries);
+    run_reserve(&recent, PREFIX_RECENT_SIZE);
+    built = true;
+}
+
+void prefix_add_user(user_t *user) {
+    prefix_name_t name;
+    make_name(name, user->username);
+    pthread_rwlock_wrlock(&prefix_lock);
+    if (built && !run_contains(&sorted, name) && !run_contains(&recent, name)) {
+        size_t i = lower_bound(&recent, name);
+        memmove(recent.names + i + 1, recent.names + i, (recent.count - i) * sizeof(prefix_name_t));
+        memmove(recent.users + i + 1, recent.users + i, (recent.count - i) * sizeof(user_t *));
+        memcpy(recent.names[i], name, PREFIX_NAME_SIZE);
+        recent.users[i] = user;
+        if (++recent.count == PREFIX_RECENT_SIZE) merge_recent();
+    }
+    pthread_rwlock_unlock(&prefix_lock);
+}
+
+void prefix_remove_user(const user_t *user) {
+    prefix_name_t name;
+    make_name(name, user->username);
+    pthread_rwlock_wrlock(&prefix_lock);
+    size_t i = built ? lower_bound(&recent, name) : recent.count;
+    if (i < recent.count && recent.users[i] == user) {
+        memmove(recent.names + i, recent.names + i + 1, (recent.count - i - 1) * sizeof(prefix_name_t));
+        memmove(recent.users + i, recent.users + i + 1, (recent.count - i - 1) * sizeof(user_t *));
+        recent.count--;
+    } else if (built) {
+        i = lower_bound(&sorted, name);
+        if (i < sorted.count && sorted.users[i] == user) {
+            sorted.users[i] = NULL;
+            // Searches step over removed names, so they are dropped once they
+            // make up a quarter of the run. The merge takes time in proportion
+            // to the run, and is paid for by the removes that made it due.
+            if (++sorted.removed * 4 > sorted.count) merge_recent();
+        }
+    }
+    pthread_rwlock_unlock(&prefix_lock);
+}
+
+size_t prefix_find(const char *prefix, user_t **results, size_t limit) {
+    prefix_name_t name;
+    size_t length = make_name(name, prefix);
+    pthread_rwlock_rdlock(&prefix_lock);
+    if (!built) {
+        pthread_rwlock_unlock(&prefix_lock);
+        pthread_rwlock_wrlock(&prefix_lock);
+        if (!built) build_index();
+        pthread_rwlock_unlock(&prefix_lock);
+        pthread_rwlock_rdlock(&prefix_lock);
+    }
+    // Every name starting with the prefix sorts at or after its padded slot,
+    // so the matches of each run are contiguous from its lower bound
+    size_t i = lower_bound(&sorted, name);
+    size_t j = lower_bound(&recent, name);
+    size_t n = 0;
+    while (n < limit) {
+        _Bool sorted_matches = i < sorted.count && memcmp(sorted.names[i], name, length) == 0;
+        _Bool recent_matches = j < recent.count && memcmp(recent.names[j], name, length) == 0;
+        if (sorted_matches && (!recent_matches || memcmp(sorted.names[i], recent.names[j], PREFIX_NAME_SIZE) < 0)) {
+            if (sorted.users[i] != NULL) results[n++] = sorted.users[i];
+            i++;
+        } else if (recent_matches) {
+            results[n++] = recent.users[j++];
+        } else {
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&prefix_lock);
+    return n;
+}
+
+void prefix_print_stats(FILE *file) {
+    pthread_rwlock_rdlock(&prefix_lock);
+    fprintf(file, "Prefix index: %zu names (%zu removed), %zu recent\n", sorted.count, sorted.removed, recent.count);
+    pthread_rwlock_unlock(&prefix_lock);
+}
+
+void prefix_clear(void) {
+    pthread_rwlock_wrlock(&prefix_lock);
+    run_free(&sorted);
+    run_free(&recent);
+    built = false;
+    pthread_rwlock_unlock(&prefix_lock);
+}
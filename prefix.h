@@ -0,0 +1,82 @@
+#ifndef PREFIX_H
+#define PREFIX_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "nodes.h"
+
+// A sorted index of every username, for finding users by the start of their
+// name. Names are folded to lowercase and padded with NULs into 32-byte
+// slots, two to a cache line, so each probe of a binary search reads a
+// single line and compares the name without following a pointer to its user.
+//
+// The index is built from the shards on the first search, so loading the
+// database does not pay for it. Users added after that go to a small sorted
+// run of recent names, which is merged into the main run once full, so
+// adding a user moves at most that run instead of the whole index. Searches
+// hold the index's read lock and binary search both runs, so they take
+// O(log n + k) time for k matches no matter how many users there are.
+// Removing a user from the main run only clears its user pointer, and the
+// empty slot is dropped at the next merge. A merge is also forced once a
+// quarter of the main run is empty, so searches never step over more
+// removed names than that.
+
+/**
+ * Adds a user to the index, if it has been built. Adding a user that is
+ * already in it does nothing.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * None
+ */
+void prefix_add_user(user_t *user);
+
+/**
+ * Removes a user from the index, if it has been built.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * None
+ */
+void prefix_remove_user(const user_t *user);
+
+/**
+ * Finds the users whose names start with a prefix, ignoring case.
+ *
+ * Parameters:
+ * prefix: The prefix. An empty prefix matches every user.
+ * results: Where to store the matching users, in alphabetical order.
+ * limit: The maximum number of results.
+ *
+ * Returns:
+ * The number of results stored.
+ */
+size_t prefix_find(const char *prefix, user_t **results, size_t limit);
+
+/**
+ * Prints the index's statistics.
+ *
+ * Parameters:
+ * file: The file to print to.
+ *
+ * Returns:
+ * None
+ */
+void prefix_print_stats(FILE *file);
+
+/**
+ * Frees the index. It is rebuilt on the next search.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void prefix_clear(void);
+
+#endif
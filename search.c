@@ -0,0 +1,526 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include "nodes.h"
+#include "functions.h"
+#include "directory.h"
+#include "search.h"
+
+#define SEARCH_INITIAL_TERMS 1024
+#define SEARCH_INITIAL_POSTS 1024
+#define SEARCH_MAX_POST_TERMS (MAX_CONTENT_SIZE / 2 + 1)
+
+// A term and its posting list. count includes the dead IDs still in the list.
+typedef struct search_term {
+    char *text;
+    unsigned char *postings;
+    size_t size;
+    size_t capacity;
+    size_t count;
+    size_t dead;
+    unsigned int last_id;
+} search_term_t;
+
+// Decodes a posting list one ID at a time
+typedef struct posting_cursor {
+    const unsigned char *next;
+    const unsigned char *end;
+    unsigned int id;
+    _Bool started;
+} posting_cursor_t;
+
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// The terms, in an open-addressing (linear probing) hash table
+static search_term_t *terms = NULL;
+static size_t terms_capacity = 0;
+static size_t num_terms = 0;
+
+// Every post indexed since the last renumbering by ID, with a NULL post once
+// it is deleted
+static search_result_t *indexed = NULL;
+static size_t indexed_count = 0;
+static size_t indexed_capacity = 0;
+static size_t live_posts = 0;
+static size_t postings_bytes = 0;
+
+static _Bool is_word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || (unsigned char) c >= 0x80;
+}
+
+static int compare_terms(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+/*
+ * Splits text into terms, sorted with duplicates removed. Terms longer than
+ * SEARCH_MAX_TERM_SIZE - 1 bytes are truncated.
+ *
+ * Returns:
+ * The number of terms, or max + 1 without sorting them if the text has more
+ * than max terms, counting the duplicates.
+ */
+static size_t tokenize(const char *text, size_t length, char (*found)[SEARCH_MAX_TERM_SIZE], size_t max) {
+    size_t count = 0;
+    size_t i = 0;
+    while (i < length) {
+        _Bool prefixed = (text[i] == '#' || text[i] == '@') && i + 1 < length && is_word_char(text[i + 1]);
+        if (!prefixed && !is_word_char(text[i])) {
+            i++;
+            continue;
+        }
+        if (count == max) return max + 1;
+        size_t term_length = 0;
+        if (prefixed) found[count][term_length++] = text[i++];
+        for (; i < length && is_word_char(text[i]); i++) {
+            if (term_length < SEARCH_MAX_TERM_SIZE - 1) found[count][term_length++] = char_to_lower(text[i]);
+        }
+        found[count++][term_length] = '\0';
+    }
+    qsort(found, count, SEARCH_MAX_TERM_SIZE, compare_terms);
+    size_t unique = 0;
+    for (size_t j = 0; j < count; j++) {
+        if (unique == 0 || strcmp(found[unique - 1], found[j]) != 0) memmove(found[unique++], found[j], SEARCH_MAX_TERM_SIZE);
+    }
+    return unique;
+}
+
+static search_term_t *probe(search_term_t *table, size_t capacity, const char *text) {
+    size_t i = directory_hash(text) & (capacity - 1);
+    while (table[i].text != NULL && strcmp(table[i].text, text) != 0) i = (i + 1) & (capacity - 1);
+    return &table[i];
+}
+
+static search_term_t *find_term(const char *text) {
+    if (terms == NULL) return NULL;
+    search_term_t *term = probe(terms, terms_capacity, text);
+    return term->text != NULL ? term : NULL;
+}
+
+static search_term_t *find_or_add_term(const char *text) {
+    // Keep the load factor at most 0.5
+    if ((num_terms + 1) * 2 > terms_capacity) {
+        size_t capacity = terms_capacity == 0 ? SEARCH_INITIAL_TERMS : terms_capacity * 2;
+        search_term_t *table = calloc(capacity, sizeof(search_term_t));
+        assert(table != NULL);
+        for (size_t i = 0; i < terms_capacity; i++) {
+            if (terms[i].text != NULL) *probe(table, capacity, terms[i].text) = terms[i];
+        }
+        free(terms);
+        terms = table;
+        terms_capacity = capacity;
+    }
+    search_term_t *term = probe(terms, terms_capacity, text);
+    if (term->text == NULL) {
+        term->text = strdup(text);
+        assert(term->text != NULL);
+        num_terms++;
+    }
+    return term;
+}
+
+// Codes an ID at the end of a posting list, without counting its bytes
+static void push_id(search_term_t *term, unsigned int id) {
+    if (term->size + 5 > term->capacity) {
+        term->capacity = term->capacity == 0 ? 16 : term->capacity * 2;
+        term->postings = realloc(term->postings, term->capacity);
+        assert(term->postings != NULL);
+    }
+    // LEB128: seven bits per byte, low bits first, with the high bit set on
+    // every byte but the last
+    unsigned int delta = term->count == 0 ? id : id - term->last_id;
+    while (delta >= 0x80) {
+        term->postings[term->size++] = (unsigned char) (delta | 0x80);
+        delta >>= 7;
+    }
+    term->postings[term->size++] = (unsigned char) delta;
+    term->last_id = id;
+    term->count++;
+}
+
+static void append_id(search_term_t *term, unsigned int id) {
+    if (term->count > 0 && term->last_id == id) return;
+    size_t start = term->size;
+    push_id(term, id);
+    postings_bytes += term->size - start;
+}
+
+static posting_cursor_t open_postings(const search_term_t *term) {
+    posting_cursor_t cursor = {term->postings, term->postings + term->size, 0, false};
+    return cursor;
+}
+
+static _Bool next_id(posting_cursor_t *cursor, unsigned int *id) {
+    if (cursor->next == cursor->end) return false;
+    unsigned int delta = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        byte = *cursor->next++;
+        delta |= (unsigned int) (byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && cursor->next != cursor->end);
+    cursor->id = cursor->started ? cursor->id + delta : delta;
+    cursor->started = true;
+    *id = cursor->id;
+    return true;
+}
+
+// Rewrites a posting list without the IDs of deleted posts, giving the others
+// their new IDs if renamed is not NULL
+static void compact_term(search_term_t *term, const unsigned int *renamed) {
+    search_term_t old = *term;
+    term->postings = NULL;
+    term->size = term->capacity = term->count = term->dead = 0;
+    postings_bytes -= old.size;
+    posting_cursor_t cursor = open_postings(&old);
+    unsigned int id;
+    while (next_id(&cursor, &id)) {
+        if (indexed[id].post != NULL) append_id(term, renamed != NULL ? renamed[id] : id);
+    }
+    free(old.postings);
+}
+
+// Gives the live posts new IDs from 0 in the same order, so the posting lists
+// stay sorted, and rewrites every term with them. The terms no post contains
+// anymore are dropped along the way.
+static void renumber(void) {
+    unsigned int *renamed = malloc((indexed_count + 1) * sizeof(unsigned int));
+    assert(renamed != NULL);
+    unsigned int live = 0;
+    for (size_t id = 0; id < indexed_count; id++) {
+        if (indexed[id].post != NULL) renamed[id] = live++;
+    }
+    size_t capacity = SEARCH_INITIAL_TERMS;
+    for (size_t i = 0; i < terms_capacity; i++) {
+        if (terms[i].text != NULL) compact_term(&terms[i], renamed);
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < terms_capacity; i++) kept += terms[i].count > 0;
+    while ((kept + 1) * 2 > capacity) capacity *= 2;
+    search_term_t *table = calloc(capacity, sizeof(search_term_t));
+    assert(table != NULL);
+    for (size_t i = 0; i < terms_capacity; i++) {
+        if (terms[i].count > 0) {
+            *probe(table, capacity, terms[i].text) = terms[i];
+        } else {
+            free(terms[i].text);
+            free(terms[i].postings);
+        }
+    }
+    free(terms);
+    terms = table;
+    terms_capacity = capacity;
+    num_terms = kept;
+    for (size_t id = 0; id < indexed_count; id++) {
+        if (indexed[id].post == NULL) continue;
+        indexed[renamed[id]] = indexed[id];
+        ((post_t *) indexed[id].post)->search_id = renamed[id];
+    }
+    indexed_count = live;
+    while (indexed_capacity > SEARCH_INITIAL_POSTS && indexed_count * 4 < indexed_capacity) indexed_capacity /= 2;
+    indexed = realloc(indexed, indexed_capacity * sizeof(search_result_t));
+    assert(indexed != NULL);
+    free(renamed);
+}
+
+// Gives a post the next search ID
+static void add_indexed(const user_t *author, post_t *post) {
+    if (indexed_count == indexed_capacity) {
+        indexed_capacity = indexed_capacity == 0 ? SEARCH_INITIAL_POSTS : indexed_capacity * 2;
+        indexed = realloc(indexed, indexed_capacity * sizeof(search_result_t));
+        assert(indexed != NULL);
+    }
+    post->search_id = indexed_count++;
+    indexed[post->search_id].post = post;
+    indexed[post->search_id].author = author;
+    live_posts++;
+}
+
+void search_add_post(const user_t *author, post_t *post) {
+    char found[SEARCH_MAX_POST_TERMS][SEARCH_MAX_TERM_SIZE];
+    size_t count = tokenize(post_content(post), post->length, found, SEARCH_MAX_POST_TERMS);
+    pthread_rwlock_wrlock(&index_lock);
+    add_indexed(author, post);
+    for (size_t i = 0; i < count; i++) append_id(find_or_add_term(found[i]), post->search_id);
+    pthread_rwlock_unlock(&index_lock);
+}
+
+void search_restore_post(const user_t *author, post_t *post) {
+    pthread_rwlock_wrlock(&index_lock);
+    add_indexed(author, post);
+    pthread_rwlock_unlock(&index_lock);
+}
+
+static int compare_ids(const void *a, const void *b) {
+    unsigned int id1 = *(const unsigned int *) a;
+    unsigned int id2 = *(const unsigned int *) b;
+    return (id1 > id2) - (id1 < id2);
+}
+
+void search_for_each_term(const unsigned int *numbers, search_term_visitor_t visit, void *context) {
+    pthread_rwlock_rdlock(&index_lock);
+    unsigned int *ids = malloc((live_posts + 1) * sizeof(unsigned int));
+    assert(ids != NULL);
+    for (size_t i = 0; i < terms_capacity; i++) {
+        if (terms[i].text == NULL) continue;
+        size_t count = 0;
+        posting_cursor_t cursor = open_postings(&terms[i]);
+        unsigned int id;
+        while (next_id(&cursor, &id)) {
+            if (indexed[id].post != NULL) ids[count++] = numbers[id];
+        }
+        if (count == 0) continue;
+        // The numbers need not be in the order of the IDs
+        qsort(ids, count, sizeof(unsigned int), compare_ids);
+        search_term_t coded = {0};
+        for (size_t j = 0; j < count; j++) push_id(&coded, ids[j]);
+        visit(terms[i].text, coded.postings, coded.size, context);
+        free(coded.postings);
+    }
+    free(ids);
+    pthread_rwlock_unlock(&index_lock);
+}
+
+_Bool search_restore_term(const char *text, const unsigned char *postings, size_t size, const unsigned int *search_ids, size_t num_numbers) {
+    // IDs take at most five bytes, and the last byte of a list ends one
+    size_t run = 0;
+    for (size_t i = 0; i < size; i++) {
+        run = (postings[i] & 0x80) != 0 ? run + 1 : 0;
+        if (run == 5) return false;
+    }
+    if (size == 0 || run != 0) return false;
+    pthread_rwlock_wrlock(&index_lock);
+    // The list is checked in full before anything is added: the numbers must
+    // be increasing and in range, and so must the IDs they map to
+    search_term_t saved = {NULL, (unsigned char *) postings, size, size, 0, 0, 0};
+    posting_cursor_t cursor = open_postings(&saved);
+    unsigned int number;
+    unsigned int previous = 0;
+    unsigned int first = SEARCH_NO_ID;
+    unsigned int last = SEARCH_NO_ID;
+    size_t count = 0;
+    // Loaded into an empty index, every post keeps its number as its ID
+    _Bool same_ids = true;
+    _Bool valid = true;
+    for (size_t i = 0; valid && next_id(&cursor, &number); i++) {
+        // A wrapped-around delta shows up as a number that is not greater
+        valid = number < num_numbers && (i == 0 || number > previous);
+        previous = number;
+        if (!valid) continue;
+        same_ids = same_ids && search_ids[number] == number;
+        if (search_ids[number] == SEARCH_NO_ID) continue;
+        valid = search_ids[number] < indexed_count && (last == SEARCH_NO_ID || search_ids[number] > last);
+        if (first == SEARCH_NO_ID) first = search_ids[number];
+        last = search_ids[number];
+        count++;
+    }
+    search_term_t *existing = find_term(text);
+    if (existing != NULL && first != SEARCH_NO_ID && existing->count > 0 && first <= existing->last_id) valid = false;
+    if (valid && same_ids && existing == NULL) {
+        // The list is already coded with the IDs, so it is copied as it is
+        search_term_t *term = find_or_add_term(text);
+        term->postings = malloc(size);
+        assert(term->postings != NULL);
+        memcpy(term->postings, postings, size);
+        term->size = term->capacity = size;
+        term->count = count;
+        term->last_id = last;
+        postings_bytes += size;
+    } else if (valid && first != SEARCH_NO_ID) {
+        search_term_t *term = find_or_add_term(text);
+        cursor = open_postings(&saved);
+        while (next_id(&cursor, &number)) {
+            if (search_ids[number] != SEARCH_NO_ID) append_id(term, search_ids[number]);
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+    return valid;
+}
+
+size_t search_id_limit(void) {
+    return indexed_count;
+}
+
+void search_remove_post(const post_t *post) {
+    char found[SEARCH_MAX_POST_TERMS][SEARCH_MAX_TERM_SIZE];
+    size_t count = tokenize(post_content(post), post->length, found, SEARCH_MAX_POST_TERMS);
+    pthread_rwlock_wrlock(&index_lock);
+    if (post->search_id < indexed_count && indexed[post->search_id].post == post) {
+        indexed[post->search_id].post = NULL;
+        live_posts--;
+        for (size_t i = 0; i < count; i++) {
+            search_term_t *term = find_term(found[i]);
+            if (term != NULL && ++term->dead * 2 > term->count) compact_term(term, NULL);
+        }
+        // Renumbering takes time in proportion to the index, and is paid for
+        // by the deletes of the half of the posts that made it due
+        if (indexed_count > SEARCH_INITIAL_POSTS && live_posts * 2 < indexed_count) renumber();
+    }
+    pthread_rwlock_unlock(&index_lock);
+}
+
+static int compare_counts(const void *a, const void *b) {
+    const search_term_t *term1 = *(const search_term_t *const *) a;
+    const search_term_t *term2 = *(const search_term_t *const *) b;
+    return (term1->count > term2->count) - (term1->count < term2->count);
+}
+
+/*
+ * Intersects the posting lists of terms, starting from the shortest one so
+ * the candidates only ever shrink.
+ *
+ * Returns:
+ * The live IDs in every list, in increasing order. The number of IDs is
+ * stored in count.
+ */
+static unsigned int *intersect(const char (*group)[SEARCH_MAX_TERM_SIZE], size_t num_group, size_t *count) {
+    *count = 0;
+    const search_term_t *lists[SEARCH_MAX_QUERY_TERMS];
+    for (size_t i = 0; i < num_group; i++) {
+        lists[i] = find_term(group[i]);
+        if (lists[i] == NULL) return NULL;
+    }
+    qsort(lists, num_group, sizeof(search_term_t *), compare_counts);
+    unsigned int *ids = malloc((lists[0]->count + 1) * sizeof(unsigned int));
+    assert(ids != NULL);
+    posting_cursor_t cursor = open_postings(lists[0]);
+    unsigned int id;
+    while (next_id(&cursor, &id)) {
+        if (indexed[id].post != NULL) ids[(*count)++] = id;
+    }
+    for (size_t i = 1; i < num_group && *count > 0; i++) {
+        cursor = open_postings(lists[i]);
+        size_t kept = 0;
+        _Bool more = next_id(&cursor, &id);
+        for (size_t j = 0; j < *count && more; j++) {
+            while (more && id < ids[j]) more = next_id(&cursor, &id);
+            if (more && id == ids[j]) ids[kept++] = ids[j];
+        }
+        *count = kept;
+    }
+    return ids;
+}
+
+// Merges two sorted lists of IDs into one without duplicates
+static unsigned int *unite(unsigned int *ids1, size_t count1, unsigned int *ids2, size_t count2, size_t *count) {
+    unsigned int *ids = malloc((count1 + count2 + 1) * sizeof(unsigned int));
+    assert(ids != NULL);
+    size_t i = 0, j = 0;
+    *count = 0;
+    while (i < count1 || j < count2) {
+        if (j == count2 || (i < count1 && ids1[i] < ids2[j])) {
+            ids[(*count)++] = ids1[i++];
+        } else if (i == count1 || ids2[j] < ids1[i]) {
+            ids[(*count)++] = ids2[j++];
+        } else {
+            ids[(*count)++] = ids1[i++];
+            j++;
+        }
+    }
+    free(ids1);
+    free(ids2);
+    return ids;
+}
+
+// Restores the order of a min-heap of results keyed on the timestamp, after
+// its root was replaced
+static void sift_down(search_result_t *heap, size_t size, size_t i) {
+    while (true) {
+        size_t oldest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < size && heap[left].post->timestamp < heap[oldest].post->timestamp) oldest = left;
+        if (right < size && heap[right].post->timestamp < heap[oldest].post->timestamp) oldest = right;
+        if (oldest == i) return;
+        search_result_t swap = heap[i];
+        heap[i] = heap[oldest];
+        heap[oldest] = swap;
+        i = oldest;
+    }
+}
+
+// Keeps the newest limit matches in a min-heap, then sorts them newest first
+static size_t select_newest(const unsigned int *ids, size_t count, search_result_t *results, size_t limit) {
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        const search_result_t *match = &indexed[ids[i]];
+        if (size < limit) {
+            results[size++] = *match;
+            for (size_t j = size - 1; j > 0 && results[(j - 1) / 2].post->timestamp > results[j].post->timestamp; j = (j - 1) / 2) {
+                search_result_t swap = results[j];
+                results[j] = results[(j - 1) / 2];
+                results[(j - 1) / 2] = swap;
+            }
+        } else if (limit > 0 && match->post->timestamp > results[0].post->timestamp) {
+            results[0] = *match;
+            sift_down(results, size, 0);
+        }
+    }
+    for (size_t end = size; end > 1; end--) {
+        search_result_t oldest = results[0];
+        results[0] = results[end - 1];
+        results[end - 1] = oldest;
+        sift_down(results, end - 1, 0);
+    }
+    return size;
+}
+
+size_t search_query(const char *query, search_result_t *results, size_t limit) {
+    char group[SEARCH_MAX_QUERY_TERMS][SEARCH_MAX_TERM_SIZE];
+    size_t num_group = 0;
+    unsigned int *matches = NULL;
+    size_t num_matches = 0;
+    pthread_rwlock_rdlock(&index_lock);
+    const char *word = query;
+    while (true) {
+        word += strspn(word, " \t");
+        size_t length = strcspn(word, " \t");
+        _Bool alternative = length == 2 && strncmp(word, "OR", 2) == 0;
+        if (!alternative && length > 0) {
+            size_t count = tokenize(word, length, group + num_group, SEARCH_MAX_QUERY_TERMS - num_group);
+            // Dropping terms would match posts that lack them
+            if (count > SEARCH_MAX_QUERY_TERMS - num_group) {
+                pthread_rwlock_unlock(&index_lock);
+                free(matches);
+                errno = E2BIG;
+                return 0;
+            }
+            num_group += count;
+        } else if (num_group > 0) {
+            size_t count;
+            unsigned int *ids = intersect((const char (*)[SEARCH_MAX_TERM_SIZE]) group, num_group, &count);
+            matches = unite(matches, num_matches, ids, count, &num_matches);
+            num_group = 0;
+        }
+        if (length == 0) break;
+        word += length;
+    }
+    size_t found = select_newest(matches, num_matches, results, limit);
+    pthread_rwlock_unlock(&index_lock);
+    free(matches);
+    errno = 0;
+    return found;
+}
+
+void search_clear(void) {
+    for (size_t i = 0; i < terms_capacity; i++) {
+        free(terms[i].text);
+        free(terms[i].postings);
+    }
+    free(terms);
+    free(indexed);
+    terms = NULL;
+    terms_capacity = num_terms = 0;
+    indexed = NULL;
+    indexed_count = indexed_capacity = live_posts = postings_bytes = 0;
+}
+
+void search_print_stats(FILE *file) {
+    fprintf(file, "Search index: %zu terms, %zu posts (%zu live), %zu bytes of postings\n",
+            num_terms, indexed_count, live_posts, postings_bytes);
+}
@@ -0,0 +1,169 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "nodes.h"
+
+#define SEARCH_MAX_TERM_SIZE 64
+#define SEARCH_MAX_QUERY_TERMS 32
+// Stands in for the search ID of a post that is not in the index
+#define SEARCH_NO_ID UINT_MAX
+
+// An inverted index over the content of every post. Content is split into
+// terms: words, #hashtags and @mentions, folded to lowercase, with hashtags
+// and mentions keeping their prefix so they never match a plain word. Every
+// term maps to a posting list of the IDs of the posts containing it, in
+// increasing order, stored as the varint-coded differences between
+// consecutive IDs.
+//
+// Posts are given IDs of their own in the order they are indexed, and the
+// index maps every ID back to its post and author in constant time. Deleting
+// a post only marks its ID dead, and a term's posting list is rewritten
+// without its dead IDs once they make up half of it. Once half of all the IDs
+// are dead, the live posts are renumbered in order and every posting list is
+// rewritten, so the map only ever holds up to twice the live posts. Queries
+// hold the index's read lock, so they run concurrently with each other but
+// not with posting.
+//
+// Snapshots save every term with its posting list, so loading one restores
+// the index without splitting any post into terms again.
+
+// A post that matched a query
+typedef struct search_result {
+    const post_t *post;
+    const user_t *author;
+} search_result_t;
+
+// Called with a term and its posting list, coded like the index's own
+typedef void (*search_term_visitor_t)(const char *text, const unsigned char *postings, size_t size, void *context);
+
+/**
+ * Adds a post to the index and gives it its search ID.
+ *
+ * Parameters:
+ * author: The post's author.
+ * post: The post.
+ *
+ * Returns:
+ * None
+ */
+void search_add_post(const user_t *author, post_t *post);
+
+/**
+ * Removes a post from the index. The post's content must still be readable.
+ *
+ * Parameters:
+ * post: The post.
+ *
+ * Returns:
+ * None
+ */
+void search_remove_post(const post_t *post);
+
+/**
+ * Adds a post to the index and gives it its search ID, without its terms,
+ * which search_restore_term adds afterwards.
+ *
+ * Parameters:
+ * author: The post's author.
+ * post: The post.
+ *
+ * Returns:
+ * None
+ */
+void search_restore_post(const user_t *author, post_t *post);
+
+/**
+ * Visits every term that a live post contains, with the live posts in its
+ * posting list renumbered and sorted by their new numbers. Takes time in
+ * proportion to the index.
+ *
+ * Parameters:
+ * numbers: The number of every live post, by search ID.
+ * visit: Called with each term and its posting list, which is freed when it
+ *        returns.
+ * context: Passed to visit.
+ *
+ * Returns:
+ * None
+ */
+void search_for_each_term(const unsigned int *numbers, search_term_visitor_t visit, void *context);
+
+/**
+ * Adds the posts of a posting list visited by search_for_each_term to a
+ * term, once they have been given search IDs with search_restore_post. The
+ * list is checked before anything is added, and a malformed one is skipped.
+ * A list whose posts all got their own numbers as IDs, as when loading into
+ * an empty index, is copied rather than coded again.
+ *
+ * Parameters:
+ * text: The term.
+ * postings: The posting list.
+ * size: The size of the posting list in bytes.
+ * search_ids: The search ID of the post with each number, or SEARCH_NO_ID
+ *             for the posts that were not restored. Numbers must map to
+ *             increasing IDs, above any the term already has.
+ * num_numbers: The number of entries in search_ids.
+ *
+ * Returns:
+ * True if the posting list was valid and false otherwise.
+ */
+_Bool search_restore_term(const char *text, const unsigned char *postings, size_t size, const unsigned int *search_ids, size_t num_numbers);
+
+/**
+ * Gets a bound on the search IDs in use, for sizing arrays indexed by search
+ * ID.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * A number greater than every search ID in use.
+ */
+size_t search_id_limit(void);
+
+/**
+ * Finds the newest posts matching a query. The query's terms are split like
+ * post content and must all appear in a post, and the word OR separates
+ * alternatives, so "#potions snape OR @harry" matches the posts that contain
+ * both #potions and snape, or @harry. An alternative has at most
+ * SEARCH_MAX_QUERY_TERMS terms, and a query with a longer one is refused
+ * rather than matching posts that lack some of them.
+ *
+ * Parameters:
+ * query: The query.
+ * results: Where to store the matching posts, newest first.
+ * limit: The maximum number of results.
+ *
+ * Returns:
+ * The number of results stored, with errno cleared, or 0 with errno set to
+ * E2BIG if an alternative has too many terms.
+ */
+size_t search_query(const char *query, search_result_t *results, size_t limit);
+
+/**
+ * Frees the whole index.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void search_clear(void);
+
+/**
+ * Prints the index's statistics.
+ *
+ * Parameters:
+ * file: The file to print to.
+ *
+ * Returns:
+ * None
+ */
+void search_print_stats(FILE *file);
+
+#endif
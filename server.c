@@ -0,0 +1,474 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "nodes.h"
+#include "batch.h"
+#include "wal.h"
+#include "epoch.h"
+#include "password.h"
+#include "postlist.h"
+#include "shard.h"
+#include "server.h"
+
+#define SERVER_MAX_EVENTS 256
+#define SERVER_MAX_INPUT (64 * 1024)
+#define SERVER_READ_SIZE 4096
+#define SERVER_CHECKPOINT_POLL 1
+
+// A client's connection and session. Input is buffered until it holds whole
+// lines, and replies the socket could not take yet are kept until it is
+// writable again. A connection whose next command hashes a password is
+// parked with that line at the front of its input until a verifier has run
+// it, and is then resumed by a worker.
+typedef struct connection {
+    int fd;
+    batch_session_t session;
+    char *input;
+    size_t input_size;
+    size_t input_capacity;
+    size_t parked_size;
+    _Bool resumed;
+    char *output;
+    size_t output_size;
+    size_t output_sent;
+    struct connection *next_ready;
+    struct connection *prev;
+    struct connection *next;
+} connection_t;
+
+// A queue of connections waiting for a thread. Once stopped, it drops the
+// connections enqueued and wakes every waiting thread.
+typedef struct connection_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    connection_t *head;
+    connection_t *tail;
+    _Bool stopping;
+} connection_queue_t;
+
+#define CONNECTION_QUEUE_INIT {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, false}
+
+// Tags for the events of the listening socket and the signalfd. Every other
+// event is tagged with its connection.
+static char listen_tag;
+static char signal_tag;
+
+static int epoll_fd = -1;
+
+// The connections that have input or can take output, in arrival order
+static connection_queue_t ready = CONNECTION_QUEUE_INIT;
+
+// The connections parked on a command that hashes a password. They are run
+// by a small pool of verifiers of their own, so a storm of logins only ever
+// ties up that many threads, and that much scrypt memory, while the workers
+// go on serving every other command.
+static connection_queue_t parked = CONNECTION_QUEUE_INIT;
+
+// Wakes the checkpointer when the server stops
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t checkpoint_cond = PTHREAD_COND_INITIALIZER;
+static _Bool checkpoint_stopping = false;
+
+// Every open connection, so they can be closed on shutdown
+static pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
+static connection_t *connections = NULL;
+
+static void enqueue(connection_queue_t *queue, connection_t *connection) {
+    pthread_mutex_lock(&queue->lock);
+    if (!queue->stopping) {
+        connection->next_ready = NULL;
+        if (queue->tail == NULL) {
+            queue->head = connection;
+        } else {
+            queue->tail->next_ready = connection;
+        }
+        queue->tail = connection;
+        pthread_cond_signal(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Waits for a connection, or returns NULL once the queue is stopping
+static connection_t *dequeue(connection_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->head == NULL && !queue->stopping) pthread_cond_wait(&queue->cond, &queue->lock);
+    connection_t *connection = queue->head;
+    if (connection != NULL) {
+        queue->head = connection->next_ready;
+        if (queue->head == NULL) queue->tail = NULL;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return connection;
+}
+
+static void stop_queue(connection_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = true;
+    queue->head = queue->tail = NULL;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void close_connection(connection_t *connection) {
+    pthread_mutex_lock(&connections_lock);
+    if (connection->prev == NULL) {
+        connections = connection->next;
+    } else {
+        connection->prev->next = connection->next;
+    }
+    if (connection->next != NULL) connection->next->prev = connection->prev;
+    pthread_mutex_unlock(&connections_lock);
+    close(connection->fd);
+    free(connection->input);
+    free(connection->output);
+    free(connection);
+}
+
+// Sends as much pending output as the socket takes
+static _Bool send_output(connection_t *connection) {
+    while (connection->output_sent < connection->output_size) {
+        ssize_t sent = send(connection->fd, connection->output + connection->output_sent,
+                            connection->output_size - connection->output_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection->output_sent += sent;
+    }
+    free(connection->output);
+    connection->output = NULL;
+    connection->output_size = connection->output_sent = 0;
+    return true;
+}
+
+// Reads everything the socket has. Returns false once the client hung up.
+static _Bool receive_input(connection_t *connection) {
+    while (true) {
+        if (connection->input_capacity - connection->input_size < SERVER_READ_SIZE) {
+            connection->input_capacity = connection->input_capacity == 0 ? SERVER_READ_SIZE * 2 : connection->input_capacity * 2;
+            connection->input = realloc(connection->input, connection->input_capacity);
+            assert(connection->input != NULL);
+        }
+        ssize_t received = recv(connection->fd, connection->input + connection->input_size,
+                                connection->input_capacity - connection->input_size, 0);
+        if (received > 0) {
+            connection->input_size += received;
+            if (connection->input_size > SERVER_MAX_INPUT && memchr(connection->input, '\n', connection->input_size) == NULL) return false;
+            continue;
+        }
+        if (received == 0) return false;
+        if (errno == EINTR) continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+}
+
+// Executes one command in the connection's session under the locks it needs
+static void execute_line(connection_t *connection, char *line, FILE *out) {
+    // Writers only lock the shard they write, and still run inside an epoch
+    // since they read the other shards without locking them. The epoch also
+    // covers the password work done before the locks are taken, so a hash a
+    // password was verified against is not reused before the command checks
+    // it is still the user's.
+    epoch_enter();
+    batch_prepare(&connection->session, line);
+    batch_locks_t locks = batch_command_locks(&connection->session, line);
+    if (locks.shard != NULL) pthread_mutex_lock(&locks.shard->lock);
+    if (locks.shared) pthread_mutex_lock(&shared_lock);
+    batch_execute(&connection->session, line, out);
+    if (locks.shared) pthread_mutex_unlock(&shared_lock);
+    if (locks.shard != NULL) pthread_mutex_unlock(&locks.shard->lock);
+    epoch_exit();
+}
+
+// Queues up replies once the changes they acknowledge are committed
+static void append_output(connection_t *connection, char *replies, size_t replies_size) {
+    if (replies_size == 0) {
+        free(replies);
+        return;
+    }
+    wal_commit();
+    if (connection->output == NULL) {
+        connection->output = replies;
+        connection->output_size = replies_size;
+        return;
+    }
+    connection->output = realloc(connection->output, connection->output_size + replies_size);
+    assert(connection->output != NULL);
+    memcpy(connection->output + connection->output_size, replies, replies_size);
+    connection->output_size += replies_size;
+    free(replies);
+}
+
+// Executes every whole line of input and queues up the replies, up to the
+// first command that hashes a password. Returns true if it stopped there,
+// with that line at the front of the input, for the connection to be parked.
+static _Bool execute_input(connection_t *connection) {
+    char *replies = NULL;
+    size_t replies_size = 0;
+    FILE *out = open_memstream(&replies, &replies_size);
+    assert(out != NULL);
+    char *line = connection->input;
+    char *end = connection->input + connection->input_size;
+    char *newline;
+    _Bool parking = false;
+    while ((newline = memchr(line, '\n', end - line)) != NULL) {
+        *newline = '\0';
+        if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+        if (batch_command_hashes(line)) {
+            connection->parked_size = newline + 1 - line;
+            parking = true;
+            break;
+        }
+        execute_line(connection, line, out);
+        line = newline + 1;
+    }
+    fclose(out);
+    connection->input_size = end - line;
+    memmove(connection->input, line, connection->input_size);
+    append_output(connection, replies, replies_size);
+    return parking;
+}
+
+static void serve(connection_t *connection) {
+    _Bool open = true;
+    _Bool parking = false;
+    if (connection->resumed) {
+        // The input was already received before the connection was parked
+        connection->resumed = false;
+        parking = execute_input(connection);
+    } else if (connection->output == NULL) {
+        open = receive_input(connection);
+        parking = execute_input(connection);
+    }
+    if (!send_output(connection) || (!open && !parking)) {
+        close_connection(connection);
+        return;
+    }
+    // A parked connection is not watched until it is resumed, so no other
+    // thread touches it in the meantime. A client that hung up is noticed
+    // once it is watched again.
+    if (parking) {
+        enqueue(&parked, connection);
+        return;
+    }
+    // Wait for the socket to drain before reading any more input
+    struct epoll_event event = {(connection->output != NULL ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT, {.ptr = connection}};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) < 0) close_connection(connection);
+}
+
+static void *work_loop(void *arg) {
+    (void) arg;
+    wal_defer_commits();
+    connection_t *connection;
+    while ((connection = dequeue(&ready)) != NULL) serve(connection);
+    return NULL;
+}
+
+// Runs the parked line of each connection it is handed, then hands the
+// connection back to the workers
+static void *verify_loop(void *arg) {
+    (void) arg;
+    wal_defer_commits();
+    connection_t *connection;
+    while ((connection = dequeue(&parked)) != NULL) {
+        char *replies = NULL;
+        size_t replies_size = 0;
+        FILE *out = open_memstream(&replies, &replies_size);
+        assert(out != NULL);
+        execute_line(connection, connection->input, out);
+        fclose(out);
+        connection->input_size -= connection->parked_size;
+        memmove(connection->input, connection->input + connection->parked_size, connection->input_size);
+        connection->parked_size = 0;
+        append_output(connection, replies, replies_size);
+        connection->resumed = true;
+        enqueue(&ready, connection);
+    }
+    return NULL;
+}
+
+// Checkpoints whenever the log has grown enough. Every shard lock and the
+// shared lock are taken, in the order commands take them, so no command
+// writes while the snapshot is saved, while commands that only read go on.
+static void *checkpoint_loop(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&checkpoint_lock);
+    while (!checkpoint_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SERVER_CHECKPOINT_POLL;
+        while (!checkpoint_stopping && pthread_cond_timedwait(&checkpoint_cond, &checkpoint_lock, &deadline) != ETIMEDOUT) {}
+        if (checkpoint_stopping || !wal_checkpoint_due()) continue;
+        pthread_mutex_unlock(&checkpoint_lock);
+        epoch_enter();
+        for (int i = 0; i < NUM_SHARDS; i++) pthread_mutex_lock(&shards[i].lock);
+        pthread_mutex_lock(&shared_lock);
+        if (!wal_checkpoint()) perror("Error saving the snapshot");
+        pthread_mutex_unlock(&shared_lock);
+        for (int i = NUM_SHARDS - 1; i >= 0; i--) pthread_mutex_unlock(&shards[i].lock);
+        epoch_exit();
+        pthread_mutex_lock(&checkpoint_lock);
+    }
+    pthread_mutex_unlock(&checkpoint_lock);
+    return NULL;
+}
+
+static void accept_connections(int listen_fd) {
+    while (true) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("Error accepting a connection");
+            return;
+        }
+        connection_t *connection = calloc(1, sizeof(connection_t));
+        assert(connection != NULL);
+        connection->fd = fd;
+        pthread_mutex_lock(&connections_lock);
+        connection->next = connections;
+        if (connections != NULL) connections->prev = connection;
+        connections = connection;
+        pthread_mutex_unlock(&connections_lock);
+        struct epoll_event event = {EPOLLIN | EPOLLONESHOT, {.ptr = connection}};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) close_connection(connection);
+    }
+}
+
+// Lets the server hold as many connections as the hard limit allows
+static void raise_file_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+_Bool server_run(const char *path, int num_workers) {
+    if (num_workers <= 0) num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers <= 0) num_workers = 1;
+    int num_verifiers = password_settings.threads;
+    if (num_verifiers <= 0) num_verifiers = sysconf(_SC_NPROCESSORS_ONLN) / 2;
+    if (num_verifiers <= 0) num_verifiers = 1;
+    raise_file_limit();
+
+    // Shutdown signals are read from a signalfd by the event loop, so they
+    // are blocked here before any worker inherits the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigset_t old_signals;
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+    int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    int listen_fd = listen_on(path);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd < 0 || listen_fd < 0 || epoll_fd < 0) {
+        int error = errno;
+        if (signal_fd >= 0) close(signal_fd);
+        if (listen_fd >= 0) close(listen_fd);
+        if (epoll_fd >= 0) close(epoll_fd);
+        epoll_fd = -1;
+        pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+        errno = error;
+        return false;
+    }
+    struct epoll_event listen_event = {EPOLLIN, {.ptr = &listen_tag}};
+    struct epoll_event signal_event = {EPOLLIN, {.ptr = &signal_tag}};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event);
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &signal_event);
+
+    ready.stopping = false;
+    parked.stopping = false;
+    pthread_t *workers = malloc((num_workers + num_verifiers) * sizeof(pthread_t));
+    assert(workers != NULL);
+    for (int i = 0; i < num_workers + num_verifiers; i++) {
+        int error = pthread_create(&workers[i], NULL, i < num_workers ? work_loop : verify_loop, NULL);
+        assert(error == 0);
+    }
+    // Deletes compact their users' lists themselves if it cannot start
+    postlist_start_compactor();
+    checkpoint_stopping = false;
+    pthread_t checkpointer;
+    int error = pthread_create(&checkpointer, NULL, checkpoint_loop, NULL);
+    assert(error == 0);
+
+    printf("Listening on %s with %d workers and %d password verifiers\n", path, num_workers, num_verifiers);
+    fflush(stdout);
+    _Bool running = true;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (running) {
+        int count = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (count < 0 && errno != EINTR) {
+            perror("Error waiting for connections");
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == &listen_tag) {
+                accept_connections(listen_fd);
+            } else if (events[i].data.ptr == &signal_tag) {
+                // Consume the signal so it is not delivered once unblocked
+                struct signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {}
+                running = false;
+            } else {
+                enqueue(&ready, events[i].data.ptr);
+            }
+        }
+    }
+
+    // Connections dropped from the queues are still closed below
+    stop_queue(&ready);
+    stop_queue(&parked);
+    for (int i = 0; i < num_workers + num_verifiers; i++) pthread_join(workers[i], NULL);
+    free(workers);
+    pthread_mutex_lock(&checkpoint_lock);
+    checkpoint_stopping = true;
+    pthread_cond_signal(&checkpoint_cond);
+    pthread_mutex_unlock(&checkpoint_lock);
+    pthread_join(checkpointer, NULL);
+    postlist_stop_compactor();
+    while (connections != NULL) close_connection(connections);
+    close(epoll_fd);
+    epoll_fd = -1;
+    close(listen_fd);
+    close(signal_fd);
+    unlink(path);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    printf("Server stopped.\n");
+    return true;
+}
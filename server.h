@@ -0,0 +1,34 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "nodes.h"
+
+// The server speaks the batch command protocol over a Unix domain socket,
+// with a session per connection. One thread waits on every connection with
+// epoll and hands the ones with input to a pool of workers. A connection is
+// only ever served by one worker at a time. Commands that write the database
+// lock the shard they write, so writes to different shards run concurrently,
+// while commands that only read it run without taking any lock, but for
+// those reading the friend graphs, which take the shared lock. Commands
+// that hash a password are handed to a separate pool of
+// password_settings.threads verifiers, so they never hold up the workers,
+// and the post lists that deletes leave due for compaction are compacted by
+// a thread of their own. Another thread checkpoints the log whenever
+// wal_checkpoint_due says it has grown enough, holding off every write while
+// the snapshot is saved.
+
+/**
+ * Serves clients on a Unix domain socket until the process receives SIGINT
+ * or SIGTERM. A stale socket file left at the path is replaced.
+ *
+ * Parameters:
+ * path: The path of the socket.
+ * num_workers: The number of worker threads, or 0 to use one per online CPU.
+ *
+ * Returns:
+ * True once the server has shut down, or false with errno set if it could
+ * not be started.
+ */
+_Bool server_run(const char *path, int num_workers);
+
+#endif
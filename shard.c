@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <pthread.h>
+#include "nodes.h"
+#include "directory.h"
+#include "arena.h"
+#include "epoch.h"
+#include "password.h"
+#include "postlist.h"
+#include "shard.h"
+
+#define SHARD_INITIAL_POST_IDS 1024
+
+#define SHARD_INIT(tag) {NULL, NULL, DIRECTORY_INIT(SHARD_BITS, tag), \
+                         ARENA_INIT("user_t", user_t, 1024), \
+                         ARENA_INIT("post_t", post_t, 1024), ARENA_INIT("password_hash_t", password_hash_t, 1024), \
+                         ARENA_INIT("post_chunk_t", post_chunk_t, 256), {NULL, 0, 0, NULL, 0, 0}, \
+                         EPOCH_DOMAIN_INIT, PTHREAD_MUTEX_INITIALIZER}
+
+_Static_assert(NUM_SHARDS == 16, "shards must list one initializer per shard");
+
+shard_t shards[NUM_SHARDS] = {
+    SHARD_INIT(0), SHARD_INIT(1), SHARD_INIT(2), SHARD_INIT(3), SHARD_INIT(4), SHARD_INIT(5), SHARD_INIT(6), SHARD_INIT(7),
+    SHARD_INIT(8), SHARD_INIT(9), SHARD_INIT(10), SHARD_INIT(11), SHARD_INIT(12), SHARD_INIT(13), SHARD_INIT(14), SHARD_INIT(15)
+};
+
+pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+shard_t *shard_for(const char *username) {
+    // The hash index probes with the low bits of the hash, so the shard is
+    // picked with the high ones, after a Fibonacci multiply to keep them
+    // independent of the low ones
+    return &shards[directory_hash(username) * 11400714819323198485ULL >> (sizeof(size_t) * CHAR_BIT - SHARD_BITS)];
+}
+
+shard_t *shard_of(const user_t *user) {
+    return &shards[user->id & (NUM_SHARDS - 1)];
+}
+
+void shard_insert(shard_t *shard, user_t *user) {
+    if (shard->users == NULL || strcmp(shard->users->username, user->username) > 0) {
+        user->next = shard->users;
+        if (shard->users == NULL) shard->tail = user;
+        epoch_publish(shard->users, user);
+    } else if (strcmp(shard->tail->username, user->username) <= 0) {
+        user->next = NULL;
+        epoch_publish(shard->tail->next, user);
+        shard->tail = user;
+    } else {
+        user_t *current = shard->users;
+        while (current->next != NULL && strcmp(current->next->username, user->username) < 0) current = current->next;
+        user->next = current->next;
+        epoch_publish(current->next, user);
+    }
+    directory_insert(&shard->directory, user);
+}
+
+void shard_remove(shard_t *shard, user_t *user) {
+    if (shard->users == user) {
+        epoch_publish(shard->users, user->next);
+        if (shard->tail == user) shard->tail = NULL;
+    } else {
+        user_t *current = shard->users;
+        while (current->next != user) current = current->next;
+        // The user keeps its next link, so a reader standing on it carries on
+        epoch_publish(current->next, user->next);
+        if (shard->tail == user) shard->tail = current;
+    }
+    directory_remove(&shard->directory, user);
+}
+
+// Gets the first user of the first shard at or after an index
+static user_t *first_user_from(int index) {
+    for (; index < NUM_SHARDS; index++) {
+        user_t *user = epoch_load(shards[index].users);
+        if (user != NULL) return user;
+    }
+    return NULL;
+}
+
+user_t *shard_first_user(void) {
+    return first_user_from(0);
+}
+
+user_t *shard_next_user(const user_t *user) {
+    user_t *next = epoch_load(user->next);
+    return next != NULL ? next : first_user_from((user->id & (NUM_SHARDS - 1)) + 1);
+}
+
+user_t *shard_user(unsigned int id) {
+    return directory_user(&shards[id & (NUM_SHARDS - 1)].directory, id);
+}
+
+user_handle_t shard_handle(const user_t *user) {
+    return (user_handle_t) {user->id, user->generation};
+}
+
+user_t *shard_resolve(user_handle_t handle) {
+    user_t *user = shard_user(handle.id);
+    return user != NULL && user->generation == handle.generation ? user : NULL;
+}
+
+void shard_add_post(shard_t *shard, post_t *post) {
+    post_ids_t *ids = &shard->post_ids;
+    // Released indexes are reused first, which keeps the IDs dense
+    unsigned int index = (unsigned int) ids->count;
+    post->generation = 0;
+    if (ids->num_released > 0) {
+        directory_released_t released = ids->released[--ids->num_released];
+        index = released.index;
+        post->generation = released.generation;
+    }
+    post->id = index << SHARD_BITS | (unsigned int) (shard - shards);
+    if (index < ids->count) {
+        epoch_publish(ids->by_id[index], post);
+        return;
+    }
+    if (ids->count == ids->capacity) {
+        size_t capacity = ids->capacity == 0 ? SHARD_INITIAL_POST_IDS : ids->capacity * 2;
+        post_t **by_id = malloc(capacity * sizeof(post_t *));
+        assert(by_id != NULL);
+        for (size_t i = 0; i < ids->count; i++) by_id[i] = ids->by_id[i];
+        post_t **old_by_id = ids->by_id;
+        epoch_publish(ids->by_id, by_id);
+        if (old_by_id != NULL) epoch_retire(&shard->retired, epoch_free, NULL, old_by_id);
+        ids->capacity = capacity;
+    }
+    ids->by_id[ids->count] = post;
+    // The count is published last, so a reader that sees the ID also sees
+    // the array holding it
+    epoch_publish(ids->count, ids->count + 1);
+}
+
+void shard_remove_post(shard_t *shard, post_t *post) {
+    post_ids_t *ids = &shard->post_ids;
+    unsigned int index = post->id >> SHARD_BITS;
+    epoch_publish(ids->by_id[index], NULL);
+    if (ids->num_released == ids->released_capacity) {
+        ids->released_capacity = ids->released_capacity == 0 ? 16 : ids->released_capacity * 2;
+        ids->released = realloc(ids->released, ids->released_capacity * sizeof(directory_released_t));
+        assert(ids->released != NULL);
+    }
+    ids->released[ids->num_released++] = (directory_released_t) {index, post->generation + 1};
+}
+
+post_handle_t shard_post_handle(const post_t *post) {
+    return (post_handle_t) {post->id, post->generation};
+}
+
+post_t *shard_resolve_post(post_handle_t handle) {
+    const post_ids_t *ids = &shards[handle.id & (NUM_SHARDS - 1)].post_ids;
+    size_t index = handle.id >> SHARD_BITS;
+    if (index >= epoch_load(ids->count)) return NULL;
+    // A post's generation never changes once it is published
+    post_t *post = epoch_load(epoch_load(ids->by_id)[index]);
+    return post != NULL && post->generation == handle.generation ? post : NULL;
+}
+
+size_t shard_count(void) {
+    size_t count = 0;
+    for (int i = 0; i < NUM_SHARDS; i++) count += epoch_load(shards[i].directory.live);
+    return count;
+}
+
+size_t shard_id_limit(void) {
+    size_t max = 0;
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        size_t count = epoch_load(shards[i].directory.count);
+        if (count > max) max = count;
+    }
+    return max << SHARD_BITS;
+}
+
+void shard_clear(void) {
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        shard_t *shard = &shards[i];
+        // Every node lives in an arena, so whole slabs are released at once
+        // instead of walking and freeing the lists node by node
+        epoch_drain(&shard->retired);
+        // Only the tables of chunk pointers are allocated on their own
+        for (user_t *user = shard->users; user != NULL; user = user->next) postlist_clear(user);
+        arena_release(&shard->post_arena);
+        arena_release(&shard->chunk_arena);
+        arena_release(&shard->user_arena);
+        arena_release(&shard->password_arena);
+        directory_clear(&shard->directory);
+        free(shard->post_ids.by_id);
+        free(shard->post_ids.released);
+        memset(&shard->post_ids, 0, sizeof(post_ids_t));
+        shard->users = NULL;
+        shard->tail = NULL;
+    }
+}
+
+// Adds an arena's counters to a running total. Peaks are summed too, which
+// overstates the combined peak if the shards peaked at different times.
+static void add_arena_stats(arena_t *total, const arena_t *arena) {
+    total->num_slabs += arena->num_slabs;
+    total->live += arena->live;
+    total->peak += arena->peak;
+    total->allocations += arena->allocations;
+    total->frees += arena->frees;
+}
+
+void shard_print_stats(FILE *file) {
+    arena_t users = shards[0].user_arena;
+    arena_t posts = shards[0].post_arena;
+    arena_t passwords = shards[0].password_arena;
+    arena_t chunks = shards[0].chunk_arena;
+    size_t min = shards[0].directory.live;
+    size_t max = min;
+    for (int i = 1; i < NUM_SHARDS; i++) {
+        add_arena_stats(&users, &shards[i].user_arena);
+        add_arena_stats(&posts, &shards[i].post_arena);
+        add_arena_stats(&passwords, &shards[i].password_arena);
+        add_arena_stats(&chunks, &shards[i].chunk_arena);
+        if (shards[i].directory.live < min) min = shards[i].directory.live;
+        if (shards[i].directory.live > max) max = shards[i].directory.live;
+    }
+    arena_print_stats(file, NULL);
+    arena_print_stats(file, &users);
+    arena_print_stats(file, &posts);
+    arena_print_stats(file, &passwords);
+    arena_print_stats(file, &chunks);
+    fprintf(file, "Shards: %d, %zu users, %zu to %zu per shard\n", NUM_SHARDS, shard_count(), min, max);
+}
@@ -0,0 +1,261 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "nodes.h"
+#include "directory.h"
+#include "arena.h"
+#include "epoch.h"
+
+#define SHARD_BITS 4
+#define NUM_SHARDS (1 << SHARD_BITS)
+
+// The IDs of a shard's posts, handed out like the directory's user IDs:
+// dense indexes tagged with the shard, where a deleted post's index goes to
+// the next post with its generation bumped. Lookups take no lock, since the
+// array is replaced rather than grown in place.
+typedef struct post_ids {
+    post_t **by_id;
+    size_t count; // Indexes handed out, including released ones
+    size_t capacity;
+    directory_released_t *released;
+    size_t num_released;
+    size_t released_capacity;
+} post_ids_t;
+
+// The user store is partitioned into shards by username hash. Each shard
+// owns a sorted list of its users, their hash index, the arenas their nodes
+// are allocated from and the domain their unlinked nodes are retired to, and
+// all of it is written under the shard's lock. A user's post nodes, and the
+// chunks its posts are listed in, live in the user's own shard, and posts are
+// given their IDs by their author's shard.
+//
+// User IDs encode their shard in the low SHARD_BITS bits, on top of the
+// user's dense index within the shard, so a user's shard is found from its ID
+// without hashing. The friend graphs, which are the only place friendships
+// are kept, and the fan-out timelines span every shard and are written under
+// the shared lock, which is always taken after a shard lock.
+typedef struct shard {
+    user_t *users;
+    user_t *tail;
+    directory_t directory;
+    arena_t user_arena;
+    arena_t post_arena;
+    arena_t password_arena;
+    arena_t chunk_arena;
+    post_ids_t post_ids;
+    epoch_domain_t retired;
+    pthread_mutex_t lock;
+} shard_t;
+
+extern shard_t shards[NUM_SHARDS];
+
+// Guards the friend graphs and the fan-out timelines
+extern pthread_mutex_t shared_lock;
+
+/**
+ * Routes a username to the shard that owns it, ignoring case.
+ *
+ * Parameters:
+ * username: The username.
+ *
+ * Returns:
+ * The shard.
+ */
+shard_t *shard_for(const char *username);
+
+/**
+ * Gets the shard a user has been added to.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * The shard.
+ */
+shard_t *shard_of(const user_t *user);
+
+/**
+ * Adds a user to its shard's sorted list and hash index, which gives it its
+ * ID. Users added in sorted order are appended in constant time.
+ *
+ * Parameters:
+ * shard: The user's shard, from shard_for.
+ * user: The user.
+ *
+ * Returns:
+ * None
+ */
+void shard_insert(shard_t *shard, user_t *user);
+
+/**
+ * Removes a user from its shard's sorted list and hash index, which frees its
+ * ID for reuse. The user is not freed.
+ *
+ * Parameters:
+ * shard: The user's shard.
+ * user: The user.
+ *
+ * Returns:
+ * None
+ */
+void shard_remove(shard_t *shard, user_t *user);
+
+/**
+ * Gets the first user of the first shard that has any, to walk every user
+ * with shard_next_user.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * The user, or NULL if there are no users.
+ */
+user_t *shard_first_user(void);
+
+/**
+ * Gets the user after a user, moving on to the next shard at the end of a
+ * shard's list.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * The next user, or NULL if it was the last one.
+ */
+user_t *shard_next_user(const user_t *user);
+
+/**
+ * Looks up a user by ID.
+ *
+ * Parameters:
+ * id: The user's ID.
+ *
+ * Returns:
+ * A pointer to the user if the ID is in use and NULL if not.
+ */
+user_t *shard_user(unsigned int id);
+
+/**
+ * Makes a stable handle to a user, which can be kept instead of a pointer to
+ * the user or into it.
+ *
+ * Parameters:
+ * user: The user.
+ *
+ * Returns:
+ * The handle.
+ */
+user_handle_t shard_handle(const user_t *user);
+
+/**
+ * Resolves a handle to its user, checking the generation so a handle to a
+ * deleted user is never resolved to a later user given the same ID.
+ *
+ * Parameters:
+ * handle: The handle.
+ *
+ * Returns:
+ * A pointer to the user if it still exists and NULL if it was deleted.
+ */
+user_t *shard_resolve(user_handle_t handle);
+
+/**
+ * Gives a post the next ID of its author's shard, reusing the index of a
+ * deleted post first.
+ *
+ * Parameters:
+ * shard: The author's shard.
+ * post: The post.
+ *
+ * Returns:
+ * None
+ */
+void shard_add_post(shard_t *shard, post_t *post);
+
+/**
+ * Releases a deleted post's ID for reuse. The post is not freed.
+ *
+ * Parameters:
+ * shard: The author's shard.
+ * post: The post.
+ *
+ * Returns:
+ * None
+ */
+void shard_remove_post(shard_t *shard, post_t *post);
+
+/**
+ * Makes a stable handle to a post, which can be kept instead of a pointer to
+ * the post.
+ *
+ * Parameters:
+ * post: The post.
+ *
+ * Returns:
+ * The handle.
+ */
+post_handle_t shard_post_handle(const post_t *post);
+
+/**
+ * Resolves a handle to its post in constant time, checking the generation so
+ * a handle to a deleted post is never resolved to a later post given the
+ * same ID.
+ *
+ * Parameters:
+ * handle: The handle.
+ *
+ * Returns:
+ * A pointer to the post if it still exists and NULL if it was deleted.
+ */
+post_t *shard_resolve_post(post_handle_t handle);
+
+/**
+ * Counts the users of every shard.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * The number of users.
+ */
+size_t shard_count(void);
+
+/**
+ * Gets a bound on the IDs in use, for sizing arrays indexed by ID.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * A number greater than every ID in use.
+ */
+size_t shard_id_limit(void);
+
+/**
+ * Frees every node of every shard at once, along with the hash indexes. There
+ * must be no readers left.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void shard_clear(void);
+
+/**
+ * Prints the arenas' statistics summed over every shard, and how evenly the
+ * users are spread.
+ *
+ * Parameters:
+ * file: The file to print to.
+ *
+ * Returns:
+ * None
+ */
+void shard_print_stats(FILE *file);
+
+#endif
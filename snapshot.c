@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nodes.h"
+#include "functions.h"
+#include "shard.h"
+#include "graph.h"
+#include "edgeset.h"
+#include "strheap.h"
+#include "search.h"
+#include "postlist.h"
+#include "wal.h"
+#include "snapshot.h"
+
+_Static_assert(MAX_USERNAME_SIZE <= SNAPSHOT_USERNAME_SIZE, "usernames must fit in a snapshot");
+_Static_assert(MAX_PASSWORD_SIZE <= SNAPSHOT_PASSWORD_SIZE, "passwords must fit in a version 1 snapshot");
+_Static_assert(SEARCH_MAX_TERM_SIZE <= SNAPSHOT_TERM_SIZE, "search terms must fit in a snapshot");
+
+// The header of the snapshots before version 3, which has no search index
+#define SNAPSHOT_V2_HEADER_SIZE offsetof(snapshot_header_t, num_terms)
+// The header of version 3 snapshots, which has no log sequence number
+#define SNAPSHOT_V3_HEADER_SIZE offsetof(snapshot_header_t, wal_sequence)
+
+const char *snapshot_path = "users.snap";
+
+static char *mapped_snapshot = NULL;
+static size_t mapped_size = 0;
+
+_Bool snapshot_detect(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return false;
+    char magic[8];
+    _Bool detected = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return detected;
+}
+
+// The terms of the search index, gathered before anything is written since
+// their sizes go in the header
+typedef struct saved_terms {
+    snapshot_term_t *terms;
+    size_t count;
+    size_t capacity;
+    unsigned char *postings;
+    size_t size;
+    size_t postings_capacity;
+} saved_terms_t;
+
+static void save_term(const char *text, const unsigned char *postings, size_t size, void *context) {
+    saved_terms_t *saved = context;
+    if (saved->count == saved->capacity) {
+        saved->capacity = saved->capacity == 0 ? 1024 : saved->capacity * 2;
+        saved->terms = realloc(saved->terms, saved->capacity * sizeof(snapshot_term_t));
+        assert(saved->terms != NULL);
+    }
+    while (saved->size + size > saved->postings_capacity) {
+        saved->postings_capacity = saved->postings_capacity == 0 ? 1 << 16 : saved->postings_capacity * 2;
+        saved->postings = realloc(saved->postings, saved->postings_capacity);
+        assert(saved->postings != NULL);
+    }
+    snapshot_term_t *term = &saved->terms[saved->count++];
+    memset(term, 0, sizeof(snapshot_term_t));
+    strncpy(term->text, text, sizeof(term->text) - 1);
+    term->postings = saved->size;
+    term->size = size;
+    memcpy(saved->postings + saved->size, postings, size);
+    saved->size += size;
+}
+
+_Bool snapshot_save(const char *path) {
+    snapshot_header_t header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, sizeof(snapshot_header_t), 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    header.wal_sequence = wal_last_sequence();
+
+    // Count every section and number the users in shard order
+    unsigned int *index_of = malloc((shard_id_limit() + 1) * sizeof(unsigned int));
+    assert(index_of != NULL);
+    for (const user_t *user = shard_first_user(); user != NULL; user = shard_next_user(user)) {
+        index_of[user->id] = header.num_users++;
+        header.num_edges += graph_degree(&friend_graph, user->id);
+        header.num_posts += postlist_count(user);
+        for (size_t i = 0; i < postlist_length(user); i++) {
+            const post_t *post = postlist_get(user, i);
+            if (post != NULL) header.strings_size += post->length + 1;
+        }
+    }
+    header.users_offset = sizeof(snapshot_header_t);
+    header.edges_offset = header.users_offset + header.num_users * sizeof(snapshot_user_t);
+    header.posts_offset = header.edges_offset + (header.num_edges * sizeof(uint32_t) + 7) / 8 * 8;
+    header.strings_offset = header.posts_offset + header.num_posts * sizeof(snapshot_post_t);
+
+    // Posts are numbered in the order they are loaded, which is the order of
+    // their search IDs once they are
+    unsigned int *numbers = malloc((search_id_limit() + 1) * sizeof(unsigned int));
+    assert(numbers != NULL);
+    unsigned int number = 0;
+    for (const user_t *user = shard_first_user(); user != NULL; user = shard_next_user(user)) {
+        for (size_t i = 0; i < postlist_length(user); i++) {
+            const post_t *post = postlist_get(user, i);
+            if (post != NULL) numbers[post->search_id] = number++;
+        }
+    }
+    saved_terms_t terms = {NULL, 0, 0, NULL, 0, 0};
+    search_for_each_term(numbers, save_term, &terms);
+    free(numbers);
+    header.num_terms = terms.count;
+    header.terms_offset = (header.strings_offset + header.strings_size + 7) / 8 * 8;
+    header.postings_offset = header.terms_offset + header.num_terms * sizeof(snapshot_term_t);
+    header.postings_size = terms.size;
+
+    size_t temporary_size = strlen(path) + 5;
+    char *temporary = malloc(temporary_size);
+    assert(temporary != NULL);
+    snprintf(temporary, temporary_size, "%s.tmp", path);
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        int error = errno;
+        free(terms.postings);
+        free(terms.terms);
+        free(temporary);
+        free(index_of);
+        errno = error;
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    fwrite(&header, sizeof(header), 1, file);
+
+    uint64_t first_edge = 0;
+    uint64_t first_post = 0;
+    for (const user_t *user = shard_first_user(); user != NULL; user = shard_next_user(user)) {
+        snapshot_user_t record;
+        memset(&record, 0, sizeof(record));
+        strncpy(record.username, user->username, sizeof(record.username) - 1);
+        record.password = *user->password;
+        record.first_edge = first_edge;
+        record.first_post = first_post;
+        record.num_friends = graph_degree(&friend_graph, user->id);
+        record.num_posts = postlist_count(user);
+        first_edge += record.num_friends;
+        first_post += record.num_posts;
+        fwrite(&record, sizeof(record), 1, file);
+    }
+
+    for (const user_t *user = shard_first_user(); user != NULL; user = shard_next_user(user)) {
+        graph_iterator_t iterator = graph_friends(&friend_graph, user->id);
+        unsigned int friend;
+        while (graph_next(&iterator, &friend)) {
+            uint32_t index = index_of[friend];
+            fwrite(&index, sizeof(index), 1, file);
+        }
+    }
+    uint32_t padding = 0;
+    if (header.num_edges % 2 != 0) fwrite(&padding, sizeof(padding), 1, file);
+
+    uint64_t content = 0;
+    for (const user_t *user = shard_first_user(); user != NULL; user = shard_next_user(user)) {
+        // Posts are saved newest first, without the deleted ones
+        for (size_t i = postlist_length(user); i > 0; i--) {
+            const post_t *post = postlist_get(user, i - 1);
+            if (post == NULL) continue;
+            snapshot_post_t record = {post->timestamp, content, post->length, 0};
+            fwrite(&record, sizeof(record), 1, file);
+            content += post->length + 1;
+        }
+    }
+
+    for (const user_t *user = shard_first_user(); user != NULL; user = shard_next_user(user)) {
+        for (size_t i = postlist_length(user); i > 0; i--) {
+            const post_t *post = postlist_get(user, i - 1);
+            if (post != NULL) fwrite(post_content(post), 1, post->length + 1, file);
+        }
+    }
+    char zeros[8] = {0};
+    fwrite(zeros, 1, header.terms_offset - header.strings_offset - header.strings_size, file);
+
+    fwrite(terms.terms, sizeof(snapshot_term_t), terms.count, file);
+    fwrite(terms.postings, 1, terms.size, file);
+
+    _Bool saved = fflush(file) == 0 && !ferror(file) && fsync(fileno(file)) == 0;
+    saved = fclose(file) == 0 && saved;
+    if (saved) saved = rename(temporary, path) == 0;
+    if (!saved) {
+        int error = errno;
+        unlink(temporary);
+        errno = error;
+    }
+    free(terms.postings);
+    free(terms.terms);
+    free(temporary);
+    free(index_of);
+    return saved;
+}
+
+// Converts the users of a version 1 snapshot to the current records,
+// hashing their passwords
+static snapshot_user_t *upgrade_users(const snapshot_user_v1_t *old_records, uint64_t num_users) {
+    snapshot_user_t *records = calloc(num_users + 1, sizeof(snapshot_user_t));
+    char (*plaintexts)[SNAPSHOT_PASSWORD_SIZE + 1] = calloc(num_users + 1, SNAPSHOT_PASSWORD_SIZE + 1);
+    const char **passwords = malloc((num_users + 1) * sizeof(char *));
+    password_hash_t *hashes = malloc((num_users + 1) * sizeof(password_hash_t));
+    assert(records != NULL && plaintexts != NULL && passwords != NULL && hashes != NULL);
+    for (uint64_t i = 0; i < num_users; i++) {
+        memcpy(plaintexts[i], old_records[i].password, SNAPSHOT_PASSWORD_SIZE);
+        passwords[i] = plaintexts[i];
+    }
+    password_hash_all(hashes, passwords, num_users, 0);
+    for (uint64_t i = 0; i < num_users; i++) {
+        memcpy(records[i].username, old_records[i].username, SNAPSHOT_USERNAME_SIZE);
+        records[i].password = hashes[i];
+        records[i].first_edge = old_records[i].first_edge;
+        records[i].first_post = old_records[i].first_post;
+        records[i].num_friends = old_records[i].num_friends;
+        records[i].num_posts = old_records[i].num_posts;
+    }
+    free(hashes);
+    free(passwords);
+    free(plaintexts);
+    return records;
+}
+
+// Checks that a section of count records of a given size fits in the file
+static _Bool section_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size) {
+    return offset <= file_size && count <= (file_size - offset) / size;
+}
+
+size_t snapshot_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return 0;
+    }
+    if ((size_t) st.st_size < SNAPSHOT_V2_HEADER_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return 0;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    // The fields an older header lacks read as 0, so its index sections are
+    // empty
+    snapshot_header_t fields;
+    memset(&fields, 0, sizeof(fields));
+    memcpy(&fields, map, SNAPSHOT_V2_HEADER_SIZE);
+    const snapshot_header_t *header = &fields;
+    uint64_t size = st.st_size;
+    size_t header_size = header->version >= 4 ? sizeof(snapshot_header_t)
+                         : header->version == 3 ? SNAPSHOT_V3_HEADER_SIZE : SNAPSHOT_V2_HEADER_SIZE;
+    if (header->header_size == header_size && header_size <= size) memcpy(&fields, map, header_size);
+    size_t user_size = header->version == 1 ? sizeof(snapshot_user_v1_t) : sizeof(snapshot_user_t);
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+        || header->version < 1 || header->version > SNAPSHOT_VERSION
+        || header->header_size != header_size || header_size > size
+        || !section_fits(header->users_offset, header->num_users, user_size, size)
+        || !section_fits(header->edges_offset, header->num_edges, sizeof(uint32_t), size)
+        || !section_fits(header->posts_offset, header->num_posts, sizeof(snapshot_post_t), size)
+        || !section_fits(header->strings_offset, header->strings_size, 1, size)
+        || !section_fits(header->terms_offset, header->num_terms, sizeof(snapshot_term_t), size)
+        || !section_fits(header->postings_offset, header->postings_size, 1, size)) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return 0;
+    }
+    snapshot_user_t *upgraded = NULL;
+    if (header->version == 1) upgraded = upgrade_users((const snapshot_user_v1_t *) (map + header->users_offset), header->num_users);
+    const snapshot_user_t *records = upgraded != NULL ? upgraded : (const snapshot_user_t *) (map + header->users_offset);
+    const uint32_t *edges = (const uint32_t *) (map + header->edges_offset);
+    const snapshot_post_t *posts = (const snapshot_post_t *) (map + header->posts_offset);
+    const char *strings = map + header->strings_offset;
+    const snapshot_term_t *terms = (const snapshot_term_t *) (map + header->terms_offset);
+    const unsigned char *postings = (const unsigned char *) (map + header->postings_offset);
+
+    // With the search index saved, each post's search ID is kept by the
+    // number it was saved under, for the posting lists to be mapped to
+    _Bool index_saved = header->version >= 3;
+    unsigned int *search_ids = NULL;
+    if (index_saved) {
+        search_ids = malloc((header->num_posts + 1) * sizeof(unsigned int));
+        assert(search_ids != NULL);
+        for (uint64_t i = 0; i < header->num_posts; i++) search_ids[i] = SEARCH_NO_ID;
+    }
+
+    // Post content is used in place when the post heap is empty, and copied
+    // otherwise
+    _Bool in_place = post_heap.base == NULL && post_heap.num_chunks == 0;
+    if (in_place) strheap_attach(&post_heap, strings, header->strings_size);
+
+    user_t **by_index = malloc((header->num_users + 1) * sizeof(user_t *));
+    assert(by_index != NULL);
+    for (uint64_t i = 0; i < header->num_users; i++) {
+        char username[SNAPSHOT_USERNAME_SIZE + 1] = "";
+        memcpy(username, records[i].username, SNAPSHOT_USERNAME_SIZE);
+        user_t *user = create_user(username, &records[i].password);
+        shard_insert(shard_for(user->username), user);
+        // The posts were saved newest first, and are pushed oldest first
+        uint64_t end = records[i].first_post + records[i].num_posts;
+        if (end > header->num_posts || end < records[i].first_post) end = header->num_posts;
+        for (uint64_t j = end; j > records[i].first_post; j--) {
+            const snapshot_post_t *record = &posts[j - 1];
+            if (record->length >= MAX_CONTENT_SIZE || record->content >= header->strings_size
+                || record->length >= header->strings_size - record->content || strings[record->content + record->length] != '\0') continue;
+            unsigned long long content = in_place ? record->content : strheap_append(&post_heap, strings + record->content, record->length);
+            post_t *post = restore_post(user, record->timestamp, content, record->length);
+            shard_add_post(shard_of(user), post);
+            postlist_push(user, post);
+            if (index_saved) {
+                search_restore_post(user, post);
+                search_ids[records[i].first_post + (end - j)] = post->search_id;
+            } else {
+                search_add_post(user, post);
+            }
+        }
+        by_index[i] = user;
+    }
+
+    unsigned int *edge_users = malloc((header->num_edges + 1) * sizeof(unsigned int));
+    unsigned int *edge_friends = malloc((header->num_edges + 1) * sizeof(unsigned int));
+    assert(edge_users != NULL && edge_friends != NULL);
+    size_t num_edges = 0;
+    edgeset_reserve(&friend_edges, friend_edges.count + header->num_edges);
+    for (uint64_t i = 0; i < header->num_users; i++) {
+        for (uint64_t j = records[i].first_edge; j < records[i].first_edge + records[i].num_friends && j < header->num_edges; j++) {
+            if (edges[j] >= header->num_users || !edgeset_insert(&friend_edges, by_index[i]->id, by_index[edges[j]]->id)) continue;
+            edge_users[num_edges] = by_index[i]->id;
+            edge_friends[num_edges++] = by_index[edges[j]]->id;
+        }
+    }
+    graph_add_edges(&friend_graph, edge_users, edge_friends, num_edges);
+    graph_add_edges(&follower_graph, edge_friends, edge_users, num_edges);
+    free(edge_friends);
+    free(edge_users);
+    free(by_index);
+    free(upgraded);
+
+    // A term whose record or posting list does not check out is skipped,
+    // like any other record, and its posts cannot be found by it
+    for (uint64_t i = 0; i < header->num_terms; i++) {
+        const snapshot_term_t *term = &terms[i];
+        if (term->text[0] == '\0' || memchr(term->text, '\0', sizeof(term->text)) == NULL
+            || term->postings > header->postings_size || term->size > header->postings_size - term->postings) continue;
+        search_restore_term(term->text, postings + term->postings, term->size, search_ids, header->num_posts);
+    }
+    free(search_ids);
+    wal_restore_sequence(header->wal_sequence);
+
+    if (in_place) {
+        snapshot_unmap();
+        mapped_snapshot = map;
+        mapped_size = st.st_size;
+    } else {
+        munmap(map, st.st_size);
+    }
+    errno = 0;
+    return header->num_users;
+}
+
+void snapshot_unmap(void) {
+    if (mapped_snapshot == NULL) return;
+    munmap(mapped_snapshot, mapped_size);
+    mapped_snapshot = NULL;
+    mapped_size = 0;
+}
@@ -0,0 +1,148 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "nodes.h"
+#include "password.h"
+
+#define SNAPSHOT_MAGIC "TBFSNAP"
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_USERNAME_SIZE 32
+#define SNAPSHOT_PASSWORD_SIZE 16
+#define SNAPSHOT_TERM_SIZE 64
+
+// A binary snapshot of the database. Every section is a flat array addressed
+// by its offset from the start of the file, so a snapshot can be mapped and
+// used without parsing:
+//
+// header   snapshot_header_t
+// users    snapshot_user_t[num_users], shard by shard in list order
+// edges    uint32_t[num_edges], the index of each friend in the users section
+// posts    snapshot_post_t[num_posts], each user's posts newest first
+// strings  The NUL-terminated content of every post
+// terms    snapshot_term_t[num_terms], every term of the search index
+// postings The posting list of every term, coded like the search index's,
+//          with the posts numbered in the order they are loaded: user by
+//          user, each user's posts oldest first
+//
+// Snapshots before version 3 end at the strings, and their header stops short
+// of num_terms. Their posts are split into terms again when they are loaded.
+// Version 3 headers stop short of wal_sequence, and their snapshots are taken
+// to reflect no log record.
+typedef struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t num_users;
+    uint64_t num_edges;
+    uint64_t num_posts;
+    uint64_t users_offset;
+    uint64_t edges_offset;
+    uint64_t posts_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t num_terms;
+    uint64_t terms_offset;
+    uint64_t postings_offset;
+    uint64_t postings_size;
+    uint64_t wal_sequence; // The last log record the snapshot reflects
+} snapshot_header_t;
+
+typedef struct snapshot_user {
+    char username[SNAPSHOT_USERNAME_SIZE];
+    password_hash_t password;
+    uint32_t reserved;
+    uint64_t first_edge;
+    uint64_t first_post;
+    uint32_t num_friends;
+    uint32_t num_posts;
+} snapshot_user_t;
+
+// A user of a version 1 snapshot, which stored passwords in plaintext. They
+// are hashed when the snapshot is loaded.
+typedef struct snapshot_user_v1 {
+    char username[SNAPSHOT_USERNAME_SIZE];
+    char password[SNAPSHOT_PASSWORD_SIZE];
+    uint64_t first_edge;
+    uint64_t first_post;
+    uint32_t num_friends;
+    uint32_t num_posts;
+} snapshot_user_v1_t;
+
+typedef struct snapshot_post {
+    int64_t timestamp;
+    uint64_t content; // Offset in the strings section
+    uint32_t length;
+    uint32_t reserved;
+} snapshot_post_t;
+
+typedef struct snapshot_term {
+    char text[SNAPSHOT_TERM_SIZE]; // NUL-terminated
+    uint64_t postings; // Offset in the postings section
+    uint64_t size;
+} snapshot_term_t;
+
+// Where snapshots are written on exit and on demand
+extern const char *snapshot_path;
+
+/**
+ * Checks if a file starts with the snapshot magic number.
+ *
+ * Parameters:
+ * path: The path of the file.
+ *
+ * Returns:
+ * True if the file is a snapshot and false otherwise.
+ */
+_Bool snapshot_detect(const char *path);
+
+/**
+ * Writes every user, friend edge and post, and the search index, to a
+ * snapshot. The snapshot is
+ * written to a temporary file which replaces the old one once it has been
+ * synced, so a crash never leaves a half-written snapshot behind.
+ *
+ * Parameters:
+ * path: The path of the snapshot.
+ *
+ * Returns:
+ * True if the snapshot was written and false otherwise, with errno set.
+ */
+_Bool snapshot_save(const char *path);
+
+/**
+ * Loads the users from a snapshot into their shards. The file is mapped
+ * read-only and the nodes are built straight from its sections. Version 1
+ * snapshots are loaded too, hashing their plaintext passwords on all CPUs.
+ * Post content is not copied:
+ * the strings section is attached to the post heap and only paged in when a
+ * post is read. The mapping stays alive until snapshot_unmap is called.
+ * The search index is rebuilt from the saved posting lists, so no post is
+ * read, except from snapshots before version 3. The log is told which of
+ * its records the snapshot reflects, for wal_replay to skip. Every user, post and edge
+ * is still built up front rather than on first lookup, since find_user and
+ * shard_resolve take no lock and callers keep the nodes they return: at 200k
+ * users and 2.8M posts a load takes about 1.3 s.
+ *
+ * Parameters:
+ * path: The path of the snapshot.
+ *
+ * Returns:
+ * The number of users. 0 with errno set if the file could not be read or is
+ * not a valid snapshot, or 0 with errno cleared if it has no users.
+ */
+size_t snapshot_load(const char *path);
+
+/**
+ * Unmaps the last snapshot loaded. Post content read from it becomes invalid.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void snapshot_unmap(void);
+
+#endif
@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "strheap.h"
+#include "epoch.h"
+
+#define STRHEAP_CHUNK_BITS 20
+#define STRHEAP_CHUNK_SIZE ((size_t) 1 << STRHEAP_CHUNK_BITS)
+
+string_heap_t post_heap = {NULL, 0, NULL, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, EPOCH_DOMAIN_INIT};
+
+unsigned long long strheap_append(string_heap_t *heap, const char *str, size_t length) {
+    assert(length < STRHEAP_CHUNK_SIZE);
+    pthread_mutex_lock(&heap->lock);
+    // Strings never straddle two chunks
+    if (heap->num_chunks == 0 || heap->used + length + 1 > STRHEAP_CHUNK_SIZE) {
+        // The chunk table is replaced rather than reallocated, since readers
+        // may be indexing the old one
+        if (heap->num_chunks == heap->chunks_capacity) {
+            heap->chunks_capacity = heap->chunks_capacity == 0 ? 16 : heap->chunks_capacity * 2;
+            char **chunks = malloc(heap->chunks_capacity * sizeof(char *));
+            assert(chunks != NULL);
+            for (size_t i = 0; i < heap->num_chunks; i++) chunks[i] = heap->chunks[i];
+            char **old_chunks = heap->chunks;
+            epoch_publish(heap->chunks, chunks);
+            if (old_chunks != NULL) epoch_retire(&heap->retired, epoch_free, NULL, old_chunks);
+        }
+        heap->chunks[heap->num_chunks] = malloc(STRHEAP_CHUNK_SIZE);
+        assert(heap->chunks[heap->num_chunks] != NULL);
+        heap->num_chunks++;
+        heap->used = 0;
+    }
+    unsigned long long offset = heap->base_size + (((unsigned long long) (heap->num_chunks - 1) << STRHEAP_CHUNK_BITS) | heap->used);
+    char *destination = heap->chunks[heap->num_chunks - 1] + heap->used;
+    memcpy(destination, str, length);
+    destination[length] = '\0';
+    heap->used += length + 1;
+    heap->strings++;
+    heap->bytes += length + 1;
+    pthread_mutex_unlock(&heap->lock);
+    return offset;
+}
+
+void strheap_attach(string_heap_t *heap, const char *base, size_t size) {
+    assert(heap->base == NULL && heap->num_chunks == 0);
+    heap->base = base;
+    heap->base_size = size;
+}
+
+const char *strheap_get(const string_heap_t *heap, unsigned long long offset) {
+    if (offset < heap->base_size) return heap->base + offset;
+    offset -= heap->base_size;
+    return epoch_load(heap->chunks)[offset >> STRHEAP_CHUNK_BITS] + (offset & (STRHEAP_CHUNK_SIZE - 1));
+}
+
+void strheap_clear(string_heap_t *heap) {
+    epoch_drain(&heap->retired);
+    for (size_t i = 0; i < heap->num_chunks; i++) free(heap->chunks[i]);
+    free(heap->chunks);
+    heap->base = NULL;
+    heap->base_size = 0;
+    heap->chunks = NULL;
+    heap->num_chunks = 0;
+    heap->chunks_capacity = 0;
+    heap->used = 0;
+    heap->strings = 0;
+    heap->bytes = 0;
+}
+
+void strheap_print_stats(FILE *file, const string_heap_t *heap) {
+    fprintf(file, "String heap: %zu strings, %zu bytes used in %zu chunks of %zu bytes, %zu bytes mapped\n",
+            heap->strings, heap->bytes, heap->num_chunks, STRHEAP_CHUNK_SIZE, heap->base_size);
+}
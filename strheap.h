@@ -0,0 +1,94 @@
+#ifndef STRHEAP_H
+#define STRHEAP_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "epoch.h"
+
+// An append-only heap of NUL-terminated strings, addressed by offset. The
+// heap grows in fixed-size chunks that never move, so a string's address
+// stays valid until the heap is cleared. Offsets below base_size address a
+// read-only base, such as the strings section of a mapped snapshot. Appends
+// are serialized by the heap's lock, while reads take no lock.
+typedef struct string_heap {
+    const char *base;
+    size_t base_size;
+    char **chunks;
+    size_t num_chunks;
+    size_t chunks_capacity;
+    size_t used;
+    size_t strings;
+    size_t bytes;
+    pthread_mutex_t lock;
+    epoch_domain_t retired;
+} string_heap_t;
+
+// The heap of every post's content
+extern string_heap_t post_heap;
+
+/**
+ * Appends a string to the heap.
+ *
+ * Parameters:
+ * heap: The heap.
+ * str: The string. It does not have to be NUL-terminated.
+ * length: The length of the string. It must be less than the chunk size.
+ *
+ * Returns:
+ * The string's offset in the heap.
+ */
+unsigned long long strheap_append(string_heap_t *heap, const char *str, size_t length);
+
+/**
+ * Attaches a read-only block of NUL-terminated strings to an empty heap, so
+ * offsets into the block can be used without copying it. The heap does not
+ * take ownership of the block.
+ *
+ * Parameters:
+ * heap: The heap.
+ * base: The block of strings.
+ * size: The size of the block in bytes.
+ *
+ * Returns:
+ * None
+ */
+void strheap_attach(string_heap_t *heap, const char *base, size_t size);
+
+/**
+ * Gets a string from the heap.
+ *
+ * Parameters:
+ * heap: The heap.
+ * offset: The string's offset.
+ *
+ * Returns:
+ * The NUL-terminated string.
+ */
+const char *strheap_get(const string_heap_t *heap, unsigned long long offset);
+
+/**
+ * Frees every chunk of the heap and detaches its base. There must be no
+ * readers left.
+ *
+ * Parameters:
+ * heap: The heap.
+ *
+ * Returns:
+ * None
+ */
+void strheap_clear(string_heap_t *heap);
+
+/**
+ * Prints the heap's statistics.
+ *
+ * Parameters:
+ * file: The file to print to.
+ * heap: The heap.
+ *
+ * Returns:
+ * None
+ */
+void strheap_print_stats(FILE *file, const string_heap_t *heap);
+
+#endif
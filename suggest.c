@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "nodes.h"
+#include "graph.h"
+#include "shard.h"
+#include "suggest.h"
+
+#define SUGGEST_EXCLUDED UINT_MAX
+#define SUGGEST_CHUNK_SIZE 256
+
+// A user's cached top suggestions, by ID
+typedef struct suggest_entry {
+    _Bool valid;
+    unsigned int count;
+    unsigned int ids[SUGGEST_MAX_RESULTS];
+    unsigned int mutual[SUGGEST_MAX_RESULTS];
+} suggest_entry_t;
+
+// The mutual friend counts of one computation, indexed by ID, with the user
+// and their friends marked SUGGEST_EXCLUDED. Only the touched counts are
+// reset afterwards, so a computation costs nothing for users it never sees.
+typedef struct suggest_scratch {
+    unsigned int *counts;
+    size_t capacity;
+    unsigned int *touched;
+    size_t num_touched;
+    size_t touched_capacity;
+} suggest_scratch_t;
+
+// A precomputing thread's share of the IDs
+typedef struct suggest_worker {
+    pthread_t thread;
+    _Bool threaded;
+    size_t computed;
+} suggest_worker_t;
+
+static suggest_entry_t *cache = NULL;
+static size_t cache_capacity = 0;
+// Reused by every suggest_friends call, which the shared lock serializes
+static suggest_scratch_t shared_scratch = {NULL, 0, NULL, 0, 0};
+static size_t next_precompute_id = 0;
+static size_t precompute_limit = 0;
+static size_t computed = 0;
+static size_t hits = 0;
+static size_t invalidations = 0;
+
+static void cache_reserve(size_t capacity) {
+    if (capacity <= cache_capacity) return;
+    size_t new_capacity = cache_capacity == 0 ? 1024 : cache_capacity;
+    while (new_capacity < capacity) new_capacity *= 2;
+    cache = realloc(cache, new_capacity * sizeof(suggest_entry_t));
+    assert(cache != NULL);
+    memset(cache + cache_capacity, 0, (new_capacity - cache_capacity) * sizeof(suggest_entry_t));
+    cache_capacity = new_capacity;
+}
+
+static void scratch_reserve(suggest_scratch_t *scratch, size_t capacity) {
+    if (capacity <= scratch->capacity) return;
+    free(scratch->counts);
+    scratch->counts = calloc(capacity, sizeof(unsigned int));
+    assert(scratch->counts != NULL);
+    scratch->capacity = capacity;
+}
+
+static void scratch_free(suggest_scratch_t *scratch) {
+    free(scratch->counts);
+    free(scratch->touched);
+    *scratch = (suggest_scratch_t) {NULL, 0, NULL, 0, 0};
+}
+
+static void touch(suggest_scratch_t *scratch, unsigned int id) {
+    if (scratch->num_touched == scratch->touched_capacity) {
+        scratch->touched_capacity = scratch->touched_capacity == 0 ? 1024 : scratch->touched_capacity * 2;
+        scratch->touched = realloc(scratch->touched, scratch->touched_capacity * sizeof(unsigned int));
+        assert(scratch->touched != NULL);
+    }
+    scratch->touched[scratch->num_touched++] = id;
+}
+
+static void exclude(suggest_scratch_t *scratch, unsigned int id) {
+    if (id >= scratch->capacity) return;
+    if (scratch->counts[id] == 0) touch(scratch, id);
+    scratch->counts[id] = SUGGEST_EXCLUDED;
+}
+
+static _Bool ranks_above(unsigned int mutual, unsigned int id, const suggest_entry_t *entry, unsigned int i) {
+    return mutual > entry->mutual[i] || (mutual == entry->mutual[i] && id < entry->ids[i]);
+}
+
+// Keeps the best candidates in order, most mutual friends first and then
+// lowest ID, so ties always break the same way
+static void rank_candidate(suggest_entry_t *entry, unsigned int id, unsigned int mutual) {
+    unsigned int i = entry->count;
+    if (i == SUGGEST_MAX_RESULTS) {
+        if (!ranks_above(mutual, id, entry, i - 1)) return;
+        i--;
+    } else {
+        entry->count++;
+    }
+    for (; i > 0 && ranks_above(mutual, id, entry, i - 1); i--) {
+        entry->ids[i] = entry->ids[i - 1];
+        entry->mutual[i] = entry->mutual[i - 1];
+    }
+    entry->ids[i] = id;
+    entry->mutual[i] = mutual;
+}
+
+static void compute_entry(suggest_scratch_t *scratch, unsigned int user, suggest_entry_t *entry) {
+    exclude(scratch, user);
+    graph_iterator_t friends = graph_friends(&friend_graph, user);
+    unsigned int friend;
+    while (graph_next(&friends, &friend)) exclude(scratch, friend);
+
+    // Every follower of a friend shares that friend with the user
+    friends = graph_friends(&friend_graph, user);
+    while (graph_next(&friends, &friend)) {
+        if (graph_degree(&follower_graph, friend) > SUGGEST_MAX_FOLLOWERS) continue;
+        graph_iterator_t followers = graph_friends(&follower_graph, friend);
+        unsigned int follower;
+        while (graph_next(&followers, &follower)) {
+            if (follower >= scratch->capacity || scratch->counts[follower] == SUGGEST_EXCLUDED) continue;
+            if (scratch->counts[follower]++ == 0) touch(scratch, follower);
+        }
+    }
+
+    entry->count = 0;
+    for (size_t i = 0; i < scratch->num_touched; i++) {
+        unsigned int id = scratch->touched[i];
+        if (scratch->counts[id] != SUGGEST_EXCLUDED) rank_candidate(entry, id, scratch->counts[id]);
+        scratch->counts[id] = 0;
+    }
+    scratch->num_touched = 0;
+    entry->valid = true;
+}
+
+size_t suggest_friends(const user_t *user, suggestion_t *results, size_t limit) {
+    cache_reserve((size_t) user->id + 1);
+    suggest_entry_t *entry = &cache[user->id];
+    if (entry->valid) {
+        hits++;
+    } else {
+        scratch_reserve(&shared_scratch, shard_id_limit());
+        compute_entry(&shared_scratch, user->id, entry);
+        computed++;
+    }
+    size_t n = 0;
+    for (unsigned int i = 0; i < entry->count && n < limit; i++) {
+        results[n].user = shard_user(entry->ids[i]);
+        results[n].mutual = entry->mutual[i];
+        if (results[n].user != NULL) n++;
+    }
+    return n;
+}
+
+size_t suggest_mutual_friends(const user_t *user, const user_t *other, user_t **results, size_t limit) {
+    graph_iterator_t friends = graph_friends(&friend_graph, user->id);
+    graph_iterator_t other_friends = graph_friends(&friend_graph, other->id);
+    unsigned int friend;
+    unsigned int other_friend;
+    size_t n = 0;
+    _Bool more = graph_next(&friends, &friend) && graph_next(&other_friends, &other_friend);
+    while (more && n < limit) {
+        if (friend < other_friend) {
+            more = graph_next(&friends, &friend);
+        } else if (friend > other_friend) {
+            more = graph_next(&other_friends, &other_friend);
+        } else {
+            user_t *mutual = shard_user(friend);
+            if (mutual != NULL) results[n++] = mutual;
+            more = graph_next(&friends, &friend) && graph_next(&other_friends, &other_friend);
+        }
+    }
+    return n;
+}
+
+static void invalidate(unsigned int user) {
+    if (user < cache_capacity && cache[user].valid) {
+        cache[user].valid = false;
+        invalidations++;
+    }
+}
+
+void suggest_invalidate(unsigned int user, unsigned int friend) {
+    invalidate(user);
+    // A friend past the follower limit is no hop for anyone, unless this
+    // edge just moved it across the limit
+    if (graph_degree(&follower_graph, friend) > SUGGEST_MAX_FOLLOWERS + 1) return;
+    graph_iterator_t followers = graph_friends(&follower_graph, friend);
+    unsigned int follower;
+    while (graph_next(&followers, &follower)) invalidate(follower);
+}
+
+static void *precompute_chunks(void *arg) {
+    suggest_worker_t *worker = arg;
+    suggest_scratch_t scratch = {NULL, 0, NULL, 0, 0};
+    scratch_reserve(&scratch, precompute_limit);
+    // Chunks are handed out one at a time, since a few users with huge
+    // neighbourhoods would leave fixed shares unbalanced
+    size_t start;
+    while ((start = __atomic_fetch_add(&next_precompute_id, SUGGEST_CHUNK_SIZE, __ATOMIC_RELAXED)) < precompute_limit) {
+        size_t end = start + SUGGEST_CHUNK_SIZE < precompute_limit ? start + SUGGEST_CHUNK_SIZE : precompute_limit;
+        for (size_t id = start; id < end; id++) {
+            if (cache[id].valid || shard_user(id) == NULL) continue;
+            compute_entry(&scratch, id, &cache[id]);
+            worker->computed++;
+        }
+    }
+    scratch_free(&scratch);
+    return NULL;
+}
+
+size_t suggest_precompute(int num_threads) {
+    if (num_threads <= 0) num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads <= 0) num_threads = 1;
+    precompute_limit = shard_id_limit();
+    next_precompute_id = 0;
+    cache_reserve(precompute_limit);
+
+    suggest_worker_t *workers = calloc(num_threads, sizeof(suggest_worker_t));
+    assert(workers != NULL);
+    for (int i = 1; i < num_threads; i++) {
+        workers[i].threaded = pthread_create(&workers[i].thread, NULL, precompute_chunks, &workers[i]) == 0;
+    }
+    precompute_chunks(&workers[0]);
+    size_t total = workers[0].computed;
+    for (int i = 1; i < num_threads; i++) {
+        if (workers[i].threaded) pthread_join(workers[i].thread, NULL);
+        total += workers[i].computed;
+    }
+    free(workers);
+    computed += total;
+    return total;
+}
+
+void suggest_clear(void) {
+    free(cache);
+    cache = NULL;
+    cache_capacity = 0;
+    scratch_free(&shared_scratch);
+}
+
+void suggest_print_stats(FILE *file) {
+    fprintf(file, "Suggestions: %zu computed, %zu cache hits, %zu invalidated\n", computed, hits, invalidations);
+}
@@ -0,0 +1,108 @@
+#ifndef SUGGEST_H
+#define SUGGEST_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "nodes.h"
+
+#define SUGGEST_MAX_RESULTS 10
+#define SUGGEST_MAX_FOLLOWERS 10000
+
+// "People you may know" suggestions from the friend graphs. The candidates
+// for a user are the other followers of the user's friends, that is everyone
+// two hops away, and each is scored by its number of mutual friends, the
+// friends both users have in common. Friends with more than
+// SUGGEST_MAX_FOLLOWERS followers are skipped as a hop, since nearly everyone
+// follows them and they would make every neighbourhood huge.
+//
+// Mutual friends are counted in an array indexed by user ID, so a user's
+// suggestions take time linear in the size of their 2-hop neighbourhood. The
+// top SUGGEST_MAX_RESULTS of every user are cached, and a friend edge being
+// added or removed invalidates the entries it can change: its user's and
+// those of the friend's followers. Like the graphs, the cache is only used
+// under the shared lock.
+
+// A suggested friend
+typedef struct suggestion {
+    user_t *user;
+    unsigned int mutual;
+} suggestion_t;
+
+/**
+ * Gets the suggested friends of a user, computing them if they are not
+ * cached.
+ *
+ * Parameters:
+ * user: The user.
+ * results: Where to store the suggestions, most mutual friends first.
+ * limit: The maximum number of suggestions, at most SUGGEST_MAX_RESULTS
+ * of which are kept.
+ *
+ * Returns:
+ * The number of suggestions stored.
+ */
+size_t suggest_friends(const user_t *user, suggestion_t *results, size_t limit);
+
+/**
+ * Finds the friends two users have in common by intersecting their sorted
+ * friend lists.
+ *
+ * Parameters:
+ * user: The first user.
+ * other: The second user.
+ * results: Where to store the mutual friends, in order of ID.
+ * limit: The maximum number of mutual friends.
+ *
+ * Returns:
+ * The number of mutual friends stored.
+ */
+size_t suggest_mutual_friends(const user_t *user, const user_t *other, user_t **results, size_t limit);
+
+/**
+ * Invalidates the cached suggestions a friend edge changes. Called after the
+ * edge is added to or removed from the graphs.
+ *
+ * Parameters:
+ * user: The ID of the user.
+ * friend: The ID of the friend.
+ *
+ * Returns:
+ * None
+ */
+void suggest_invalidate(unsigned int user, unsigned int friend);
+
+/**
+ * Computes the suggestions of every user whose suggestions are not cached,
+ * split across threads. Nothing may write the graphs while it runs.
+ *
+ * Parameters:
+ * num_threads: The number of threads, or 0 for one per CPU.
+ *
+ * Returns:
+ * The number of users whose suggestions were computed.
+ */
+size_t suggest_precompute(int num_threads);
+
+/**
+ * Frees the cache.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void suggest_clear(void);
+
+/**
+ * Prints the cache's statistics.
+ *
+ * Parameters:
+ * file: The file to print to.
+ *
+ * Returns:
+ * None
+ */
+void suggest_print_stats(FILE *file);
+
+#endif
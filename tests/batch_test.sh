@@ -0,0 +1,138 @@
+#!/bin/sh
+# Runs a script of commands through -b against a small users.csv and checks
+# every reply, with the timestamps masked: each command's success and error
+# replies, logging in and out, a deleted account, and the lists of posts,
+# feeds, search results, users and suggestions.
+#
+# gcc -g main.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o tbf.exe -pthread
+# tests/batch_test.sh ./tbf.exe
+
+program=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+directory=$(mktemp -d)
+trap 'rm -rf "$directory"' EXIT
+cd "$directory" || exit 1
+
+cat > users.csv << 'END'
+username,password,friends,,,posts,,
+alice,alicepassword,bob, , ,hello from alice #intro,second alice post
+bob,bobpassword,alice,carol, ,bob was here #intro
+carol,carolpassword,bob, , ,carol says hi
+END
+
+"$program" -k 1 -b - << 'END' | sed -E 's/[0-9]{16}/T/g' > replies
+# Comments and blank lines get no reply
+
+feed
+frobnicate
+register dave
+register dave short
+register dave davepassword
+register alice alicepassword
+login alice wrongpassword
+login alice alicepassword
+post
+post   
+post a new post from alice
+posts alice
+unpost 999.0
+unpost
+unpost
+posts alice 1
+purge
+purge nothing matches
+friend nobody
+friend carol
+posts carol
+unfriend carol
+posts carol
+unfriend carol
+feed 2
+search #intro
+search #intro OR carol
+search a b c d e f g h i j k l m n o p q r s t u v w x y z 0 1 2 3 4 5 6
+users b
+users
+suggest
+page bob 1
+password wrongpassword newpassword1
+password alicepassword newpassword1
+logout
+login alice alicepassword
+login alice newpassword1
+delete alicepassword
+delete newpassword1
+feed
+login bob bobpassword
+feed
+END
+
+cat > expected << 'END'
+err login
+err command
+err usage
+err password
+ok
+err exists
+err auth
+ok
+err usage
+err usage
+ok T 40.0
+ok 3
+T a new post from alice
+T second alice post
+T hello from alice #intro
+err notfound
+ok
+ok
+ok 1
+T hello from alice #intro
+err usage
+ok 0
+err notfound
+ok
+ok 1
+T carol says hi
+ok
+err notfriend
+err notfound
+ok 1
+T bob bob was here #intro
+ok 2
+T bob bob was here #intro
+T alice hello from alice #intro
+ok 3
+T carol carol says hi
+T bob bob was here #intro
+T alice hello from alice #intro
+err query
+ok 1
+bob
+ok 4
+alice
+bob
+carol
+dave
+ok 1
+carol 1
+ok 1 end
+T bob was here #intro
+err auth
+ok
+ok
+err auth
+ok
+err auth
+ok
+err login
+ok
+ok 1
+T carol carol says hi
+END
+
+if ! diff expected replies > /dev/null; then
+    echo "batch_test: the replies differ from the expected ones:" >&2
+    diff expected replies >&2
+    exit 1
+fi
+exit 0
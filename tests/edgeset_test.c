@@ -0,0 +1,119 @@
+// Checks the edge set against a plain matrix through enough inserts and
+// removes to rebuild its table several times, then checks that friendships
+// are one-way by default and mutual with symmetric edges (-m), in both the
+// edge set and the friend and follower graphs.
+//
+// gcc -g -I. tests/edgeset_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o edgeset_test -pthread -lm
+// ./edgeset_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "nodes.h"
+#include "functions.h"
+#include "edgeset.h"
+#include "graph.h"
+#include "test.h"
+
+#define NUM_IDS 64
+
+static _Bool matrix[NUM_IDS][NUM_IDS];
+
+static void check_matrix(const edgeset_t *set) {
+    size_t count = 0;
+    for (unsigned int i = 0; i < NUM_IDS; i++) {
+        for (unsigned int j = 0; j < NUM_IDS; j++) {
+            check(edgeset_contains(set, i, j) == matrix[i][j]);
+            count += matrix[i][j];
+        }
+    }
+    check(set->count == count);
+}
+
+// Checks one direction of a friendship everywhere it is kept
+static void check_friends(const user_t *user, const user_t *friend_user, _Bool expected) {
+    check(edgeset_contains(&friend_edges, user->id, friend_user->id) == expected);
+    check(graph_has_edge(&friend_graph, user->id, friend_user->id) == expected);
+    check(graph_has_edge(&follower_graph, friend_user->id, user->id) == expected);
+}
+
+int main(void) {
+    // Random inserts and removes, with ID 0 and pairs in both directions
+    // included, leave the set agreeing with the matrix
+    edgeset_t set = EDGESET_INIT;
+    check(!edgeset_contains(&set, 0, 0));
+    check(!edgeset_remove(&set, 0, 0));
+    srand(1);
+    for (int i = 0; i < 20000; i++) {
+        unsigned int user = rand() % NUM_IDS;
+        unsigned int friend = rand() % NUM_IDS;
+        if (rand() % 3 == 0) {
+            check(edgeset_remove(&set, user, friend) == matrix[user][friend]);
+            matrix[user][friend] = false;
+        } else {
+            check(edgeset_insert(&set, user, friend) == !matrix[user][friend]);
+            matrix[user][friend] = true;
+        }
+        if (i % 1000 == 0) check_matrix(&set);
+    }
+    check_matrix(&set);
+    // Emptying the set leaves only tombstones, which lookups step over
+    for (unsigned int i = 0; i < NUM_IDS; i++) {
+        for (unsigned int j = 0; j < NUM_IDS; j++) {
+            check(edgeset_remove(&set, i, j) == matrix[i][j]);
+            matrix[i][j] = false;
+        }
+    }
+    check_matrix(&set);
+    edgeset_reserve(&set, 1000);
+    check(edgeset_insert(&set, 3, 5));
+    matrix[3][5] = true;
+    check_matrix(&set);
+    edgeset_clear(&set);
+
+    user_t *alice = test_add_user("alice");
+    user_t *bob = test_add_user("bob");
+    user_t *carol = test_add_user("carol");
+
+    // By default a friendship goes one way
+    add_friend(alice, "bob");
+    check_friends(alice, bob, true);
+    check_friends(bob, alice, false);
+    check(!delete_friend(bob, "alice"));
+    check_friends(alice, bob, true);
+    check(delete_friend(alice, "BOB"));
+    check_friends(alice, bob, false);
+
+    // Symmetric edges make both directions together, and removing either
+    // removes both
+    edgeset_settings.symmetric = true;
+    add_friend(alice, "carol");
+    check_friends(alice, carol, true);
+    check_friends(carol, alice, true);
+    add_friend(carol, "alice");
+    check(friend_edges.count == 2);
+    check(delete_friend(carol, "alice"));
+    check_friends(alice, carol, false);
+    check_friends(carol, alice, false);
+    check(!delete_friend(alice, "carol"));
+    // Befriending oneself makes one edge
+    add_friend(bob, "bob");
+    check_friends(bob, bob, true);
+    check(friend_edges.count == 1);
+    check(delete_friend(bob, "bob"));
+    check(friend_edges.count == 0);
+
+    // Deleting a user removes the friendships both ways
+    add_friend(alice, "bob");
+    add_friend(carol, "bob");
+    unsigned int bob_id = bob->id;
+    delete_user(bob);
+    check(!edgeset_contains(&friend_edges, alice->id, bob_id));
+    check(friend_edges.count == 0);
+    edgeset_settings.symmetric = false;
+
+    teardown();
+    printf("ok\n");
+    return 0;
+}
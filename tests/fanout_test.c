@@ -0,0 +1,89 @@
+// Fans posts out to a follower's timeline, deletes some of them along with
+// one of their authors, and checks that the feed skips the dead entries, even
+// once a new post reuses a deleted post's ID.
+//
+// gcc -g -I. tests/fanout_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o fanout_test -pthread -lm
+// ./fanout_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "nodes.h"
+#include "functions.h"
+#include "postlist.h"
+#include "fanout.h"
+#include "feed.h"
+#include "shard.h"
+#include "test.h"
+
+#define NUM_POSTS 10
+
+static post_t *write_post(user_t *user, int number) {
+    char text[32];
+    snprintf(text, sizeof(text), "post %d", number);
+    add_post(user, text);
+    return postlist_newest(user);
+}
+
+// Reads a user's whole feed and checks it against the expected post numbers
+// and authors, newest first
+static void check_feed(const user_t *user, const int *numbers, const user_t **authors, size_t count) {
+    feed_t feed;
+    feed_open(&feed, user);
+    size_t n = 0;
+    const post_t *post;
+    const user_t *author;
+    while ((post = feed_next(&feed, &author)) != NULL) {
+        check(n < count);
+        check(test_post_number(post) == numbers[n]);
+        check(author == authors[n]);
+        n++;
+    }
+    check(n == count);
+    feed_close(&feed);
+}
+
+int main(void) {
+    fanout_settings.enabled = true;
+    fanout_settings.capacity = 32;
+    fanout_settings.celebrity_threshold = 100;
+    user_t *reader = test_add_user("alice");
+    user_t *writer = test_add_user("bob");
+    user_t *leaver = test_add_user("carol");
+    add_friend(reader, "bob");
+    add_friend(reader, "carol");
+
+    // The reader's timeline is warm before anything is posted, so every post
+    // is pushed to it
+    check(fanout_timeline(reader)->warm);
+    post_t *posts[NUM_POSTS];
+    for (int i = 0; i < NUM_POSTS; i++) posts[i] = write_post(writer, i);
+    write_post(leaver, NUM_POSTS);
+    write_post(leaver, NUM_POSTS + 1);
+
+    // Deleting posts leaves their entries in place, and a new post that
+    // reuses a deleted post's ID only shows up once
+    post_handle_t deleted = shard_post_handle(posts[7]);
+    remove_post(writer, posts[3]);
+    remove_post(writer, posts[7]);
+    post_t *reused = write_post(writer, NUM_POSTS + 2);
+    check(shard_post_handle(reused).id == deleted.id);
+    check(shard_resolve_post(deleted) == NULL);
+    check(fanout_timeline(reader)->count == NUM_POSTS + 3);
+    {
+        int numbers[] = {12, 11, 10, 9, 8, 6, 5, 4, 2, 1, 0};
+        const user_t *authors[] = {writer, leaver, leaver, writer, writer, writer, writer, writer, writer, writer, writer};
+        check_feed(reader, numbers, authors, sizeof(numbers) / sizeof(numbers[0]));
+    }
+
+    // Deleting an author drops all of their posts from the feed
+    delete_user(leaver);
+    {
+        int numbers[] = {12, 9, 8, 6, 5, 4, 2, 1, 0};
+        const user_t *authors[] = {writer, writer, writer, writer, writer, writer, writer, writer, writer};
+        check_feed(reader, numbers, authors, sizeof(numbers) / sizeof(numbers[0]));
+    }
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Checks that every compare and hash kernel the CPU supports gives the same
+// results as the scalar one, on strings of every length up to a few blocks,
+// with bytes around 'A' to 'Z' and above 0x7F, followed by garbage the
+// vector loads read and must mask off, and ending right before an unmapped
+// page, where a load past the end would fault.
+//
+// gcc -g -I. tests/fold_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o fold_test -pthread -lm
+// ./fold_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "fold.h"
+#include "test.h"
+
+#define MAX_LENGTH 96
+#define ROUNDS 200
+
+// The bytes on either side of the letters, and some that are not ASCII
+static const unsigned char edge_bytes[] = {'@', 'A', 'M', 'Z', '[', '`', 'a', 'm', 'z', '{', 0x00, 0x7F, 0x80, 0xC1, 0xC3, 0xDA, 0xFF};
+
+static unsigned char random_byte(void) {
+    if (rand() % 2 == 0) return edge_bytes[rand() % sizeof(edge_bytes)];
+    return (unsigned char) rand();
+}
+
+// Maps a readable page followed by an unmapped one
+static char *map_guarded_page(size_t page_size) {
+    char *pages = mmap(NULL, 2 * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    check(pages != MAP_FAILED);
+    check(mprotect(pages + page_size, page_size, PROT_NONE) == 0);
+    return pages;
+}
+
+// Checks every kernel on a pair of strings against the scalar one
+static void check_kernels(const char *str1, const char *str2, size_t length) {
+    check(fold_select(FOLD_SCALAR));
+    int compare = fold_compare(str1, str2, length);
+    size_t hash1 = fold_hash(str1, length);
+    size_t hash2 = fold_hash(str2, length);
+    for (fold_isa_t isa = FOLD_SSE2; isa <= FOLD_AVX2; isa++) {
+        if (!fold_select(isa)) continue;
+        check(fold_compare(str1, str2, length) == compare);
+        check(fold_compare(str2, str1, length) == -compare);
+        check(fold_hash(str1, length) == hash1);
+        check(fold_hash(str2, length) == hash2);
+    }
+}
+
+// Writes a string and a copy of it with the case of the letters swapped and
+// possibly one byte changed, then checks them with different bytes after
+// them
+static void check_strings(char *str1, char *str2, size_t length, size_t after) {
+    for (size_t i = 0; i < length; i++) {
+        str1[i] = (char) random_byte();
+        char c = str1[i];
+        str2[i] = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ? c ^ 0x20 : c;
+    }
+    if (length > 0 && rand() % 2 == 0) str2[rand() % length] = (char) random_byte();
+    for (int fill = 0; fill < 2; fill++) {
+        for (size_t i = 0; i < after; i++) {
+            str1[length + i] = (char) random_byte();
+            str2[length + i] = fill == 0 ? str1[length + i] : (char) random_byte();
+        }
+        check_kernels(str1, str2, length);
+    }
+}
+
+int main(void) {
+    printf("Kernels:");
+    for (fold_isa_t isa = FOLD_SCALAR; isa <= fold_detect(); isa++) printf(" %s", fold_isa_name(isa));
+    printf("\n");
+
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    char *page1 = map_guarded_page(page_size);
+    char *page2 = map_guarded_page(page_size);
+    srand(1);
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t length = 0; length <= MAX_LENGTH; length++) {
+            // Inside the page, at any alignment, with garbage after the end
+            size_t offset = rand() % 64;
+            check_strings(page1 + offset, page2 + offset + rand() % 64, length, 64);
+            // Ending right at the unmapped page, and one string starting a
+            // page so the two are not aligned alike
+            check_strings(page1 + page_size - length, page2 + page_size - length, length, 0);
+            check_strings(page1 + page_size - length, page2 + (page_size - MAX_LENGTH) / 2, length, 0);
+        }
+    }
+
+    // Equal strings hash and compare the same in any case
+    check_kernels("Hello, World! \xC3\x89t\xC3\xA9", "hELLO, wORLD! \xC3\x89T\xC3\xA9", 19);
+    check(fold_compare("Hello", "hELLO", 5) == 0);
+    check(fold_hash("Hello", 5) == fold_hash("hELLO", 5));
+    // Bytes from 0x80 on are never folded, nor '@' or '['
+    check(fold_compare("\xC3", "\xE3", 1) != 0);
+    check(fold_compare("@[", "`{", 2) != 0);
+
+    munmap(page1, 2 * page_size);
+    munmap(page2, 2 * page_size);
+    printf("ok\n");
+    return 0;
+}
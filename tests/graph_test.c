@@ -0,0 +1,92 @@
+// Checks the friend graph against an adjacency matrix through random adds and
+// removes, across the compactions that merge the delta rows into the CSR
+// arrays.
+//
+// gcc -g -I. tests/graph_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o graph_test -pthread -lm
+// ./graph_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "graph.h"
+#include "test.h"
+
+#define NUM_USERS 300
+#define NUM_CHANGES 200000
+
+static _Bool edges[NUM_USERS][NUM_USERS];
+
+static void check_user(const friend_graph_t *graph, unsigned int user) {
+    graph_iterator_t iterator = graph_friends(graph, user);
+    unsigned int expected = 0;
+    size_t degree = 0;
+    unsigned int friend;
+    while (graph_next(&iterator, &friend)) {
+        while (expected < NUM_USERS && !edges[user][expected]) expected++;
+        check(friend == expected);
+        expected++;
+        degree++;
+    }
+    while (expected < NUM_USERS && !edges[user][expected]) expected++;
+    check(expected == NUM_USERS);
+    check(graph_degree(graph, user) == degree);
+}
+
+int main(void) {
+    friend_graph_t graph = {NULL, NULL, 0, 0, NULL, 0, 0};
+    srand(1);
+
+    // A bulk load with repeated edges, which leaves the users past the first
+    // half out of the CSR arrays until the first compaction
+    size_t count = NUM_USERS * 20;
+    unsigned int *users = malloc(count * sizeof(unsigned int));
+    unsigned int *friends = malloc(count * sizeof(unsigned int));
+    check(users != NULL && friends != NULL);
+    for (size_t i = 0; i < count; i++) {
+        users[i] = rand() % (NUM_USERS / 2);
+        friends[i] = rand() % NUM_USERS;
+        edges[users[i]][friends[i]] = true;
+    }
+    graph_add_edges(&graph, users, friends, count);
+    free(users);
+    free(friends);
+    check(graph.delta_count == 0);
+    for (unsigned int user = 0; user < NUM_USERS; user++) check_user(&graph, user);
+
+    size_t compactions = 0;
+    for (size_t i = 0; i < NUM_CHANGES; i++) {
+        unsigned int user = rand() % NUM_USERS;
+        unsigned int friend = rand() % NUM_USERS;
+        size_t pending = graph.delta_count;
+        if (rand() % 2 == 0) {
+            graph_add_edge(&graph, user, friend);
+            edges[user][friend] = true;
+        } else {
+            graph_remove_edge(&graph, user, friend);
+            edges[user][friend] = false;
+        }
+        check(graph_has_edge(&graph, user, friend) == edges[user][friend]);
+        if (graph.delta_count < pending) {
+            // A compaction leaves nothing pending, and the CSR arrays alone
+            // hold every edge
+            compactions++;
+            check(graph.delta_count == 0);
+            size_t num_edges = 0;
+            for (unsigned int u = 0; u < NUM_USERS; u++) {
+                for (unsigned int f = 0; f < NUM_USERS; f++) num_edges += edges[u][f];
+            }
+            check(graph.num_edges == num_edges);
+        }
+        if (i % 5000 == 0) {
+            for (unsigned int u = 0; u < NUM_USERS; u++) check_user(&graph, u);
+        }
+    }
+    check(compactions > 0);
+    for (unsigned int user = 0; user < NUM_USERS; user++) check_user(&graph, user);
+
+    graph_compact(&graph);
+    check(graph.delta_count == 0);
+    for (unsigned int user = 0; user < NUM_USERS; user++) check_user(&graph, user);
+    graph_clear(&graph);
+    return 0;
+}
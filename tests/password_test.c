@@ -0,0 +1,112 @@
+// Checks scrypt against the test vectors of RFC 7914, then that hashes made
+// at the import cost verify and are replaced at the full cost when their
+// user logs in, while hashes at the full cost are kept.
+//
+// gcc -g -I. tests/password_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o password_test -pthread -lm
+// ./password_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "nodes.h"
+#include "functions.h"
+#include "password.h"
+#include "batch.h"
+#include "test.h"
+
+// The scrypt test vectors of RFC 7914, section 12
+static const struct {
+    const char *password;
+    const char *salt;
+    unsigned int log_n;
+    unsigned int r;
+    unsigned int p;
+    uint8_t key[64];
+} vectors[] = {
+    {"", "", 4, 1, 1, {
+        0x77, 0xd6, 0x57, 0x62, 0x38, 0x65, 0x7b, 0x20, 0x3b, 0x19, 0xca, 0x42, 0xc1, 0x8a, 0x04, 0x97,
+        0xf1, 0x6b, 0x48, 0x44, 0xe3, 0x07, 0x4a, 0xe8, 0xdf, 0xdf, 0xfa, 0x3f, 0xed, 0xe2, 0x14, 0x42,
+        0xfc, 0xd0, 0x06, 0x9d, 0xed, 0x09, 0x48, 0xf8, 0x32, 0x6a, 0x75, 0x3a, 0x0f, 0xc8, 0x1f, 0x17,
+        0xe8, 0xd3, 0xe0, 0xfb, 0x2e, 0x0d, 0x36, 0x28, 0xcf, 0x35, 0xe2, 0x0c, 0x38, 0xd1, 0x89, 0x06}},
+    {"password", "NaCl", 10, 8, 16, {
+        0xfd, 0xba, 0xbe, 0x1c, 0x9d, 0x34, 0x72, 0x00, 0x78, 0x56, 0xe7, 0x19, 0x0d, 0x01, 0xe9, 0xfe,
+        0x7c, 0x6a, 0xd7, 0xcb, 0xc8, 0x23, 0x78, 0x30, 0xe7, 0x73, 0x76, 0x63, 0x4b, 0x37, 0x31, 0x62,
+        0x2e, 0xaf, 0x30, 0xd9, 0x2e, 0x22, 0xa3, 0x88, 0x6f, 0xf1, 0x09, 0x27, 0x9d, 0x98, 0x30, 0xda,
+        0xc7, 0x27, 0xaf, 0xb9, 0x4a, 0x83, 0xee, 0x6d, 0x83, 0x60, 0xcb, 0xdf, 0xa2, 0xcc, 0x06, 0x40}},
+    {"pleaseletmein", "SodiumChloride", 14, 8, 1, {
+        0x70, 0x23, 0xbd, 0xcb, 0x3a, 0xfd, 0x73, 0x48, 0x46, 0x1c, 0x06, 0xcd, 0x81, 0xfd, 0x38, 0xeb,
+        0xfd, 0xa8, 0xfb, 0xba, 0x90, 0x4f, 0x8e, 0x3e, 0xa9, 0xb5, 0x43, 0xf6, 0x54, 0x5d, 0xa1, 0xf2,
+        0xd5, 0x43, 0x29, 0x55, 0x61, 0x3f, 0x0f, 0xcf, 0x62, 0xd4, 0x97, 0x05, 0x24, 0x2a, 0x9a, 0xf9,
+        0xe6, 0x1e, 0x85, 0xdc, 0x0d, 0x65, 0x1e, 0x40, 0xdf, 0xcf, 0x01, 0x7b, 0x45, 0x57, 0x58, 0x87}}
+};
+
+// Logs in through the command stream, preparing the command as the server does
+static void login(const char *line, const char *expected) {
+    batch_session_t session = BATCH_SESSION_INIT;
+    char command[64];
+    char *reply = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&reply, &size);
+    check(out != NULL);
+    snprintf(command, sizeof(command), "%s", line);
+    batch_prepare(&session, command);
+    batch_execute(&session, command, out);
+    fclose(out);
+    check(strcmp(reply, expected) == 0);
+    free(reply);
+}
+
+int main(void) {
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        uint8_t key[64];
+        password_scrypt(vectors[i].password, strlen(vectors[i].password), vectors[i].salt, strlen(vectors[i].salt),
+                        vectors[i].log_n, vectors[i].r, vectors[i].p, key, sizeof(key));
+        check(memcmp(key, vectors[i].key, sizeof(key)) == 0);
+        // A shorter key is a prefix of the longer one
+        password_scrypt(vectors[i].password, strlen(vectors[i].password), vectors[i].salt, strlen(vectors[i].salt),
+                        vectors[i].log_n, vectors[i].r, vectors[i].p, key, 16);
+        check(memcmp(key, vectors[i].key, 16) == 0);
+    }
+
+    // A bulk import hashes at the import cost, and the hashes still verify
+    password_settings.log_n = 6;
+    password_settings.import_log_n = 2;
+    static const char *const passwords[] = {"alicepassword", "bobpassword"};
+    password_hash_t hashes[2];
+    password_hash_all(hashes, passwords, 2, 2);
+    for (int i = 0; i < 2; i++) {
+        check(hashes[i].log_n == 2);
+        check(password_outdated(&hashes[i]));
+        check(password_verify(&hashes[i], passwords[i]));
+        check(!password_verify(&hashes[i], passwords[1 - i]));
+    }
+    check(memcmp(hashes[0].salt, hashes[1].salt, PASSWORD_SALT_SIZE) != 0);
+    password_hash_t full;
+    password_hash(&full, "carolpassword");
+    check(full.log_n == 6 && !password_outdated(&full));
+    // The import cost never exceeds the full one
+    password_settings.import_log_n = 10;
+    password_hash_t capped;
+    password_hash_all(&capped, passwords, 1, 1);
+    check(capped.log_n == 6);
+
+    // A wrong password leaves an imported hash alone, and the right one
+    // replaces it at the full cost
+    user_t *alice = add_user("alice", &hashes[0]);
+    user_t *carol = add_user("carol", &full);
+    check(alice != NULL && carol != NULL);
+    login("login alice bobpassword", "err auth\n");
+    check(alice->password->log_n == 2);
+    login("login alice alicepassword", "ok\n");
+    check(alice->password->log_n == 6);
+    check(password_verify(alice->password, "alicepassword"));
+    const password_hash_t *upgraded = alice->password;
+    login("login alice alicepassword", "ok\n");
+    check(alice->password == upgraded);
+    login("login carol carolpassword", "ok\n");
+    check(memcmp(carol->password, &full, sizeof(full)) == 0);
+
+    teardown();
+    printf("ok\n");
+    return 0;
+}
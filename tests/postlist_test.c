@@ -0,0 +1,99 @@
+// Deletes posts from the middle of a user's list until it is compacted, and
+// checks that a cursor opened before the deletes resumes at the right post,
+// that the tombstones are gone after the compaction, and that the IDs of the
+// deleted posts never find the posts that reuse them.
+//
+// gcc -g -I. tests/postlist_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o postlist_test -pthread -lm
+// ./postlist_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "nodes.h"
+#include "functions.h"
+#include "postlist.h"
+#include "shard.h"
+#include "test.h"
+
+#define NUM_POSTS 200
+#define PAGE_SIZE 10
+
+int main(void) {
+    user_t *user = test_add_user("alice");
+    user_t *other = test_add_user("bob");
+
+    post_t *posts[NUM_POSTS];
+    post_handle_t handles[NUM_POSTS];
+    for (int i = 0; i < NUM_POSTS; i++) {
+        char text[32];
+        snprintf(text, sizeof(text), "post %d", i);
+        add_post(user, text);
+        posts[i] = postlist_newest(user);
+        handles[i] = shard_post_handle(posts[i]);
+        check(test_post_number(posts[i]) == i);
+        check(find_post(user, handles[i]) == posts[i]);
+        check(find_post(other, handles[i]) == NULL);
+    }
+
+    // The first page is read before anything is deleted
+    post_cursor_t cursor = post_cursor_open(user);
+    const post_t *page[PAGE_SIZE];
+    check(post_cursor_next(&cursor, page, PAGE_SIZE) == PAGE_SIZE);
+    for (int i = 0; i < PAGE_SIZE; i++) check(test_post_number(page[i]) == NUM_POSTS - 1 - i);
+
+    // Deleting every even post leaves tombstones until half of the list is
+    // deleted, which compacts it
+    for (int i = 0; i < NUM_POSTS; i += 2) {
+        remove_post(user, find_post(user, handles[i]));
+        check(find_post(user, handles[i]) == NULL);
+        if (i + 2 < NUM_POSTS) {
+            check(postlist_length(user) == NUM_POSTS);
+            check(postlist_get(user, i) == NULL);
+        }
+    }
+    check(postlist_length(user) == NUM_POSTS / 2);
+    check(postlist_count(user) == NUM_POSTS / 2);
+    for (size_t i = 0; i < postlist_length(user); i++) {
+        check(postlist_get(user, i) == posts[2 * i + 1]);
+        check(posts[2 * i + 1]->position == i);
+    }
+    check(postlist_find(user, posts[NUM_POSTS - 1]->timestamp) == posts[NUM_POSTS - 1]);
+    check(postlist_find(user, posts[0]->timestamp) == NULL);
+
+    // A post added now is newer than the cursor, and is not read by it
+    add_post(user, "post 1000");
+    post_t *newest = postlist_newest(user);
+
+    // The cursor carries on from its last post, through the compacted list
+    int expected = NUM_POSTS - PAGE_SIZE - 1;
+    size_t n;
+    while ((n = post_cursor_next(&cursor, page, PAGE_SIZE)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            check(test_post_number(page[i]) == expected);
+            expected -= 2;
+        }
+    }
+    check(expected == -1);
+    check(cursor.position == 0);
+
+    // The new post took the ID of the last post deleted, with a new
+    // generation, so the old ID does not find it
+    post_handle_t handle = shard_post_handle(newest);
+    check(handle.id == handles[NUM_POSTS - 2].id);
+    check(handle.generation != handles[NUM_POSTS - 2].generation);
+    check(find_post(user, handles[NUM_POSTS - 2]) == NULL);
+    check(find_post(user, handle) == newest);
+
+    // Deleting the newest posts pops them and the tombstones under them
+    remove_post(user, newest);
+    remove_post(user, posts[NUM_POSTS - 3]);
+    check(postlist_length(user) == NUM_POSTS / 2);
+    remove_post(user, posts[NUM_POSTS - 1]);
+    check(postlist_length(user) == NUM_POSTS / 2 - 2);
+    check(postlist_newest(user) == posts[NUM_POSTS - 5]);
+
+    delete_user(user);
+    check(find_post(other, handles[1]) == NULL);
+    teardown();
+    return 0;
+}
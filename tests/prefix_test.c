@@ -0,0 +1,89 @@
+// Checks prefix searches against a scan of every name, ignoring case, as
+// users are added before and after the index is built, across the merges of
+// its recent run, and as most of them are deleted, which must never leave
+// more than a quarter of the main run removed.
+//
+// gcc -g -I. tests/prefix_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o prefix_test -pthread -lm
+// ./prefix_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "nodes.h"
+#include "functions.h"
+#include "prefix.h"
+#include "test.h"
+
+#define NUM_USERS 3000
+#define MAX_RESULTS 50
+
+static char names[NUM_USERS][32];
+static user_t *users[NUM_USERS];
+
+static const char *prefixes[] = {"", "a", "ALPHA1", "alpha12", "Beta", "beta2999", "gamma", "z"};
+
+static int compare_names(const void *a, const void *b) {
+    return strcasecmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+static void read_stats(size_t *count, size_t *removed) {
+    char line[256] = "";
+    FILE *file = tmpfile();
+    check(file != NULL);
+    prefix_print_stats(file);
+    rewind(file);
+    check(fgets(line, sizeof(line), file) != NULL);
+    fclose(file);
+    check(sscanf(line, "Prefix index: %zu names (%zu removed)", count, removed) == 2);
+}
+
+// Checks every prefix against the names of the users still in the database
+static void check_prefixes(void) {
+    for (size_t p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); p++) {
+        const char *expected[NUM_USERS];
+        size_t count = 0;
+        for (int i = 0; i < NUM_USERS; i++) {
+            if (users[i] != NULL && strncasecmp(names[i], prefixes[p], strlen(prefixes[p])) == 0) expected[count++] = names[i];
+        }
+        qsort(expected, count, sizeof(char *), compare_names);
+        user_t *results[MAX_RESULTS];
+        size_t found = prefix_find(prefixes[p], results, MAX_RESULTS);
+        check(found == (count < MAX_RESULTS ? count : MAX_RESULTS));
+        for (size_t i = 0; i < found; i++) check(strcasecmp(results[i]->username, expected[i]) == 0);
+    }
+}
+
+int main(void) {
+    // Half of the users are there when the index is built on the first
+    // search, and the rest go through the recent run
+    for (int i = 0; i < NUM_USERS; i++) {
+        snprintf(names[i], sizeof(names[i]), "%s%d", i % 2 == 0 ? "Alpha" : "beta", i);
+        if (i == NUM_USERS / 2) check_prefixes();
+        users[i] = test_add_user(names[i]);
+        if (i % 400 == 0) check_prefixes();
+    }
+    check_prefixes();
+
+    // Deleting most of the users, the alphas first, keeps the removed names
+    // to a quarter of the main run
+    for (int round = 0; round < 2; round++) {
+        for (int i = round; i < NUM_USERS; i += 2) {
+            if (i % 10 == 9) continue;
+            delete_user(users[i]);
+            users[i] = NULL;
+            size_t count, removed;
+            read_stats(&count, &removed);
+            check(removed * 4 <= count);
+            if (i % 300 == round) check_prefixes();
+        }
+    }
+    check_prefixes();
+
+    // Names can be added again once deleted
+    users[0] = test_add_user(names[0]);
+    check_prefixes();
+    teardown();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Builds the program and every test, and runs them all. The C tests are linked
+# against every source but main.c, along with the helpers of tests/test.c, and
+# the shell tests are given the program.
+#
+# tests/run.sh
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+build=$(mktemp -d)
+trap 'rm -rf "$build"' EXIT
+sources="functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c"
+cd "$root" || exit 1
+gcc -g main.c $sources -o "$build/tbf.exe" -pthread || exit 1
+
+failed=0
+for test in tests/*_test.c tests/*_test.sh; do
+    [ -e "$test" ] || continue
+    name=$(basename "$test")
+    case "$test" in
+        *.c)
+            gcc -g -I. "$test" tests/test.c $sources -o "$build/${name%.c}" -pthread -lm || exit 1
+            (cd "$build" && "./${name%.c}")
+            ;;
+        *.sh)
+            sh "$test" "$build/tbf.exe"
+            ;;
+    esac
+    if [ $? -eq 0 ]; then
+        echo "PASS $name"
+    else
+        echo "FAIL $name"
+        failed=$((failed + 1))
+    fi
+done
+exit $((failed > 0))
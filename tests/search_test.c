@@ -0,0 +1,101 @@
+// Deletes most of the posts in the search index, and checks that queries
+// find exactly the live posts before and after the index renumbers them, and
+// that the renumbering gives back the slots and terms of the deleted posts.
+//
+// gcc -g -I. tests/search_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o search_test -pthread -lm
+// ./search_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "nodes.h"
+#include "functions.h"
+#include "postlist.h"
+#include "search.h"
+#include "test.h"
+
+#define NUM_POSTS 3000
+#define MAX_RESULTS 20
+
+// Checks that a query finds the newest live posts among the numbered ones
+static void check_query(const char *query, post_t **posts, const _Bool *live, int step) {
+    search_result_t results[MAX_RESULTS];
+    size_t found = search_query(query, results, MAX_RESULTS);
+    size_t n = 0;
+    for (int i = NUM_POSTS - 1; i >= 0 && n < MAX_RESULTS; i--) {
+        if (!live[i] || i % step != 0) continue;
+        check(n < found && results[n].post == posts[i]);
+        n++;
+    }
+    check(found == n);
+}
+
+int main(void) {
+    user_t *user = test_add_user("alice");
+
+    static post_t *posts[NUM_POSTS];
+    static _Bool live[NUM_POSTS];
+    for (int i = 0; i < NUM_POSTS; i++) {
+        char text[64];
+        snprintf(text, sizeof(text), "common word%d%s", i, i % 3 == 0 ? " #third" : "");
+        add_post(user, text);
+        posts[i] = postlist_newest(user);
+        live[i] = true;
+    }
+    size_t terms, indexed, live_posts;
+    test_search_stats(&terms, &indexed, &live_posts);
+    check(indexed == NUM_POSTS && live_posts == NUM_POSTS);
+
+    // Deleting every post but each fourth one goes past half of the index,
+    // which renumbers it
+    for (int i = 0; i < NUM_POSTS; i++) {
+        if (i % 4 == 0) continue;
+        remove_post(user, posts[i]);
+        live[i] = false;
+        if (i % 500 == 1) {
+            check_query("common", posts, live, 1);
+            check_query("#third", posts, live, 3);
+        }
+    }
+    test_search_stats(&terms, &indexed, &live_posts);
+    check(live_posts == NUM_POSTS / 4);
+    check(indexed <= 2 * live_posts);
+    check(terms <= indexed + 2);
+    check_query("common", posts, live, 1);
+    check_query("#third", posts, live, 3);
+    check_query("common #third", posts, live, 3);
+
+    // Every live post is still found by its own word, and no deleted one is
+    search_result_t results[MAX_RESULTS];
+    for (int i = 0; i < NUM_POSTS; i++) {
+        char query[32];
+        snprintf(query, sizeof(query), "word%d", i);
+        size_t found = search_query(query, results, MAX_RESULTS);
+        check(found == (live[i] ? 1 : 0));
+        if (found == 1) check(results[0].post == posts[i] && results[0].author == user);
+    }
+
+    // Posts indexed after the renumbering are found along with the old ones
+    add_post(user, "common newest");
+    check(search_query("common", results, 1) == 1);
+    check(results[0].post == postlist_newest(user));
+    check(search_query("newest", results, MAX_RESULTS) == 1);
+
+    // An alternative with more terms than a query holds is refused rather
+    // than cut short, which would match posts without the terms left out
+    char query[512] = "common";
+    for (int i = 1; i < SEARCH_MAX_QUERY_TERMS; i++) strcat(query, " common");
+    check(search_query(query, results, MAX_RESULTS) > 0 && errno == 0);
+    strcat(query, " word0");
+    check(search_query(query, results, MAX_RESULTS) == 0 && errno == E2BIG);
+    strcat(query, " OR newest");
+    check(search_query(query, results, MAX_RESULTS) == 0 && errno == E2BIG);
+    check(search_query("common common OR newest", results, MAX_RESULTS) > 0 && errno == 0);
+    // A single word may hold many terms
+    check(search_query("a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.0.1.2.3.4.5.6", results, MAX_RESULTS) == 0);
+    check(errno == E2BIG);
+
+    teardown();
+    return 0;
+}
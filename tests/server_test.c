@@ -0,0 +1,248 @@
+// Checks the locks each command takes, then serves clients over the socket:
+// a session's replies come back in order even when its commands arrive in
+// one write, sessions see each other's writes, and several clients posting
+// and befriending each other at once lose nothing, neither in memory nor in
+// the snapshots the server checkpoints meanwhile and the log on top of them.
+//
+// gcc -g -I. tests/server_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o server_test -pthread -lm
+// ./server_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <glob.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "nodes.h"
+#include "functions.h"
+#include "shard.h"
+#include "postlist.h"
+#include "fanout.h"
+#include "edgeset.h"
+#include "batch.h"
+#include "server.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "test.h"
+
+#define SOCKET_PATH "server_test.sock"
+#define LOG_PATH "server_test.wal"
+#define SNAPSHOT_FILE "server_test.snap"
+#define NUM_CLIENTS 4
+#define NUM_POSTS 200
+
+static void check_locks(const batch_session_t *session, const char *line, shard_t *shard, _Bool shared) {
+    batch_locks_t locks = batch_command_locks(session, line);
+    check(locks.shard == shard);
+    check(locks.shared == shared);
+}
+
+static void *serve(void *ran) {
+    *(_Bool *) ran = server_run(SOCKET_PATH, 2);
+    return NULL;
+}
+
+static int connect_client(void) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, SOCKET_PATH);
+    // The server may not be listening yet
+    for (int tries = 0; tries < 500; tries++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        check(fd >= 0);
+        if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0) return fd;
+        close(fd);
+        usleep(10000);
+    }
+    check(!"the server never listened");
+    return -1;
+}
+
+// Sends commands and reads back the given number of reply lines
+static void exchange(int fd, const char *commands, size_t lines, char *reply, size_t size) {
+    size_t length = strlen(commands);
+    check(write(fd, commands, length) == (ssize_t) length);
+    size_t received = 0;
+    size_t newlines = 0;
+    while (newlines < lines) {
+        check(received + 1 < size);
+        ssize_t n = read(fd, reply + received, size - received - 1);
+        check(n > 0);
+        for (ssize_t i = 0; i < n; i++) newlines += reply[received + i] == '\n';
+        received += n;
+    }
+    check(newlines == lines);
+    reply[received] = '\0';
+}
+
+static user_t *find_client(int number) {
+    char username[32];
+    snprintf(username, sizeof(username), "client%d", number);
+    user_t *user = find_user(username);
+    check(user != NULL);
+    return user;
+}
+
+// Checks that every client's posts and friends are there
+static void check_clients(void) {
+    for (int i = 0; i < NUM_CLIENTS; i++) {
+        const user_t *user = find_client(i);
+        check(postlist_count(user) == NUM_POSTS);
+        // Each client befriended every other one
+        for (int j = 1; j < NUM_CLIENTS; j++) check(edgeset_contains(&friend_edges, user->id, find_client((i + j) % NUM_CLIENTS)->id));
+    }
+}
+
+static void remove_log(void) {
+    glob_t segments;
+    if (glob(LOG_PATH ".*", 0, NULL, &segments) == 0) {
+        for (size_t i = 0; i < segments.gl_pathc; i++) remove(segments.gl_pathv[i]);
+        globfree(&segments);
+    }
+}
+
+// Posts as one user and befriends every other, alongside the other clients
+static void *client(void *arg) {
+    int number = *(const int *) arg;
+    int fd = connect_client();
+    char command[128];
+    char reply[256];
+    snprintf(command, sizeof(command), "login client%d client%d\n", number, number);
+    exchange(fd, command, 1, reply, sizeof(reply));
+    check(strcmp(reply, "ok\n") == 0);
+    for (int i = 0; i < NUM_POSTS; i++) {
+        snprintf(command, sizeof(command), "post client %d post %d\n", number, i);
+        exchange(fd, command, 1, reply, sizeof(reply));
+        check(strncmp(reply, "ok ", 3) == 0);
+        if (i % 50 == 0 && i / 50 < NUM_CLIENTS - 1) {
+            snprintf(command, sizeof(command), "friend client%d\n", (number + 1 + i / 50) % NUM_CLIENTS);
+            exchange(fd, command, 1, reply, sizeof(reply));
+            check(strcmp(reply, "ok\n") == 0);
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+int main(void) {
+    user_t *alice = test_add_user("alice");
+    test_add_user("bob");
+    // A user in another shard than alice's, for a mutual friendship
+    char other[32];
+    for (int i = 0;; i++) {
+        snprintf(other, sizeof(other), "other%d", i);
+        if (shard_for(other) != shard_of(alice)) break;
+    }
+    test_add_user(other);
+    for (int i = 0; i < NUM_CLIENTS; i++) {
+        char username[32];
+        snprintf(username, sizeof(username), "client%d", i);
+        test_add_user(username);
+    }
+
+    batch_session_t session = BATCH_SESSION_INIT;
+    check_locks(&session, "post hello", NULL, false);
+    check_locks(&session, "register dave davepassword", shard_for("dave"), false);
+    // Logging in may replace the user's password hash
+    check_locks(&session, "login bob bob", shard_for("bob"), false);
+    session.user = shard_handle(alice);
+    session.logged_in = true;
+    shard_t *shard = shard_of(alice);
+    check_locks(&session, "post hello", shard, false);
+    check_locks(&session, "unpost", shard, false);
+    check_locks(&session, "purge hello", shard, false);
+    check_locks(&session, "password alice newpassword", shard, false);
+    check_locks(&session, "delete alice", shard, true);
+    check_locks(&session, "friend bob", shard, true);
+    check_locks(&session, "unfriend bob", shard, true);
+    check_locks(&session, "suggest", NULL, true);
+    check_locks(&session, "feed", NULL, true);
+    check_locks(&session, "posts bob", NULL, false);
+    check_locks(&session, "search hello", NULL, false);
+    check_locks(&session, "users a", NULL, false);
+    // Fan-out writes the followers' timelines, and reading a feed may
+    // rebuild one
+    fanout_settings.enabled = true;
+    check_locks(&session, "post hello", shard, true);
+    check_locks(&session, "unpost", shard, false);
+    check_locks(&session, "feed", NULL, true);
+    fanout_settings.enabled = false;
+    // A mutual friendship only writes the friend graphs, even when the
+    // friend lives in another shard
+    edgeset_settings.symmetric = true;
+    char line[64];
+    snprintf(line, sizeof(line), "friend %s", other);
+    check_locks(&session, line, shard, true);
+    check_locks(&session, "unfriend nobody", shard, true);
+    edgeset_settings.symmetric = false;
+
+    // The log is written on top of a snapshot, and checkpointed every few
+    // hundred records
+    wal_settings.path = LOG_PATH;
+    wal_settings.checkpoint_bytes = 8192;
+    snapshot_path = SNAPSHOT_FILE;
+    remove_log();
+    check(snapshot_save(SNAPSHOT_FILE));
+    check(wal_open());
+
+    // The shutdown signal is left to the server's signalfd
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    _Bool ran = false;
+    pthread_t server;
+    check(pthread_create(&server, NULL, serve, &ran) == 0);
+
+    // Replies come back in order, one per command, however the commands
+    // arrive
+    char reply[4096];
+    int reader = connect_client();
+    int writer = connect_client();
+    exchange(reader, "feed\nlogin alice alice\nfriend bob\n", 3, reply, sizeof(reply));
+    check(strcmp(reply, "err login\nok\nok\n") == 0);
+    exchange(writer, "login bob bob\npost hello from bob\n", 2, reply, sizeof(reply));
+    check(strncmp(reply, "ok\nok ", 6) == 0);
+    exchange(reader, "feed\n", 2, reply, sizeof(reply));
+    check(strncmp(reply, "ok 1\n", 5) == 0 && strstr(reply, " bob hello from bob\n") != NULL);
+    exchange(writer, "unpost\nposts bob\n", 2, reply, sizeof(reply));
+    check(strcmp(reply, "ok\nok 0\n") == 0);
+    exchange(reader, "feed\n", 1, reply, sizeof(reply));
+    check(strcmp(reply, "ok 0\n") == 0);
+    close(reader);
+    close(writer);
+
+    pthread_t clients[NUM_CLIENTS];
+    int numbers[NUM_CLIENTS];
+    for (int i = 0; i < NUM_CLIENTS; i++) {
+        numbers[i] = i;
+        check(pthread_create(&clients[i], NULL, client, &numbers[i]) == 0);
+    }
+    for (int i = 0; i < NUM_CLIENTS; i++) pthread_join(clients[i], NULL);
+    // The checkpointer looks at the log once a second
+    for (int tries = 0; tries < 500 && wal_checkpoint_due(); tries++) usleep(10000);
+    check(!wal_checkpoint_due());
+
+    kill(getpid(), SIGTERM);
+    pthread_join(server, NULL);
+    check(ran);
+    check_clients();
+    // A checkpoint deleted the first segment, and the last snapshot and the
+    // log after it hold everything
+    check(access(LOG_PATH ".00000001", F_OK) != 0);
+    wal_close();
+    teardown();
+    check(snapshot_load(SNAPSHOT_FILE) > 0);
+    wal_replay();
+    check_clients();
+    teardown();
+    remove_log();
+    remove(SNAPSHOT_FILE);
+    printf("ok\n");
+    return 0;
+}
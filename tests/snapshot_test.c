@@ -0,0 +1,149 @@
+// Saves a snapshot of users with interleaved and partly deleted posts, loads
+// it back, and checks that the users, passwords, friends, posts and search
+// results all come back the same, both with the search index read from the
+// snapshot and with it rebuilt from the posts as for an older snapshot.
+//
+// gcc -g -I. tests/snapshot_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o snapshot_test -pthread -lm
+// ./snapshot_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include "nodes.h"
+#include "functions.h"
+#include "graph.h"
+#include "password.h"
+#include "postlist.h"
+#include "search.h"
+#include "shard.h"
+#include "snapshot.h"
+#include "test.h"
+
+#define NUM_USERS 4
+#define NUM_POSTS 400
+#define MAX_RESULTS 50
+#define SNAPSHOT_FILE "snapshot_test.snap"
+
+static const char *usernames[NUM_USERS] = {"alice", "bob", "carol", "dave"};
+
+static const char *queries[] = {"#potions", "@harry", "snape", "#potions snape", "quidditch OR @harry", "post", "nothing"};
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+// Writes out everything a snapshot should keep, in an order that does not
+// depend on where users and posts are stored
+static char *describe(void) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *file = open_memstream(&text, &size);
+    check(file != NULL);
+    for (int i = 0; i < NUM_USERS; i++) {
+        const user_t *user = find_user(usernames[i]);
+        if (user == NULL) {
+            fprintf(file, "%s: none\n", usernames[i]);
+            continue;
+        }
+        fprintf(file, "%s:", user->username);
+        const unsigned char *hash = (const unsigned char *) user->password;
+        for (size_t j = 0; j < sizeof(password_hash_t); j++) fprintf(file, "%02x", hash[j]);
+        const char *friends[NUM_USERS];
+        size_t num_friends = 0;
+        graph_iterator_t iterator = graph_friends(&friend_graph, user->id);
+        unsigned int friend;
+        while (graph_next(&iterator, &friend)) friends[num_friends++] = shard_user(friend)->username;
+        qsort(friends, num_friends, sizeof(char *), compare_strings);
+        for (size_t j = 0; j < num_friends; j++) fprintf(file, " %s", friends[j]);
+        fprintf(file, "\n");
+        size_t position = postlist_length(user);
+        const post_t *post;
+        while ((post = postlist_older(user, &position, LLONG_MAX)) != NULL) {
+            fprintf(file, "  %lld %s\n", post->timestamp, post_content(post));
+        }
+    }
+    for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+        search_result_t results[MAX_RESULTS];
+        size_t count = search_query(queries[i], results, MAX_RESULTS);
+        fprintf(file, "%s:", queries[i]);
+        for (size_t j = 0; j < count; j++) fprintf(file, " %s/%lld", results[j].author->username, results[j].post->timestamp);
+        fprintf(file, "\n");
+    }
+    fclose(file);
+    return text;
+}
+
+// Loads the snapshot into an empty database and checks it against the
+// description of the database it was saved from
+static void check_reload(const char *expected) {
+    teardown();
+    check(snapshot_load(SNAPSHOT_FILE) == NUM_USERS - 1);
+    char *loaded = describe();
+    check(strcmp(loaded, expected) == 0);
+    free(loaded);
+    // Only the live posts were saved, so none of the search IDs are dead
+    size_t terms, posts, live;
+    test_search_stats(&terms, &posts, &live);
+    check(posts == live);
+}
+
+int main(void) {
+    user_t *users[NUM_USERS];
+    for (int i = 0; i < NUM_USERS; i++) users[i] = test_add_user(usernames[i]);
+    add_friend(users[0], "bob");
+    add_friend(users[0], "carol");
+    add_friend(users[1], "dave");
+    add_friend(users[2], "bob");
+
+    // The users post in turn, so their search IDs are interleaved while the
+    // snapshot numbers the posts user by user
+    static const char *words[] = {"#potions", "@harry", "snape", "quidditch"};
+    post_t *posts[NUM_POSTS];
+    for (int i = 0; i < NUM_POSTS; i++) {
+        char text[64];
+        snprintf(text, sizeof(text), "post %d %s %s", i, words[i % 4], words[i / 4 % 4]);
+        add_post(users[i % NUM_USERS], text);
+        posts[i] = postlist_newest(users[i % NUM_USERS]);
+    }
+    for (int i = 0; i < NUM_POSTS; i += 3) {
+        if (i % NUM_USERS != 3) remove_post(users[i % NUM_USERS], posts[i]);
+    }
+    delete_user(users[3]);
+    add_post(users[1], "a #potions post after the deletes");
+
+    char *expected = describe();
+    check(snapshot_save(SNAPSHOT_FILE));
+    check_reload(expected);
+
+    // Loaded posts can still be deleted from the index, and new ones found
+    const user_t *bob = find_user("bob");
+    check(bob != NULL);
+    search_result_t results[MAX_RESULTS];
+    check(search_query("#potions", results, MAX_RESULTS) > 0);
+    check(results[0].author == bob);
+    remove_post((user_t *) bob, (post_t *) results[0].post);
+    add_post((user_t *) bob, "#potions again");
+    check(search_query("#potions", results, 1) == 1);
+    check(strcmp(post_content(results[0].post), "#potions again") == 0);
+
+    // An older snapshot has no index, so the posts are split into terms again.
+    // Passing this one off as version 2 leaves its index sections unread.
+    FILE *file = fopen(SNAPSHOT_FILE, "r+b");
+    check(file != NULL);
+    snapshot_header_t header;
+    check(fread(&header, sizeof(header), 1, file) == 1);
+    header.version = 2;
+    header.header_size = offsetof(snapshot_header_t, num_terms);
+    rewind(file);
+    check(fwrite(&header, offsetof(snapshot_header_t, num_terms), 1, file) == 1);
+    check(fclose(file) == 0);
+    check_reload(expected);
+
+    teardown();
+    free(expected);
+    remove(SNAPSHOT_FILE);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,32 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "nodes.h"
+#include "functions.h"
+#include "password.h"
+#include "search.h"
+#include "test.h"
+
+user_t *test_add_user(const char *username) {
+    password_settings.log_n = 1;
+    password_hash_t hash;
+    password_hash(&hash, username);
+    user_t *user = add_user(username, &hash);
+    check(user != NULL);
+    return user;
+}
+
+int test_post_number(const post_t *post) {
+    return atoi(post_content(post) + strlen("post "));
+}
+
+void test_search_stats(size_t *terms, size_t *posts, size_t *live) {
+    char line[256] = "";
+    FILE *file = tmpfile();
+    check(file != NULL);
+    search_print_stats(file);
+    rewind(file);
+    check(fgets(line, sizeof(line), file) != NULL);
+    fclose(file);
+    check(sscanf(line, "Search index: %zu terms, %zu posts (%zu live)", terms, posts, live) == 3);
+}
@@ -0,0 +1,53 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "nodes.h"
+
+// Stops the test with the file and line of a condition that does not hold
+#define check(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        exit(1); \
+    } \
+} while (0)
+
+/**
+ * Adds a user whose password is their username, hashed at the lowest cost so
+ * tests can add many.
+ *
+ * Parameters:
+ * username: The user's username.
+ *
+ * Returns:
+ * The user, which must have been added.
+ */
+user_t *test_add_user(const char *username);
+
+/**
+ * Gets the number a post was written with, as "post <number> ...".
+ *
+ * Parameters:
+ * post: The post.
+ *
+ * Returns:
+ * The number.
+ */
+int test_post_number(const post_t *post);
+
+/**
+ * Reads the number of terms, posts and live posts from the search index's
+ * statistics.
+ *
+ * Parameters:
+ * terms: Where to store the number of terms.
+ * posts: Where to store the number of posts, including the deleted ones.
+ * live: Where to store the number of live posts.
+ *
+ * Returns:
+ * None
+ */
+void test_search_stats(size_t *terms, size_t *posts, size_t *live);
+
+#endif
@@ -0,0 +1,81 @@
+#!/bin/sh
+# Kills the program with changes that only the write-ahead log holds, and checks
+# that they are all back after a restart: a post added on top of users.csv,
+# and then a post of users.csv deleted on top of the snapshot. Also checks that
+# users.csv is refused while its log is still waiting to be replayed, and that
+# a run that changes nothing leaves the snapshot alone.
+#
+# gcc -g main.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o tbf.exe -pthread
+# tests/wal_replay_test.sh ./tbf.exe
+
+program=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+users=$(cd "$(dirname "$0")/.." && pwd)/users.csv
+directory=$(mktemp -d)
+trap 'rm -rf "$directory"' EXIT
+cd "$directory" || exit 1
+cp "$users" users.csv
+
+fail() {
+    echo "wal_replay_test: $*" >&2
+    exit 1
+}
+
+# Counts the records the log holds for arthurhermione, whose username ends
+# with a NUL in each of them
+logged() {
+    cat users.wal.* 2> /dev/null | tr '\0' '\n' | grep -c 'arthurhermione$'
+}
+
+# Runs the commands and kills the program once the log holds the given number
+# of records, so nothing is left to the exit checkpoint. Replies are buffered
+# until exit, so the log is all there is to wait for.
+crash() {
+    records=$1
+    shift
+    rm -f commands
+    mkfifo commands
+    "$program" -k 1 -b commands > /dev/null &
+    pid=$!
+    exec 3> commands
+    printf '%s\n' "$@" >&3
+    tries=0
+    while [ "$(logged)" -lt "$records" ]; do
+        tries=$((tries + 1))
+        [ "$tries" -le 300 ] || fail "nothing was logged for: $*"
+        sleep 0.1
+    done
+    kill -9 "$pid"
+    wait "$pid" 2> /dev/null
+    exec 3>&-
+}
+
+# Prints the replies to the commands of a clean run
+run() {
+    printf '%s\n' "$@" | "$program" -k 1 -b -
+}
+
+crash 1 "login arthurhermione 12345678" "post HELLO_CRASH_TEST"
+[ -f users.snap ] || fail "no snapshot was saved before the log"
+run "login arthurhermione 12345678" "posts arthurhermione" > replies
+grep -q '^ok 4$' replies || fail "the logged post was lost: $(cat replies)"
+grep -q 'HELLO_CRASH_TEST$' replies || fail "the logged post was lost: $(cat replies)"
+
+crash 2 "login arthurhermione 12345678" "unpost" "unpost"
+if "$program" -k 1 -i users.csv -b - < /dev/null > /dev/null 2>&1; then
+    fail "users.csv was loaded under a log written on top of the snapshot"
+fi
+run "login arthurhermione 12345678" "posts arthurhermione" > replies
+grep -q '^ok 2$' replies || fail "the logged deletes were lost: $(cat replies)"
+grep -q 'HELLO_CRASH_TEST$\|magicalmishaps' replies && fail "a deleted post is back: $(cat replies)"
+grep -q 'mischiefmanaged' replies || fail "the wrong post was deleted: $(cat replies)"
+
+# The replies above came from a run that replayed the log, so the snapshot
+# is current and has no segments left behind
+ls users.wal.* > /dev/null 2>&1 && fail "the log was kept after a checkpoint"
+cp users.snap saved.snap
+touch -d '2000-01-01' users.snap
+run "login arthurhermione 12345678" "posts arthurhermione" > /dev/null
+[ "$(find users.snap -newer saved.snap)" = "" ] || fail "a run that changed nothing saved the snapshot"
+run "login arthurhermione 12345678" "post after" > /dev/null
+[ "$(find users.snap -newer saved.snap)" = "users.snap" ] || fail "a run that posted did not save the snapshot"
+exit 0
@@ -0,0 +1,162 @@
+// Leaves a checkpoint's old segment behind, as a crash between saving the
+// snapshot and deleting the segment would, and checks that replaying it
+// skips the records the snapshot reflects: a post is not added twice, a user
+// deleted and registered again keeps the account, posts and friends it had
+// at the checkpoint, and only the records logged after it are applied. A
+// segment from before sequence numbers still replays the posts newer than
+// the user's newest.
+//
+// gcc -g -I. tests/wal_test.c tests/test.c functions.c directory.c loader.c graph.c arena.c strheap.c feed.c fanout.c snapshot.c wal.c batch.c server.c epoch.c shard.c search.c fold.c prefix.c suggest.c edgeset.c password.c metrics.c postlist.c -o wal_test -pthread -lm
+// ./wal_test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include "nodes.h"
+#include "functions.h"
+#include "password.h"
+#include "postlist.h"
+#include "edgeset.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "test.h"
+
+#define LOG_PATH "wal_test.wal"
+#define FIRST_SEGMENT LOG_PATH ".00000001"
+#define SECOND_SEGMENT LOG_PATH ".00000002"
+#define SNAPSHOT_FILE "wal_test.snap"
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    check(file != NULL);
+    check(fseek(file, 0, SEEK_END) == 0);
+    *size = (size_t) ftell(file);
+    rewind(file);
+    char *data = malloc(*size + 1);
+    check(data != NULL);
+    check(fread(data, 1, *size, file) == *size);
+    fclose(file);
+    return data;
+}
+
+static void write_file(const char *path, const char *data, size_t size) {
+    FILE *file = fopen(path, "wb");
+    check(file != NULL);
+    check(fwrite(data, 1, size, file) == size);
+    check(fclose(file) == 0);
+}
+
+// Appends a post record as segments without sequence numbers held them
+static size_t legacy_post(char *segment, const char *username, int64_t timestamp, const char *content) {
+    size_t username_length = strlen(username) + 1;
+    uint16_t length = username_length + sizeof(timestamp) + strlen(content);
+    memcpy(segment, &length, sizeof(length));
+    segment[2] = WAL_POST;
+    memcpy(segment + 3, username, username_length);
+    memcpy(segment + 3 + username_length, &timestamp, sizeof(timestamp));
+    memcpy(segment + 3 + username_length + sizeof(timestamp), content, strlen(content));
+    // FNV-1a over the type and the payload
+    uint32_t sum = 2166136261u;
+    for (size_t i = 2; i < 3 + (size_t) length; i++) {
+        sum ^= (unsigned char) segment[i];
+        sum *= 16777619u;
+    }
+    memcpy(segment + 3 + length, &sum, sizeof(sum));
+    return 3 + length + sizeof(sum);
+}
+
+// Lists a user's posts, newest first, one per line
+static void describe_posts(const user_t *user, char *text, size_t size) {
+    text[0] = '\0';
+    size_t position = postlist_length(user);
+    const post_t *post;
+    while ((post = postlist_older(user, &position, LLONG_MAX)) != NULL) {
+        strncat(text, post_content(post), size - strlen(text) - 2);
+        strcat(text, "\n");
+    }
+}
+
+int main(void) {
+    wal_settings.path = LOG_PATH;
+    snapshot_path = SNAPSHOT_FILE;
+    remove(FIRST_SEGMENT);
+    remove(SECOND_SEGMENT);
+
+    // The users the log starts from
+    test_add_user("alice");
+    user_t *bob = test_add_user("bob");
+    check(snapshot_save(SNAPSHOT_FILE));
+    check(wal_last_sequence() == 0);
+
+    check(wal_open());
+    user_t *alice = find_user("alice");
+    add_post(alice, "first");
+    delete_user(alice);
+    password_hash_t hash;
+    password_hash(&hash, "alicepassword2");
+    alice = add_user("alice", &hash);
+    add_post(alice, "second");
+    add_friend(bob, "alice");
+    add_post(bob, "from bob");
+    check(wal_last_sequence() == 6);
+
+    // The checkpoint's snapshot reflects the six records, and the segment
+    // holding them comes back as if it was never deleted
+    wal_sync();
+    size_t size;
+    char *segment = read_file(FIRST_SEGMENT, &size);
+    check(wal_checkpoint());
+    check(fopen(FIRST_SEGMENT, "rb") == NULL);
+    write_file(FIRST_SEGMENT, segment, size);
+    free(segment);
+    add_post(alice, "third");
+    wal_close();
+
+    teardown();
+    check(snapshot_load(SNAPSHOT_FILE) == 2);
+    check(wal_last_sequence() == 6);
+    wal_replay();
+    check(wal_last_sequence() == 7);
+    alice = find_user("alice");
+    bob = find_user("bob");
+    check(alice != NULL && bob != NULL);
+    check(password_verify(alice->password, "alicepassword2"));
+    char posts[256];
+    describe_posts(alice, posts, sizeof(posts));
+    check(strcmp(posts, "third\nsecond\n") == 0);
+    check(edgeset_contains(&friend_edges, bob->id, alice->id));
+    describe_posts(bob, posts, sizeof(posts));
+    check(strcmp(posts, "from bob\n") == 0);
+
+    // New records are numbered after the replayed ones, and the next
+    // checkpoint deletes both segments
+    check(wal_open());
+    add_post(alice, "fourth");
+    check(wal_last_sequence() == 8);
+    check(wal_checkpoint());
+    wal_close();
+    check(fopen(FIRST_SEGMENT, "rb") == NULL);
+    check(fopen(SECOND_SEGMENT, "rb") == NULL);
+    teardown();
+    check(snapshot_load(SNAPSHOT_FILE) == 2);
+    check(wal_last_sequence() == 8);
+    describe_posts(find_user("alice"), posts, sizeof(posts));
+    check(strcmp(posts, "fourth\nthird\nsecond\n") == 0);
+
+    bob = find_user("bob");
+    char legacy[256];
+    size = legacy_post(legacy, "bob", postlist_newest(bob)->timestamp, "old");
+    size += legacy_post(legacy + size, "bob", postlist_newest(bob)->timestamp + 1, "legacy");
+    write_file(FIRST_SEGMENT, legacy, size);
+    wal_replay();
+    describe_posts(bob, posts, sizeof(posts));
+    check(strcmp(posts, "legacy\nfrom bob\n") == 0);
+    remove(FIRST_SEGMENT);
+
+    teardown();
+    remove(SNAPSHOT_FILE);
+    printf("ok\n");
+    return 0;
+}
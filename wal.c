@@ -0,0 +1,496 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <signal.h>
+#include <glob.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nodes.h"
+#include "functions.h"
+#include "strheap.h"
+#include "snapshot.h"
+#include "password.h"
+#include "postlist.h"
+#include "wal.h"
+
+#define WAL_SEGMENT_SIZE ((size_t) 16 << 20)
+#define WAL_BATCH_SIZE ((size_t) 64 << 10)
+#define WAL_RECORD_OVERHEAD (sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint32_t))
+#define WAL_LEGACY_RECORD_OVERHEAD (sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint32_t))
+#define WAL_MAGIC "TBFWAL2"
+#define WAL_MAGIC_SIZE 8
+#define WAL_SEGMENT_DIGITS 8
+
+wal_settings_t wal_settings = {"users.wal", 10, false, (size_t) 64 << 20};
+
+// The state of the open log. Appenders only hold lock while copying a record
+// into the pending buffer. The flusher swaps the pending buffer out and
+// writes it under io_lock, so appends carry on while it syncs.
+static struct {
+    _Bool open;
+    _Bool running;
+    _Bool urgent;
+    int fd;
+    unsigned long segment;
+    size_t segment_bytes;
+    char *pending;
+    size_t pending_size;
+    size_t pending_capacity;
+    char *writing;
+    size_t writing_capacity;
+    unsigned long long appended;
+    unsigned long long durable;
+    unsigned long long checkpointed;
+    size_t checkpointed_bytes;
+    _Bool snapshot_current;
+    size_t records;
+    size_t bytes;
+    size_t fsyncs;
+    size_t replayed;
+    pthread_mutex_t lock;
+    pthread_mutex_t io_lock;
+    pthread_cond_t wake;
+    pthread_cond_t flushed;
+    pthread_t flusher;
+} wal = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .io_lock = PTHREAD_MUTEX_INITIALIZER,
+         .wake = PTHREAD_COND_INITIALIZER, .flushed = PTHREAD_COND_INITIALIZER};
+
+// The last record appended by this thread, and whether it waits for its
+// synchronous commits in wal_commit rather than in wal_append
+static __thread unsigned long long last_appended = 0;
+static __thread _Bool deferred = false;
+
+static uint32_t checksum(const char *data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void segment_name(char *name, size_t size, unsigned long segment) {
+    snprintf(name, size, "%s.%0*lu", wal_settings.path, WAL_SEGMENT_DIGITS, segment);
+}
+
+// Lists the numbers of the existing segments in increasing order
+static size_t list_segments(unsigned long **segments) {
+    size_t pattern_size = strlen(wal_settings.path) + 3;
+    char *pattern = malloc(pattern_size);
+    assert(pattern != NULL);
+    snprintf(pattern, pattern_size, "%s.*", wal_settings.path);
+    glob_t matches;
+    size_t count = 0;
+    *segments = NULL;
+    if (glob(pattern, 0, NULL, &matches) == 0) {
+        *segments = malloc(matches.gl_pathc * sizeof(unsigned long));
+        assert(*segments != NULL);
+        // glob sorts its matches and the numbers are zero-padded, so the
+        // segments come out in order
+        for (size_t i = 0; i < matches.gl_pathc; i++) {
+            const char *suffix = matches.gl_pathv[i] + strlen(wal_settings.path) + 1;
+            char *end;
+            unsigned long segment = strtoul(suffix, &end, 10);
+            if (end - suffix == WAL_SEGMENT_DIGITS && *end == '\0') (*segments)[count++] = segment;
+        }
+        globfree(&matches);
+    }
+    free(pattern);
+    return count;
+}
+
+// Syncs the log's directory so newly created and deleted segments survive a
+// crash
+static void sync_directory(void) {
+    char *path = strdup(wal_settings.path);
+    assert(path != NULL);
+    int fd = open(dirname(path), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(path);
+}
+
+static _Bool open_segment(unsigned long segment) {
+    char name[4096];
+    segment_name(name, sizeof(name), segment);
+    int fd = open(name, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (fd < 0) return false;
+    if (write(fd, WAL_MAGIC, WAL_MAGIC_SIZE) != WAL_MAGIC_SIZE) {
+        int error = errno;
+        close(fd);
+        unlink(name);
+        errno = error != 0 ? error : EIO;
+        return false;
+    }
+    sync_directory();
+    if (wal.fd >= 0) close(wal.fd);
+    wal.fd = fd;
+    wal.segment = segment;
+    wal.segment_bytes = 0;
+    return true;
+}
+
+static void write_batch(const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(wal.fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            perror("Error writing the write-ahead log");
+            return;
+        }
+        data += written;
+        size -= written;
+        wal.segment_bytes += written;
+    }
+    if (fdatasync(wal.fd) < 0) perror("Error syncing the write-ahead log");
+}
+
+static void *flush_loop(void *arg) {
+    (void) arg;
+    // Signals are left to the threads that expect them
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    pthread_mutex_lock(&wal.lock);
+    while (true) {
+        while (wal.running && wal.pending_size == 0) pthread_cond_wait(&wal.wake, &wal.lock);
+        if (wal.pending_size == 0) break;
+        // Asynchronous commits wait for the batch to fill up or for the commit
+        // interval to pass, whichever comes first
+        if (!wal_settings.synchronous && wal_settings.commit_interval > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += wal_settings.commit_interval / 1000;
+            deadline.tv_nsec += (long) (wal_settings.commit_interval % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            while (wal.running && !wal.urgent && wal.pending_size < WAL_BATCH_SIZE
+                   && pthread_cond_timedwait(&wal.wake, &wal.lock, &deadline) != ETIMEDOUT) {}
+        }
+        char *batch = wal.pending;
+        size_t size = wal.pending_size;
+        size_t capacity = wal.pending_capacity;
+        unsigned long long batch_end = wal.appended;
+        wal.pending = wal.writing;
+        wal.pending_capacity = wal.writing_capacity;
+        wal.pending_size = 0;
+        wal.writing = batch;
+        wal.writing_capacity = capacity;
+        wal.urgent = false;
+        pthread_mutex_unlock(&wal.lock);
+
+        pthread_mutex_lock(&wal.io_lock);
+        write_batch(batch, size);
+        if (wal.segment_bytes >= WAL_SEGMENT_SIZE && !open_segment(wal.segment + 1)) {
+            perror("Error starting a write-ahead log segment");
+        }
+        pthread_mutex_unlock(&wal.io_lock);
+
+        pthread_mutex_lock(&wal.lock);
+        wal.durable = batch_end;
+        wal.fsyncs++;
+        pthread_cond_broadcast(&wal.flushed);
+    }
+    pthread_mutex_unlock(&wal.lock);
+    return NULL;
+}
+
+_Bool wal_open(void) {
+    if (wal.open) return true;
+    unsigned long *segments;
+    size_t count = list_segments(&segments);
+    unsigned long segment = count == 0 ? 1 : segments[count - 1] + 1;
+    free(segments);
+    if (!open_segment(segment)) return false;
+    wal.open = true;
+    wal.running = true;
+    int error = pthread_create(&wal.flusher, NULL, flush_loop, NULL);
+    assert(error == 0);
+    return true;
+}
+
+void wal_append(wal_record_type_t type, const char *username, const void *data, size_t length) {
+    if (!wal.open) return;
+    size_t username_length = strlen(username) + 1;
+    size_t payload_length = username_length + length;
+    assert(payload_length <= UINT16_MAX);
+    pthread_mutex_lock(&wal.lock);
+    if (wal.pending_size + payload_length + WAL_RECORD_OVERHEAD > wal.pending_capacity) {
+        wal.pending_capacity = (wal.pending_size + payload_length + WAL_RECORD_OVERHEAD) * 2;
+        wal.pending = realloc(wal.pending, wal.pending_capacity);
+        assert(wal.pending != NULL);
+    }
+    char *record = wal.pending + wal.pending_size;
+    uint16_t header_length = payload_length;
+    uint8_t header_type = type;
+    unsigned long long lsn = ++wal.appended;
+    uint64_t sequence = lsn;
+    memcpy(record, &header_length, sizeof(header_length));
+    memcpy(record + 2, &header_type, sizeof(header_type));
+    memcpy(record + 3, &sequence, sizeof(sequence));
+    memcpy(record + 11, username, username_length);
+    if (length > 0) memcpy(record + 11 + username_length, data, length);
+    uint32_t sum = checksum(record + 2, payload_length + 9);
+    memcpy(record + 11 + payload_length, &sum, sizeof(sum));
+    wal.pending_size += payload_length + WAL_RECORD_OVERHEAD;
+    wal.records++;
+    wal.bytes += payload_length + WAL_RECORD_OVERHEAD;
+    last_appended = lsn;
+    pthread_cond_signal(&wal.wake);
+    if (wal_settings.synchronous && !deferred) {
+        while (wal.durable < lsn) pthread_cond_wait(&wal.flushed, &wal.lock);
+    }
+    pthread_mutex_unlock(&wal.lock);
+}
+
+void wal_defer_commits(void) {
+    deferred = true;
+}
+
+void wal_commit(void) {
+    if (!wal.open || !wal_settings.synchronous) return;
+    pthread_mutex_lock(&wal.lock);
+    while (wal.durable < last_appended) pthread_cond_wait(&wal.flushed, &wal.lock);
+    pthread_mutex_unlock(&wal.lock);
+}
+
+void wal_sync(void) {
+    if (!wal.open) return;
+    pthread_mutex_lock(&wal.lock);
+    unsigned long long target = wal.appended;
+    wal.urgent = true;
+    pthread_cond_signal(&wal.wake);
+    while (wal.durable < target) pthread_cond_wait(&wal.flushed, &wal.lock);
+    pthread_mutex_unlock(&wal.lock);
+}
+
+_Bool wal_checkpoint(void) {
+    if (!wal.open) return snapshot_save(snapshot_path);
+    // Nothing was appended since the snapshot was saved
+    if (wal.snapshot_current && wal.appended == wal.checkpointed) return true;
+    unsigned long long appended = wal.appended;
+    size_t bytes = wal.bytes;
+    wal_sync();
+    pthread_mutex_lock(&wal.io_lock);
+    _Bool rotated = open_segment(wal.segment + 1);
+    unsigned long first_kept = wal.segment;
+    pthread_mutex_unlock(&wal.io_lock);
+    if (!rotated) return false;
+    if (!snapshot_save(snapshot_path)) return false;
+    unsigned long *segments;
+    size_t count = list_segments(&segments);
+    for (size_t i = 0; i < count && segments[i] < first_kept; i++) {
+        char name[4096];
+        segment_name(name, sizeof(name), segments[i]);
+        unlink(name);
+    }
+    free(segments);
+    sync_directory();
+    wal.checkpointed = appended;
+    pthread_mutex_lock(&wal.lock);
+    wal.checkpointed_bytes = bytes;
+    pthread_mutex_unlock(&wal.lock);
+    wal.snapshot_current = true;
+    return true;
+}
+
+_Bool wal_checkpoint_due(void) {
+    if (!wal.open || wal_settings.checkpoint_bytes == 0) return false;
+    pthread_mutex_lock(&wal.lock);
+    _Bool due = wal.bytes - wal.checkpointed_bytes >= wal_settings.checkpoint_bytes;
+    pthread_mutex_unlock(&wal.lock);
+    return due;
+}
+
+void wal_close(void) {
+    if (!wal.open) return;
+    pthread_mutex_lock(&wal.lock);
+    wal.running = false;
+    pthread_cond_signal(&wal.wake);
+    pthread_mutex_unlock(&wal.lock);
+    pthread_join(wal.flusher, NULL);
+    close(wal.fd);
+    if (wal.segment_bytes == 0) {
+        char name[4096];
+        segment_name(name, sizeof(name), wal.segment);
+        unlink(name);
+    }
+    wal.fd = -1;
+    wal.open = false;
+    free(wal.pending);
+    free(wal.writing);
+    wal.pending = wal.writing = NULL;
+    wal.pending_size = wal.pending_capacity = wal.writing_capacity = 0;
+}
+
+// Reads the password of a record. Logs written before passwords were hashed
+// carry them in plaintext, which is hashed now.
+static void read_password(password_hash_t *password, const char *fields, size_t length, const char *plaintext) {
+    if (length == sizeof(password_hash_t)) {
+        memcpy(password, fields, sizeof(password_hash_t));
+    } else {
+        password_hash(password, plaintext);
+    }
+}
+
+// Applies a record's mutation. Records from segments before sequence numbers
+// carry no way to tell if the snapshot already reflects them, so their posts
+// are only applied if newer than the user's newest.
+static void apply_record(uint8_t type, const char *payload, size_t length, _Bool legacy) {
+    const char *end = memchr(payload, '\0', length);
+    if (end == NULL) return;
+    const char *username = payload;
+    const char *fields = end + 1;
+    size_t fields_length = length - (fields - payload);
+    user_t *user = find_user(username);
+    // Every string field is NUL-terminated within the payload
+    char name[MAX_USERNAME_SIZE];
+    snprintf(name, sizeof(name), "%.*s", (int) strnlen(fields, fields_length), fields);
+    long long timestamp = 0;
+    if ((type == WAL_POST || type == WAL_UNPOST) && fields_length >= sizeof(int64_t)) {
+        int64_t value;
+        memcpy(&value, fields, sizeof(value));
+        timestamp = value;
+    }
+    password_hash_t password;
+    switch (type) {
+        case WAL_REGISTER:
+            if (user != NULL) break;
+            read_password(&password, fields, fields_length, name);
+            add_user(username, &password);
+            break;
+        case WAL_PASSWORD:
+            if (user == NULL) break;
+            read_password(&password, fields, fields_length, name);
+            set_password(user, &password);
+            break;
+        case WAL_POST:
+            if (user == NULL || fields_length < sizeof(int64_t) || fields_length - sizeof(int64_t) >= MAX_CONTENT_SIZE) break;
+            const post_t *newest = postlist_newest(user);
+            if (legacy && newest != NULL && newest->timestamp >= timestamp) break;
+            size_t content_length = fields_length - sizeof(int64_t);
+            unsigned long long content = strheap_append(&post_heap, fields + sizeof(int64_t), content_length);
+            push_post(user, restore_post(user, timestamp, content, content_length));
+            break;
+        case WAL_UNPOST:
+            // Any post may have been deleted, and it is found by timestamp
+            if (user == NULL) break;
+            post_t *post = postlist_find(user, timestamp);
+            if (post != NULL) remove_post(user, post);
+            break;
+        case WAL_FRIEND:
+            if (user != NULL) add_friend(user, name);
+            break;
+        case WAL_UNFRIEND:
+            if (user != NULL) delete_friend(user, name);
+            break;
+        case WAL_DELETE_USER:
+            if (user != NULL) delete_user(user);
+            break;
+    }
+}
+
+// Replays a segment written before records had sequence numbers
+static void replay_legacy_segment(const char *data, size_t size) {
+    size_t position = 0;
+    while (size - position >= WAL_LEGACY_RECORD_OVERHEAD) {
+        uint16_t length;
+        memcpy(&length, data + position, sizeof(length));
+        if (size - position - WAL_LEGACY_RECORD_OVERHEAD < length) break;
+        uint32_t sum;
+        memcpy(&sum, data + position + 3 + length, sizeof(sum));
+        if (sum != checksum(data + position + 2, length + 1)) break;
+        apply_record((uint8_t) data[position + 2], data + position + 3, length, true);
+        wal.replayed++;
+        position += length + WAL_LEGACY_RECORD_OVERHEAD;
+    }
+}
+
+// Replays the intact records of a segment that come after the snapshot, and
+// stops at the first torn one
+static void replay_segment(const char *data, size_t size) {
+    if (size < WAL_MAGIC_SIZE || memcmp(data, WAL_MAGIC, WAL_MAGIC_SIZE) != 0) {
+        replay_legacy_segment(data, size);
+        return;
+    }
+    size_t position = WAL_MAGIC_SIZE;
+    while (size - position >= WAL_RECORD_OVERHEAD) {
+        uint16_t length;
+        memcpy(&length, data + position, sizeof(length));
+        if (size - position - WAL_RECORD_OVERHEAD < length) break;
+        uint32_t sum;
+        memcpy(&sum, data + position + 11 + length, sizeof(sum));
+        if (sum != checksum(data + position + 2, length + 9)) break;
+        uint64_t sequence;
+        memcpy(&sequence, data + position + 3, sizeof(sequence));
+        if (sequence > wal.checkpointed) {
+            apply_record((uint8_t) data[position + 2], data + position + 11, length, false);
+            wal.replayed++;
+            if (sequence > wal.appended) wal.appended = wal.durable = sequence;
+        }
+        position += length + WAL_RECORD_OVERHEAD;
+    }
+}
+
+_Bool wal_is_empty(void) {
+    unsigned long *segments;
+    size_t count = list_segments(&segments);
+    free(segments);
+    return count == 0;
+}
+
+void wal_set_snapshot_current(_Bool current) {
+    wal.snapshot_current = current;
+}
+
+void wal_restore_sequence(unsigned long long sequence) {
+    wal.appended = wal.durable = wal.checkpointed = sequence;
+}
+
+unsigned long long wal_last_sequence(void) {
+    pthread_mutex_lock(&wal.lock);
+    unsigned long long sequence = wal.appended;
+    pthread_mutex_unlock(&wal.lock);
+    return sequence;
+}
+
+void wal_replay(void) {
+    assert(!wal.open);
+    unsigned long *segments;
+    size_t count = list_segments(&segments);
+    for (size_t i = 0; i < count; i++) {
+        char name[4096];
+        segment_name(name, sizeof(name), segments[i]);
+        int fd = open(name, O_RDONLY);
+        if (fd < 0) continue;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                replay_segment(map, st.st_size);
+                munmap(map, st.st_size);
+            }
+        }
+        close(fd);
+    }
+    free(segments);
+    if (wal.replayed > 0) wal.snapshot_current = false;
+}
+
+void wal_print_stats(FILE *file) {
+    fprintf(file, "Write-ahead log: %zu records replayed, %zu records (%zu bytes) written with %zu fsyncs\n",
+            wal.replayed, wal.records, wal.bytes, wal.fsyncs);
+}
@@ -0,0 +1,227 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdio.h>
+#include "nodes.h"
+
+// The write-ahead log. Every mutation made after startup is appended as a
+// compact binary record:
+//
+// length   uint16_t, the size of the payload
+// type     uint8_t, a wal_record_type_t
+// sequence uint64_t, one more than the previous record's, across restarts
+// payload  The username, NUL-terminated, followed by the type's fields
+// checksum uint32_t, FNV-1a over the type, the sequence and the payload
+//
+// Each segment starts with the 8-byte magic number "TBFWAL2". Snapshots store
+// the sequence number of the last record they reflect, and replay skips the
+// records up to it, so a record is never applied twice whatever crashed when.
+// Segments without the magic number come from before sequence numbers, and
+// their posts are only replayed if newer than the user's newest.
+//
+// Records are buffered and written by a flusher thread, which syncs a whole
+// batch of them with a single fsync. The log is split into numbered segments
+// (path.00000001, path.00000002, ...), and the segments written before a
+// snapshot are deleted once the snapshot is safely on disk.
+typedef enum wal_record_type {
+    WAL_REGISTER = 1, // password_hash_t
+    WAL_PASSWORD,     // password_hash_t
+    WAL_POST,         // int64_t timestamp, content
+    WAL_UNPOST,       // int64_t timestamp of the deleted post
+    WAL_FRIEND,       // friend's username
+    WAL_UNFRIEND,     // friend's username
+    WAL_DELETE_USER   // empty string
+} wal_record_type_t;
+
+// How the log is written. Asynchronous commits return straight away and are
+// synced within commit_interval milliseconds, together with every other
+// record appended in that window. Synchronous commits wait until their record
+// is on disk, sharing each fsync with the records appended while the previous
+// one was running. A server checkpoints whenever checkpoint_bytes of records
+// have been logged since the last checkpoint, so the log never grows much
+// past that, and neither does the time to replay it.
+typedef struct wal_settings {
+    const char *path;
+    unsigned int commit_interval;
+    _Bool synchronous;
+    size_t checkpoint_bytes;
+} wal_settings_t;
+
+extern wal_settings_t wal_settings;
+
+/**
+ * Checks if there are log segments left to replay.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * True if no segment exists and false otherwise.
+ */
+_Bool wal_is_empty(void);
+
+/**
+ * Tells the log whether the snapshot at snapshot_path holds the users as
+ * they were loaded, so a checkpoint with nothing appended can skip saving
+ * it. Replaying any record makes it stale.
+ *
+ * Parameters:
+ * current: Whether the snapshot is current.
+ *
+ * Returns:
+ * None
+ */
+void wal_set_snapshot_current(_Bool current);
+
+/**
+ * Sets the sequence number of the last record the loaded users reflect, as
+ * stored in the snapshot. Replay skips the records up to it, and new records
+ * are numbered after it.
+ *
+ * Parameters:
+ * sequence: The sequence number, or 0 if the users reflect no record.
+ *
+ * Returns:
+ * None
+ */
+void wal_restore_sequence(unsigned long long sequence);
+
+/**
+ * Gets the sequence number of the last record appended or replayed, which a
+ * snapshot of the users as they are now reflects.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * The sequence number, or 0 if there is none.
+ */
+unsigned long long wal_last_sequence(void);
+
+/**
+ * Replays the log segments on top of the users loaded from the snapshot,
+ * skipping the records the snapshot already reflects. Replay stops at the
+ * first torn or corrupt record of a segment. It must run before wal_open so
+ * the replayed mutations are not logged again.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void wal_replay(void);
+
+/**
+ * Starts a new log segment and the flusher thread. Mutations are only logged
+ * while the log is open.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * True if the log was opened and false otherwise, with errno set.
+ */
+_Bool wal_open(void);
+
+/**
+ * Appends a record to the log. Nothing happens if the log is not open.
+ *
+ * Parameters:
+ * type: The record's type.
+ * username: The username the record applies to.
+ * data: The type's fields after the username.
+ * length: The size of the fields in bytes.
+ *
+ * Returns:
+ * None
+ */
+void wal_append(wal_record_type_t type, const char *username, const void *data, size_t length);
+
+/**
+ * Makes the calling thread's synchronous commits wait in wal_commit instead
+ * of in wal_append, so a thread can release its locks before it waits.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void wal_defer_commits(void);
+
+/**
+ * Waits until the last record the calling thread appended is on disk, if
+ * commits are synchronous.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void wal_commit(void);
+
+/**
+ * Waits until every record appended so far is on disk.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void wal_sync(void);
+
+/**
+ * Saves a snapshot and truncates the log. The log is switched to a new
+ * segment first, and the older segments are only deleted once the snapshot
+ * has been written, so a crash at any point loses nothing. Nothing is saved
+ * if the snapshot is current and no record was appended since. No mutation
+ * may run concurrently.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * True if the snapshot was saved and false otherwise, with errno set.
+ */
+_Bool wal_checkpoint(void);
+
+/**
+ * Checks if enough records were logged since the last checkpoint that the
+ * log should be checkpointed again.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * True if the log is open and has grown by wal_settings.checkpoint_bytes
+ * since the last checkpoint, and false otherwise.
+ */
+_Bool wal_checkpoint_due(void);
+
+/**
+ * Syncs every pending record, stops the flusher thread and closes the log.
+ * The current segment is deleted if nothing was written to it.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void wal_close(void);
+
+/**
+ * Prints the log's statistics.
+ *
+ * Parameters:
+ * file: The file to print to.
+ *
+ * Returns:
+ * None
+ */
+void wal_print_stats(FILE *file);
+
+#endif